@@ -0,0 +1,357 @@
+/* audio.c - Tone audio engine for the 'minimalist' repeater
+ * controller.
+ *
+ * The control loop is the only producer of commands and the engine
+ * (the audio thread, or loop() through audio_pump()) the only
+ * consumer, so the command queue is an Spsc. The voice, the clip
+ * being played and the streaming state belong to the engine alone.
+ * With the audio I/O engine running the sink is its TX ring, and the
+ * engine is also what passes the RX audio to its listeners.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audio.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "audio.h"
+#include "synth.h"
+#include "clipcache.h"
+#include "stats.h"
+#include "spsc.h"
+#include "audioio.h"
+
+static AudioCmd cmd_buf[AUDIO_QUEUE];
+static Spsc cmds;
+static AudioSink * sink;        // where the audio goes
+static int rate;                // in Hz
+
+// the engine's own state
+static SynthVoice voice;        // the voice tone()/noTone() key
+static int streaming;           // audio is being sent to the sink
+static msec_t stream_start;     // when streaming started
+static long long stream_done;   // samples sent since stream_start
+static msec_t stream_last;      // last time there was sound
+static const Clip * clip;       // cached clip being played, NULL for the voice
+static int clip_pos;            // next sample of clip to send
+static unsigned int marks;      // last mark queued
+static unsigned int marked;     // last mark acted on
+static unsigned int passed;     // last mark passed with no clip playing
+
+// the audio thread
+static pthread_t thread;
+static int threaded;            // the thread is the engine
+static int stopping;
+static int sleeping;            // the thread is waiting for a command
+static int wake_fd = -1;
+static void (*start_hook)(void);
+
+/* Sets the engine up to stream to 'sink' at 'rate' Hz. The
+ * engine owns the sink from here on.
+ */
+void audio_init(AudioSink * s, int r) {
+	spsc_init(&cmds, "audio", cmd_buf, AUDIO_QUEUE, sizeof(AudioCmd));
+	voice_init(&voice);
+	streaming = 0;
+	clip = NULL;
+	rate = r;
+	__atomic_store_n(&sink, s, __ATOMIC_RELEASE);
+}
+
+/* Returns the sink, NULL if there is none (or it failed)
+ */
+AudioSink * audio_sink(void) {
+	return(__atomic_load_n(&sink, __ATOMIC_ACQUIRE));
+}
+
+/* Queues a command for the engine, waking the thread if it
+ * is asleep
+ */
+static void queue(int cmd, int arg, const Clip * cl) {
+	AudioCmd c;
+	unsigned long long one = 1;
+
+	if (audio_sink() == NULL)
+		return;
+	c.t = now_ms();
+	c.cmd = cmd;
+	c.arg = arg;
+	c.clip = cl;
+	if (!spsc_push(&cmds, &c))
+		return;
+	// the thread sets 'sleeping' before its last look at the
+	// queue, so one of the two sides always sees the other
+	if (threaded && __atomic_load_n(&sleeping, __ATOMIC_SEQ_CST)) {
+		if (write(wake_fd, &one, sizeof(one)) < 0)
+			return;
+	}
+}
+
+/* Keys the live tone at 'freq' Hz, 0 unkeys it. Ignored while a
+ * clip is playing.
+ */
+void audio_key(int freq) {
+	queue(AUDIO_KEY, freq, NULL);
+}
+
+/* Starts playing a pre-rendered clip in place of the live voice.
+ * Returns 0 (and the voice is used) if 'clip' is NULL.
+ */
+int audio_play_clip(const Clip * cl) {
+	if (audio_sink() == NULL || cl == NULL)
+		return(0);
+	queue(AUDIO_CLIP, 0, cl);
+	return(1);
+}
+
+/* Stops a clip part way through, the rest of it is not sent
+ */
+void audio_stop_clip(void) {
+	queue(AUDIO_STOP_CLIP, 0, NULL);
+}
+
+/* Queues a mark behind the commands already queued. Returns its
+ * number, 0 if there is no sink. A mark that didn't fit in the
+ * queue is passed along with the next one that did.
+ */
+unsigned int audio_mark(void) {
+	if (audio_sink() == NULL)
+		return(0);
+	marks++;
+	queue(AUDIO_MARK, marks, NULL);
+	return(marks);
+}
+
+/* Returns 1 once the engine has acted on every command up to mark
+ * 'n' and has no clip playing, so clips queued before it are no
+ * longer in use. Any thread.
+ */
+int audio_passed(unsigned int n) {
+	if (audio_sink() == NULL)
+		return(1);
+	return((int)(__atomic_load_n(&passed, __ATOMIC_ACQUIRE) - n) >= 0);
+}
+
+/* Sends the sound up to time 't' to the sink. Returns 0 if the
+ * sink failed.
+ */
+static int stream_to(msec_t t) {
+	short buf[SYNTH_BLOCK * 8];
+	long long due;
+
+	if (!streaming)
+		return(1);
+	if (clip != NULL || voice_active(&voice))
+		stream_last = t;
+
+	due = (t - stream_start) * rate / 1000;
+	while (stream_done < due) {
+		const short * pcm = buf;
+		int n = sizeof(buf) / sizeof(buf[0]);
+
+		if (clip != NULL) {
+			// no copy, the sink reads the cached samples directly
+			n = clip->samples - clip_pos;
+			pcm = clip->pcm + clip_pos;
+		}
+		if (due - stream_done < n)
+			n = (int)(due - stream_done);
+		if (clip == NULL)
+			voice_render(&voice, buf, n);
+		if (n > 0 && sink_write(sink, pcm, n) < 0)
+			return(0);
+		stream_done += n;
+		if (clip != NULL) {
+			clip_pos += n;
+			if (clip_pos >= clip->samples)
+				clip = NULL;
+		}
+	}
+	return(1);
+}
+
+/* Starts streaming at 't' if it isn't already
+ */
+static void stream_from(msec_t t) {
+	if (streaming)
+		return;
+	streaming = 1;
+	stream_start = stream_last = t;
+	stream_done = 0;
+}
+
+/* Acts on a command, at its time
+ */
+static void run_cmd(const AudioCmd * c) {
+	switch(c->cmd)
+	{
+		case AUDIO_KEY:
+			// a cached clip is playing the tones already
+			if (clip != NULL)
+				break;
+			voice_key(&voice, c->arg);
+			if (voice_active(&voice))
+				stream_from(c->t);
+			break;
+
+		case AUDIO_CLIP:
+			voice_init(&voice);
+			clip = c->clip;
+			clip_pos = 0;
+			// the clip is aligned with the tone sequence that
+			// started alongside it
+			streaming = 0;
+			stream_from(c->t);
+			break;
+
+		case AUDIO_STOP_CLIP:
+			clip = NULL;
+			break;
+
+		case AUDIO_MARK:
+			marked = c->arg;
+			break;
+	}
+}
+
+/* Acts on the queued commands, each once the sound before it has
+ * gone out, then streams up to 't'. Streaming stops AUDIO_TAIL mS
+ * after the sound does.
+ */
+static void pump(msec_t t) {
+	const AudioCmd * c;
+	AudioSink * s;
+
+	aio_rx_run();
+	if (sink == NULL)
+		return;
+
+	while ((c = spsc_peek(&cmds)) != NULL) {
+		if (!stream_to(c->t))
+			break;
+		run_cmd(c);
+		spsc_drop(&cmds);
+	}
+	if (c == NULL && stream_to(t)) {
+		if (streaming && t - stream_last > AUDIO_TAIL) {
+			streaming = 0;
+			sink_flush(sink);
+		}
+		if (clip == NULL)
+			__atomic_store_n(&passed, marked, __ATOMIC_RELEASE);
+		return;
+	}
+
+	printf("Audio sink write failed, audio off\n");
+	s = sink;
+	__atomic_store_n(&sink, NULL, __ATOMIC_RELEASE);
+	sink_close(s);
+	clip = NULL;
+	streaming = 0;
+}
+
+/* Acts on the queued commands and streams up to now. Does nothing,
+ * and returns 0, while the audio thread is running.
+ */
+int audio_pump(void) {
+	if (threaded)
+		return(0);
+	pump(now_ms());
+	return(1);
+}
+
+/* Returns mS until audio_pump() is needed, -1 if idle or threaded
+ */
+long audio_timeout(void) {
+	if (threaded)
+		return(-1);
+	if (sink != NULL && spsc_count(&cmds) > 0)
+		return(0);
+	// the RX audio needs passing on too
+	return((streaming || aio_ready()) ? AUDIO_PERIOD : -1);
+}
+
+/* Audio thread: pumps every AUDIO_PERIOD mS while there is sound
+ * (or RX audio), and sleeps until the next command when there isn't
+ */
+static void * audio_main(void * arg) {
+	struct pollfd pfd;
+	unsigned long long n;
+
+	if (start_hook != NULL)
+		start_hook();
+
+	pfd.fd = wake_fd;
+	pfd.events = POLLIN;
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		long long t = stats_clock();
+		int timeout = AUDIO_PERIOD;
+
+		pump(now_ms());
+		stats_since(ST_AUDIO_PUMP, t);
+
+		if ((!streaming || sink == NULL) && !aio_ready()) {
+			__atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+			timeout = (spsc_count(&cmds) == 0) ? -1 : 0;
+		}
+		if (poll(&pfd, 1, timeout) > 0) {
+			if (read(wake_fd, &n, sizeof(n)) < 0)
+				n = 0;
+		}
+		__atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+	return(NULL);
+}
+
+/* Starts the audio thread, which runs 'start' first (e.g. to set
+ * its CPU). Returns 1 on success.
+ */
+int audio_start_thread(void (*start)(void)) {
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		printf("audio: can't make the wakeup fd, pumping from loop()\n");
+		return(0);
+	}
+	start_hook = start;
+	stopping = 0;
+	threaded = 1;
+	if (pthread_create(&thread, NULL, audio_main, NULL) != 0) {
+		printf("audio: can't start the audio thread, pumping from loop()\n");
+		threaded = 0;
+		close(wake_fd);
+		wake_fd = -1;
+		return(0);
+	}
+	return(1);
+}
+
+/* Stops the audio thread, if it is running
+ */
+void audio_stop_thread(void) {
+	unsigned long long one = 1;
+
+	if (!threaded)
+		return;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	if (write(wake_fd, &one, sizeof(one)) < 0)
+		one = 0;
+	pthread_join(thread, NULL);
+	threaded = 0;
+	close(wake_fd);
+	wake_fd = -1;
+}
+
+/* Prints the command queue's counters
+ */
+void audio_dump(FILE * fp) {
+	spsc_dump(&cmds, fp);
+}
@@ -0,0 +1,103 @@
+/* audio.h - Tone audio engine for the 'minimalist' repeater
+ * controller.
+ *
+ * Streams the software tone (or a pre-rendered clip) to the audio
+ * sink. The control loop never touches the voice or the sink: tone()
+ * and noTone() and the clip starts only queue a timestamped command,
+ * and the engine renders up to each command's time before it acts on
+ * it, so the keying lands on the right sample however late the audio
+ * is pumped.
+ *
+ * In the normal build the engine is the pipeline's audio thread,
+ * which feeds the sink every AUDIO_PERIOD mS while there is sound and
+ * sleeps otherwise. The simulator (or a controller run without the
+ * pipeline) pumps it from loop() instead.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audio.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __AUDIO_H__
+#define __AUDIO_H__
+
+#include <stdio.h>
+#include "timers.h"
+#include "audiosink.h"
+#include "clipcache.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_PERIOD  10        // in mS, how often audio is fed to the sink
+#define AUDIO_TAIL    200       // in mS, streaming stops this long after the tone
+#define AUDIO_QUEUE   256       // commands waiting for the engine, a power of 2
+
+// Commands from the control loop
+enum AudioCmds {
+  AUDIO_KEY,        // arg = freq in Hz, 0 = unkey
+  AUDIO_CLIP,       // clip = the clip to play
+  AUDIO_STOP_CLIP,
+  AUDIO_MARK        // arg = mark number, see audio_mark()
+};
+
+typedef struct
+{
+    msec_t t;               // now_ms() when it was queued
+    int cmd;                // AudioCmds
+    int arg;
+    const Clip * clip;
+} AudioCmd;
+
+/* Sets the engine up to stream to 'sink' at 'rate' Hz. The
+ * engine owns the sink from here on.
+ */
+void audio_init(AudioSink * sink, int rate);
+/* Returns the sink, NULL if there is none (or it failed) */
+AudioSink * audio_sink(void);
+/* Keys the live tone at 'freq' Hz, 0 unkeys it. Ignored while a
+ * clip is playing.
+ */
+void audio_key(int freq);
+/* Starts playing a pre-rendered clip in place of the live voice.
+ * Returns 0 (and the voice is used) if 'clip' is NULL.
+ */
+int audio_play_clip(const Clip * clip);
+/* Stops a clip part way through, the rest of it is not sent */
+void audio_stop_clip(void);
+/* Queues a mark behind the commands already queued. Returns its
+ * number, 0 if there is no sink.
+ */
+unsigned int audio_mark(void);
+/* Returns 1 once the engine has acted on every command up to mark
+ * 'n' and has no clip playing, so clips queued before it are no
+ * longer in use
+ */
+int audio_passed(unsigned int n);
+/* Acts on the queued commands and streams up to now. Does nothing,
+ * and returns 0, while the audio thread is running.
+ */
+int audio_pump(void);
+/* Returns mS until audio_pump() is needed, -1 if idle or threaded */
+long audio_timeout(void);
+/* Starts the audio thread, which runs 'start' first (e.g. to set
+ * its CPU). Returns 1 on success.
+ */
+int audio_start_thread(void (*start)(void));
+/* Stops the audio thread, if it is running */
+void audio_stop_thread(void);
+/* Prints the command queue's counters */
+void audio_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __AUDIO_H__
@@ -0,0 +1,508 @@
+/* audioio.c - Audio I/O engine for the 'minimalist' repeater
+ * controller.
+ *
+ * Each pass of the thread is one period: it writes a TX period (the
+ * next one queued, or silence), then reads an RX period straight into
+ * a slot of the RX ring. A sound device that blocks (ALSA) sets the
+ * pace; with only files and pipes the thread sleeps to the period
+ * boundaries itself. The TX side is written first, so a loopback
+ * through a pipe has something to read.
+ *
+ * The rings are Spscs: the aio thread produces RX and consumes TX,
+ * the audio thread (or loop()) consumes RX and, through aio_tx_sink(),
+ * produces TX. Everything else here belongs to the aio thread, apart
+ * from the round trip test's request and result.
+ *
+ * With the repeat path set up (see repeat.h) each RX period also goes
+ * into its delay line, and each TX period, tones or silence, has the
+ * line's audio mixed in on its way out.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audioio.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "audioio.h"
+#include "audio.h"
+#include "spsc.h"
+#include "stats.h"
+#include "repeat.h"
+
+#define PING_TONE   1000        // in Hz
+
+static AudioSource * src;       // RX audio comes from
+static AudioSink * sink;        // TX audio goes to
+static int rate;                // in Hz
+static int frames;              // frames in a period
+static int channels = 1;        // in an RX frame
+static long long period_ns;
+static int prefill;             // TX periods queued before a burst starts
+static int ready;
+static const char * rx_type = "-";  // for aio_dump() once they are closed
+static const char * tx_type = "-";
+static unsigned long rx_xruns;
+static unsigned long tx_xruns;
+
+static AioPeriod rx_buf[AIO_RING];
+static AioPeriod tx_buf[AIO_RING];
+static Spsc rx;
+static Spsc tx;
+
+// the TX ring as a sink, the producer's side
+static AudioSink ring_sink;
+static AioPeriod * tx_cur;      // being filled
+static unsigned long tx_dropped;  // samples, the ring was full
+
+static struct {
+    AioListener fn;
+    void * arg;
+} listeners[AIO_LISTENERS];
+static int nlisteners;
+
+// the aio thread's own
+static short silence[AIO_FRAMES];
+static short scratch[AIO_FRAMES];   // RX period with no room in the ring
+static short mix[AIO_FRAMES];       // TX period with the repeat audio in
+static short ping[AIO_FRAMES];
+static int ping_lead;           // samples into the ping before it would be heard
+static int playing;             // a TX burst is going out
+static int rx_ended;
+static long long rx_frames;     // frames read
+static long long tx_frames;     // samples written, silence too
+static unsigned long rx_periods;
+static unsigned long tx_periods;
+static unsigned long rx_overruns;   // RX periods dropped, the listeners were behind
+static unsigned long tx_underruns;  // TX ran dry part way through a burst
+static unsigned long late;          // passes that started a period late
+
+// the round trip test
+static int test_pings;          // asked for by aio_latency_test()
+static int test_result = -1;    // pings heard, once it is done
+static int test_left;
+static int test_heard;
+static long long ping_at = -1;  // the TX sample the ping went out on
+static long long ping_next;     // and when the next one goes
+
+static pthread_t thread;
+static int running;
+static int stopping;
+static void (*start_hook)(void);
+
+/* The TX ring's sink: fills the ring a period at a time
+ */
+static int ring_write(AudioSink * s, const short * buf, int n) {
+	int done = 0;
+
+	while (done < n) {
+		int len;
+
+		if (tx_cur == NULL) {
+			tx_cur = spsc_reserve(&tx);
+			if (tx_cur == NULL) {
+				tx_dropped += n - done;
+				break;
+			}
+			tx_cur->t = 0;
+			tx_cur->n = 0;
+			tx_cur->channels = 1;
+			tx_cur->last = 0;
+		}
+		len = frames - tx_cur->n;
+		if (len > n - done)
+			len = n - done;
+		memcpy(tx_cur->pcm + tx_cur->n, buf + done, len * sizeof(short));
+		tx_cur->n += len;
+		done += len;
+		if (tx_cur->n == frames) {
+			spsc_commit(&tx);
+			tx_cur = NULL;
+		}
+	}
+	return(n);
+}
+
+/* Ends the burst: sends the part period, marked as the last
+ */
+static void ring_flush(AudioSink * s) {
+	if (tx_cur == NULL) {
+		tx_cur = spsc_reserve(&tx);
+		if (tx_cur == NULL)
+			return;
+		tx_cur->t = 0;
+		tx_cur->n = 0;
+		tx_cur->channels = 1;
+	}
+	tx_cur->last = 1;
+	spsc_commit(&tx);
+	tx_cur = NULL;
+}
+
+/* The engine closes the real sink
+ */
+static void ring_close(AudioSink * s) {
+}
+
+/* Sets the engine up to read 'src' and write 'sink' (either may be
+ * NULL) at 'rate' Hz, 'period' mS at a time. The engine owns them
+ * from here on. The round trip test listens on the source's first
+ * channel. Returns 1 on success.
+ */
+int aio_init(AudioSource * s, AudioSink * k, int r, int period) {
+	int i;
+
+	if (s == NULL && k == NULL)
+		return(0);
+	rate = r;
+	channels = (s != NULL) ? s->channels : 1;
+	frames = rate * period / 1000;
+	if (frames < 1)
+		frames = 1;
+	if (frames * channels > AIO_FRAMES) {
+		printf("Audio I/O: %d mS periods are too long, using %d frames\n",period,AIO_FRAMES / channels);
+		frames = AIO_FRAMES / channels;
+	}
+	period_ns = frames * 1000000000LL / rate;
+	// enough to cover the time between the tone engine's pumps
+	prefill = (int)((AUDIO_PERIOD * 1000000LL + period_ns - 1) / period_ns) + 1;
+
+	spsc_init(&rx, "audio rx", rx_buf, AIO_RING, sizeof(AioPeriod));
+	spsc_init(&tx, "audio tx", tx_buf, AIO_RING, sizeof(AioPeriod));
+	ring_sink.type = "aio";
+	ring_sink.rate = rate;
+	ring_sink.write = ring_write;
+	ring_sink.flush = ring_flush;
+	ring_sink.close = ring_close;
+
+	for (i = 0; i < frames; i++)
+		ping[i] = (short)(16000 * sin(2 * M_PI * PING_TONE * i / rate));
+	for (ping_lead = 0; ping_lead < frames - 1; ping_lead++)
+		if (ping[ping_lead] > AIO_PING_LEVEL)
+			break;
+
+	src = s;
+	sink = k;
+	if (src != NULL)
+		rx_type = src->type;
+	if (sink != NULL)
+		tx_type = sink->type;
+	ready = 1;
+	return(1);
+}
+
+/* Returns 1 once aio_init() has been called
+ */
+int aio_ready(void) {
+	return(ready);
+}
+
+/* Returns the sink that feeds the TX ring, for the tone engine.
+ * NULL if the engine has no sink.
+ */
+AudioSink * aio_tx_sink(void) {
+	return((ready && sink != NULL) ? &ring_sink : NULL);
+}
+
+/* Adds an RX listener. Returns 0 if there are too many.
+ */
+int aio_listen(AioListener fn, void * arg) {
+	if (nlisteners >= AIO_LISTENERS)
+		return(0);
+	listeners[nlisteners].fn = fn;
+	listeners[nlisteners].arg = arg;
+	nlisteners++;
+	return(1);
+}
+
+/* Passes the waiting RX periods to the listeners
+ */
+void aio_rx_run(void) {
+	const AioPeriod * p;
+	int i;
+
+	if (!ready || src == NULL)
+		return;
+	while ((p = spsc_peek(&rx)) != NULL) {
+		for (i = 0; i < nlisteners; i++)
+			listeners[i].fn(p, listeners[i].arg);
+		spsc_drop(&rx);
+	}
+}
+
+/* Finishes the ping in flight, heard or not
+ */
+static void ping_done(void) {
+	ping_at = -1;
+	ping_next = tx_frames + (long long)rate * AIO_PING_GAP / 1000;
+	if (--test_left == 0)
+		__atomic_store_n(&test_result, test_heard, __ATOMIC_RELEASE);
+}
+
+/* The TX side of the test: returns the ping when the next one is
+ * due, otherwise silence
+ */
+static const short * ping_tx(void) {
+	if (ping_at >= 0 && tx_frames - ping_at > (long long)rate * AIO_PING_WAIT / 1000)
+		ping_done();
+	if (test_left > 0 && ping_at < 0 && tx_frames >= ping_next) {
+		ping_at = tx_frames;
+		return(ping);
+	}
+	return(silence);
+}
+
+/* The RX side of the test: looks for the ping in flight, on the
+ * first channel
+ */
+static void ping_rx(const short * pcm, int n) {
+	int i;
+
+	if (ping_at < 0)
+		return;
+	for (i = 0; i < n; i++)
+		if (pcm[i * channels] > AIO_PING_LEVEL || pcm[i * channels] < -AIO_PING_LEVEL)
+			break;
+	if (i == n || rx_frames + i < ping_at + ping_lead)
+		return;
+	stats_record(ST_AUDIO_RTT, (rx_frames + i - ping_at - ping_lead) * 1000000000LL / rate);
+	test_heard++;
+	ping_done();
+}
+
+/* Writes one TX period: during the test the pings, otherwise the
+ * next queued period once a burst has started, or silence
+ */
+static void tx_period(void) {
+	const AioPeriod * p = NULL;
+	const short * pcm = silence;
+	int n = frames;
+
+	if (sink == NULL)
+		return;
+
+	if (test_left > 0) {
+		pcm = ping_tx();
+	} else {
+		if (!playing) {
+			p = spsc_peek(&tx);
+			if (p != NULL && (spsc_count(&tx) >= (unsigned int)prefill || p->last))
+				playing = 1;
+		}
+		p = playing ? spsc_peek(&tx) : NULL;
+		if (playing && p == NULL) {
+			// the tone engine was late
+			tx_underruns++;
+			playing = 0;
+		} else if (p != NULL) {
+			pcm = p->pcm;
+			n = p->n;
+			if (p->last)
+				playing = 0;
+		}
+		// the repeat audio goes out with the tones, and the silence
+		if (repeat_ready()) {
+			memcpy(mix, pcm, n * sizeof(short));
+			memset(mix + n, 0, (frames - n) * sizeof(short));
+			repeat_tx(mix, frames);
+			pcm = mix;
+			n = frames;
+		}
+	}
+
+	if ((n > 0 && sink_write(sink, pcm, n) < 0) ||
+			(n < frames && sink_write(sink, silence, frames - n) < 0)) {
+		printf("Audio output failed, audio output off\n");
+		tx_xruns = sink->xruns;
+		sink_close(sink);
+		sink = NULL;
+		return;
+	}
+	if (p != NULL)
+		spsc_drop(&tx);
+	// a file or pipe gets each period as it goes
+	if (!sink->clocked)
+		sink_flush(sink);
+	tx_frames += frames;
+	tx_periods++;
+}
+
+/* Reads one RX period, into the ring if there is room
+ */
+static void rx_period(void) {
+	AioPeriod * p;
+	short * pcm = scratch;
+	int n;
+
+	if (src == NULL || rx_ended)
+		return;
+
+	p = spsc_reserve(&rx);
+	if (p != NULL)
+		pcm = p->pcm;
+	n = source_read(src, pcm, frames);
+	if (n <= 0) {
+		printf("Audio input %s\n",(n < 0) ? "failed, audio input off" : "ended");
+		rx_ended = 1;
+		return;
+	}
+	if (test_left > 0)
+		ping_rx(pcm, n);
+	repeat_rx(pcm, n, channels);
+	rx_frames += n;
+	rx_periods++;
+	if (p == NULL) {
+		rx_overruns++;
+		return;
+	}
+	p->t = stats_clock();
+	p->n = n;
+	p->channels = channels;
+	p->last = 0;
+	spsc_commit(&rx);
+}
+
+/* Returns the CLOCK_MONOTONIC time in nS
+ */
+static long long mono_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* aio thread: a period each pass
+ */
+static void * aio_main(void * arg) {
+	struct timespec ts;
+	long long next;
+
+	if (start_hook != NULL)
+		start_hook();
+
+	next = mono_ns();
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		int n;
+
+		if (test_left == 0 && (n = __atomic_exchange_n(&test_pings, 0, __ATOMIC_ACQ_REL)) > 0) {
+			test_left = n;
+			test_heard = 0;
+			ping_at = -1;
+			ping_next = tx_frames;
+		}
+
+		tx_period();
+		rx_period();
+
+		// a sound device keeps time, otherwise sleep to the next period
+		if ((src != NULL && !rx_ended && src->clocked) || (sink != NULL && sink->clocked))
+			continue;
+		next += period_ns;
+		if (mono_ns() - next > period_ns) {
+			late++;
+			next = mono_ns();
+			continue;
+		}
+		ts.tv_sec = next / 1000000000LL;
+		ts.tv_nsec = next % 1000000000LL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	return(NULL);
+}
+
+/* Starts the engine's thread, which runs 'start' first (e.g. to set
+ * its CPU). Returns 1 on success.
+ */
+int aio_start_thread(void (*start)(void)) {
+	if (!ready)
+		return(0);
+	start_hook = start;
+	stopping = 0;
+	if (pthread_create(&thread, NULL, aio_main, NULL) != 0) {
+		printf("Audio I/O: can't start the aio thread\n");
+		return(0);
+	}
+	running = 1;
+	return(1);
+}
+
+/* Stops the thread and closes the source and sink
+ */
+void aio_stop_thread(void) {
+	if (running) {
+		__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+		pthread_join(thread, NULL);
+		running = 0;
+	}
+	if (src != NULL)
+		rx_xruns = src->xruns;
+	if (sink != NULL)
+		tx_xruns = sink->xruns;
+	source_close(src);
+	sink_close(sink);
+	src = NULL;
+	sink = NULL;
+}
+
+/* Sends 'pings' pings out and times each coming back in, into the
+ * 'audio round trip' histogram. Waits until it's done, and returns
+ * the number heard.
+ */
+int aio_latency_test(int pings) {
+	struct timespec ts;
+	long long wait;
+	const Histogram * h = stats_get(ST_AUDIO_RTT);
+	int heard;
+
+	if (pings <= 0)
+		return(0);
+	if (!running || src == NULL || sink == NULL) {
+		printf("Audio round trip: needs both an audio input and output\n");
+		return(0);
+	}
+
+	__atomic_store_n(&test_result, -1, __ATOMIC_RELEASE);
+	__atomic_store_n(&test_pings, pings, __ATOMIC_RELEASE);
+	ts.tv_sec = 0;
+	ts.tv_nsec = 10000000L;
+	wait = (long long)pings * (AIO_PING_GAP + AIO_PING_WAIT) + 1000;
+	while ((heard = __atomic_load_n(&test_result, __ATOMIC_ACQUIRE)) < 0 && wait > 0) {
+		nanosleep(&ts, NULL);
+		wait -= 10;
+	}
+	if (heard <= 0) {
+		printf("Audio round trip: none of %d pings heard\n",pings);
+		return(0);
+	}
+	printf("Audio round trip: %d of %d pings heard, p50 %.1f mS (min %.1f, max %.1f)\n",
+		heard, pings, stats_percentile(ST_AUDIO_RTT, 50) / 1e6,
+		h->min / 1e6, h->max / 1e6);
+	return(heard);
+}
+
+/* Prints the engine's counters
+ */
+void aio_dump(FILE * fp) {
+	if (!ready)
+		return;
+	fprintf(fp, "Audio I/O: %d frames (%.1f mS) a period, %d RX channel(s), TX starts with %d queued\n",
+		frames, period_ns / 1e6, channels, prefill);
+	fprintf(fp, "  rx %-5s %10lu periods, %lu dropped (listeners behind), %lu device overruns\n",
+		rx_type, rx_periods, rx_overruns, (src != NULL) ? src->xruns : rx_xruns);
+	fprintf(fp, "  tx %-5s %10lu periods, %lu underruns, %lu samples dropped (ring full), %lu device underruns\n",
+		tx_type, tx_periods, tx_underruns, tx_dropped, (sink != NULL) ? sink->xruns : tx_xruns);
+	fprintf(fp, "  %lu passes started late\n", late);
+	repeat_dump(fp);
+	fprintf(fp, "%-14s %6s %10s %9s %6s %6s\n", "queue", "size",
+		"pushed", "refused", "high", "now");
+	spsc_dump(&rx, fp);
+	spsc_dump(&tx, fp);
+	fflush(fp);
+}
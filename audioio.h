@@ -0,0 +1,109 @@
+/* audioio.h - Audio I/O engine for the 'minimalist' repeater
+ * controller.
+ *
+ * Moves the receive (RX) audio in from an audio source and the
+ * transmit (TX) audio out to the sink, on a thread of its own, a
+ * fixed size period at a time. The periods are passed through two
+ * preallocated Spsc rings, so nothing on the way allocates, takes a
+ * lock or waits:
+ *
+ *   source -> aio thread -> RX ring -> listeners (the audio thread)
+ *   tone engine -> TX ring -> aio thread -> sink
+ *
+ * The tone engine (audio.c) writes into the TX ring through a sink
+ * of its own, aio_tx_sink(), so it works the same with or without
+ * the engine. Between bursts of sound the engine sends silence, so
+ * a sound device never runs dry. A burst starts once a few periods
+ * are queued, enough to ride out the audio thread's wakeups.
+ *
+ * Xruns are counted on both sides: RX periods dropped because the
+ * listeners were behind, TX periods that weren't there when they were
+ * due, and the ones the devices themselves report. A round trip test
+ * sends pings out and times them coming back in (through a loopback
+ * cable, or the radio), see aio_latency_test().
+ *
+ * The receive audio can also be repeated, through the delay line of
+ * repeat.c, which the thread fills and empties alongside.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audioio.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __AUDIOIO_H__
+#define __AUDIOIO_H__
+
+#include <stdio.h>
+#include "audiosrc.h"
+#include "audiosink.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AIO_PERIOD      5       // in mS, the default period
+#define AIO_FRAMES      960     // most samples in a period, all channels (20 mS at 48 kHz)
+#define AIO_CHANNELS    8       // most input channels
+#define AIO_RING        32      // periods in each ring, a power of 2
+#define AIO_LISTENERS   4       // most RX listeners
+#define AIO_PING_GAP    250     // in mS, between round trip pings
+#define AIO_PING_WAIT   500     // in mS, how long a ping is listened for
+#define AIO_PING_LEVEL  8192    // a ping is heard when the input goes over this
+
+// A period of audio
+typedef struct
+{
+    long long t;            // RX: stats_clock() when it was read
+    int n;                  // frames, up to the period
+    int channels;           // samples in a frame, interleaved (TX is mono)
+    int last;               // TX: the sound stops after this one
+    short pcm[AIO_FRAMES];
+} AioPeriod;
+
+// Gets each RX period, on the thread that runs aio_rx_run()
+typedef void (*AioListener)(const AioPeriod * p, void * arg);
+
+/* Sets the engine up to read 'src' and write 'sink' (either may be
+ * NULL) at 'rate' Hz, 'period' mS at a time. The engine owns them
+ * from here on. The round trip test listens on the source's first
+ * channel. Returns 1 on success.
+ */
+int aio_init(AudioSource * src, AudioSink * sink, int rate, int period);
+/* Returns 1 once aio_init() has been called */
+int aio_ready(void);
+/* Returns the sink that feeds the TX ring, for the tone engine.
+ * Its writes never fail, a full ring drops (and counts) the audio.
+ * NULL if the engine has no sink.
+ */
+AudioSink * aio_tx_sink(void);
+/* Adds an RX listener. Returns 0 if there are too many. */
+int aio_listen(AioListener fn, void * arg);
+/* Passes the waiting RX periods to the listeners. The one RX
+ * consumer, the audio thread (or loop() without it).
+ */
+void aio_rx_run(void);
+/* Starts the engine's thread, which runs 'start' first (e.g. to set
+ * its CPU). Returns 1 on success.
+ */
+int aio_start_thread(void (*start)(void));
+/* Stops the thread and closes the source and sink */
+void aio_stop_thread(void);
+/* Sends 'pings' pings out and times each coming back in, into the
+ * 'audio round trip' histogram. Waits until it's done, and returns
+ * the number heard.
+ */
+int aio_latency_test(int pings);
+/* Prints the engine's counters */
+void aio_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __AUDIOIO_H__
@@ -0,0 +1,236 @@
+/* audiosink.c - Pluggable PCM audio outputs for the 'minimalist'
+ * repeater controller.
+ *
+ * The WAV and raw sinks make the synthesized audio easy to check
+ * in tests (or to pipe into 'aplay'), the ALSA sink is the sound
+ * device used in production. ALSA support is only compiled in when
+ * HAVE_ALSA is defined, which the Makefile does unless built with
+ * 'make ALSA=0', since the Pi may be built without it.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audiosink.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiosink.h"
+#ifdef HAVE_ALSA
+#include <errno.h>
+#include <alsa/asoundlib.h>
+#endif
+
+/* Writes a little endian value of 'bytes' bytes
+ */
+static void put_le(FILE * fp, unsigned int v, int bytes) {
+	while (bytes--) {
+		fputc(v & 0xff, fp);
+		v >>= 8;
+	}
+}
+
+/* Writes a mono 16 bit WAV header for 'frames' samples
+ */
+static void wav_header(FILE * fp, int rate, long long frames) {
+	unsigned int data = (unsigned int)(frames * 2);
+
+	fwrite("RIFF", 1, 4, fp);
+	put_le(fp, 36 + data, 4);
+	fwrite("WAVEfmt ", 1, 8, fp);
+	put_le(fp, 16, 4);          // fmt chunk size
+	put_le(fp, 1, 2);           // PCM
+	put_le(fp, 1, 2);           // mono
+	put_le(fp, rate, 4);
+	put_le(fp, rate * 2, 4);    // byte rate
+	put_le(fp, 2, 2);           // block align
+	put_le(fp, 16, 2);          // bits per sample
+	fwrite("data", 1, 4, fp);
+	put_le(fp, data, 4);
+}
+
+/* wav/raw/pipe: samples go straight to the FILE, converted to
+ * little endian a chunk at a time
+ */
+static int file_write(AudioSink * s, const short * buf, int n) {
+	unsigned char le[512 * 2];
+	int done = 0;
+
+	while (done < n) {
+		int len = n - done;
+		int i;
+
+		if (len > 512)
+			len = 512;
+		for (i = 0; i < len; i++) {
+			unsigned short v = (unsigned short)buf[done + i];
+			le[2 * i] = v & 0xff;
+			le[2 * i + 1] = v >> 8;
+		}
+		if (fwrite(le, 2, len, s->fp) != (size_t)len)
+			return(-1);
+		done += len;
+	}
+	return(done);
+}
+
+static void file_flush(AudioSink * s) {
+	fflush(s->fp);
+}
+
+static void file_close(AudioSink * s) {
+	if (s->is_pipe) {
+		pclose(s->fp);
+	} else if (s->fp != stdout) {
+		fclose(s->fp);
+	} else {
+		fflush(s->fp);
+	}
+}
+
+static void wav_close(AudioSink * s) {
+	// go back and fill in the real sizes
+	if (fseek(s->fp, 0, SEEK_SET) == 0)
+		wav_header(s->fp, s->rate, s->frames);
+	fclose(s->fp);
+}
+
+#ifdef HAVE_ALSA
+static int alsa_write(AudioSink * s, const short * buf, int n) {
+	snd_pcm_sframes_t r;
+	int done = 0;
+
+	while (done < n) {
+		r = snd_pcm_writei((snd_pcm_t *)s->pcm, buf + done, n - done);
+		if (r < 0) {
+			// underrun (we stopped feeding between tones) or
+			// suspend, restart the stream
+			if (r == -EPIPE)
+				s->xruns++;
+			if (snd_pcm_recover((snd_pcm_t *)s->pcm, (int)r, 1) < 0)
+				return(-1);
+			continue;
+		}
+		done += (int)r;
+	}
+	return(done);
+}
+
+static void alsa_close(AudioSink * s) {
+	snd_pcm_drain((snd_pcm_t *)s->pcm);
+	snd_pcm_close((snd_pcm_t *)s->pcm);
+}
+
+static int alsa_open(AudioSink * s, const char * dev) {
+	snd_pcm_t * pcm;
+
+	if (snd_pcm_open(&pcm, dev, SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+		printf("audiosink: can't open ALSA device '%s'\n",dev);
+		return(0);
+	}
+	// 100 mS of buffering is plenty for tones
+	if (snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+			SND_PCM_ACCESS_RW_INTERLEAVED, 1, s->rate, 1, 100000) < 0) {
+		printf("audiosink: can't set ALSA params on '%s'\n",dev);
+		snd_pcm_close(pcm);
+		return(0);
+	}
+	s->pcm = pcm;
+	s->clocked = 1;
+	s->write = alsa_write;
+	s->flush = NULL;
+	s->close = alsa_close;
+	return(1);
+}
+#endif
+
+/* Opens a sink from a '<type>:<target>' spec. Returns NULL (and
+ * prints why) if it cannot be opened.
+ */
+AudioSink * sink_open(const char * spec, int rate) {
+	AudioSink * s;
+	const char * target;
+	int ok = 0;
+
+	target = strchr(spec, ':');
+	if (target == NULL) {
+		printf("audiosink: bad sink '%s', expected <type>:<target>\n",spec);
+		return(NULL);
+	}
+	target++;
+
+	s = calloc(1, sizeof(AudioSink));
+	if (s == NULL)
+		return(NULL);
+	s->rate = rate;
+	s->write = file_write;
+	s->flush = file_flush;
+	s->close = file_close;
+
+	if (strncmp(spec, "wav:", 4) == 0) {
+		s->type = "wav";
+		s->fp = fopen(target, "wb");
+		if (s->fp != NULL) {
+			wav_header(s->fp, rate, 0);
+			s->close = wav_close;
+			ok = 1;
+		}
+	} else if (strncmp(spec, "raw:", 4) == 0) {
+		s->type = "raw";
+		s->fp = (strcmp(target, "-") == 0) ? stdout : fopen(target, "wb");
+		ok = (s->fp != NULL);
+	} else if (strncmp(spec, "pipe:", 5) == 0) {
+		s->type = "pipe";
+		s->fp = popen(target, "w");
+		s->is_pipe = 1;
+		ok = (s->fp != NULL);
+	} else if (strncmp(spec, "alsa:", 5) == 0) {
+		s->type = "alsa";
+#ifdef HAVE_ALSA
+		ok = alsa_open(s, target);
+#else
+		printf("audiosink: built without ALSA support (HAVE_ALSA)\n");
+#endif
+	} else {
+		printf("audiosink: unknown sink type in '%s'\n",spec);
+	}
+
+	if (!ok) {
+		if (s->type != NULL)
+			printf("audiosink: can't open %s sink '%s'\n",s->type,target);
+		free(s);
+		return(NULL);
+	}
+	return(s);
+}
+
+/* Writes 'n' samples, returns the number written or -1 on error
+ */
+int sink_write(AudioSink * s, const short * buf, int n) {
+	int r = s->write(s, buf, n);
+
+	if (r > 0)
+		s->frames += r;
+	return(r);
+}
+
+/* Pushes out what has been written so far, e.g. when the sound
+ * stops for a while
+ */
+void sink_flush(AudioSink * s) {
+	if (s->flush != NULL)
+		s->flush(s);
+}
+
+/* Finishes and closes a sink
+ */
+void sink_close(AudioSink * s) {
+	if (s == NULL)
+		return;
+	s->close(s);
+	free(s);
+}
@@ -0,0 +1,65 @@
+/* audiosink.h - Pluggable PCM audio outputs for the 'minimalist'
+ * repeater controller.
+ *
+ * A sink takes signed 16 bit mono samples. Sinks are opened from a
+ * spec string of the form '<type>:<target>':
+ *
+ *   wav:<file>     - WAV file, for tests
+ *   raw:<file>     - raw S16_LE samples, '-' for stdout
+ *   pipe:<command> - raw S16_LE samples piped into a command
+ *   alsa:<device>  - ALSA sound device (when built with HAVE_ALSA)
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audiosink.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __AUDIOSINK_H__
+#define __AUDIOSINK_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AudioSink
+{
+    const char * type;      // sink type name
+    int rate;               // sample rate in Hz
+    long long frames;       // samples written so far
+    unsigned long xruns;    // underruns the device reported
+    int clocked;            // writes wait for the device, it sets the pace
+    FILE * fp;              // wav/raw/pipe output
+    int is_pipe;            // fp came from popen()
+    void * pcm;             // ALSA handle
+    void * priv;            // anything else the sink type needs
+    int (*write)(struct AudioSink * s, const short * buf, int n);
+    void (*flush)(struct AudioSink * s);
+    void (*close)(struct AudioSink * s);
+} AudioSink;
+
+/* Opens a sink from a '<type>:<target>' spec. Returns NULL (and
+ * prints why) if it cannot be opened.
+ */
+AudioSink * sink_open(const char * spec, int rate);
+/* Writes 'n' samples, returns the number written or -1 on error */
+int sink_write(AudioSink * s, const short * buf, int n);
+/* Pushes out what has been written so far, e.g. when the sound
+ * stops for a while
+ */
+void sink_flush(AudioSink * s);
+/* Finishes and closes a sink */
+void sink_close(AudioSink * s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __AUDIOSINK_H__
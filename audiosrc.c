@@ -0,0 +1,234 @@
+/* audiosrc.c - Pluggable PCM audio inputs for the 'minimalist'
+ * repeater controller.
+ *
+ * The WAV and raw sources feed recorded receiver audio through the
+ * controller in tests, the ALSA source is the sound device used in
+ * production. As with the sinks, ALSA support is only compiled in
+ * when HAVE_ALSA is defined ('make ALSA=0' leaves it out).
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audiosrc.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audiosrc.h"
+#ifdef HAVE_ALSA
+#include <errno.h>
+#include <alsa/asoundlib.h>
+#endif
+
+/* Returns a little endian value of 'bytes' bytes
+ */
+static unsigned int get_le(const unsigned char * p, int bytes) {
+	unsigned int v = 0;
+
+	while (bytes--)
+		v = (v << 8) | p[bytes];
+	return(v);
+}
+
+/* Reads a WAV header up to the start of the samples. Returns 0 (and
+ * prints why) if it isn't 16 bit PCM at 'rate' Hz with 'channels'
+ * channels.
+ */
+static int wav_header(FILE * fp, const char * file, int rate, int channels) {
+	unsigned char h[16];
+	int fmt = 0;
+
+	if (fread(h, 1, 12, fp) != 12 || memcmp(h, "RIFF", 4) != 0 ||
+			memcmp(h + 8, "WAVE", 4) != 0) {
+		printf("audiosrc: '%s' isn't a WAV file\n",file);
+		return(0);
+	}
+	// the chunks, up to 'data'
+	while (fread(h, 1, 8, fp) == 8) {
+		unsigned int len = get_le(h + 4, 4);
+
+		if (memcmp(h, "data", 4) == 0) {
+			if (fmt)
+				return(1);
+			break;
+		}
+		if (memcmp(h, "fmt ", 4) == 0 && len >= 16) {
+			if (fread(h, 1, 16, fp) != 16)
+				break;
+			if (get_le(h, 2) != 1 || (int)get_le(h + 2, 2) != channels ||
+					(int)get_le(h + 4, 4) != rate || get_le(h + 14, 2) != 16) {
+				printf("audiosrc: '%s' must be 16 bit PCM at %d Hz, %d channel(s)\n",file,rate,channels);
+				return(0);
+			}
+			fmt = 1;
+			len -= 16;
+		}
+		// chunks are padded to an even length
+		if (fseek(fp, len + (len & 1), SEEK_CUR) != 0)
+			break;
+	}
+	printf("audiosrc: '%s' has no samples\n",file);
+	return(0);
+}
+
+/* wav/raw/pipe: samples come straight from the FILE, converted from
+ * little endian a chunk at a time. A part frame at the end is dropped.
+ */
+static int file_read(AudioSource * s, short * buf, int n) {
+	unsigned char le[512 * 2];
+	int done = 0;
+
+	n *= s->channels;
+	while (done < n) {
+		int len = n - done;
+		int got;
+		int i;
+
+		if (len > 512)
+			len = 512;
+		got = (int)fread(le, 2, len, s->fp);
+		for (i = 0; i < got; i++)
+			buf[done + i] = (short)get_le(le + 2 * i, 2);
+		done += got;
+		if (got < len)
+			return(ferror(s->fp) ? -1 : done / s->channels);
+	}
+	return(done / s->channels);
+}
+
+static void file_close(AudioSource * s) {
+	if (s->is_pipe)
+		pclose(s->fp);
+	else if (s->fp != stdin)
+		fclose(s->fp);
+}
+
+#ifdef HAVE_ALSA
+static int alsa_read(AudioSource * s, short * buf, int n) {
+	snd_pcm_sframes_t r;
+	int done = 0;
+
+	while (done < n) {
+		r = snd_pcm_readi((snd_pcm_t *)s->pcm, buf + done * s->channels, n - done);
+		if (r < 0) {
+			// overrun, we didn't read in time
+			if (r == -EPIPE)
+				s->xruns++;
+			if (snd_pcm_recover((snd_pcm_t *)s->pcm, (int)r, 1) < 0)
+				return(-1);
+			continue;
+		}
+		done += (int)r;
+	}
+	return(done);
+}
+
+static void alsa_close(AudioSource * s) {
+	snd_pcm_close((snd_pcm_t *)s->pcm);
+}
+
+static int alsa_open(AudioSource * s, const char * dev) {
+	snd_pcm_t * pcm;
+
+	if (snd_pcm_open(&pcm, dev, SND_PCM_STREAM_CAPTURE, 0) < 0) {
+		printf("audiosrc: can't open ALSA device '%s'\n",dev);
+		return(0);
+	}
+	// short buffering, this is the receive audio
+	if (snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+			SND_PCM_ACCESS_RW_INTERLEAVED, s->channels, s->rate, 1, 20000) < 0) {
+		printf("audiosrc: can't set ALSA params on '%s'\n",dev);
+		snd_pcm_close(pcm);
+		return(0);
+	}
+	s->pcm = pcm;
+	s->clocked = 1;
+	s->read = alsa_read;
+	s->close = alsa_close;
+	return(1);
+}
+#endif
+
+/* Opens a source from a '<type>:<target>' spec, with 'channels'
+ * channels. Returns NULL (and prints why) if it cannot be opened.
+ */
+AudioSource * source_open(const char * spec, int rate, int channels) {
+	AudioSource * s;
+	const char * target;
+	int ok = 0;
+
+	target = strchr(spec, ':');
+	if (target == NULL) {
+		printf("audiosrc: bad source '%s', expected <type>:<target>\n",spec);
+		return(NULL);
+	}
+	target++;
+
+	s = calloc(1, sizeof(AudioSource));
+	if (s == NULL)
+		return(NULL);
+	s->rate = rate;
+	s->channels = (channels > 0) ? channels : 1;
+	s->read = file_read;
+	s->close = file_close;
+
+	if (strncmp(spec, "wav:", 4) == 0) {
+		s->type = "wav";
+		s->fp = fopen(target, "rb");
+		if (s->fp != NULL && !wav_header(s->fp, target, rate, s->channels)) {
+			fclose(s->fp);
+			s->fp = NULL;
+		}
+		ok = (s->fp != NULL);
+	} else if (strncmp(spec, "raw:", 4) == 0) {
+		s->type = "raw";
+		s->fp = (strcmp(target, "-") == 0) ? stdin : fopen(target, "rb");
+		ok = (s->fp != NULL);
+	} else if (strncmp(spec, "pipe:", 5) == 0) {
+		s->type = "pipe";
+		s->fp = popen(target, "r");
+		s->is_pipe = 1;
+		ok = (s->fp != NULL);
+	} else if (strncmp(spec, "alsa:", 5) == 0) {
+		s->type = "alsa";
+#ifdef HAVE_ALSA
+		ok = alsa_open(s, target);
+#else
+		printf("audiosrc: built without ALSA support (HAVE_ALSA)\n");
+#endif
+	} else {
+		printf("audiosrc: unknown source type in '%s'\n",spec);
+	}
+
+	if (!ok) {
+		if (s->type != NULL)
+			printf("audiosrc: can't open %s source '%s'\n",s->type,target);
+		free(s);
+		return(NULL);
+	}
+	return(s);
+}
+
+/* Reads up to 'n' frames, returns the number read, 0 at the end
+ * of the input or -1 on error
+ */
+int source_read(AudioSource * s, short * buf, int n) {
+	int r = s->read(s, buf, n);
+
+	if (r > 0)
+		s->frames += r;
+	return(r);
+}
+
+/* Closes a source
+ */
+void source_close(AudioSource * s) {
+	if (s == NULL)
+		return;
+	s->close(s);
+	free(s);
+}
@@ -0,0 +1,64 @@
+/* audiosrc.h - Pluggable PCM audio inputs for the 'minimalist'
+ * repeater controller.
+ *
+ * A source gives signed 16 bit samples, the receiver audio, with one
+ * channel per receiver (interleaved, receiver 1 first). Sources are
+ * opened from a spec string of the form '<type>:<target>', as the
+ * sinks are (see audiosink.h):
+ *
+ *   wav:<file>     - WAV file (16 bit, at the sample rate), for tests
+ *   raw:<file>     - raw S16_LE samples, '-' for stdin
+ *   pipe:<command> - raw S16_LE samples from a command
+ *   alsa:<device>  - ALSA capture device (when built with HAVE_ALSA)
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: audiosrc.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __AUDIOSRC_H__
+#define __AUDIOSRC_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AudioSource
+{
+    const char * type;      // source type name
+    int rate;               // sample rate in Hz
+    int channels;           // samples in a frame
+    long long frames;       // frames read so far
+    unsigned long xruns;    // overruns the device reported
+    int clocked;            // reads wait for the device, it sets the pace
+    FILE * fp;              // wav/raw/pipe input
+    int is_pipe;            // fp came from popen()
+    void * pcm;             // ALSA handle
+    int (*read)(struct AudioSource * s, short * buf, int n);
+    void (*close)(struct AudioSource * s);
+} AudioSource;
+
+/* Opens a source from a '<type>:<target>' spec, with 'channels'
+ * channels. Returns NULL (and prints why) if it cannot be opened.
+ */
+AudioSource * source_open(const char * spec, int rate, int channels);
+/* Reads up to 'n' frames, returns the number read, 0 at the end
+ * of the input or -1 on error
+ */
+int source_read(AudioSource * s, short * buf, int n);
+/* Closes a source */
+void source_close(AudioSource * s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __AUDIOSRC_H__
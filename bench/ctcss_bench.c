@@ -0,0 +1,146 @@
+/* ctcss_bench.c - CTCSS decoder benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * First checks the decoder does its job on synthetic receiver audio:
+ * how long it takes to hear a 100.0 Hz tone under voice, and that it
+ * stays off for the neighbouring tones and for voice alone. Then runs
+ * it on 1 to 8 receivers at once, at 8 and 48 kHz, and reports its
+ * throughput in tones x channels per second (a decoder listens for
+ * all 50 tones) and how much of a core it takes.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/ctcss_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "ctcss.h"
+
+#define RATE        8000
+#define CHUNK       80          // samples fed at a time, 10 mS
+#define TONE_LEVEL  1500        // about 10% of the deviation
+#define MAX_CH      8
+#define BENCH_SECS  2
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* Receiver audio: a tone at 'hz' (0 = none) under a syllabic
+ * voice-like mix, sample 'i' at 'rate' Hz
+ */
+static short rx_sample(double hz, long i, int rate) {
+	double t = (double)i / rate;
+	double env = 0.5 + 0.5 * sin(2 * M_PI * 3.7 * t);
+	double v;
+
+	v = env * (5000 * sin(2 * M_PI * 470 * t) + 3000 * sin(2 * M_PI * 1130 * t) +
+		1500 * sin(2 * M_PI * 2310 * t)) + (rand() % 1001 - 500);
+	if (hz > 0)
+		v += TONE_LEVEL * sin(2 * M_PI * hz * t);
+	return((short)v);
+}
+
+/* Feeds 'ms' of audio with a tone at 'hz' from sample '*i' on, and
+ * returns mS until the decoder's output became 'want', -1 if it
+ * never did
+ */
+static int run(Ctcss * d, double hz, long * i, int ms, int want) {
+	short pcm[CHUNK];
+	int t, k;
+
+	for (t = 0; t < ms; t += CHUNK * 1000 / RATE) {
+		for (k = 0; k < CHUNK; k++)
+			pcm[k] = rx_sample(hz, (*i)++, RATE);
+		ctcss_feed(d, pcm, CHUNK, 1);
+		if (ctcss_on(d) == want)
+			return(t + CHUNK * 1000 / RATE);
+	}
+	return(-1);
+}
+
+int main(int argc, char **argv)
+{
+	static const int rates[] = { 8000, 48000 };
+	static const int chans[] = { 1, 2, 4, 8 };
+	static const double others[] = { 97.4, 103.5, 0 };
+	static Ctcss dec[MAX_CH];
+	int want = ctcss_tone_index(100.0);
+	int fail = 0;
+	long i = 0;
+	int r, c, k, ms;
+
+	// detect and release, a few times over
+	ctcss_init(&dec[0], RATE, want, DEFAULT_CTCSS_DETECT, DEFAULT_CTCSS_RELEASE);
+	for (k = 0; k < 5; k++) {
+		run(&dec[0], 0, &i, 1000, 1);
+		ms = run(&dec[0], 100.0, &i, 2000, 1);
+		printf("ctcss 100.0 Hz: detected in %d mS", ms);
+		if (ms < 0)
+			fail = 1;
+		ms = run(&dec[0], 0, &i, 2000, 0);
+		printf(", released in %d mS\n", ms);
+		if (ms < 0)
+			fail = 1;
+	}
+
+	// the neighbours, and voice alone, never open it
+	for (k = 0; k < (int)(sizeof(others) / sizeof(others[0])); k++) {
+		ctcss_init(&dec[0], RATE, want, DEFAULT_CTCSS_DETECT, DEFAULT_CTCSS_RELEASE);
+		ms = run(&dec[0], others[k], &i, 10000, 1);
+		if (others[k] > 0)
+			printf("ctcss %.1f Hz: %s", others[k], (ms < 0) ? "rejected" : "FALSE DETECT");
+		else
+			printf("ctcss voice only: %s", (ms < 0) ? "rejected" : "FALSE DETECT");
+		printf(" over 10 S, heard %.1f Hz\n",
+			(dec[0].heard >= 0) ? ctcss_tones[dec[0].heard] : 0.0);
+		if (ms >= 0)
+			fail = 1;
+	}
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		int frames = rates[r] * BENCH_SECS;
+		short * pcm = malloc((size_t)frames * MAX_CH * sizeof(short));
+
+		for (c = 0; c < (int)(sizeof(chans) / sizeof(chans[0])); c++) {
+			long long start, elapsed;
+			double rt;
+
+			// interleaved as the engine gives them, each receiver on
+			// a different tone
+			for (i = 0; i < (long)frames * chans[c]; i++)
+				pcm[i] = rx_sample(ctcss_tones[i % chans[c] * 5], i / chans[c], rates[r]);
+			for (k = 0; k < chans[c]; k++)
+				ctcss_init(&dec[k], rates[r], k * 5, DEFAULT_CTCSS_DETECT, DEFAULT_CTCSS_RELEASE);
+			start = clock_ns();
+			for (k = 0; k < chans[c]; k++)
+				ctcss_feed(&dec[k], pcm + k, frames, chans[c]);
+			elapsed = clock_ns() - start;
+
+			rt = (double)BENCH_SECS / (elapsed / 1e9);
+			printf("ctcss @ %5d Hz x %d ch: %.1f nS/sample, %.0fx real time, %.2f%% of a core, %.2e tones x channels/S\n",
+				rates[r], chans[c], (double)elapsed / ((double)frames * chans[c]),
+				rt, 100 / rt, CTCSS_TONES * chans[c] * rt);
+			for (k = 0; k < chans[c]; k++)
+				if (!ctcss_on(&dec[k]))
+					fail = 1;
+		}
+		free(pcm);
+	}
+
+	if (fail) {
+		printf("FAIL: the CTCSS decoder missed a tone or heard a wrong one\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,356 @@
+/* ctrl_bench.c - Controller hot path benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Links the controller built for the simulator (virtual clock, sim
+ * GPIO backend, scripted COR) without its main() and times:
+ *
+ *  - one loop() pass in every CtrlStates state, both on entry to the
+ *    state and in the steady state
+ *  - morse_compile() of the callsign (what used to be ConvertCall())
+ *  - LoadConfig(), i.e. ini_parse() + handler()
+ *  - a config reload: snap_load() on the reload thread, and the
+ *    snap_apply() the control loop does to switch to it
+ *  - COR edge to PTT ON, from the edge being reported to the PTT pin
+ *    being written, through the real main loop path
+ *  - an idle loop() pass with 1 to PORT_MAX ports configured, which
+ *    should stay close to flat as ports are added
+ *
+ * and fails (exits 1) if loop() allocated memory in any of them.
+ *
+ * Each is reported as p50/p99/p99.9/max in nS, and also written as
+ * CSV (to bench/results.csv, or the file given on the command line)
+ * so runs can be compared by a script.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/ctrl_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rptrctrl.h"
+#include "corevent.h"
+#include "gpio.h"
+#include "morse.h"
+#include "fsm.h"
+
+#define LOOP_PASSES    20000   // per state, per entry/steady
+#define MORSE_PASSES   100000
+#define CONFIG_PASSES  2000
+#define KEYUPS         500     // COR_SIM_MAX edges / 2
+#define DEFAULT_RESULTS "bench/results.csv"
+
+// controller globals
+extern Snapshot * Snap;
+extern Port Ports[];
+extern int NumPorts;
+extern int PTT_ON;
+extern int PTT_OFF;
+extern int COR_ON;
+extern int COR_OFF;
+extern int pwm_div;
+extern Settings Set;
+
+static long long samples[LOOP_PASSES > MORSE_PASSES ? LOOP_PASSES : MORSE_PASSES];
+static FILE * out;      // the real stdout, the controller's goes to /dev/null
+static FILE * csv;
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static int cmp_ns(const void * a, const void * b) {
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return((x > y) - (x < y));
+}
+
+/* Sorts the samples and prints / records their percentiles
+ */
+static void report(const char * name, long long * ns, int n) {
+	long long p50, p99, p999;
+
+	qsort(ns, n, sizeof(long long), cmp_ns);
+	p50 = ns[(int)(0.50 * (n - 1))];
+	p99 = ns[(int)(0.99 * (n - 1))];
+	p999 = ns[(int)(0.999 * (n - 1))];
+
+	fprintf(out, "%-30s %7d %9lld %9lld %9lld %9lld\n",
+		name, n, p50, p99, p999, ns[n - 1]);
+	if (csv != NULL)
+		fprintf(csv, "%s,%d,%lld,%lld,%lld,%lld\n",
+			name, n, p50, p99, p999, ns[n - 1]);
+}
+
+/* Writes a config with every key LoadConfig() expects. The ID
+ * timer is long enough that no ID gets in the way of the COR runs.
+ */
+static void write_config(const char * file) {
+	FILE * fp = fopen(file, "w");
+
+	if (fp == NULL)
+		return;
+	fprintf(fp, "[CONTROL]\nCORSense=Negative\nPTTSense=Positive\n");
+	fprintf(fp, "IDTimer=100000000\nSQTimer=1000\n\n");
+	fprintf(fp, "[CWID]\nCallsign=KB4OID/R\nWPM=20\n\n");
+	fprintf(fp, "[TONES]\nCWIDFreq=1200\nCBEEPtype=DeDoop\n");
+	fprintf(fp, "CBEEPFreq1=1000\nCBEEPFreq2=800\nCBEEPTimeDuration=2\n");
+	fprintf(fp, "CWIDClockTime=50\n");
+	fclose(fp);
+}
+
+/* The same config with PORT_MAX [PORTn] sections
+ */
+static void write_port_config(const char * file) {
+	FILE * fp;
+	int i;
+
+	write_config(file);
+	fp = fopen(file, "a");
+	if (fp == NULL)
+		return;
+	for (i = 0; i < PORT_MAX; i++)
+		fprintf(fp, "\n[PORT%d]\nPTTPin=%d\nCORPin=%d\nCORLED=%d\nIDPin=%d\n",
+			i + 1, 2 + i * 4, 3 + i * 4, 4 + i * 4, 5 + i * 4);
+	fclose(fp);
+}
+
+/* Writes a COR script of KEYUPS 2 S keyups, 4 S apart
+ */
+static void write_script(const char * file) {
+	FILE * fp = fopen(file, "w");
+	int i;
+
+	if (fp == NULL)
+		return;
+	for (i = 0; i < KEYUPS; i++) {
+		fprintf(fp, "%d %d\n", 1000 + i * 4000, COR_ON);
+		fprintf(fp, "%d %d\n", 3000 + i * 4000, COR_OFF);
+	}
+	fclose(fp);
+}
+
+/* One loop() pass in each state, on entry and steady
+ */
+static void bench_loop(void) {
+	Port * p = &Ports[0];
+	char name[40];
+	int state, entry, i;
+
+	for (state = CS_START; state < CS_COUNT; state++) {
+		for (entry = 1; entry >= 0; entry--) {
+			for (i = 0; i < LOOP_PASSES; i++) {
+				long long t;
+
+				p->fsm.state = entry ? CS_START : state;
+				p->wake = 1;
+				t = clock_ns();
+				if (entry)
+					fsm_enter(&p->fsm, state);
+				loop();
+				samples[i] = clock_ns() - t;
+			}
+			snprintf(name, sizeof(name), "loop.%s.%s",
+				fsm_state_name(&p->fsm, state), entry ? "entry" : "steady");
+			report(name, samples, LOOP_PASSES);
+		}
+	}
+
+	// leave nothing playing and PTT off
+	id_abort(p);
+	cbeep_abort(p);
+	p->fsm.state = p->fsm.prev = CS_IDLE;
+	p->ptt = PTT_OFF;
+	digitalWrite(p->ptt_pin, PTT_OFF);
+	gpio_flush();
+}
+
+static void bench_morse(void) {
+	static MorseTimeline tl;
+	int i;
+
+	for (i = 0; i < MORSE_PASSES; i++) {
+		long long t = clock_ns();
+		morse_compile(&tl, Set.callsign, 20, 0);
+		samples[i] = clock_ns() - t;
+	}
+	report("morse_compile", samples, MORSE_PASSES);
+}
+
+static void bench_config(char * file) {
+	int i;
+
+	for (i = 0; i < CONFIG_PASSES; i++) {
+		long long t = clock_ns();
+		LoadConfig(file);
+		samples[i] = clock_ns() - t;
+	}
+	report("LoadConfig", samples, CONFIG_PASSES);
+}
+
+static void bench_reload(char * file) {
+	Snapshot * cur = Snap;
+	Snapshot * s;
+	int i;
+
+	for (i = 0; i < CONFIG_PASSES; i++) {
+		long long t = clock_ns();
+		s = snap_load(file, cur);
+		samples[i] = clock_ns() - t;
+		snap_free(s);
+	}
+	report("snap_load", samples, CONFIG_PASSES);
+
+	s = snap_load(file, cur);
+	for (i = 0; i < CONFIG_PASSES; i++) {
+		long long t = clock_ns();
+		snap_apply((i & 1) ? cur : s);
+		samples[i] = clock_ns() - t;
+	}
+	report("snap_apply", samples, CONFIG_PASSES);
+	snap_apply(cur);
+	snap_free(s);
+}
+
+/* Runs the main loop against the COR script and times each
+ * COR ON edge until the PTT pin goes on
+ */
+static void bench_cor_ptt(const char * script) {
+	long long edge_ns = 0;
+	msec_t edge_ms = 0;
+	msec_t virt = 0;
+	int waiting = 0;
+	int n = 0;
+
+	// the script starts now, in controller time
+	write_script(script);
+	cor_event_init(COR_EVT_SIM, &Ports[0].cor_pin, 1, script);
+
+	while (n < KEYUPS) {
+		cor_edge edge;
+
+		if (cor_wait(loop_timeout(), &edge) > 0) {
+			Ports[0].edge_time = edge.ts_ns;
+			Ports[0].wake = 1;
+			if (edge.level == COR_ON) {
+				edge_ns = clock_ns();
+				edge_ms = now();
+				waiting = 1;
+			}
+		}
+		loop();
+		if (waiting && gpio_sim_get(Ports[0].ptt_pin) == PTT_ON) {
+			samples[n++] = clock_ns() - edge_ns;
+			virt = now() - edge_ms;
+			waiting = 0;
+		}
+	}
+	report("cor_to_ptt", samples, n);
+	fprintf(out, "  (plus %lld mS of debounce in controller time)\n", virt);
+}
+
+/* An idle loop() pass, with every port polled for COR, as ports
+ * are added
+ */
+static void bench_ports(char * file, const char * script) {
+	int pins[PORT_MAX];
+	char name[40];
+	int n, i;
+
+	write_port_config(file);
+	LoadConfig(file);
+	port_init();
+	setup();
+	for (i = 0; i < PORT_MAX; i++)
+		pins[i] = Ports[i].cor_pin;
+	cor_event_init(COR_EVT_SIM, pins, PORT_MAX, script);
+
+	for (n = 1; n <= PORT_MAX; n++) {
+		NumPorts = n;
+		// let the startup IDs go by
+		for (i = 0; i < NumPorts; i++) {
+			Ports[i].need_id = LOW;
+			Ports[i].fsm.state = CS_IDLE;
+			Ports[i].due = -1;
+			Ports[i].wake = 0;
+		}
+		for (i = 0; i < LOOP_PASSES; i++) {
+			long long t = clock_ns();
+			loop();
+			samples[i] = clock_ns() - t;
+		}
+		snprintf(name, sizeof(name), "loop.idle.%dport", n);
+		report(name, samples, LOOP_PASSES);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char cfg[] = "/tmp/ctrl_bench_cfgXXXXXX";
+	char script[] = "/tmp/ctrl_bench_corXXXXXX";
+	const char * results = (argc > 1) ? argv[1] : DEFAULT_RESULTS;
+	int fd;
+
+	// keep the controller's own messages out of the results
+	out = fdopen(dup(fileno(stdout)), "w");
+	if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+		return 1;
+
+	fd = mkstemp(cfg);
+	if (fd < 0)
+		return 1;
+	close(fd);
+	fd = mkstemp(script);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	csv = fopen(results, "w");
+	if (csv != NULL)
+		fprintf(csv, "name,samples,p50_ns,p99_ns,p999_ns,max_ns\n");
+
+	// what main() does, against the mock hardware
+	settings_default(&Set);
+	pwm_div = PWM_DIV;
+	write_config(cfg);
+	LoadConfig(cfg);
+	port_init();
+	gpio_open(GPIO_SIM, NULL);
+	setup();
+	Ports[0].need_id = LOW;
+
+	fprintf(out, "%-30s %7s %9s %9s %9s %9s\n",
+		"nS", "samples", "p50", "p99", "p99.9", "max");
+	bench_loop();
+	bench_morse();
+	bench_config(cfg);
+	bench_reload(cfg);
+	bench_cor_ptt(script);
+	bench_ports(cfg, script);
+
+	unlink(cfg);
+	unlink(script);
+	if (csv != NULL) {
+		fclose(csv);
+		fprintf(out, "Results written to '%s'\n", results);
+	}
+
+	// the control path must not allocate once setup() is done
+	if (mem_guard_allocs() != 0) {
+		fprintf(out, "FAIL: loop() allocated memory %lu times\n", mem_guard_allocs());
+		return 1;
+	}
+	fprintf(out, "loop() allocated no memory\n");
+	return 0;
+}
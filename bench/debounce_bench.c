@@ -0,0 +1,285 @@
+/* debounce_bench.c - COR debouncer benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Runs noisy COR traces, sampled at 1 mS, through the old debounce
+ * (wait 50 mS and read COR again) and through the integrating
+ * debouncer with a few assert/release windows, and reports:
+ *
+ *  - missed keyups, and false triggers on bursts of squelch noise
+ *  - dropouts, i.e. PTT dropping and coming back during a keyup
+ *  - COR on to debounced on, and COR off to debounced off, in mS
+ *  - the cost of one debounce_update() in nS
+ *
+ * With no arguments it makes up a 30 minute trace (the same every
+ * run) of keyups with contact bounce and picket fencing, mixed with
+ * noise bursts. Recorded traces can be given instead, in the same
+ * 'mS level' format as a --corsim script (0 = COR active, the default
+ * negative sense), with a '# keyup <start> <end>' line for each real
+ * signal in it.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/debounce_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "debounce.h"
+
+#define TRACE_MAX   (30 * 60 * 1000)    // mS
+#define KEYUP_MAX   4096
+#define SLACK       500     // mS after a keyup that PTT may still be on
+#define OLD_DELAY   50      // mS, the old COR_DEBOUNCE_DELAY
+
+typedef struct
+{
+    long start;             // mS, COR first goes active
+    long end;               // mS, COR last goes inactive
+} Keyup;
+
+typedef struct
+{
+    const char * name;
+    int integrator;         // 0 = the old two sample debounce
+    int assert_ms;
+    int release_ms;
+} Algo;
+
+static const Algo algos[] = {
+	{ "delay 50 + re-read", 0, OLD_DELAY, OLD_DELAY },
+	{ "integrator 10/30", 1, 10, 30 },
+	{ "integrator 20/50", 1, 20, 50 },
+	{ "integrator 50/100", 1, 50, 100 },
+};
+
+static unsigned char level[TRACE_MAX];  // raw COR per mS, 1 = active
+static unsigned char out[TRACE_MAX];    // debounced COR per mS
+static long trace_len;
+static Keyup keyups[KEYUP_MAX];
+static int nkeyups;
+static int nbursts;
+static long on_lat[KEYUP_MAX];
+static long off_lat[KEYUP_MAX];
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+static int cmp_long(const void * a, const void * b) {
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+
+	return((x > y) - (x < y));
+}
+
+static int rnd(int lo, int hi) {
+	return(lo + rand() % (hi - lo + 1));
+}
+
+/* Sets 'n' mS of the trace to 'v', from 't'. Returns the new t.
+ */
+static long fill(long t, long n, int v) {
+	if (t + n > TRACE_MAX)
+		n = TRACE_MAX - t;
+	if (n > 0)
+		memset(&level[t], v, n);
+	return(t + n);
+}
+
+/* A few 1-3 mS toggles, as a relay or squelch opens or closes
+ */
+static long bounce(long t, int v) {
+	int i, n = rnd(0, 4);
+
+	for (i = 0; i < n; i++) {
+		t = fill(t, rnd(1, 3), v);
+		t = fill(t, rnd(1, 3), !v);
+	}
+	return(t);
+}
+
+/* Makes up the trace: keyups 1-8 S long, with picket fencing
+ * dropouts of up to 40 mS, and 100-600 mS bursts of 1-10 mS noise
+ * pulses 2-40 mS apart, with 0.5-3 S of quiet between them
+ */
+static void make_trace(void) {
+	long t = 0;
+
+	srand(1);
+	while (t < TRACE_MAX - 20000 && nkeyups < KEYUP_MAX) {
+		long end;
+
+		t = fill(t, rnd(500, 3000), 0);
+		if (rand() & 1) {
+			keyups[nkeyups].start = t;
+			t = bounce(t, 1);
+			end = t + rnd(1000, 8000);
+			while (t < end) {
+				t = fill(t, rnd(200, 2000), 1);
+				if (t < end)
+					t = fill(t, rnd(2, 40), 0);
+			}
+			t = fill(t, 1, 1);
+			t = bounce(t, 0);
+			keyups[nkeyups++].end = t;
+		} else {
+			end = t + rnd(100, 600);
+			while (t < end) {
+				t = fill(t, rnd(1, 10), 1);
+				t = fill(t, rnd(2, 40), 0);
+			}
+			nbursts++;
+		}
+	}
+	trace_len = fill(t, 2000, 0);
+}
+
+/* Loads a recorded trace. Returns 1 on success.
+ */
+static int load_trace(const char * file) {
+	char line[128];
+	FILE * fp = fopen(file, "r");
+	long t, last = 0;
+	int v, cur = 0;
+
+	if (fp == NULL) {
+		printf("Can't open '%s'\n", file);
+		return(0);
+	}
+	trace_len = nkeyups = nbursts = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		long s, e;
+
+		if (sscanf(line, "# keyup %ld %ld", &s, &e) == 2) {
+			if (nkeyups < KEYUP_MAX) {
+				keyups[nkeyups].start = s;
+				keyups[nkeyups++].end = e;
+			}
+			continue;
+		}
+		if (line[0] == '#' || sscanf(line, "%ld %d", &t, &v) != 2)
+			continue;
+		if (t < last)
+			continue;
+		fill(last, t - last, cur);
+		last = t;
+		cur = (v == 0);
+	}
+	fclose(fp);
+	trace_len = fill(last, 2000, cur);
+	return(1);
+}
+
+/* Debounces the trace into out[], returns nS per sample
+ */
+static double run(const Algo * a) {
+	Debouncer d;
+	long long t0;
+	long t, due = -1;
+	int on = 0, target = 0;
+
+	debounce_init(&d, a->assert_ms, a->release_ms, DEBOUNCE_PERIOD, 0);
+	t0 = clock_ns();
+	for (t = 0; t < trace_len; t++) {
+		if (a->integrator) {
+			out[t] = debounce_update(&d, level[t], t);
+			continue;
+		}
+		// the old way: blocked for OLD_DELAY, then one re-read
+		if (due >= 0) {
+			if (t >= due) {
+				if (level[t] == target)
+					on = target;
+				due = -1;
+			}
+		} else if (level[t] != on) {
+			target = level[t];
+			due = t + a->release_ms;
+		}
+		out[t] = on;
+	}
+	return((double)(clock_ns() - t0) / trace_len);
+}
+
+static void report(const Algo * a, double ns) {
+	int detected[KEYUP_MAX];
+	int k = 0, j, non = 0, noff = 0;
+	int falses = 0, dropouts = 0, missed = 0;
+	long t = 0;
+
+	memset(detected, 0, sizeof(detected));
+	while (t < trace_len) {
+		long s, e;
+
+		// the next debounced on interval, [s, e)
+		while (t < trace_len && !out[t])
+			t++;
+		if (t >= trace_len)
+			break;
+		s = t;
+		while (t < trace_len && out[t])
+			t++;
+		e = t;
+
+		while (k < nkeyups && keyups[k].end + SLACK <= s)
+			k++;
+		if (k >= nkeyups || keyups[k].start >= e) {
+			falses++;
+			continue;
+		}
+		for (j = k; j < nkeyups && keyups[j].start < e; j++) {
+			if (detected[j]++)
+				dropouts++;
+			else
+				on_lat[non++] = s - keyups[j].start;
+			if (e >= keyups[j].end)
+				off_lat[noff++] = e - keyups[j].end;
+		}
+	}
+	for (j = 0; j < nkeyups; j++)
+		if (!detected[j])
+			missed++;
+
+	qsort(on_lat, non, sizeof(long), cmp_long);
+	qsort(off_lat, noff, sizeof(long), cmp_long);
+	printf("%-20s %6d %6d %6d %8d %6ld %6ld %6ld %7ld %6ld %7.1f\n",
+		a->name, missed, falses, nbursts, dropouts,
+		non ? on_lat[non / 2] : 0, non ? on_lat[(int)(0.99 * (non - 1))] : 0,
+		non ? on_lat[non - 1] : 0,
+		noff ? off_lat[noff / 2] : 0, noff ? off_lat[noff - 1] : 0, ns);
+}
+
+int main(int argc, char **argv)
+{
+	int i, f;
+	int nalgos = sizeof(algos) / sizeof(algos[0]);
+
+	for (f = 1; f < argc || f == 1; f++) {
+		if (argc > 1) {
+			if (!load_trace(argv[f]))
+				return 1;
+			printf("%s: ", argv[f]);
+		} else {
+			make_trace();
+			printf("generated: ");
+		}
+		printf("%ld mS, %d keyups, %d noise bursts\n",
+			trace_len, nkeyups, nbursts);
+		printf("%-20s %6s %6s %6s %8s %6s %6s %6s %7s %6s %7s\n",
+			"", "missed", "false", "bursts", "dropouts",
+			"on p50", "p99", "max", "off p50", "max", "nS/smp");
+		for (i = 0; i < nalgos; i++)
+			report(&algos[i], run(&algos[i]));
+		printf("\n");
+	}
+	return 0;
+}
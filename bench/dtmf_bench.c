@@ -0,0 +1,281 @@
+/* dtmf_bench.c - DTMF decoder benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Writes a WAV fixture at 8 and 48 kHz: all 16 digits, the digits
+ * again with twist, a remote command, and a stretch of voice-like
+ * audio that must not decode (talk-off). Each fixture is read back
+ * through the WAV source, a period at a time as the audio I/O engine
+ * does, and run through the decoder and the command interpreter. It
+ * shows the digits heard, the decode latency per digit (from the
+ * start of the tone) and the CPU per audio channel, and fails if a
+ * digit is missed or made up, or the command isn't taken.
+ *
+ * Recorded receiver audio can be checked too, as '<file.wav>=<digits>'
+ * arguments (mono, 8 kHz).
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/dtmf_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "dtmf.h"
+#include "cmd.h"
+#include "audiosrc.h"
+#include "audiosink.h"
+
+#define PERIOD      5           // in mS, read at a time
+#define MAX_DIGITS  64
+#define MAX_SAMPLES (48000 * 20)
+#define NUM_PASSES  20
+
+static const char digits[] = "123A456B789C*0#D";
+static const float rows[4] = { 697, 770, 852, 941 };
+static const float cols[4] = { 1209, 1336, 1477, 1633 };
+
+static short pcm[MAX_SAMPLES];
+static int samples;
+
+// what went into the fixture, and what came out
+static char sent[MAX_DIGITS + 1];
+static long long sent_at[MAX_DIGITS];
+static char heard[MAX_DIGITS + 1];
+static long long heard_at[MAX_DIGITS];
+static int nsent;
+static int nheard;
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* A little receiver hiss
+ */
+static double hiss(void) {
+	return(rand() % 601 - 300);
+}
+
+/* Appends 'ms' of a digit (0 = hiss only), the row 'twist' dB
+ * above the column
+ */
+static void add_digit(char k, int ms, double twist, int rate) {
+	int n = rate * ms / 1000;
+	double ra = 0, ca = 0;
+	double rf = 0, cf = 0;
+	int i;
+
+	if (k != 0) {
+		i = (int)(strchr(digits, k) - digits);
+		rf = rows[i / 4];
+		cf = cols[i % 4];
+		ra = 6000;
+		ca = 6000 * pow(10, -twist / 20);
+		sent_at[nsent] = samples;
+		sent[nsent++] = k;
+	}
+	for (i = 0; i < n && samples < MAX_SAMPLES; i++, samples++)
+		pcm[samples] = (short)(ra * sin(2 * M_PI * rf * i / rate) +
+			ca * sin(2 * M_PI * cf * i / rate) + hiss());
+}
+
+/* Appends 'ms' of voice-like audio: a glottal buzz sweeping 90 to
+ * 250 Hz with every harmonic up to 3.5 kHz, through a syllable
+ * envelope
+ */
+static void add_voice(int ms, int rate) {
+	int n = rate * ms / 1000;
+	double ph = 0;
+	int i, h;
+
+	for (i = 0; i < n && samples < MAX_SAMPLES; i++, samples++) {
+		double t = (double)i / rate;
+		double f0 = 170 + 80 * sin(2 * M_PI * 0.7 * t);
+		double env = 0.5 + 0.5 * sin(2 * M_PI * 4.1 * t);
+		double v = 0;
+
+		ph += 2 * M_PI * f0 / rate;
+		for (h = 1; h * f0 < 3500; h++)
+			v += sin(h * ph) / h;
+		pcm[samples] = (short)(6000 * env * v + hiss());
+	}
+}
+
+/* The decoder's callback
+ */
+static void got(char digit, long long at, void * arg) {
+	if (nheard < MAX_DIGITS) {
+		heard_at[nheard] = at;
+		heard[nheard++] = digit;
+	}
+}
+
+/* Reads a fixture back through the WAV source and decodes it a
+ * period at a time. Returns 0 if it can't be read.
+ */
+static int decode(const char * file, int rate) {
+	char spec[200];
+	AudioSource * src;
+	Dtmf d;
+	int n;
+
+	snprintf(spec, sizeof(spec), "wav:%s", file);
+	src = source_open(spec, rate, 1);
+	if (src == NULL)
+		return(0);
+	dtmf_init(&d, rate, got, NULL);
+	nheard = 0;
+	samples = 0;
+	while ((n = source_read(src, pcm + samples, rate * PERIOD / 1000)) > 0 &&
+			samples + n < MAX_SAMPLES) {
+		dtmf_feed(&d, pcm + samples, n, 1);
+		samples += n;
+	}
+	source_close(src);
+	heard[nheard] = '\0';
+	return(1);
+}
+
+/* Runs the digits heard through the command interpreter, at the
+ * times they were heard. Returns the last command, with its value.
+ */
+static int interpret(int rate, long * value) {
+	static const char codes[CMD_COUNT][CMD_CODE] = { "1", "2", "3", "91", "90" };
+	CmdTrie t;
+	CmdState s;
+	int last = CMD_NONE;
+	int i, c;
+
+	cmd_compile(&t, "1234", codes);
+	cmd_reset(&s);
+	s.last = 0;
+	for (i = 0; i < nheard; i++) {
+		c = cmd_digit(&t, &s, heard[i], heard_at[i] * 1000 / rate, DEFAULT_CMD_TIMEOUT, value);
+		if (c != CMD_NONE)
+			last = c;
+	}
+	return(last);
+}
+
+/* Checks a fixture's digits and shows the latency
+ */
+static int check(const char * name, int rate) {
+	long long lat, min = -1, max = 0, sum = 0;
+	int i;
+
+	printf("dtmf %s: sent  %s\n", name, sent);
+	printf("dtmf %s: heard %s\n", name, heard);
+	if (strcmp(sent, heard) != 0)
+		return(0);
+	for (i = 0; i < nheard && i < nsent; i++) {
+		lat = heard_at[i] - sent_at[i];
+		sum += lat;
+		if (min < 0 || lat < min)
+			min = lat;
+		if (lat > max)
+			max = lat;
+	}
+	if (nheard > 0)
+		printf("dtmf %s: %d digits, decode latency %.1f / %.1f / %.1f mS (min/mean/max)\n",
+			name, nheard, min * 1000.0 / rate, sum * 1000.0 / nheard / rate, max * 1000.0 / rate);
+	return(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const int rates[] = { 8000, 48000 };
+	char file[100];
+	char spec[110];
+	char name[20];
+	AudioSink * sink;
+	long value = 0;
+	int fail = 0;
+	int r, i, k;
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		int rate = rates[r];
+		long long start, elapsed;
+		Dtmf d;
+
+		// the fixture
+		nsent = samples = 0;
+		add_digit(0, 300, 0, rate);
+		for (i = 0; digits[i] != '\0'; i++) {
+			add_digit(digits[i], 70, 0, rate);
+			add_digit(0, 70, 0, rate);
+		}
+		for (i = 0; i < 10; i++) {
+			add_digit(digits[(i * 5) % 16], 60, (i & 1) ? 6 : -3, rate);
+			add_digit(0, 60, 0, rate);
+		}
+		add_voice(5000, rate);
+		for (i = 0; "12342500#"[i] != '\0'; i++) {
+			add_digit("12342500#"[i], 80, 0, rate);
+			add_digit(0, 80, 0, rate);
+		}
+		add_digit(0, 300, 0, rate);
+		sent[nsent] = '\0';
+
+		snprintf(file, sizeof(file), "bench/dtmf-%dk.wav", rate / 1000);
+		snprintf(spec, sizeof(spec), "wav:%s", file);
+		sink = sink_open(spec, rate);
+		if (sink == NULL)
+			return 1;
+		sink_write(sink, pcm, samples);
+		sink_close(sink);
+
+		snprintf(name, sizeof(name), "@ %5d Hz", rate);
+		if (!decode(file, rate) || !check(name, rate))
+			fail = 1;
+		if (interpret(rate, &value) != CMD_SQ_TIMER || value != 500) {
+			printf("dtmf %s: the SQTimer 500 command wasn't taken\n", name);
+			fail = 1;
+		}
+
+		// CPU, one channel's worth of audio through the decoder
+		dtmf_init(&d, rate, NULL, NULL);
+		start = clock_ns();
+		for (k = 0; k < NUM_PASSES; k++)
+			dtmf_feed(&d, pcm, samples, 1);
+		elapsed = (clock_ns() - start) / NUM_PASSES;
+		printf("dtmf %s: %.1f nS/sample, %.0fx real time, %.3f%% of a core per channel\n",
+			name, (double)elapsed / samples, ((double)samples / rate) / (elapsed / 1e9),
+			100.0 * (elapsed / 1e9) / ((double)samples / rate));
+	}
+
+	// recorded fixtures
+	for (i = 1; i < argc; i++) {
+		char * want = strchr(argv[i], '=');
+
+		if (want == NULL) {
+			printf("usage: %s [<file.wav>=<digits> ...]\n", argv[0]);
+			return 1;
+		}
+		*want++ = '\0';
+		snprintf(sent, sizeof(sent), "%s", want);
+		nsent = 0;
+		if (!decode(argv[i], 8000)) {
+			fail = 1;
+			continue;
+		}
+		printf("dtmf %s: sent  %s\n", argv[i], sent);
+		printf("dtmf %s: heard %s\n", argv[i], heard);
+		if (strcmp(sent, heard) != 0)
+			fail = 1;
+	}
+
+	if (fail) {
+		printf("FAIL: the DTMF decoder missed or made up a digit\n");
+		return 1;
+	}
+	return 0;
+}
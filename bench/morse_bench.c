@@ -0,0 +1,99 @@
+/* morse_bench.c - Morse compiler benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Compiles thousands of callsigns and messages into keying
+ * timelines with morse_compile() and reports the throughput.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/morse_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "morse.h"
+
+#define NUM_MESSAGES 5000
+#define NUM_PASSES   20
+
+static char messages[NUM_MESSAGES][64];
+
+static const char * fixed[] = {
+	"N0S",
+	"KB4OID/R",
+	"DE W1AW/RPT <AR>",
+	"QRZ? PSE K",
+	"CQ CQ CQ DE KB4OID KB4OID K",
+	"73 ES GUD DX <SK>",
+	"WX: 72F, WIND 5 MPH = HAPPY (USERS) !",
+};
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* Makes up a callsign-like string, with an occasional suffix
+ */
+static void make_call(char * buf, int i) {
+	static const char * suffix[] = { "", "", "", "/R", "/P", " <AR>" };
+
+	sprintf(buf, "%c%c%d%c%c%c%s",
+		'A' + rand() % 26, 'A' + rand() % 26, rand() % 10,
+		'A' + rand() % 26, 'A' + rand() % 26, 'A' + rand() % 26,
+		suffix[i % 6]);
+}
+
+int main(int argc, char **argv)
+{
+	static MorseTimeline tl;
+	long long start, elapsed;
+	long chars = 0;
+	long edges = 0;
+	int i, pass;
+	int nfixed = sizeof(fixed) / sizeof(fixed[0]);
+
+	srand(1);
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		if (i % 10 == 0)
+			strcpy(messages[i], fixed[(i / 10) % nfixed]);
+		else
+			make_call(messages[i], i);
+	}
+
+	start = clock_ns();
+	for (pass = 0; pass < NUM_PASSES; pass++) {
+		for (i = 0; i < NUM_MESSAGES; i++) {
+			int n = morse_compile(&tl, messages[i], 20, (i & 1) ? 13 : 0);
+			if (n < 0) {
+				printf("overflow on '%s'\n", messages[i]);
+				return 1;
+			}
+			edges += n;
+			chars += strlen(messages[i]);
+		}
+	}
+	elapsed = clock_ns() - start;
+
+	printf("morse_compile: %d messages, %ld chars, %ld edges\n",
+		NUM_MESSAGES * NUM_PASSES, chars, edges);
+	printf("morse_compile: %.1f nS/message, %.1f nS/char, %.0f messages/S\n",
+		(double)elapsed / (NUM_MESSAGES * NUM_PASSES),
+		(double)elapsed / chars,
+		1e9 * NUM_MESSAGES * NUM_PASSES / (double)elapsed);
+
+	// a reference timeline, so the timing can be eyeballed
+	morse_compile(&tl, "PARIS ", 20, 0);
+	printf("PARIS @ 20 WPM: dit %d mS, %d edges, %u mS\n",
+		tl.dit, tl.count, tl.length);
+
+	return 0;
+}
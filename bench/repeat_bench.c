@@ -0,0 +1,181 @@
+/* repeat_bench.c - Repeat audio path benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Runs the delay line the way the aio thread does, a TX period then
+ * an RX period, on synthetic receiver audio: a 600 Hz voice tone, then
+ * a squelch crash (loud 3 kHz) just before COR drops. The gate is
+ * opened and closed as the control thread would, with the debounce's
+ * lag. Checks that the voice, from its start, comes out 'delay'
+ * later, that none of the crash does, and that the fades have no
+ * steps in them. Then times a period with the gate open and closed, which should cost
+ * the same, at 8 and 48 kHz.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/repeat_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "repeat.h"
+#include "stats.h"
+
+#define PERIOD      5           // in mS
+#define MAX_PERIOD  (48000 * PERIOD / 1000)
+#define VOICE_AT    1000        // in mS, COR on
+#define CRASH_AT    2450        // in mS, the crash starts
+#define DROP_AT     2500        // in mS, the COR edge
+#define ASSERT      50          // in mS, the debounce's lag on COR on
+#define RELEASE     50          // in mS, and on the drop
+#define END_AT      4000
+#define NUM_PASSES  20000
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* The delay histogram isn't kept here, it would pull in the COR
+ * clock and the GPIO with it
+ */
+void stats_record(int id, long long ns) {
+}
+
+/* Receiver audio, sample 'i' at 'rate' Hz
+ */
+static short rx_sample(long i, int rate) {
+	long ms = i * 1000 / rate;
+	double t = (double)i / rate;
+
+	if (ms >= CRASH_AT && ms < CRASH_AT + 100)
+		return((short)(20000 * sin(2 * M_PI * 3000 * t)));
+	if (ms >= VOICE_AT && ms < CRASH_AT)
+		return((short)(5000 * sin(2 * M_PI * 600 * t)));
+	return(0);
+}
+
+/* The amplitude of 'f' Hz in 'n' samples
+ */
+static double level(const short * pcm, int n, double f, int rate) {
+	double c = 2 * cos(2 * M_PI * f / rate);
+	double s0, s1 = 0, s2 = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		s0 = pcm[i] + c * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	return(2 * sqrt(fabs(s1 * s1 + s2 * s2 - c * s1 * s2)) / n);
+}
+
+/* Runs the receive audio through the path, as the aio and control
+ * threads would. Returns 0 if the crash got out, the voice didn't, or
+ * a fade had a step in it.
+ */
+static int check(int rate, int delay) {
+	int n = rate * PERIOD / 1000;
+	short rx[MAX_PERIOD], tx[MAX_PERIOD];
+	long i = 0;
+	int first = -1, last = -1;
+	int crash = 0;
+	int step = 0;
+	short prev = 0;
+	int ms, k;
+
+	for (ms = 0; ms < END_AT; ms += PERIOD) {
+		// the control thread: on once the debouncer has the voice,
+		// off once it lets go of the drop
+		if (ms == VOICE_AT + ASSERT)
+			repeat_open(ASSERT * 1000000LL);
+		if (ms == DROP_AT + RELEASE)
+			repeat_close(RELEASE * 1000000LL);
+
+		for (k = 0; k < n; k++)
+			tx[k] = 0;
+		repeat_tx(tx, n);
+		for (k = 0; k < n; k++)
+			rx[k] = rx_sample(i++, rate);
+		repeat_rx(rx, n, 1);
+
+		if (level(tx, n, 3000, rate) > 100)
+			crash = 1;
+		if (level(tx, n, 600, rate) > 2500) {
+			if (first < 0)
+				first = ms;
+			last = ms + PERIOD;
+		}
+		// a sine at 600 Hz moves at most 2 pi 600 / rate of its
+		// peak a sample, and a fade a step of its gain more
+		for (k = 0; k < n; k++) {
+			if (abs(tx[k] - prev) > 5000 * (2 * M_PI * 600 / rate + 1000.0 / (rate * DEFAULT_REPEAT_FADE)) + 50)
+				step = 1;
+			prev = tx[k];
+		}
+	}
+	printf("repeat @ %5d Hz: voice out %d to %d mS (in %d to %d, %d mS delay), crash %s, fades %s\n",
+		rate, first, last, VOICE_AT, CRASH_AT, delay, crash ? "GOT OUT" : "held back",
+		step ? "STEP" : "smooth");
+	return(!crash && !step && first >= VOICE_AT + delay && first <= VOICE_AT + delay + PERIOD &&
+		last <= DROP_AT - DEFAULT_REPEAT_MUTE + delay + PERIOD);
+}
+
+/* Times 'passes' periods, a TX and an RX each
+ */
+static double time_passes(int rate, int passes) {
+	int n = rate * PERIOD / 1000;
+	short rx[MAX_PERIOD], tx[MAX_PERIOD];
+	long long start;
+	int k;
+
+	for (k = 0; k < n; k++) {
+		rx[k] = rx_sample(rate * VOICE_AT / 1000 + k, rate);
+		tx[k] = 0;
+	}
+	start = clock_ns();
+	for (k = 0; k < passes; k++) {
+		repeat_tx(tx, n);
+		repeat_rx(rx, n, 1);
+	}
+	return((double)(clock_ns() - start) / ((double)passes * n));
+}
+
+int main(int argc, char **argv)
+{
+	static const int rates[] = { 8000, 48000 };
+	int fail = 0;
+	int r;
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		int rate = rates[r];
+		double open, closed;
+
+		repeat_init(rate, DEFAULT_REPEAT_DELAY, DEFAULT_REPEAT_MUTE, DEFAULT_REPEAT_FADE);
+		if (!check(rate, DEFAULT_REPEAT_DELAY))
+			fail = 1;
+
+		// warm up first
+		time_passes(rate, NUM_PASSES / 10);
+		closed = time_passes(rate, NUM_PASSES);
+		repeat_open(0);
+		open = time_passes(rate, NUM_PASSES);
+		repeat_close(0);
+		printf("repeat @ %5d Hz: %.1f nS/sample open, %.1f closed, %.3f%% of a core\n",
+			rate, open, closed, open * rate / 1e7);
+	}
+	repeat_dump(stdout);
+
+	if (fail) {
+		printf("FAIL: the repeat path let the crash out, lost the voice or stepped\n");
+		return 1;
+	}
+	return 0;
+}
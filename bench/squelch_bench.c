@@ -0,0 +1,218 @@
+/* squelch_bench.c - Audio carrier detect benchmark for the
+ * 'minimalist' repeater controller.
+ *
+ * First checks the detector does its job on synthetic receiver audio
+ * at 8 and 48 kHz: with noise squelch, how long a carrier (voice,
+ * then a quiet carrier) takes to open it and the open squelch hiss
+ * after it to close it, and that hiss alone never opens it; with
+ * VOX, the same for voice against a quiet receiver, and that the
+ * gaps between syllables don't chop it up. Then runs it on 1 to 8
+ * receivers at once and reports how much of a core it takes, and
+ * fails if one receiver at 48 kHz takes SQ_BUDGET or more.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/squelch_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "squelch.h"
+
+#define PERIOD      5           // in mS, fed at a time
+#define HISS        10000       // open squelch noise, about -15 dBFS
+#define QUIET       100         // what's left with a carrier, about -55 dBFS
+#define VOICE       6000
+#define MAX_CH      8
+#define MAX_PERIOD  (48000 * PERIOD / 1000)
+#define BENCH_SECS  2
+#define SQ_BUDGET   5.0         // percent of a core, one receiver at 48 kHz
+
+// what's on the receiver's audio
+enum Inputs { IN_HISS, IN_QUIET, IN_VOICE };
+
+static const char * const inputs[] = { "hiss", "quiet carrier", "voice" };
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* White noise, 'amp' peak
+ */
+static double noise(int amp) {
+	return((double)(rand() % (2 * amp + 1) - amp));
+}
+
+/* Receiver audio, sample 'i' at 'rate' Hz: voice is a glottal buzz
+ * sweeping 90 to 250 Hz with its harmonics to 3 kHz, through a
+ * syllable envelope, over a quiet carrier
+ */
+static short rx_sample(int in, long i, int rate) {
+	static double ph;
+	double t = (double)i / rate;
+	double f0, env, v = 0;
+	int h;
+
+	if (in == IN_HISS)
+		return((short)noise(HISS));
+	if (in == IN_QUIET)
+		return((short)noise(QUIET));
+	f0 = 170 + 80 * sin(2 * M_PI * 0.7 * t);
+	env = 0.5 + 0.5 * sin(2 * M_PI * 4.1 * t);
+	ph += 2 * M_PI * f0 / rate;
+	for (h = 1; h * f0 < 3000; h++)
+		v += sin(h * ph) / h;
+	return((short)(VOICE * env * v + noise(QUIET)));
+}
+
+/* Feeds 'ms' of 'in' from sample '*i' on. Returns mS until the
+ * output became 'want', -1 if it never did; counts the opens.
+ */
+static int run(Squelch * d, int in, long * i, int ms, int want, int rate, int * opens) {
+	short pcm[MAX_PERIOD];
+	int n = rate * PERIOD / 1000;
+	long long start = (long long)*i * 1000000000LL / rate;
+	int at = -1;
+	int t, k;
+
+	for (t = 0; t < ms; t += PERIOD) {
+		int was = squelch_on(d);
+
+		for (k = 0; k < n; k++)
+			pcm[k] = rx_sample(in, (*i)++, rate);
+		squelch_feed(d, pcm, n, 1, (long long)(*i - 1) * 1000000000LL / rate);
+		if (opens != NULL && squelch_on(d) && !was)
+			(*opens)++;
+		if (at < 0 && squelch_on(d) == want) {
+			// from the block that decided it, not the period
+			at = (int)((squelch_changed(d) - start) / 1000000);
+			if (opens == NULL)
+				break;
+		}
+	}
+	return(at);
+}
+
+/* Opens a detector on 'on' after 'off' and closes it again, a few
+ * times over. Returns 0 if it didn't.
+ */
+static int cycle(int mode, int rate, int off, int on) {
+	Squelch d;
+	double open, close;
+	int ok = 1;
+	long i = 0;
+	int k, ms;
+
+	squelch_defaults(mode, &open, &close);
+	squelch_init(&d, rate, mode, open, close, DEFAULT_SQ_ATTACK, DEFAULT_SQ_RELEASE);
+	for (k = 0; k < 3; k++) {
+		if (run(&d, off, &i, 1000, 1, rate, NULL) >= 0)
+			ok = 0;
+		ms = run(&d, on, &i, 1000, 1, rate, NULL);
+		printf("squelch %-5s @ %5d Hz: %s opens in %d mS",
+			squelch_mode_name(mode), rate, inputs[on], ms);
+		if (ms < 0)
+			ok = 0;
+		// noise squelch stays open on the carrier once the voice stops
+		if (mode == SQ_NOISE && run(&d, IN_QUIET, &i, 1000, 0, rate, NULL) >= 0)
+			ok = 0;
+		ms = run(&d, off, &i, 1000, 0, rate, NULL);
+		printf(", %s closes in %d mS\n", inputs[off], ms);
+		if (ms < 0)
+			ok = 0;
+	}
+	return(ok);
+}
+
+/* Runs 'secs' of one input through a fresh detector. Returns the
+ * times it opened.
+ */
+static int steady(int mode, int rate, int in, int secs, Squelch * d) {
+	double open, close;
+	int opens = 0;
+	long i = 0;
+
+	squelch_defaults(mode, &open, &close);
+	squelch_init(d, rate, mode, open, close, DEFAULT_SQ_ATTACK, DEFAULT_SQ_RELEASE);
+	run(d, in, &i, secs * 1000, -1, rate, &opens);
+	return(opens);
+}
+
+int main(int argc, char **argv)
+{
+	static const int rates[] = { 8000, 48000 };
+	static const int chans[] = { 1, 2, 4, 8 };
+	static Squelch dec[MAX_CH];
+	int fail = 0;
+	int r, c, k, n;
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		int rate = rates[r];
+
+		if (!cycle(SQ_NOISE, rate, IN_HISS, IN_VOICE) ||
+				!cycle(SQ_VOX, rate, IN_QUIET, IN_VOICE))
+			fail = 1;
+
+		// hiss never opens noise squelch, a quiet carrier never
+		// opens VOX, and voice opens VOX just the once
+		n = steady(SQ_NOISE, rate, IN_HISS, 10, &dec[0]);
+		printf("squelch Noise @ %5d Hz: hiss %s over 10 S, noise %.1f dBFS\n",
+			rate, (n == 0) ? "rejected" : "OPENED", dec[0].noise_db);
+		fail |= (n != 0);
+		n = steady(SQ_VOX, rate, IN_QUIET, 10, &dec[0]);
+		printf("squelch VOX   @ %5d Hz: quiet carrier %s over 10 S, voice %.1f dBFS\n",
+			rate, (n == 0) ? "rejected" : "OPENED", dec[0].voice_db);
+		fail |= (n != 0);
+		n = steady(SQ_VOX, rate, IN_VOICE, 10, &dec[0]);
+		printf("squelch VOX   @ %5d Hz: 10 S of voice opened it %d time(s)\n", rate, n);
+		fail |= (n != 1);
+	}
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		int frames = rates[r] * BENCH_SECS;
+		short * pcm = malloc((size_t)frames * MAX_CH * sizeof(short));
+		long i;
+
+		for (c = 0; c < (int)(sizeof(chans) / sizeof(chans[0])); c++) {
+			long long start, elapsed;
+			double rt;
+
+			// interleaved as the engine gives them, half the
+			// receivers on hiss
+			for (i = 0; i < (long)frames * chans[c]; i++)
+				pcm[i] = rx_sample((i % chans[c]) & 1 ? IN_HISS : IN_VOICE, i / chans[c], rates[r]);
+			for (k = 0; k < chans[c]; k++)
+				squelch_init(&dec[k], rates[r], SQ_NOISE, DEFAULT_NOISE_OPEN, DEFAULT_NOISE_CLOSE,
+					DEFAULT_SQ_ATTACK, DEFAULT_SQ_RELEASE);
+			start = clock_ns();
+			for (k = 0; k < chans[c]; k++)
+				squelch_feed(&dec[k], pcm + k, frames, chans[c], 0);
+			elapsed = clock_ns() - start;
+
+			rt = (double)BENCH_SECS / (elapsed / 1e9);
+			printf("squelch @ %5d Hz x %d ch: %.1f nS/sample, %.0fx real time, %.3f%% of a core\n",
+				rates[r], chans[c], (double)elapsed / ((double)frames * chans[c]), rt, 100 / rt);
+			if (rates[r] == 48000 && chans[c] == 1 && 100 / rt >= SQ_BUDGET)
+				fail = 1;
+			for (k = 0; k < chans[c]; k++)
+				if (squelch_on(&dec[k]) == (k & 1))
+					fail = 1;
+		}
+		free(pcm);
+	}
+
+	if (fail) {
+		printf("FAIL: the squelch missed a signal, opened on none, or is over budget\n");
+		return 1;
+	}
+	return 0;
+}
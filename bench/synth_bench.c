@@ -0,0 +1,86 @@
+/* synth_bench.c - Tone synthesis benchmark for the 'minimalist'
+ * repeater controller.
+ *
+ * Renders a CW ID plus courtesy beep with the software synthesizer
+ * at several sample rates and reports how much faster than real
+ * time it runs.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: bench/synth_bench.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "morse.h"
+#include "synth.h"
+
+#define NUM_PASSES 50
+
+static ToneSeq seq;
+static MorseTimeline tl;
+
+static long long clock_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/* Same as seq_add(), without pulling in the player
+ */
+static void add(int freq, int ms) {
+	if (seq.count > 0 && seq.seg[seq.count - 1].freq == freq) {
+		seq.seg[seq.count - 1].ms += ms;
+		return;
+	}
+	seq.seg[seq.count].freq = freq;
+	seq.seg[seq.count].ms = ms;
+	seq.count++;
+}
+
+int main(int argc, char **argv)
+{
+	static const int rates[] = { 8000, 16000, 48000 };
+	unsigned int prev = 0;
+	int i, r;
+
+	// an ID like the controller builds: delay, call, beep, hang
+	morse_compile(&tl, "KB4OID/R", 20, 0);
+	add(0, 200);
+	for (i = 0; i + 1 < tl.count; i += 2) {
+		add(0, tl.edge[i] - prev);
+		add(1200, tl.edge[i + 1] - tl.edge[i]);
+		prev = tl.edge[i + 1];
+	}
+	add(0, 400);
+	add(1000, 200);
+	add(0, 100);
+	add(800, 100);
+	add(0, 530);
+
+	for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+		long long start, elapsed;
+		short * pcm;
+		int n = 0;
+
+		synth_init(rates[r], DEFAULT_RAMP_TIME, DEFAULT_TONE_LEVEL);
+		pcm = malloc(synth_seq_samples(&seq) * sizeof(short));
+
+		start = clock_ns();
+		for (i = 0; i < NUM_PASSES; i++)
+			n = synth_render_seq(&seq, pcm, synth_seq_samples(&seq));
+		elapsed = (clock_ns() - start) / NUM_PASSES;
+
+		printf("synth @ %5d Hz: %d samples (%.2f S) in %.3f mS, %.1f nS/sample, %.0fx real time\n",
+			rates[r], n, (double)n / rates[r], elapsed / 1e6,
+			(double)elapsed / n, ((double)n / rates[r]) / (elapsed / 1e9));
+		free(pcm);
+	}
+	return 0;
+}
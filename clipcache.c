@@ -0,0 +1,266 @@
+/* clipcache.c - Pre-rendered audio clip cache for the 'minimalist'
+ * repeater controller.
+ *
+ * Cache file layout (native byte order, the cache is per machine):
+ *
+ *   char     magic[8]      "RPTRCLIP"
+ *   uint64   hash          FNV-1a of the clip inputs
+ *   uint32   rate          sample rate in Hz
+ *   uint32   samples       number of samples that follow
+ *   int16    pcm[samples]
+ *
+ * Files are written under a temporary name and renamed into place,
+ * so a crash mid-render never leaves a truncated clip behind. If the
+ * cache directory can't be used the clips are rendered into memory
+ * instead, which still saves re-rendering on every ID.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: clipcache.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "clipcache.h"
+#include "synth.h"
+
+#define CLIP_MAGIC "RPTRCLIP"
+
+typedef struct
+{
+    char magic[8];
+    uint64_t hash;
+    uint32_t rate;
+    uint32_t samples;
+} ClipHeader;
+
+// Work for one render thread
+typedef struct
+{
+    Clip * clip;
+    const ToneSeq * seq;
+    const char * dir;
+    int rate;
+    int ok;
+} ClipJob;
+
+/* FNV-1a over a block of bytes
+ */
+static uint64_t fnv1a(uint64_t h, const void * data, size_t len) {
+	const unsigned char * p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return(h);
+}
+
+/* Hashes everything that affects a clip's samples
+ */
+static uint64_t clip_hash(const ToneSeq * seq, int rate, int ramp_ms, int level) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int params[3];
+
+	params[0] = rate;
+	params[1] = ramp_ms;
+	params[2] = level;
+	h = fnv1a(h, params, sizeof(params));
+	h = fnv1a(h, &seq->count, sizeof(seq->count));
+	h = fnv1a(h, seq->seg, seq->count * sizeof(ToneSeg));
+	return(h);
+}
+
+static void clip_path(char * buf, size_t len, const char * dir, uint64_t hash) {
+	snprintf(buf, len, "%s/clip-%016llx.pcm", dir, (unsigned long long)hash);
+}
+
+/* Maps a cache file if it exists and matches. Returns 1 if mapped.
+ */
+static int clip_map(Clip * c, const char * path, int rate) {
+	struct stat st;
+	const ClipHeader * hdr;
+	void * map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return(0);
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(ClipHeader)) {
+		close(fd);
+		return(0);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return(0);
+
+	hdr = map;
+	if (memcmp(hdr->magic, CLIP_MAGIC, 8) != 0 || hdr->hash != c->hash ||
+			hdr->rate != (uint32_t)rate ||
+			st.st_size != (off_t)(sizeof(ClipHeader) + hdr->samples * sizeof(short))) {
+		munmap(map, st.st_size);
+		return(0);
+	}
+
+	c->map = map;
+	c->maplen = st.st_size;
+	c->pcm = (const short *)((const char *)map + sizeof(ClipHeader));
+	c->samples = hdr->samples;
+	return(1);
+}
+
+/* Writes a rendered clip to the cache, under a temporary name
+ * first. Returns 1 on success.
+ */
+static int clip_store(Clip * c, const char * path, int rate) {
+	char tmp[300];
+	ClipHeader hdr;
+	FILE * fp;
+	int ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fp = fopen(tmp, "wb");
+	if (fp == NULL)
+		return(0);
+
+	memcpy(hdr.magic, CLIP_MAGIC, 8);
+	hdr.hash = c->hash;
+	hdr.rate = rate;
+	hdr.samples = c->samples;
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(c->heap, sizeof(short), c->samples, fp) == (size_t)c->samples;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return(0);
+	}
+	return(1);
+}
+
+/* Render thread: renders one clip and, if possible, stores it in
+ * the cache and swaps the heap copy for the mapping.
+ */
+static void * clip_render(void * arg) {
+	ClipJob * job = arg;
+	Clip * c = job->clip;
+	char path[256];
+	int n;
+
+	n = synth_seq_samples(job->seq);
+	c->heap = malloc(n * sizeof(short));
+	if (c->heap == NULL)
+		return(NULL);
+	c->samples = synth_render_seq(job->seq, c->heap, n);
+	c->pcm = c->heap;
+	job->ok = 1;
+
+	if (job->dir == NULL)
+		return(NULL);
+	clip_path(path, sizeof(path), job->dir, c->hash);
+	if (clip_store(c, path, job->rate) && clip_map(c, path, job->rate)) {
+		free(c->heap);
+		c->heap = NULL;
+	}
+	return(NULL);
+}
+
+/* Renders (or loads from 'dir') a clip into 'set' for each non-NULL
+ * sequence in 'seqs'. Missing clips are rendered in parallel, one
+ * thread per clip. synth_init() must have been called. Returns the
+ * number of clips reused from the cache, or -1 on failure.
+ */
+int clip_cache_build(ClipSet * set, const char * dir, ToneSeq * seqs[CLIP_COUNT],
+                     int rate, int ramp_ms, int level) {
+	Clip * clips = set->clip;
+	pthread_t threads[CLIP_COUNT];
+	ClipJob jobs[CLIP_COUNT];
+	int started[CLIP_COUNT];
+	char path[256];
+	int reused = 0;
+	int ok = 1;
+	int i;
+
+	clip_cache_free(set);
+
+	// no usable cache directory means render to memory only
+	if (dir != NULL && dir[0] != '\0') {
+		mkdir(dir, 0755);
+		if (access(dir, W_OK) != 0) {
+			printf("clipcache: can't write '%s', not caching clips\n",dir);
+			dir = NULL;
+		}
+	} else {
+		dir = NULL;
+	}
+
+	for (i = 0; i < CLIP_COUNT; i++) {
+		started[i] = 0;
+		if (seqs[i] == NULL)
+			continue;
+
+		clips[i].hash = clip_hash(seqs[i], rate, ramp_ms, level);
+		if (dir != NULL) {
+			clip_path(path, sizeof(path), dir, clips[i].hash);
+			if (clip_map(&clips[i], path, rate)) {
+				clips[i].reused = 1;
+				reused++;
+				continue;
+			}
+		}
+
+		jobs[i].clip = &clips[i];
+		jobs[i].seq = seqs[i];
+		jobs[i].dir = dir;
+		jobs[i].rate = rate;
+		jobs[i].ok = 0;
+		if (pthread_create(&threads[i], NULL, clip_render, &jobs[i]) == 0)
+			started[i] = 1;
+		else
+			clip_render(&jobs[i]);
+	}
+
+	for (i = 0; i < CLIP_COUNT; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		if (seqs[i] != NULL && !clips[i].reused && !jobs[i].ok)
+			ok = 0;
+	}
+
+	return(ok ? reused : -1);
+}
+
+/* Returns a clip of 'set', or NULL if it was not built
+ */
+const Clip * clip_get(const ClipSet * set, int id) {
+	if (set == NULL || id < 0 || id >= CLIP_COUNT || set->clip[id].pcm == NULL)
+		return(NULL);
+	return(&set->clip[id]);
+}
+
+/* Unmaps / frees the clips of 'set'
+ */
+void clip_cache_free(ClipSet * set) {
+	Clip * clips = set->clip;
+	int i;
+
+	for (i = 0; i < CLIP_COUNT; i++) {
+		if (clips[i].map != NULL)
+			munmap(clips[i].map, clips[i].maplen);
+		free(clips[i].heap);
+		memset(&clips[i], 0, sizeof(Clip));
+	}
+}
@@ -0,0 +1,76 @@
+/* clipcache.h - Pre-rendered audio clip cache for the 'minimalist'
+ * repeater controller.
+ *
+ * The CW ID and every courtesy beep type only change when the config
+ * changes, so they are rendered to PCM once at startup and kept in a
+ * cache directory, one file per clip, named by a hash of everything
+ * that went into the clip (the tone sequence, sample rate, ramp time
+ * and level). Cache files are memory mapped, so a restart with an
+ * unchanged config costs no rendering at all, and playback hands out
+ * pointers straight into the mapping.
+ *
+ * The clips are built into a ClipSet the caller owns, so a config
+ * reload can build a new set while the old one is still playing.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: clipcache.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __CLIPCACHE_H__
+#define __CLIPCACHE_H__
+
+#include <stddef.h>
+#include "toneseq.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFAULT_CACHE_DIR "/var/cache/rptrctrl"
+
+// Clip slots: the ID, then one per BeepTypes value
+#define CLIP_ID     0
+#define CLIP_BEEP   1       // + BeepTypes value
+#define CLIP_COUNT  (CLIP_BEEP + 5)
+
+typedef struct
+{
+    const short * pcm;      // the samples, in the mapping or heap
+    int samples;            // number of samples
+    unsigned long long hash;    // hash of what the clip was rendered from
+    void * map;             // mmap()ed cache file, NULL if not mapped
+    size_t maplen;
+    short * heap;           // rendered copy when the cache can't be used
+    int reused;             // clip came from the cache unchanged
+} Clip;
+
+// The ID and courtesy beep clips, built together
+typedef struct
+{
+    Clip clip[CLIP_COUNT];
+} ClipSet;
+
+/* Renders (or loads from 'dir') a clip into 'set' for each non-NULL
+ * sequence in 'seqs'. Missing clips are rendered in parallel, one
+ * thread per clip. synth_init() must have been called. Returns the
+ * number of clips reused from the cache, or -1 on failure.
+ */
+int clip_cache_build(ClipSet * set, const char * dir, ToneSeq * seqs[CLIP_COUNT],
+                     int rate, int ramp_ms, int level);
+/* Returns a clip of 'set', or NULL if it was not built */
+const Clip * clip_get(const ClipSet * set, int id);
+/* Unmaps / frees the clips of 'set' */
+void clip_cache_free(ClipSet * set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CLIPCACHE_H__
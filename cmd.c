@@ -0,0 +1,185 @@
+/* cmd.c - DTMF remote control commands for the 'minimalist'
+ * repeater controller.
+ *
+ * The trie has a node for each digit of the PIN and codes, sixteen
+ * ways out of each (one per DTMF key). The node a code ends on holds
+ * the command. Following a digit is then a single lookup, and a digit
+ * with no way out takes the receiver off the trie until the '#'.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: cmd.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "cmd.h"
+
+static const char * const names[CMD_COUNT] = {
+	"IDTimer", "SQTimer", "BeepType", "Enable", "Disable"
+};
+
+// commands that take a value
+static const unsigned char takes_value[CMD_COUNT] = { 1, 1, 1, 0, 0 };
+
+/* Returns a DTMF key's index, -1 if it isn't one
+ */
+static int key_index(char k) {
+	static const char keys[] = "0123456789ABCD*#";
+	const char * p;
+
+	if (k == '\0')
+		return(-1);
+	p = strchr(keys, k);
+	return((p != NULL) ? (int)(p - keys) : -1);
+}
+
+/* Follows (adding it if it isn't there) the way out of node 'n' for
+ * key 'k'. Returns the node, 0 if the trie is full.
+ */
+static int trie_step(CmdTrie * t, int n, int k) {
+	int next = t->node[n].next[k];
+
+	if (next == 0) {
+		if (t->count >= CMD_NODES)
+			return(0);
+		next = t->count++;
+		memset(&t->node[next], 0, sizeof(CmdNode));
+		t->node[next].cmd = CMD_NONE;
+		t->node[n].next[k] = next;
+	}
+	return(next);
+}
+
+/* Compiles the PIN and the codes into a trie. Returns 0 (and prints
+ * why) if a code is bad or is the start of another.
+ */
+int cmd_compile(CmdTrie * t, const char * pin, const char codes[][CMD_CODE]) {
+	const char * p;
+	int base = 0;
+	int c;
+
+	memset(t, 0, sizeof(*t));
+	t->node[0].cmd = CMD_NONE;
+	t->count = 1;
+	if (pin[0] == '\0')
+		return(1);
+
+	// the PIN, then each code from where it ends
+	for (p = pin; *p != '\0'; p++) {
+		int k = key_index(*p);
+
+		if (k < 0 || k > 13) {
+			printf("Remote: the PIN may only have 0-9 and A-D\n");
+			return(0);
+		}
+		base = trie_step(t, base, k);
+	}
+	for (c = 0; c < CMD_COUNT; c++) {
+		int n = base;
+		int i;
+
+		if (codes[c][0] == '\0')
+			continue;
+		for (p = codes[c]; *p != '\0'; p++) {
+			int k = key_index(*p);
+
+			if (k < 0 || k > 13) {
+				printf("Remote: %s code '%s' may only have 0-9 and A-D\n",names[c],codes[c]);
+				return(0);
+			}
+			if (t->node[n].cmd != CMD_NONE)
+				break;
+			n = trie_step(t, n, k);
+			if (n == 0) {
+				printf("Remote: too many codes\n");
+				return(0);
+			}
+		}
+		// it mustn't pass through, end on, or lead on from another
+		for (i = 0; i < 16 && t->node[n].next[i] == 0; i++)
+			;
+		if (*p != '\0' || t->node[n].cmd != CMD_NONE || i < 16) {
+			printf("Remote: %s code '%s' clashes with another code\n",names[c],codes[c]);
+			return(0);
+		}
+		t->node[n].cmd = c;
+	}
+	return(1);
+}
+
+/* Returns the config key name of a command
+ */
+const char * cmd_name(int cmd) {
+	return((cmd >= 0 && cmd < CMD_COUNT) ? names[cmd] : "?");
+}
+
+/* Returns 1 if a command takes a value
+ */
+int cmd_has_value(int cmd) {
+	return(cmd >= 0 && cmd < CMD_COUNT && takes_value[cmd]);
+}
+
+/* Starts a receiver over
+ */
+void cmd_reset(CmdState * s) {
+	s->node = 0;
+	s->cmd = CMD_NONE;
+	s->value = 0;
+	s->digits = 0;
+}
+
+/* Takes a digit, heard at 'now' mS. Returns the command when a '#'
+ * ends one, with its value in 'value', CMD_BAD if the '#' ended
+ * something else, otherwise CMD_NONE.
+ */
+int cmd_digit(const CmdTrie * t, CmdState * s, char digit, msec_t now, int timeout, long * value) {
+	int k = key_index(digit);
+	int cmd;
+
+	if (now - s->last > (msec_t)timeout)
+		cmd_reset(s);
+	s->last = now;
+
+	if (k < 0 || t->count <= 1)
+		return(CMD_NONE);
+	if (digit == '*') {
+		cmd_reset(s);
+		return(CMD_NONE);
+	}
+
+	if (digit == '#') {
+		cmd = s->cmd;
+		if (cmd != CMD_NONE && takes_value[cmd] != (s->digits > 0))
+			cmd = CMD_BAD;
+		// a '#' on its own is just a '#'
+		else if (cmd == CMD_NONE && (s->node != 0 || s->digits > 0))
+			cmd = CMD_BAD;
+		*value = s->value;
+		cmd_reset(s);
+		return(cmd);
+	}
+
+	if (s->cmd != CMD_NONE) {
+		// the value, A-D aren't digits
+		if (k > 9 || ++s->digits > CMD_VALUE) {
+			s->node = -1;
+			s->cmd = CMD_NONE;
+		} else {
+			s->value = s->value * 10 + k;
+		}
+		return(CMD_NONE);
+	}
+	if (s->node < 0)
+		return(CMD_NONE);
+	s->node = t->node[s->node].next[k];
+	if (s->node == 0)
+		s->node = -1;
+	else
+		s->cmd = t->node[s->node].cmd;
+	return(CMD_NONE);
+}
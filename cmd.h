@@ -0,0 +1,99 @@
+/* cmd.h - DTMF remote control commands for the 'minimalist'
+ * repeater controller.
+ *
+ * A command is the PIN, the command's code, its value (if it takes
+ * one) and '#':
+ *
+ *   <PIN> <code> [<value>] #
+ *
+ * '*' starts over, and so does a pause of more than the timeout
+ * between digits. The PIN and codes are compiled into a trie once
+ * per config (see snap_build()), so each digit is one table step and
+ * nothing is looked up or allocated on the control thread. A code
+ * may not be the start of another one, as the value follows it.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: cmd.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __CMD_H__
+#define __CMD_H__
+
+#include "timers.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CMD_NODES       64      // in the trie, the PIN and every code
+#define CMD_CODE        9       // longest PIN or code, with its '\0'
+#define CMD_VALUE       7       // most digits in a value
+
+#define DEFAULT_CMD_TIMEOUT  5000   // in mS, between digits
+#define CMD_SQ_MAX           60000  // in mS, the longest squelch tail a command sets
+
+// The commands, in config key order
+enum CmdIds {
+  CMD_ID_TIMER,         // value: ID interval in seconds
+  CMD_SQ_TIMER,         // value: squelch tail in mS, up to CMD_SQ_MAX
+  CMD_BEEP_TYPE,        // value: courtesy beep type, 0 = None
+  CMD_ENABLE,           // the port repeats
+  CMD_DISABLE,          // the port stops repeating
+  CMD_COUNT
+};
+
+#define CMD_NONE  -1            // no command (yet)
+#define CMD_BAD   -2            // a '#' that didn't end a command
+
+typedef struct
+{
+    unsigned char next[16];     // the node after each key, 0 = none
+    signed char cmd;            // the command a code ends in, CMD_NONE
+} CmdNode;
+
+typedef struct
+{
+    CmdNode node[CMD_NODES];    // node 0 is the start
+    int count;
+} CmdTrie;
+
+// Where a receiver is in a command
+typedef struct
+{
+    int node;               // in the trie, -1 = off it (a wrong digit)
+    int cmd;                // the code matched, CMD_NONE
+    long value;
+    int digits;             // in the value
+    msec_t last;            // when the last digit came
+} CmdState;
+
+/* Compiles the PIN and the codes (CMD_COUNT of them, '' for a
+ * command that isn't used) into a trie. An empty PIN leaves the
+ * trie empty, nothing is taken. Returns 0 (and prints why) if a
+ * code is bad or is the start of another.
+ */
+int cmd_compile(CmdTrie * t, const char * pin, const char codes[][CMD_CODE]);
+/* Returns the config key name of a command */
+const char * cmd_name(int cmd);
+/* Returns 1 if a command takes a value */
+int cmd_has_value(int cmd);
+/* Starts a receiver over */
+void cmd_reset(CmdState * s);
+/* Takes a digit, heard at 'now' mS. Returns the command when a '#'
+ * ends one, with its value in 'value', CMD_BAD if the '#' ended
+ * something else, otherwise CMD_NONE.
+ */
+int cmd_digit(const CmdTrie * t, CmdState * s, char digit, msec_t now, int timeout, long * value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CMD_H__
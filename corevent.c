@@ -0,0 +1,481 @@
+/* corevent.c - COR edge event sources for the 'minimalist' repeater
+ * controller.
+ *
+ * The controller used to call loop() in a bare while(1), reading
+ * the COR pin on every pass and pinning a CPU core while idle. The
+ * functions here let main() sleep until the COR input changes or
+ * the next timer deadline arrives.
+ *
+ * The preferred source is the Linux GPIO character device line
+ * event interface (GPIO_GET_LINEEVENT_IOCTL). The kernel timestamps
+ * each edge when the interrupt fires, so the time the carrier
+ * actually changed reaches the state machine even if we were busy
+ * when it happened. If the character device cannot be opened we
+ * fall back to polling the pin every COR_POLL_PERIOD mS, which is
+ * still a small fraction of a core. For testing without hardware,
+ * a simulated source plays back a script of edges.
+ *
+ * Simulation scripts are plain text, one edge per line:
+ *
+ *   # mS-from-start  raw-level  [port]
+ *   1000 0
+ *   4500 1
+ *
+ * The port (1 for the first COR line) may be left off, it is then 1.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: corevent.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/gpio.h>
+#include "gpio.h"
+#include "corevent.h"
+#include "rptrctrl.h"
+#ifdef SIMULATION
+#include "simclock.h"
+#endif
+
+static int cor_mode = COR_EVT_POLL;
+static int cor_lines;                   // COR inputs in use
+static int cor_pin[COR_LINES_MAX];
+static int cor_fd[COR_LINES_MAX];       // line event fds (COR_EVT_EVENT)
+static int timer_fd = -1;               // deadline timer polled with cor_fd
+static int cor_level[COR_LINES_MAX];    // last reported raw levels, shared
+static int cor_turn;                    // line to check first next time
+static int cor_ts_bad;                  // kernel timestamps not CLOCK_MONOTONIC
+
+// simulated edge script
+static long sim_at[COR_SIM_MAX];    // edge time, mS from start
+static int sim_level[COR_SIM_MAX];  // raw level after the edge
+static int sim_line[COR_SIM_MAX];   // which COR line
+static int sim_count;
+static int sim_next;
+static long long sim_start;
+
+/* Returns the current CLOCK_MONOTONIC time in nS
+ */
+long long cor_clock_ns(void) {
+#ifdef SIMULATION
+	return(sim_clock_ns());
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+#endif
+}
+
+/* Sleeps until absolute time 't' in nS, used by the polled and
+ * simulated sources. Returns 0 if a signal cut the sleep short.
+ */
+static int cor_sleep_until(long long t) {
+#ifdef SIMULATION
+	long long now = sim_clock_ns();
+
+	if (t > now)
+		sim_sleep_ms((long)((t - now + 999999LL) / 1000000LL));
+	return(1);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000LL;
+	ts.tv_nsec = t % 1000000000LL;
+	return(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 0);
+#endif
+}
+
+/* Requests a both-edges line event handle for a COR line
+ * from the GPIO character device.
+ */
+static int open_line_event(const char * chip, int line) {
+	struct gpioevent_request req;
+	struct gpiohandle_data data;
+	int pin = cor_pin[line];
+	int fd;
+
+	// no COR input, nothing to watch
+	if (pin < 0)
+		return(1);
+
+	// the chardev GPIO backend may be holding the line
+	gpio_release(pin);
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		printf("corevent: can't open '%s'\n",chip);
+		return(0);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = pin;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strncpy(req.consumer_label, "rptrctrl", sizeof(req.consumer_label) - 1);
+
+	if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+		printf("corevent: line event request for pin %d failed\n",pin);
+		close(fd);
+		return(0);
+	}
+	close(fd);
+
+	cor_fd[line] = req.fd;
+	if (ioctl(req.fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0)
+		cor_level[line] = data.values[0];
+	return(1);
+}
+
+/* Opens a line event handle for every COR line, and the deadline
+ * timer. Returns 0, with nothing left open, if any of them fails.
+ */
+static int open_line_events(const char * chip) {
+	int i;
+
+	for (i = 0; i < cor_lines; i++) {
+		if (!open_line_event(chip, i)) {
+			cor_event_close();
+			return(0);
+		}
+	}
+
+	// deadlines are absolute, so they come from a timerfd rather
+	// than a poll() timeout
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timer_fd < 0) {
+		printf("corevent: can't create the deadline timer\n");
+		cor_event_close();
+		return(0);
+	}
+	return(1);
+}
+
+/* Reads every COR line, for the polled source
+ */
+static void read_levels(void) {
+	int i;
+
+	for (i = 0; i < cor_lines; i++)
+		if (cor_pin[i] >= 0)
+			cor_level[i] = digitalRead(cor_pin[i]);
+}
+
+/* Loads a simulation script into the edge table
+ */
+static int load_sim_script(const char * file) {
+	FILE * fp;
+	char line[100];
+	long at;
+	int level, port;
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		printf("corevent: can't open sim script '%s'\n",file);
+		return(0);
+	}
+
+	sim_count = 0;
+	while (fgets(line, sizeof(line), fp) != NULL && sim_count < COR_SIM_MAX) {
+		if (line[0] == '#')
+			continue;
+		port = 1;
+		if (sscanf(line, "%ld %d %d", &at, &level, &port) < 2)
+			continue;
+		if (port < 1 || port > cor_lines)
+			continue;
+		sim_at[sim_count] = at;
+		sim_level[sim_count] = (level != 0);
+		sim_line[sim_count] = port - 1;
+		sim_count++;
+	}
+	fclose(fp);
+
+	sim_next = 0;
+	sim_start = cor_clock_ns();
+	return(1);
+}
+
+/* Returns the time of the last scripted edge in mS, or 0
+ */
+long cor_sim_length(void) {
+	if (sim_count == 0)
+		return(0);
+	return(sim_at[sim_count - 1]);
+}
+
+/* Opens the selected edge source for 'count' COR pins, which
+ * become lines 0 to count - 1, -1 for a line with no COR input.
+ * 'arg' is the gpiochip device for COR_EVT_EVENT and the script
+ * file for COR_EVT_SIM. Returns 1 on success, 0 on failure.
+ */
+int cor_event_init(int mode, const int * pins, int count, const char * arg) {
+	int i;
+
+	if (count < 1 || count > COR_LINES_MAX) {
+		printf("corevent: %d COR lines, 1 to %d are supported\n",count,COR_LINES_MAX);
+		return(0);
+	}
+	cor_lines = count;
+	cor_turn = 0;
+	for (i = 0; i < count; i++) {
+		cor_pin[i] = pins[i];
+		cor_fd[i] = -1;
+	}
+	cor_mode = mode;
+
+	switch(mode)
+	{
+		case COR_EVT_EVENT:
+			if (arg == NULL)
+				arg = DEFAULT_GPIOCHIP;
+			if (open_line_events(arg))
+				return(1);
+			// no character device, so fall back to polling
+			printf("corevent: falling back to polled COR\n");
+			cor_mode = COR_EVT_POLL;
+			read_levels();
+			return(1);
+
+		case COR_EVT_SIM:
+			// idle level until the script says otherwise
+			for (i = 0; i < count; i++)
+				cor_level[i] = HIGH;
+			return(load_sim_script(arg));
+
+		case COR_EVT_POLL:
+		default:
+			cor_mode = COR_EVT_POLL;
+			read_levels();
+			return(1);
+	}
+}
+
+/* Releases the edge source
+ */
+void cor_event_close(void) {
+	int i;
+
+	for (i = 0; i < cor_lines; i++) {
+		if (cor_fd[i] >= 0)
+			close(cor_fd[i]);
+		cor_fd[i] = -1;
+	}
+	if (timer_fd >= 0)
+		close(timer_fd);
+	timer_fd = -1;
+}
+
+/* Returns the mode actually in use
+ */
+int cor_event_mode(void) {
+	return(cor_mode);
+}
+
+/* Returns the name of an edge source mode
+ */
+const char * cor_event_name(int mode) {
+	switch(mode)
+	{
+		case COR_EVT_EVENT:
+			return("event");
+		case COR_EVT_SIM:
+			return("sim");
+		case COR_EVT_POLL:
+		default:
+			return("poll");
+	}
+}
+
+/* Returns a line event's kernel timestamp as CLOCK_MONOTONIC nS.
+ * Kernels before 5.7 stamp events with CLOCK_REALTIME, which is
+ * decades ahead of the monotonic clock; a stamp in the future or
+ * more than COR_TS_MAX_AGE old is one of those, and the edge gets
+ * the time it was read instead.
+ */
+static long long event_time(long long ts) {
+	long long t = cor_clock_ns();
+
+	if (ts <= t && ts >= t - COR_TS_MAX_AGE * 1000000LL)
+		return(ts);
+	if (!cor_ts_bad) {
+		printf("COR: the kernel's edge timestamps aren't CLOCK_MONOTONIC, using the read time\n");
+		cor_ts_bad = 1;
+	}
+	return(t);
+}
+
+/* Waits on the kernel line event fds and the deadline timer
+ */
+static int wait_event(long long deadline, cor_edge * edge) {
+	struct pollfd pfd[COR_LINES_MAX + 1];
+	struct gpioevent_data ev;
+	struct itimerspec its;
+	unsigned long long ticks;
+	int timeout = -1;
+	int ret, i, line = -1;
+
+	for (i = 0; i < cor_lines; i++) {
+		pfd[i].fd = cor_fd[i];
+		pfd[i].events = POLLIN | POLLPRI;
+	}
+	pfd[cor_lines].fd = timer_fd;
+	pfd[cor_lines].events = POLLIN;
+
+	memset(&its, 0, sizeof(its));
+	if (deadline >= 0 && deadline <= cor_clock_ns()) {
+		// already due, just pick up a pending edge
+		timeout = 0;
+	} else if (deadline >= 0) {
+		its.it_value.tv_sec = deadline / 1000000000LL;
+		its.it_value.tv_nsec = deadline % 1000000000LL;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	ret = poll(pfd, cor_lines + 1, timeout);
+	if (ret < 0)
+		return((errno == EINTR) ? 0 : -1);
+	if (pfd[cor_lines].revents & POLLIN) {
+		if (read(timer_fd, &ticks, sizeof(ticks)) < 0)
+			ticks = 0;
+	}
+
+	// take turns, so a chattering line can't starve the others
+	for (i = 0; i < cor_lines && line < 0; i++) {
+		int l = (cor_turn + i) % cor_lines;
+
+		if (pfd[l].revents & (POLLIN | POLLPRI))
+			line = l;
+	}
+	if (line < 0)
+		return(0);
+	cor_turn = (line + 1) % cor_lines;
+
+	if (read(cor_fd[line], &ev, sizeof(ev)) != sizeof(ev))
+		return(-1);
+
+	edge->line = line;
+	edge->level = (ev.id == GPIOEVENT_EVENT_RISING_EDGE) ? HIGH : LOW;
+	__atomic_store_n(&cor_level[line], edge->level, __ATOMIC_RELAXED);
+	edge->ts_ns = event_time((long long)ev.timestamp);
+	return(1);
+}
+
+/* Samples the pins every COR_POLL_PERIOD mS until one changes
+ */
+static int wait_poll(long long deadline, cor_edge * edge) {
+	long long step;
+	int level, i;
+
+	while (1) {
+		for (i = 0; i < cor_lines; i++) {
+			if (cor_pin[i] < 0)
+				continue;
+			level = digitalRead(cor_pin[i]);
+			if (level != cor_level[i]) {
+				__atomic_store_n(&cor_level[i], level, __ATOMIC_RELAXED);
+				edge->line = i;
+				edge->level = level;
+				edge->ts_ns = cor_clock_ns();
+				return(1);
+			}
+		}
+
+		step = cor_clock_ns();
+		if (deadline >= 0 && step >= deadline)
+			return(0);
+		step += COR_POLL_PERIOD * 1000000LL;
+		if (deadline >= 0 && deadline < step)
+			step = deadline;
+		if (!cor_sleep_until(step))
+			return(0);
+	}
+}
+
+/* Plays back the next scripted edge once its time arrives
+ */
+static int wait_sim(long long deadline, cor_edge * edge) {
+	long long due;
+
+	if (sim_next >= sim_count) {
+		// script finished, behave like an idle input
+		cor_sleep_until((deadline < 0) ? cor_clock_ns() + 1000000000LL : deadline);
+		return(0);
+	}
+
+	due = sim_start + (long long)sim_at[sim_next] * 1000000LL;
+	if (deadline >= 0 && deadline < due) {
+		cor_sleep_until(deadline);
+		return(0);
+	}
+	cor_sleep_until(due);
+
+	// a line without a COR input has no edges, whatever the script says
+	if (cor_pin[sim_line[sim_next]] < 0) {
+		sim_next++;
+		return(0);
+	}
+	__atomic_store_n(&cor_level[sim_line[sim_next]], sim_level[sim_next], __ATOMIC_RELAXED);
+	edge->line = sim_line[sim_next];
+	edge->level = sim_level[sim_next];
+	edge->ts_ns = due;
+	sim_next++;
+	return(1);
+}
+
+/* Sleeps until the next COR edge or until the absolute time
+ * 'deadline' (CLOCK_MONOTONIC nS). A deadline that has passed
+ * checks for a pending edge without blocking, a negative one
+ * waits forever. Returns 1 and fills in 'edge' if an edge
+ * arrived, 0 on timeout or a signal and -1 on error.
+ */
+int cor_wait_until(long long deadline, cor_edge * edge) {
+	switch(cor_mode)
+	{
+		case COR_EVT_EVENT:
+			return(wait_event(deadline, edge));
+		case COR_EVT_SIM:
+			return(wait_sim(deadline, edge));
+		case COR_EVT_POLL:
+		default:
+			return(wait_poll(deadline, edge));
+	}
+}
+
+/* Sleeps until the next COR edge or until timeout_ms has passed.
+ * A timeout_ms of zero checks for a pending edge without blocking,
+ * a negative timeout_ms waits forever. Returns 1 and fills in
+ * 'edge' if an edge arrived, 0 on timeout and -1 on error.
+ */
+int cor_wait(long timeout_ms, cor_edge * edge) {
+	if (timeout_ms < 0)
+		return(cor_wait_until(-1, edge));
+	return(cor_wait_until(cor_clock_ns() + timeout_ms * 1000000LL, edge));
+}
+
+/* Returns the current raw level of a COR input. Polled, that is
+ * the level wait_poll() last saw: the thread that waits for edges
+ * is the only one to read the pins, so the GPIO backend's lazily
+ * opened line handles are never claimed from two threads at once.
+ */
+int cor_read(int line) {
+	struct gpiohandle_data data;
+
+	if (cor_pin[line] >= 0 && cor_mode == COR_EVT_EVENT &&
+			ioctl(cor_fd[line], GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0)
+		return(data.values[0]);
+	return(__atomic_load_n(&cor_level[line], __ATOMIC_RELAXED));
+}
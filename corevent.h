@@ -0,0 +1,101 @@
+/* corevent.h - COR edge event sources for the 'minimalist' repeater
+ * controller.
+ *
+ * Instead of spinning on get_cor() the controller sleeps until the
+ * COR input changes or the next timer deadline arrives, whichever
+ * comes first. Three edge sources are provided:
+ *
+ *  COR_EVT_EVENT - kernel GPIO character device line events. The
+ *                  kernel timestamps each edge, so the state machine
+ *                  sees when the carrier actually changed. Kernels
+ *                  before 5.7 stamp them with CLOCK_REALTIME, those
+ *                  edges get the time they were read instead.
+ *  COR_EVT_POLL  - polled fallback, for kernels/boards without the
+ *                  GPIO character device. Samples COR_PIN with
+ *                  digitalRead() every COR_POLL_PERIOD mS.
+ *  COR_EVT_SIM   - simulated edge source, plays back a script of
+ *                  '<mS> <level>' lines so the controller can be
+ *                  exercised without hardware.
+ *
+ * With more than one repeater port there is a COR line per port,
+ * all watched at once, and each edge says which line it was on.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: corevent.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __COREVENT_H__
+#define __COREVENT_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// COR edge source types
+enum CorEventModes {
+  COR_EVT_EVENT,
+  COR_EVT_POLL,
+  COR_EVT_SIM
+};
+
+#define DEFAULT_GPIOCHIP "/dev/gpiochip0"
+#define COR_POLL_PERIOD  10     // in mS
+#define COR_SIM_MAX      1024   // max edges in a simulation script
+#define COR_LINES_MAX    4      // COR inputs watched at once
+#define COR_TS_MAX_AGE   1000   // in mS, an older kernel timestamp isn't believed
+
+// A single COR edge, as reported by the edge source
+typedef struct
+{
+    int line;               // which of the COR inputs
+    int level;              // raw pin level after the edge
+    long long ts_ns;        // edge timestamp, CLOCK_MONOTONIC nS
+} cor_edge;
+
+/* Opens the selected edge source for 'count' COR pins, which
+ * become lines 0 to count - 1. A pin of -1 is a line with no COR
+ * input, which never has an edge. 'arg' is the gpiochip device for
+ * COR_EVT_EVENT and the script file for COR_EVT_SIM. Returns 1 on
+ * success, 0 on failure.
+ */
+int cor_event_init(int mode, const int * pins, int count, const char * arg);
+/* Releases the edge source */
+void cor_event_close(void);
+/* Returns the mode actually in use */
+int cor_event_mode(void);
+/* Returns the name of an edge source mode */
+const char * cor_event_name(int mode);
+/* Sleeps until the next COR edge or until timeout_ms has passed.
+ * A timeout_ms of zero checks for a pending edge without blocking,
+ * a negative timeout_ms waits forever. Returns 1 and fills in
+ * 'edge' if an edge arrived, 0 on timeout and -1 on error.
+ */
+int cor_wait(long timeout_ms, cor_edge * edge);
+/* Sleeps until the next COR edge or until the absolute time
+ * 'deadline' (CLOCK_MONOTONIC nS). A deadline that has passed
+ * checks for a pending edge without blocking, a negative one
+ * waits forever. Returns 1 and fills in 'edge' if an edge
+ * arrived, 0 on timeout or a signal and -1 on error.
+ */
+int cor_wait_until(long long deadline, cor_edge * edge);
+/* Returns the current raw level of a COR input, from any thread;
+ * polled, the level the edge source last saw
+ */
+int cor_read(int line);
+/* Returns the time of the last scripted edge in mS, or 0 */
+long cor_sim_length(void);
+/* Returns the current CLOCK_MONOTONIC time in nS */
+long long cor_clock_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __COREVENT_H__
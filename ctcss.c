@@ -0,0 +1,234 @@
+/* ctcss.c - Software CTCSS tone decoder for the 'minimalist'
+ * repeater controller.
+ *
+ * The low pass is a 4th order Butterworth at CTCSS_CUTOFF, two
+ * biquads in transposed direct form II. It runs at the input rate;
+ * everything after it runs at the decimated rate, on one sample in
+ * 'decim'. What is above 750 Hz can alias onto the tones, and it
+ * is only down 35 dB at 750 Hz, 46 dB at 1 kHz and 63 dB at 1.5 kHz
+ * (at 8 kHz; up to 4 dB less above 1 kHz at 48 kHz). So voice
+ * at 0.75 to 1 kHz lands in the tone band just 35 to 46 dB down;
+ * it is the share test below, not the filter, that keeps it from
+ * opening a tone.
+ *
+ * The Goertzel filters run four bins to a vector with GCC's vector
+ * extensions, so the same code uses NEON on the Pi and SSE on a PC.
+ * At the end of a block the power in each bin is
+ *
+ *   P = s1^2 + s2^2 - coef s1 s2
+ *
+ * which for a steady tone of amplitude A is (A N / 2)^2 over N
+ * samples, and the energy N A^2 / 2, so 2 P / (N E) is the share
+ * of the energy in the bin, 1 for a clean tone.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: ctcss.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "ctcss.h"
+
+#define CTCSS_CUTOFF    280.0   // in Hz, the low pass
+
+const float ctcss_tones[CTCSS_TONES] = {
+	 67.0f,  69.3f,  71.9f,  74.4f,  77.0f,  79.7f,  82.5f,  85.4f,  88.5f,  91.5f,
+	 94.8f,  97.4f, 100.0f, 103.5f, 107.2f, 110.9f, 114.8f, 118.8f, 123.0f, 127.3f,
+	131.8f, 136.5f, 141.3f, 146.2f, 151.4f, 156.7f, 159.8f, 162.2f, 165.5f, 167.9f,
+	171.3f, 173.8f, 177.3f, 179.9f, 183.5f, 186.2f, 189.9f, 192.8f, 196.6f, 199.5f,
+	203.5f, 206.5f, 210.7f, 218.1f, 225.7f, 229.1f, 233.6f, 241.8f, 250.3f, 254.1f
+};
+
+/* Returns the index of the EIA tone 'hz' (to 0.1 Hz), -1 if it
+ * isn't one
+ */
+int ctcss_tone_index(double hz) {
+	int i;
+
+	for (i = 0; i < CTCSS_TONES; i++)
+		if (fabs(hz - ctcss_tones[i]) < 0.05)
+			return(i);
+	return(-1);
+}
+
+/* Designs one biquad of the Butterworth low pass, 'q' its Q, by the
+ * bilinear transform
+ */
+static void lp_design(float * c, double fs, double q) {
+	double k = tan(M_PI * CTCSS_CUTOFF / fs);
+	double norm = 1 / (1 + k / q + k * k);
+
+	c[0] = (float)(k * k * norm);
+	c[1] = 2 * c[0];
+	c[2] = c[0];
+	c[3] = (float)(2 * (k * k - 1) * norm);
+	c[4] = (float)((1 - k / q + k * k) * norm);
+}
+
+/* Starts a bank's block over, 'wait' samples from now
+ */
+static void bank_reset(CtcssBank * b, int wait) {
+	memset(b->s1, 0, sizeof(b->s1));
+	memset(b->s2, 0, sizeof(b->s2));
+	b->energy = 0;
+	b->count = -wait;
+}
+
+/* Sets up a decoder for tone 'tone' (an index) on audio at 'rate'
+ * Hz, going on after the tone has been heard for 'detect_ms' and
+ * off after it has been gone for 'release_ms'. Returns 0 if the
+ * rate is too low.
+ */
+int ctcss_init(Ctcss * d, int rate, int tone, int detect_ms, int release_ms) {
+	double fs;
+	float * c;
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	d->decim = rate / CTCSS_RATE;
+	if (d->decim < 1 || tone < 0 || tone >= CTCSS_TONES) {
+		printf("CTCSS: needs audio at %d Hz or more\n",CTCSS_RATE);
+		return(0);
+	}
+	fs = (double)rate / d->decim;
+	d->block = (int)(fs * CTCSS_BLOCK / 1000);
+
+	// the Q's of a 4th order Butterworth
+	lp_design(d->lp[0], rate, 0.54119610);
+	lp_design(d->lp[1], rate, 1.3065630);
+
+	c = (float *)d->coef;
+	for (i = 0; i < CTCSS_TONES; i++)
+		c[i] = (float)(2 * cos(2 * M_PI * ctcss_tones[i] / fs));
+	bank_reset(&d->bank[0], 0);
+	bank_reset(&d->bank[1], d->block / 2);
+
+	d->tone = tone;
+	d->heard = -1;
+	// the first block takes CTCSS_BLOCK, each one after a hop
+	d->detect_n = 1 + (detect_ms - CTCSS_BLOCK) / CTCSS_HOP;
+	if (d->detect_n < 1)
+		d->detect_n = 1;
+	d->release_n = release_ms / CTCSS_HOP;
+	if (d->release_n < 1)
+		d->release_n = 1;
+	return(1);
+}
+
+/* Decides a finished block: was the tone the strongest, with its
+ * share of the energy? Then counts it towards going on or off.
+ */
+static void bank_decide(Ctcss * d, CtcssBank * b) {
+	union {
+		CtcssVec v[CTCSS_VECS];
+		float f[CTCSS_BINS];
+	} p;
+	int best = 0;
+	int hit = 0;
+	int i;
+
+	for (i = 0; i < CTCSS_VECS; i++)
+		p.v[i] = b->s1[i] * b->s1[i] + b->s2[i] * b->s2[i] - d->coef[i] * b->s1[i] * b->s2[i];
+	for (i = 1; i < CTCSS_TONES; i++)
+		if (p.f[i] > p.f[best])
+			best = i;
+
+	d->heard = -1;
+	if (b->energy >= CTCSS_FLOOR * d->block &&
+			2 * p.f[best] >= CTCSS_SHARE * d->block * b->energy) {
+		d->heard = best;
+		hit = (best == d->tone);
+	}
+	d->blocks++;
+
+	if (hit) {
+		d->misses = 0;
+		if (++d->hits >= d->detect_n && !d->on) {
+			__atomic_store_n(&d->on, 1, __ATOMIC_RELAXED);
+			d->detects++;
+		}
+	} else {
+		d->hits = 0;
+		if (++d->misses >= d->release_n && d->on)
+			__atomic_store_n(&d->on, 0, __ATOMIC_RELAXED);
+	}
+	bank_reset(b, 0);
+}
+
+/* One decimated sample through both banks
+ */
+static void goertzel(Ctcss * d, float x) {
+	CtcssVec xv = { x, x, x, x };
+	int j, i;
+
+	for (j = 0; j < 2; j++) {
+		CtcssBank * b = &d->bank[j];
+
+		if (b->count++ < 0)
+			continue;
+		for (i = 0; i < CTCSS_VECS; i++) {
+			CtcssVec s0 = xv + d->coef[i] * b->s1[i] - b->s2[i];
+
+			b->s2[i] = b->s1[i];
+			b->s1[i] = s0;
+		}
+		b->energy += x * x;
+		if (b->count == d->block)
+			bank_decide(d, b);
+	}
+}
+
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame)
+ */
+void ctcss_feed(Ctcss * d, const short * pcm, int n, int stride) {
+	const float * a = d->lp[0];
+	const float * b = d->lp[1];
+	float z0 = d->z[0][0], z1 = d->z[0][1];
+	float z2 = d->z[1][0], z3 = d->z[1][1];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float x = pcm[i * stride];
+		float y;
+
+		y = a[0] * x + z0;
+		z0 = a[1] * x - a[3] * y + z1;
+		z1 = a[2] * x - a[4] * y;
+		x = y;
+		y = b[0] * x + z2;
+		z2 = b[1] * x - b[3] * y + z3;
+		z3 = b[2] * x - b[4] * y;
+
+		if (++d->phase == d->decim) {
+			d->phase = 0;
+			goertzel(d, y);
+		}
+	}
+	d->z[0][0] = z0;
+	d->z[0][1] = z1;
+	d->z[1][0] = z2;
+	d->z[1][1] = z3;
+}
+
+/* Returns 1 while the tone is heard, from any thread
+ */
+int ctcss_on(const Ctcss * d) {
+	return(__atomic_load_n(&d->on, __ATOMIC_RELAXED));
+}
+
+/* Prints the decoder's counters, for port 'num'
+ */
+void ctcss_dump(const Ctcss * d, int num, FILE * fp) {
+	fprintf(fp, "CTCSS port %d: %.1f Hz, %s, %lu blocks, %lu detects, last heard ",
+		num, ctcss_tones[d->tone], ctcss_on(d) ? "on" : "off", d->blocks, d->detects);
+	if (d->heard >= 0)
+		fprintf(fp, "%.1f Hz\n", ctcss_tones[d->heard]);
+	else
+		fprintf(fp, "none\n");
+}
@@ -0,0 +1,106 @@
+/* ctcss.h - Software CTCSS tone decoder for the 'minimalist'
+ * repeater controller.
+ *
+ * Listens for a sub-audible tone on a receiver's audio, so the
+ * controller can do its own tone access: COR only counts while the
+ * receiver's tone is heard (see get_cor()).
+ *
+ * The audio is low pass filtered and decimated to about 1 kHz, and
+ * then run through a bank of Goertzel filters, one on each of the
+ * 50 EIA tones. Two banks, half a block apart, each add up a block
+ * of CTCSS_BLOCK mS, so there is a decision every CTCSS_HOP mS. A
+ * block hits if the wanted tone is the strongest of the 50 and holds
+ * at least CTCSS_SHARE of the audio's energy, over a floor.
+ *
+ * The decoder is fed on the audio thread (an aio listener) and read
+ * on the control thread; only 'on' is shared.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: ctcss.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __CTCSS_H__
+#define __CTCSS_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CTCSS_TONES     50      // the EIA tones, 67.0 to 254.1 Hz
+#define CTCSS_BINS      52      // padded to a whole number of vectors
+#define CTCSS_RATE      1000    // in Hz, roughly, after decimation
+#define CTCSS_BLOCK     200     // in mS, 5 Hz resolution
+#define CTCSS_HOP       100     // in mS, between decisions
+#define CTCSS_SHARE     0.25f   // of the energy, in the tone's bin
+#define CTCSS_FLOOR     2500.0f // mean square, quieter blocks never hit
+
+#define DEFAULT_CTCSS_DETECT   200  // in mS
+#define DEFAULT_CTCSS_RELEASE  200  // in mS
+#define CTCSS_TONE_MAX  300     // in Hz, most a Tone setting can be
+#define CTCSS_TIME_MAX  5000    // in mS, longest Detect or Release
+
+// four bins at a time, NEON or SSE as the target has
+typedef float CtcssVec __attribute__((vector_size(16)));
+#define CTCSS_VECS      (CTCSS_BINS / 4)
+
+typedef struct
+{
+    CtcssVec s1[CTCSS_VECS];    // the Goertzel state
+    CtcssVec s2[CTCSS_VECS];
+    float energy;               // sum of the squares
+    int count;                  // samples so far, < 0 while waiting to start
+} CtcssBank;
+
+typedef struct
+{
+    CtcssVec coef[CTCSS_VECS];  // 2 cos(w) for each bin
+    CtcssBank bank[2];
+    float lp[2][5];             // low pass biquads: b0 b1 b2 a1 a2
+    float z[2][2];              // and their state
+    int decim;                  // input samples per decimated one
+    int phase;
+    int block;                  // decimated samples in a block
+    int tone;                   // wanted, index into ctcss_tones
+    int heard;                  // strongest tone in the last block, -1 = none
+    int hits;                   // blocks in a row that did / didn't hit
+    int misses;
+    int detect_n;               // hits to go on
+    int release_n;              // misses to go off
+    int on;                     // the output, shared
+    unsigned long blocks;       // decided
+    unsigned long detects;      // times it went on
+} Ctcss;
+
+extern const float ctcss_tones[CTCSS_TONES];
+
+/* Returns the index of the EIA tone 'hz' (to 0.1 Hz), -1 if it
+ * isn't one
+ */
+int ctcss_tone_index(double hz);
+/* Sets up a decoder for tone 'tone' (an index) on audio at 'rate'
+ * Hz, going on after the tone has been heard for 'detect_ms' and
+ * off after it has been gone for 'release_ms'. Returns 0 if the
+ * rate is too low.
+ */
+int ctcss_init(Ctcss * d, int rate, int tone, int detect_ms, int release_ms);
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame) */
+void ctcss_feed(Ctcss * d, const short * pcm, int n, int stride);
+/* Returns 1 while the tone is heard, from any thread */
+int ctcss_on(const Ctcss * d);
+/* Prints the decoder's counters, for port 'num' */
+void ctcss_dump(const Ctcss * d, int num, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CTCSS_H__
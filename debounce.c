@@ -0,0 +1,96 @@
+/* debounce.c - COR debouncer for the 'minimalist' repeater
+ * controller.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: debounce.c
+ * Author: KB4OID/Kodetroll
+ */
+#include "debounce.h"
+
+/* Sets up a debouncer with the given assert and release windows
+ * in mS, sampling every 'period' mS, starting inactive at time 't'
+ */
+void debounce_init(Debouncer * d, int assert_ms, int release_ms, int period, msec_t t) {
+	if (period < 1)
+		period = 1;
+	d->period = period;
+	d->assert_n = assert_ms / period;
+	d->release_n = release_ms / period;
+	// a window of 0 still takes the one sample
+	if (d->assert_n < 1)
+		d->assert_n = 1;
+	if (d->release_n < 1)
+		d->release_n = 1;
+	d->on = 0;
+	d->raw = 0;
+	d->count = 0;
+	d->last = t;
+	d->changed = t;
+}
+
+/* Counts 'n' samples at the current raw level
+ */
+static void integrate(Debouncer * d, long n) {
+	long need;
+
+	if (d->raw == d->on) {
+		// agrees, bleed off any evidence against the output
+		d->count = (n >= d->count) ? 0 : d->count - n;
+		return;
+	}
+
+	need = (d->on ? d->release_n : d->assert_n) - d->count;
+	if (n < need) {
+		d->count += n;
+		return;
+	}
+
+	// the window filled, the rest of the samples agree
+	d->on = d->raw;
+	d->count = 0;
+	d->changed = d->last + (need - n) * d->period;
+}
+
+/* Counts the samples due up to time 't' and then takes 'active'
+ * as the new raw input. Returns the debounced output.
+ */
+int debounce_update(Debouncer * d, int active, msec_t t) {
+	long n;
+
+	if (t > d->last) {
+		n = (t - d->last) / d->period;
+		d->last += n * d->period;
+		integrate(d, n);
+	}
+	d->raw = active ? 1 : 0;
+	return(d->on);
+}
+
+/* Returns 1 if the input agrees with the output and there is no
+ * evidence against it left, i.e. a flake has been rejected
+ */
+int debounce_settled(const Debouncer * d) {
+	return(d->raw == d->on && d->count == 0);
+}
+
+/* Returns mS from 't' until the output could change or the
+ * debouncer settles, or -1 if it is already settled
+ */
+long debounce_next(const Debouncer * d, msec_t t) {
+	long n;
+	msec_t due;
+
+	if (debounce_settled(d))
+		return(-1);
+	if (d->raw == d->on)
+		n = d->count;
+	else
+		n = (d->on ? d->release_n : d->assert_n) - d->count;
+	due = d->last + n * d->period;
+	return((due > t) ? (long)(due - t) : 0);
+}
@@ -0,0 +1,72 @@
+/* debounce.h - COR debouncer for the 'minimalist' repeater
+ * controller.
+ *
+ * An integrating debouncer. COR is sampled every 'period' mS and
+ * each sample that disagrees with the debounced output adds one to
+ * a counter, each sample that agrees takes one off (down to zero).
+ * The output changes when the counter reaches the assert (or release)
+ * window. Unlike sampling COR twice, 50 mS apart, a noise burst only
+ * gets through if it is mostly on for the whole window, and dropouts
+ * shorter than the release window are ridden through.
+ *
+ * Nothing here blocks. The raw COR level only changes on an edge, so
+ * the samples between two calls are all at the level seen by the
+ * previous call and are counted in one go. debounce_next() says how
+ * long the caller may sleep before the output could change.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: debounce.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __DEBOUNCE_H__
+#define __DEBOUNCE_H__
+
+#include "timers.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEBOUNCE_PERIOD  1      // in mS, 1 kHz sampling
+
+typedef struct
+{
+    int on;                 // debounced output, 1 = active
+    int raw;                // raw input at the last update, 1 = active
+    int count;              // samples of evidence against 'on'
+    int assert_n;           // samples needed to go active
+    int release_n;          // samples needed to go inactive
+    int period;             // mS per sample
+    msec_t last;            // time of the last sample counted
+    msec_t changed;         // time the output last changed
+} Debouncer;
+
+/* Sets up a debouncer with the given assert and release windows
+ * in mS, sampling every 'period' mS, starting inactive at time 't'
+ */
+void debounce_init(Debouncer * d, int assert_ms, int release_ms, int period, msec_t t);
+/* Counts the samples due up to time 't' and then takes 'active'
+ * as the new raw input. Returns the debounced output.
+ */
+int debounce_update(Debouncer * d, int active, msec_t t);
+/* Returns 1 if the input agrees with the output and there is no
+ * evidence against it left, i.e. a flake has been rejected
+ */
+int debounce_settled(const Debouncer * d);
+/* Returns mS from 't' until the output could change or the
+ * debouncer settles, or -1 if it is already settled
+ */
+long debounce_next(const Debouncer * d, msec_t t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __DEBOUNCE_H__
@@ -0,0 +1,144 @@
+/* dtmf.c - DTMF decoder for the 'minimalist' repeater controller.
+ *
+ * The Goertzel filters run at the input rate, a block's length is
+ * scaled with it so the bins stay 39 Hz wide. At the end of a block
+ * the power in each bin is
+ *
+ *   P = s1^2 + s2^2 - coef s1 s2
+ *
+ * which for a tone of amplitude A is (A N / 2)^2 over N samples, and
+ * the energy of two tones N (A^2 + B^2) / 2, so 2 (Prow + Pcol) / (N E)
+ * is the share of the block's energy in the pair, 1 for clean DTMF.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: dtmf.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "dtmf.h"
+
+static const float tones[8] = {
+	697, 770, 852, 941,         // rows
+	1209, 1336, 1477, 1633      // columns
+};
+
+static const char keys[16] = {
+	'1', '2', '3', 'A',
+	'4', '5', '6', 'B',
+	'7', '8', '9', 'C',
+	'*', '0', '#', 'D'
+};
+
+/* Sets up a decoder for audio at 'rate' Hz, calling 'fn' with each
+ * digit. Returns 0 if the rate is too low for the tones.
+ */
+int dtmf_init(Dtmf * d, int rate, DtmfDigitFn fn, void * arg) {
+	float * c = (float *)d->coef;
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	if (rate < 8000) {
+		printf("DTMF: needs audio at 8000 Hz or more\n");
+		return(0);
+	}
+	for (i = 0; i < 8; i++)
+		c[i] = (float)(2 * cos(2 * M_PI * tones[i] / rate));
+	d->block = (int)((long long)DTMF_BLOCK * rate / 8000);
+	d->fn = fn;
+	d->arg = arg;
+	return(1);
+}
+
+/* Returns the strongest bin of a group of four, 0 if it isn't
+ * DTMF_PEAK over the others
+ */
+static int group_peak(const float * p, int * best) {
+	int i;
+
+	*best = 0;
+	for (i = 1; i < 4; i++)
+		if (p[i] > p[*best])
+			*best = i;
+	for (i = 0; i < 4; i++)
+		if (i != *best && p[i] * DTMF_PEAK > p[*best])
+			return(0);
+	return(1);
+}
+
+/* Decides a finished block, returns its digit or 0
+ */
+static char block_digit(Dtmf * d) {
+	union {
+		DtmfVec v[2];
+		float f[8];
+	} p;
+	float row_p, col_p;
+	int row, col;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		p.v[i] = d->s1[i] * d->s1[i] + d->s2[i] * d->s2[i] - d->coef[i] * d->s1[i] * d->s2[i];
+
+	if (d->energy < DTMF_FLOOR * d->block)
+		return(0);
+	if (!group_peak(p.f, &row) || !group_peak(p.f + 4, &col))
+		return(0);
+	row_p = p.f[row];
+	col_p = p.f[4 + col];
+	if (col_p * DTMF_TWIST < row_p || row_p * DTMF_RTWIST < col_p)
+		return(0);
+	if (2 * (row_p + col_p) < DTMF_SHARE * d->block * d->energy)
+		return(0);
+	return(keys[row * 4 + col]);
+}
+
+/* Ends a block: two alike in a row change the digit, and a new one
+ * is passed on
+ */
+static void block_end(Dtmf * d) {
+	char k = block_digit(d);
+
+	if (k == d->last && k != d->digit) {
+		d->digit = k;
+		if (k != 0) {
+			d->digits++;
+			if (d->fn != NULL)
+				d->fn(k, d->samples, d->arg);
+		}
+	}
+	d->last = k;
+
+	memset(d->s1, 0, sizeof(d->s1));
+	memset(d->s2, 0, sizeof(d->s2));
+	d->energy = 0;
+	d->count = 0;
+}
+
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame)
+ */
+void dtmf_feed(Dtmf * d, const short * pcm, int n, int stride) {
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		float x = pcm[i * stride];
+		DtmfVec xv = { x, x, x, x };
+
+		for (j = 0; j < 2; j++) {
+			DtmfVec s0 = xv + d->coef[j] * d->s1[j] - d->s2[j];
+
+			d->s2[j] = d->s1[j];
+			d->s1[j] = s0;
+		}
+		d->energy += x * x;
+		d->samples++;
+		if (++d->count == d->block)
+			block_end(d);
+	}
+}
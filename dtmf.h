@@ -0,0 +1,79 @@
+/* dtmf.h - DTMF decoder for the 'minimalist' repeater controller.
+ *
+ * Hears the touch tones on a receiver's audio, for remote control
+ * (see cmd.h). The audio is cut into blocks of 25.6 mS (205 samples
+ * at 8 kHz) and each block run through eight Goertzel filters, one
+ * on each DTMF tone, the four row tones in one vector and the four
+ * column tones in the other. A block holds a digit if:
+ *
+ *  - the strongest row and column tone carry DTMF_SHARE of its energy,
+ *    over a floor, so voice doesn't
+ *  - the twist between them is within 8 dB (column weaker) or 4 dB
+ *    (row weaker)
+ *  - each is 6 dB above the other tones of its group
+ *
+ * A digit is taken when two blocks in a row hold it, and the next
+ * one once two blocks in a row haven't, so digits and the gaps
+ * between them have to be 50 mS or more.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: dtmf.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __DTMF_H__
+#define __DTMF_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DTMF_BLOCK      205     // samples in a block at 8 kHz, 25.6 mS
+#define DTMF_SHARE      0.6f    // of the energy, in the row and column tones
+#define DTMF_FLOOR      4000.0f // mean square, quieter blocks never hold a digit
+#define DTMF_TWIST      6.31f   // 8 dB, column below row
+#define DTMF_RTWIST     2.51f   // 4 dB, row below column
+#define DTMF_PEAK       4.0f    // 6 dB, over the rest of the group
+
+// four tones at a time, NEON or SSE as the target has
+typedef float DtmfVec __attribute__((vector_size(16)));
+
+// Gets each digit, with the input sample it was taken on
+typedef void (*DtmfDigitFn)(char digit, long long at, void * arg);
+
+typedef struct
+{
+    DtmfVec coef[2];        // 2 cos(w), rows then columns
+    DtmfVec s1[2];          // the Goertzel state
+    DtmfVec s2[2];
+    float energy;           // sum of the squares
+    int count;              // samples in the block so far
+    int block;              // samples in a block
+    char last;              // the last block's digit, 0 = none
+    char digit;             // the digit taken, 0 = none
+    long long samples;      // fed so far
+    unsigned long digits;   // taken
+    DtmfDigitFn fn;
+    void * arg;
+} Dtmf;
+
+/* Sets up a decoder for audio at 'rate' Hz, calling 'fn' with each
+ * digit. Returns 0 if the rate is too low for the tones.
+ */
+int dtmf_init(Dtmf * d, int rate, DtmfDigitFn fn, void * arg);
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame) */
+void dtmf_feed(Dtmf * d, const short * pcm, int n, int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __DTMF_H__
@@ -0,0 +1,327 @@
+/* evlog.c - Binary event log for the 'minimalist' repeater
+ * controller.
+ *
+ * Each thread that logs gets its own ring (an Spsc) the first time
+ * it does, so every ring still has a single producer and no lock is
+ * needed. The writer thread merges the rings by time. It polls every
+ * EVLOG_PERIOD mS rather than being woken, which keeps the producer
+ * side free of syscalls.
+ *
+ * The simulator build always writes synchronously, so its output is
+ * complete and in order however fast virtual time runs.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: evlog.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "evlog.h"
+#include "cmd.h"
+
+static EvRecord ring_buf[EVLOG_RINGS][EVLOG_SIZE];
+static Spsc rings[EVLOG_RINGS];
+static char ring_names[EVLOG_RINGS][8];
+static int nrings;              // rings handed out so far
+static __thread Spsc * my_ring; // this thread's ring
+static unsigned long lost;      // records from threads with no ring
+static int running;             // writer thread is up
+static int stopping;            // writer should drain and exit
+static pthread_t writer;
+static FILE * out;
+static void (*start_hook)(void);
+static void (*idle_hook)(void);
+
+static const char * ev_names[EV_COUNT] = {
+	"START",
+	"IDLE",
+	"COR ON",
+	"PTT ON",
+	"COR OFF",
+	"SQT ON",
+	"BEEP",
+	"SQT OFF",
+	"PTT OFF",
+	"ID",
+	"ID ABORT",
+	"ID DONE",
+};
+
+/* Formats an event as a line of text, without the newline
+ */
+void evlog_format(const EvRecord * ev, char * buf, int len) {
+	char port[12] = "";
+
+	switch(ev->id)
+	{
+		case EV_PIN_MODE:
+			snprintf(buf, len, "PM: 0x%02llx: 0x%02llx [%s]",
+				ev->a, ev->b, ev->b ? "OUTPUT" : "INPUT");
+			break;
+		case EV_PIN_WRITE:
+			snprintf(buf, len, "DW: 0x%02llx: 0x%02llx", ev->a, ev->b);
+			break;
+		case EV_PIN_READ:
+			snprintf(buf, len, "DR: 0x%02llx: 0x%02llx", ev->a, ev->b);
+			break;
+		case EV_PWM:
+			snprintf(buf, len, "AW: 0x%02llx: 0x%02llx", ev->a, ev->b);
+			break;
+		case EV_TONE:
+			snprintf(buf, len, "tone: %lld, %lld", ev->a, ev->b);
+			break;
+		case EV_NOTONE:
+			snprintf(buf, len, "noTone: %lld", ev->a);
+			break;
+		case EV_BEEP_START:
+			snprintf(buf, len, "Beep: %lld, %lld mS", ev->a, ev->b);
+			break;
+		case EV_BEEP_DONE:
+			snprintf(buf, len, "Beep Done!");
+			break;
+		case EV_COR_PTT_ON:
+			snprintf(buf, len, "COR edge to PTT ON: %lld uS", ev->a / 1000);
+			break;
+		case EV_BEEP_CUT:
+			snprintf(buf, len, "COR edge to BEEP cut: %lld uS (max %lld uS)",
+				ev->a / 1000, ev->b / 1000);
+			break;
+		case EV_OVERRUN:
+			snprintf(buf, len, "[%lld] Task overrun: %lld deadlines missed (%lld total)",
+				ev->t, ev->a, ev->b);
+			break;
+		case EV_GPIO_STATS:
+			snprintf(buf, len, "GPIO: %lld hardware writes, %lld avoided",
+				ev->a, ev->b);
+			break;
+		case EV_RELOAD:
+			snprintf(buf, len, "[%lld] Config reloaded", ev->t);
+			break;
+		case EV_CMD:
+			if (ev->port)
+				snprintf(port, sizeof(port), "PORT%d ", ev->port);
+			if (ev->a == CMD_BAD)
+				snprintf(buf, len, "[%lld] %sRemote: bad command", ev->t, port);
+			else if (cmd_has_value(ev->a))
+				snprintf(buf, len, "[%lld] %sRemote: %s %lld", ev->t, port, cmd_name(ev->a), ev->b);
+			else
+				snprintf(buf, len, "[%lld] %sRemote: %s", ev->t, port, cmd_name(ev->a));
+			break;
+		default:
+			if (ev->id < EV_COUNT && ev_names[ev->id] != NULL && ev->port)
+				snprintf(buf, len, "[%lld] PORT%d %s", ev->t, ev->port, ev_names[ev->id]);
+			else if (ev->id < EV_COUNT && ev_names[ev->id] != NULL)
+				snprintf(buf, len, "[%lld] %s", ev->t, ev_names[ev->id]);
+			else
+				snprintf(buf, len, "[%lld] event %d", ev->t, ev->id);
+			break;
+	}
+}
+
+static void write_event(const EvRecord * ev) {
+	char buf[120];
+
+	evlog_format(ev, buf, sizeof(buf));
+	fprintf(out ? out : stdout, "%s\n", buf);
+}
+
+// the writer thread's, the simulator has none and writes events
+// straight away
+#ifndef SIMULATION
+/* Writes out everything in the rings, oldest first. Returns the
+ * number of records written.
+ */
+static int drain(void) {
+	int n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+	int written = 0;
+
+	if (n > EVLOG_RINGS)
+		n = EVLOG_RINGS;
+
+	while (1) {
+		const EvRecord * first = NULL;
+		int i, from = 0;
+
+		for (i = 0; i < n; i++) {
+			const EvRecord * ev = spsc_peek(&rings[i]);
+
+			if (ev != NULL && (first == NULL || ev->t < first->t)) {
+				first = ev;
+				from = i;
+			}
+		}
+		if (first == NULL)
+			return(written);
+		write_event(first);
+		spsc_drop(&rings[from]);
+		written++;
+	}
+}
+
+/* Writer thread: drains the rings every EVLOG_PERIOD mS
+ */
+static void * writer_main(void * arg) {
+	unsigned long reported = 0;
+	struct timespec ts;
+
+	if (start_hook != NULL)
+		start_hook();
+
+	while (1) {
+		unsigned long d;
+		int done;
+
+		done = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+		drain();
+
+		d = evlog_dropped();
+		if (d != reported) {
+			fprintf(out, "*** event log: %lu events dropped\n", d - reported);
+			reported = d;
+		}
+		if (idle_hook != NULL)
+			idle_hook();
+		fflush(out);
+
+		// the last drain started after the stop was asked for
+		if (done)
+			break;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = EVLOG_PERIOD * 1000000L;
+		while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+			;
+	}
+	return(NULL);
+}
+#endif
+
+/* Starts the writer thread, writing to 'fp'. Until this is
+ * called, events are formatted and written straight away.
+ * Returns 1 on success.
+ */
+int evlog_start(FILE * fp) {
+	int i;
+
+	out = fp;
+	for (i = 0; i < EVLOG_RINGS; i++) {
+		snprintf(ring_names[i], sizeof(ring_names[i]), "log.%d", i);
+		spsc_init(&rings[i], ring_names[i], ring_buf[i], EVLOG_SIZE, sizeof(EvRecord));
+	}
+#ifdef SIMULATION
+	return(1);
+#else
+	stopping = 0;
+	if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+		printf("evlog: can't start the writer, logging directly\n");
+		return(0);
+	}
+	running = 1;
+	return(1);
+#endif
+}
+
+/* Writes out what is left in the rings and stops the writer
+ */
+void evlog_stop(void) {
+	if (!running)
+		return;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	running = 0;
+}
+
+/* Sets functions the writer thread runs when it starts (e.g. to
+ * set its CPU) and after each pass (e.g. telemetry). Call before
+ * evlog_start().
+ */
+void evlog_set_hooks(void (*start)(void), void (*idle)(void)) {
+	start_hook = start;
+	idle_hook = idle;
+}
+
+/* Returns the calling thread's ring, giving it one the first time
+ */
+static Spsc * thread_ring(void) {
+	int n;
+
+	if (my_ring != NULL)
+		return(my_ring);
+	// the rings were set up by evlog_start(), this one stays
+	// empty until it is committed to
+	n = __atomic_fetch_add(&nrings, 1, __ATOMIC_ACQ_REL);
+	if (n >= EVLOG_RINGS)
+		return(NULL);
+	my_ring = &rings[n];
+	return(my_ring);
+}
+
+/* Logs an event, never blocks
+ */
+void evlog_push(int id, int port, int state, int cor, int ptt, long long a, long long b) {
+	EvRecord * ev;
+	EvRecord now_ev;
+	Spsc * q = NULL;
+
+	if (running) {
+		q = thread_ring();
+		if (q == NULL) {
+			__atomic_fetch_add(&lost, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		// NULL if full, the writer is behind
+		ev = spsc_reserve(q);
+		if (ev == NULL)
+			return;
+	} else {
+		ev = &now_ev;
+	}
+
+	ev->t = now_ms();
+	ev->id = id;
+	ev->port = port;
+	ev->state = state;
+	ev->cor = cor;
+	ev->ptt = ptt;
+	ev->a = a;
+	ev->b = b;
+
+	if (q != NULL)
+		spsc_commit(q);
+	else
+		write_event(ev);
+}
+
+/* Returns the number of events dropped because a ring was full
+ */
+unsigned long evlog_dropped(void) {
+	unsigned long d = __atomic_load_n(&lost, __ATOMIC_RELAXED);
+	int n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+	int i;
+
+	if (n > EVLOG_RINGS)
+		n = EVLOG_RINGS;
+	for (i = 0; i < n; i++)
+		d += __atomic_load_n(&rings[i].full, __ATOMIC_RELAXED);
+	return(d);
+}
+
+/* Prints the rings' counters
+ */
+void evlog_dump(FILE * fp) {
+	int n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+	int i;
+
+	if (n > EVLOG_RINGS)
+		n = EVLOG_RINGS;
+	for (i = 0; i < n; i++)
+		spsc_dump(&rings[i], fp);
+}
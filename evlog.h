@@ -0,0 +1,112 @@
+/* evlog.h - Binary event log for the 'minimalist' repeater
+ * controller.
+ *
+ * show_msg() and the debug messages used to printf() straight from
+ * the control loop, so a slow SD card or a blocked pipe on stdout
+ * stalled the state machine. Now the control loop only writes a
+ * small fixed size record into a single producer / single consumer
+ * ring, and a writer thread formats the records and writes them out.
+ * If the writer falls behind and the ring is full, new records are
+ * dropped and counted rather than waiting.
+ *
+ * Every thread that logs gets a ring of its own, and the writer is
+ * the pipeline's I/O thread: it also runs the telemetry, through
+ * evlog_set_hooks().
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: evlog.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __EVLOG_H__
+#define __EVLOG_H__
+
+#include <stdio.h>
+#include "timers.h"
+#include "spsc.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVLOG_SIZE    4096      // records in a ring, a power of 2
+#define EVLOG_RINGS   4         // threads that can log
+#define EVLOG_PERIOD  20        // in mS, how often the writer wakes up
+
+// The events. The first group are the state machine messages.
+enum EventIds {
+  EV_START,
+  EV_IDLE,
+  EV_COR_ON,
+  EV_PTT_ON,
+  EV_COR_OFF,
+  EV_SQT_ON,
+  EV_BEEP,
+  EV_SQT_OFF,
+  EV_PTT_OFF,
+  EV_ID,
+  EV_ID_ABORT,
+  EV_ID_DONE,
+  EV_PIN_MODE,      // a = pin, b = mode
+  EV_PIN_WRITE,     // a = pin, b = value
+  EV_PIN_READ,      // a = pin, b = value
+  EV_PWM,           // a = pin, b = value
+  EV_TONE,          // a = pin, b = freq
+  EV_NOTONE,        // a = pin
+  EV_BEEP_START,    // a = beep type, b = length in mS
+  EV_BEEP_DONE,
+  EV_COR_PTT_ON,    // a = COR edge to PTT on in nS
+  EV_BEEP_CUT,      // a = COR edge to beep cut in nS, b = worst
+  EV_GPIO_STATS,    // a = hardware writes, b = writes avoided
+  EV_OVERRUN,       // a = new task overruns, b = total
+  EV_RELOAD,        // switched to a reloaded config
+  EV_CMD,           // a = remote command (CMD_BAD), b = its value
+  EV_COUNT
+};
+
+// One event, 32 bytes
+typedef struct
+{
+    msec_t t;               // now() when it happened
+    unsigned short id;      // EventIds
+    unsigned char port;     // repeater port, 0 if there is only one
+    unsigned char state;    // CtrlStates
+    unsigned char cor;      // COR_Value
+    unsigned char ptt;      // PTT_Value
+    unsigned char pad[2];
+    long long a;            // event arguments
+    long long b;
+} EvRecord;
+
+/* Starts the writer thread, writing to 'fp'. Until this is
+ * called, events are formatted and written straight away.
+ * Returns 1 on success.
+ */
+int evlog_start(FILE * fp);
+/* Sets functions the writer thread runs when it starts (e.g. to
+ * set its CPU) and after each pass (e.g. telemetry). Call before
+ * evlog_start().
+ */
+void evlog_set_hooks(void (*start)(void), void (*idle)(void));
+/* Writes out what is left in the rings and stops the writer */
+void evlog_stop(void);
+/* Logs an event, never blocks */
+void evlog_push(int id, int port, int state, int cor, int ptt, long long a, long long b);
+/* Formats an event as a line of text, without the newline */
+void evlog_format(const EvRecord * ev, char * buf, int len);
+/* Returns the number of events dropped because a ring was full */
+unsigned long evlog_dropped(void);
+/* Prints the rings' counters */
+void evlog_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __EVLOG_H__
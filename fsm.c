@@ -0,0 +1,226 @@
+/* fsm.c - Table driven state machine engine for the 'minimalist'
+ * repeater controller.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: fsm.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "fsm.h"
+
+/* Leaves the current state for 'to' through 'action'
+ */
+static void fsm_go(Fsm * fsm, int to, FsmAction action) {
+	const FsmState * states = fsm->def->states;
+
+	if (states[fsm->state].exit != NULL)
+		states[fsm->state].exit(fsm);
+	if (action != NULL)
+		action(fsm);
+	fsm->prev = fsm->state;
+	fsm->state = to;
+	fsm->transitions++;
+	if (states[to].entry != NULL)
+		states[to].entry(fsm);
+}
+
+/* Sets a machine up to run 'def' in its initial state, with 'ctx'
+ * for the actions. No entry action is run.
+ */
+void fsm_init(Fsm * fsm, const FsmDef * def, void * ctx) {
+	int s, e;
+
+	memset(fsm, 0, sizeof(*fsm));
+	fsm->def = def;
+	fsm->ctx = ctx;
+	fsm->state = fsm->prev = def->initial;
+
+	// which events each state handles, so a step is one AND
+	for (s = 0; s < def->nstates && s < FSM_MAX_STATES; s++)
+		for (e = 0; e < def->nevents && e < FSM_MAX_EVENTS; e++)
+			if (def->table[s * def->nevents + e].to != 0)
+				fsm->handled[s] |= FSM_EV(e);
+}
+
+/* Moves to 'state' regardless of the table, running the exit and
+ * entry actions
+ */
+void fsm_enter(Fsm * fsm, int state) {
+	fsm_go(fsm, state, NULL);
+}
+
+/* Takes the highest priority of the 'events' the current state
+ * handles. Returns 1 if there was one.
+ */
+int fsm_step(Fsm * fsm, unsigned long events) {
+	const FsmTrans * tr;
+	unsigned long m = events & fsm->handled[fsm->state];
+
+	if (m == 0)
+		return(0);
+	tr = &fsm->def->table[fsm->state * fsm->def->nevents + __builtin_ctzl(m)];
+	fsm_go(fsm, tr->to - 1, tr->action);
+	return(1);
+}
+
+/* Runs the current state's 'during' action and steps on the events
+ * 'events()' returns until nothing more happens. Returns the number
+ * of transitions taken.
+ */
+int fsm_run(Fsm * fsm, unsigned long (*events)(Fsm * fsm)) {
+	int n;
+
+	for (n = 0; n < FSM_MAX_STEPS; n++) {
+		FsmAction during = fsm->def->states[fsm->state].during;
+
+		if (during != NULL)
+			during(fsm);
+		if (!fsm_step(fsm, events(fsm)))
+			break;
+	}
+	return(n);
+}
+
+/* Returns the name of a state
+ */
+const char * fsm_state_name(const Fsm * fsm, int state) {
+	if (state < 0 || state >= fsm->def->nstates)
+		return("?");
+	return(fsm->def->states[state].name);
+}
+
+/* Checks a table, printing any problems to 'fp'. Returns 1 if it
+ * is good.
+ */
+int fsm_validate(const FsmDef * def, FILE * fp) {
+	unsigned long seen = 0;
+	unsigned long used = 0;
+	int queue[FSM_MAX_STATES];
+	int head = 0, tail = 0;
+	int s, e, ntrans = 0, bad = 0;
+
+	if (def->nstates > FSM_MAX_STATES || def->nevents > FSM_MAX_EVENTS) {
+		fprintf(fp, "FSM '%s': %d states, %d events, at most %d of each\n",
+			def->name, def->nstates, def->nevents, FSM_MAX_STATES);
+		return(0);
+	}
+
+	// every cell goes somewhere real
+	for (s = 0; s < def->nstates; s++) {
+		unsigned long row = 0;
+
+		for (e = 0; e < def->nevents; e++) {
+			int to = def->table[s * def->nevents + e].to;
+
+			if (to == 0)
+				continue;
+			if (to > def->nstates) {
+				fprintf(fp, "FSM '%s': %s on %s goes to unknown state %d\n",
+					def->name, def->states[s].name, def->events[e], to - 1);
+				bad++;
+				continue;
+			}
+			row |= FSM_EV(e);
+			ntrans++;
+		}
+		if (row == 0) {
+			fprintf(fp, "FSM '%s': state %s has no way out\n",
+				def->name, def->states[s].name);
+			bad++;
+		} else if ((row & FSM_EV(FSM_DONE)) && row != FSM_EV(FSM_DONE)) {
+			fprintf(fp, "FSM '%s': state %s handles %s, its other events are never taken\n",
+				def->name, def->states[s].name, def->events[FSM_DONE]);
+			bad++;
+		}
+		used |= row;
+	}
+
+	// walk the table from the initial state
+	seen = FSM_EV(def->initial);
+	queue[tail++] = def->initial;
+	while (head < tail) {
+		s = queue[head++];
+		for (e = 0; e < def->nevents; e++) {
+			int to = def->table[s * def->nevents + e].to - 1;
+
+			if (to < 0 || to >= def->nstates || (seen & FSM_EV(to)))
+				continue;
+			seen |= FSM_EV(to);
+			queue[tail++] = to;
+		}
+	}
+
+	for (s = 0; s < def->nstates; s++) {
+		if (!(seen & FSM_EV(s))) {
+			fprintf(fp, "FSM '%s': state %s can't be reached\n",
+				def->name, def->states[s].name);
+			bad++;
+		}
+	}
+	for (e = 0; e < def->nevents; e++) {
+		if (!(used & FSM_EV(e))) {
+			fprintf(fp, "FSM '%s': event %s isn't handled by any state\n",
+				def->name, def->events[e]);
+			bad++;
+		}
+	}
+
+	fprintf(fp, "FSM '%s': %d states, %d events, %d transitions, %s\n",
+		def->name, def->nstates, def->nevents, ntrans,
+		bad ? "FAILED" : "OK");
+	return(bad == 0);
+}
+
+/* Checks that every way from the states in 'from' (a mask) to state
+ * 'to' goes through state 'via', printing one that doesn't to 'fp'.
+ * Returns 1 if they all do.
+ */
+int fsm_check_via(const FsmDef * def, unsigned long from, int to, int via, FILE * fp) {
+	int came[FSM_MAX_STATES];
+	int queue[FSM_MAX_STATES];
+	int path[FSM_MAX_STATES];
+	unsigned long seen = 0;
+	int head = 0, tail = 0;
+	int s, e, n;
+
+	// walk the table from 'from', stopping at 'via'
+	for (s = 0; s < def->nstates && s < FSM_MAX_STATES; s++) {
+		if ((from & FSM_EV(s)) && s != via) {
+			seen |= FSM_EV(s);
+			came[s] = -1;
+			queue[tail++] = s;
+		}
+	}
+	while (head < tail) {
+		s = queue[head++];
+		if (s == to)
+			break;
+		for (e = 0; e < def->nevents; e++) {
+			int next = def->table[s * def->nevents + e].to - 1;
+
+			if (next < 0 || next >= def->nstates || next == via || (seen & FSM_EV(next)))
+				continue;
+			seen |= FSM_EV(next);
+			came[next] = s;
+			queue[tail++] = next;
+		}
+	}
+	if (!(seen & FSM_EV(to)))
+		return(1);
+
+	// print the way it got there
+	for (n = 0, s = to; s >= 0 && n < FSM_MAX_STATES; s = came[s])
+		path[n++] = s;
+	fprintf(fp, "FSM '%s': gets to %s without going through %s:",
+		def->name, def->states[to].name, def->states[via].name);
+	while (n > 0)
+		fprintf(fp, " %s", def->states[path[--n]].name);
+	fprintf(fp, "\n");
+	return(0);
+}
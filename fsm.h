@@ -0,0 +1,130 @@
+/* fsm.h - Table driven state machine engine for the 'minimalist'
+ * repeater controller.
+ *
+ * A state machine is described by a constant table, indexed by
+ * [state][event], giving the action to run and the state to go to,
+ * plus an entry, a 'during' and an exit action for each state. The
+ * engine itself keeps no globals, all the run time state is in an
+ * Fsm, so one table can drive any number of independent machines
+ * (one per repeater port), each with its own context pointer.
+ *
+ * Each pass the caller hands the engine a bit mask of the events
+ * that are true right now. The lowest numbered event the current
+ * state handles wins, so the event numbering is also the priority.
+ * Finding it is a mask and a count-trailing-zeros, and the table
+ * lookup is a plain index, so dispatch costs the same whatever the
+ * size of the table.
+ *
+ * A state that handles FSM_DONE (event 0) is a transition state: it
+ * does its work in its entry action and moves straight on, in the
+ * same pass.
+ *
+ * fsm_validate() checks a table for states that can't be reached,
+ * events that no state handles and states with no way out, and
+ * fsm_check_via() that the table can't get from one set of states
+ * to another without passing a given state, e.g. can't get back to
+ * idle without turning an output off. 'make check' runs them, see
+ * 'rptrctrl --checkfsm'.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: fsm.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __FSM_H__
+#define __FSM_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FSM_MAX_STATES  32
+#define FSM_MAX_EVENTS  32      // bits in an event mask
+#define FSM_MAX_STEPS   16      // transitions in one fsm_run() pass
+#define FSM_DONE        0       // the 'always true' event
+
+// Builds a table cell: go to state 'n', running 'a' (may be NULL)
+#define FSM_TO(n, a)    { (a), (n) + 1 }
+// The event bit for event 'e'
+#define FSM_EV(e)       (1UL << (e))
+
+struct Fsm;
+typedef void (*FsmAction)(struct Fsm * fsm);
+
+typedef struct
+{
+    FsmAction action;       // run between the exit and entry actions
+    unsigned char to;       // next state + 1, 0 = event not handled
+} FsmTrans;
+
+typedef struct
+{
+    const char * name;
+    FsmAction entry;        // on the way in
+    FsmAction during;       // every pass, before the events are read
+    FsmAction exit;         // on the way out
+} FsmState;
+
+typedef struct
+{
+    const char * name;
+    int nstates;
+    int nevents;
+    int initial;
+    const FsmState * states;        // [nstates]
+    const char * const * events;    // [nevents] names
+    const FsmTrans * table;         // [nstates][nevents]
+} FsmDef;
+
+typedef struct Fsm
+{
+    const FsmDef * def;
+    void * ctx;             // whatever the actions need, e.g. a port
+    int state;
+    int prev;               // the state before the last transition
+    unsigned long handled[FSM_MAX_STATES];  // event mask per state
+    unsigned long transitions;
+} Fsm;
+
+/* Sets a machine up to run 'def' in its initial state, with 'ctx'
+ * for the actions. No entry action is run.
+ */
+void fsm_init(Fsm * fsm, const FsmDef * def, void * ctx);
+/* Moves to 'state' regardless of the table, running the exit and
+ * entry actions
+ */
+void fsm_enter(Fsm * fsm, int state);
+/* Takes the highest priority of the 'events' the current state
+ * handles. Returns 1 if there was one.
+ */
+int fsm_step(Fsm * fsm, unsigned long events);
+/* Runs the current state's 'during' action and steps on the events
+ * 'events()' returns until nothing more happens. Returns the number
+ * of transitions taken.
+ */
+int fsm_run(Fsm * fsm, unsigned long (*events)(Fsm * fsm));
+/* Returns the name of a state */
+const char * fsm_state_name(const Fsm * fsm, int state);
+/* Checks a table, printing any problems to 'fp'. Returns 1 if it
+ * is good.
+ */
+int fsm_validate(const FsmDef * def, FILE * fp);
+/* Checks that every way from the states in 'from' (a mask) to state
+ * 'to' goes through state 'via', printing one that doesn't to 'fp'.
+ * Returns 1 if they all do.
+ */
+int fsm_check_via(const FsmDef * def, unsigned long from, int to, int via, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __FSM_H__
@@ -0,0 +1,518 @@
+/* gpio.c - GPIO backends for the 'minimalist' repeater controller.
+ *
+ * The chardev backend holds one line handle for all the output pins,
+ * so a flush is a single GPIOHANDLE_SET_LINE_VALUES_IOCTL, and one
+ * handle per input pin. It has no PWM, so the ID tone has to come
+ * from the software synthesizer (an audio sink) in that mode.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: gpio.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#ifdef HAVE_BCM2835
+#include <bcm2835.h>
+#endif
+#include "gpio.h"
+#include "corevent.h"
+#include "rptrctrl.h"
+#ifdef SIMULATION
+#include "simclock.h"
+#endif
+
+static const GpioBackend * backend;
+static int backend_id = -1;
+static GpioStats stats;
+
+static unsigned int out_mask;   // pins set as outputs
+static unsigned int known;      // output pins the hardware level is known for
+static unsigned int shadow;     // what the hardware was last told
+static unsigned int pending;    // what loop() wants
+static int pwm_div = -1;        // last PWM settings sent
+static int pwm_range = -1;
+static int pwm_value = -1;
+
+static const char * pin_names[GPIO_MAX_PINS];  // outputs to trace
+static FILE * trace_fp;
+static char trace_buf[BUFSIZ];
+
+static int pin_ok(int pin) {
+	return(pin >= 0 && pin < GPIO_MAX_PINS);
+}
+
+/************************************************************
+ * bcm2835
+ */
+#ifdef HAVE_BCM2835
+static int bcm_open(const char * dev) {
+	return(bcm2835_init());
+}
+
+static void bcm_close(void) {
+	bcm2835_close();
+}
+
+static void bcm_mode(int pin, int output) {
+	if (output) {
+		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+		bcm2835_gpio_set_pud(pin, BCM2835_GPIO_PUD_OFF);
+	} else {
+		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
+		bcm2835_gpio_set_pud(pin, BCM2835_GPIO_PUD_UP);
+	}
+}
+
+static int bcm_read(int pin) {
+	return(bcm2835_gpio_lev(pin));
+}
+
+static void bcm_write_mask(unsigned int set, unsigned int clr, unsigned int level) {
+	// one register write each for the set and clear banks
+	if (set)
+		bcm2835_gpio_set_multi(set);
+	if (clr)
+		bcm2835_gpio_clr_multi(clr);
+}
+
+static void bcm_pwm(int div, int range, int value) {
+	bcm2835_pwm_set_clock(div);
+	bcm2835_pwm_set_mode(PWM_CH, PWM_MARKSPACE, PWM_ON);
+	bcm2835_pwm_set_range(PWM_CH, range);
+	bcm2835_pwm_set_data(PWM_CH, value);
+}
+
+static const GpioBackend bcm_backend = {
+	"bcm2835", bcm_open, bcm_close, bcm_mode, bcm_read,
+	bcm_write_mask, bcm_pwm, NULL
+};
+#endif
+
+/************************************************************
+ * Linux GPIO character device
+ */
+static int chip_fd = -1;
+static int out_fd = -1;                 // handle for all the outputs
+static int out_lines[GPIO_MAX_PINS];    // output pins, in handle order
+static int out_count;
+static int in_fd[GPIO_MAX_PINS];        // per input pin handles, 0 = none
+
+static int cdev_open(const char * dev) {
+	if (dev == NULL || dev[0] == '\0')
+		dev = DEFAULT_GPIOCHIP;
+	chip_fd = open(dev, O_RDONLY | O_CLOEXEC);
+	if (chip_fd < 0) {
+		printf("gpio: can't open '%s'\n",dev);
+		return(0);
+	}
+	memset(in_fd, 0, sizeof(in_fd));
+	out_count = 0;
+	return(1);
+}
+
+static void cdev_release(int pin) {
+	if (in_fd[pin] > 0)
+		close(in_fd[pin]);
+	in_fd[pin] = 0;
+}
+
+static void cdev_close(void) {
+	int i;
+
+	for (i = 0; i < GPIO_MAX_PINS; i++)
+		cdev_release(i);
+	if (out_fd >= 0)
+		close(out_fd);
+	if (chip_fd >= 0)
+		close(chip_fd);
+	out_fd = chip_fd = -1;
+}
+
+/* (Re)requests the output handle with every output pin in it
+ */
+static void cdev_request_outputs(void) {
+	struct gpiohandle_request req;
+	int i;
+
+	if (out_fd >= 0)
+		close(out_fd);
+	out_fd = -1;
+
+	memset(&req, 0, sizeof(req));
+	for (i = 0; i < out_count; i++) {
+		req.lineoffsets[i] = out_lines[i];
+		req.default_values[i] = (shadow >> out_lines[i]) & 1;
+	}
+	req.lines = out_count;
+	req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+	strncpy(req.consumer_label, "rptrctrl", sizeof(req.consumer_label) - 1);
+
+	if (ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+		printf("gpio: output request failed (%s)\n",strerror(errno));
+		return;
+	}
+	out_fd = req.fd;
+}
+
+static void cdev_mode(int pin, int output) {
+	int i;
+
+	cdev_release(pin);
+	for (i = 0; i < out_count; i++)
+		if (out_lines[i] == pin)
+			break;
+
+	if (output && i == out_count)
+		out_lines[out_count++] = pin;
+	else if (!output && i < out_count)
+		out_lines[i] = out_lines[--out_count];
+	else
+		return;
+	cdev_request_outputs();
+}
+
+static int cdev_read(int pin) {
+	struct gpiohandle_request req;
+	struct gpiohandle_data data;
+
+	// inputs are claimed on first use
+	if (in_fd[pin] == 0) {
+		memset(&req, 0, sizeof(req));
+		req.lineoffsets[0] = pin;
+		req.lines = 1;
+		req.flags = GPIOHANDLE_REQUEST_INPUT;
+#ifdef GPIOHANDLE_REQUEST_BIAS_PULL_UP
+		req.flags |= GPIOHANDLE_REQUEST_BIAS_PULL_UP;
+#endif
+		strncpy(req.consumer_label, "rptrctrl", sizeof(req.consumer_label) - 1);
+		if (ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+			return(HIGH);
+		in_fd[pin] = req.fd;
+	}
+
+	if (ioctl(in_fd[pin], GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+		return(HIGH);
+	return(data.values[0]);
+}
+
+static void cdev_write_mask(unsigned int set, unsigned int clr, unsigned int level) {
+	struct gpiohandle_data data;
+	int i;
+
+	if (out_fd < 0)
+		return;
+	memset(&data, 0, sizeof(data));
+	for (i = 0; i < out_count; i++)
+		data.values[i] = (level >> out_lines[i]) & 1;
+	ioctl(out_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+}
+
+static void cdev_pwm(int div, int range, int value) {
+	// no PWM through the character device
+}
+
+static const GpioBackend cdev_backend = {
+	"chardev", cdev_open, cdev_close, cdev_mode, cdev_read,
+	cdev_write_mask, cdev_pwm, cdev_release
+};
+
+/************************************************************
+ * Simulated, in memory
+ */
+static int sim_levels[GPIO_MAX_PINS];
+
+static int sim_open(const char * dev) {
+	int i;
+
+	// everything floats high, like the pulled up inputs
+	for (i = 0; i < GPIO_MAX_PINS; i++)
+		sim_levels[i] = HIGH;
+	return(1);
+}
+
+static void sim_close(void) {
+}
+
+static void sim_mode(int pin, int output) {
+}
+
+static int sim_read(int pin) {
+	return(sim_levels[pin]);
+}
+
+static void sim_write_mask(unsigned int set, unsigned int clr, unsigned int level) {
+	int i;
+
+	for (i = 0; i < GPIO_MAX_PINS; i++) {
+		if (set & (1u << i))
+			sim_levels[i] = HIGH;
+		else if (clr & (1u << i))
+			sim_levels[i] = LOW;
+	}
+}
+
+static void sim_pwm(int div, int range, int value) {
+}
+
+static const GpioBackend sim_backend = {
+	"sim", sim_open, sim_close, sim_mode, sim_read,
+	sim_write_mask, sim_pwm, NULL
+};
+
+/************************************************************
+ * Common front end
+ */
+static const GpioBackend * backends[] = {
+#ifdef HAVE_BCM2835
+	[GPIO_BCM2835] = &bcm_backend,
+#else
+	[GPIO_BCM2835] = NULL,
+#endif
+	[GPIO_CHARDEV] = &cdev_backend,
+	[GPIO_SIM] = &sim_backend,
+};
+
+/* Opens a backend, 'dev' is the gpiochip for GPIO_CHARDEV.
+ * Returns 1 on success, 0 on failure.
+ */
+int gpio_open(int id, const char * dev) {
+	if (id < 0 || id > GPIO_SIM || backends[id] == NULL) {
+		printf("gpio: backend '%s' not built in\n",gpio_backend_name(id));
+		return(0);
+	}
+	if (!backends[id]->open(dev))
+		return(0);
+
+	backend = backends[id];
+	backend_id = id;
+	out_mask = known = shadow = pending = 0;
+	pwm_div = pwm_range = pwm_value = -1;
+	memset(&stats, 0, sizeof(stats));
+	return(1);
+}
+
+/* Flushes and closes the backend
+ */
+void gpio_close(void) {
+	if (backend == NULL)
+		return;
+	gpio_flush();
+	backend->close();
+	backend = NULL;
+	backend_id = -1;
+}
+
+/* Returns the backend in use
+ */
+int gpio_backend(void) {
+	return(backend_id);
+}
+
+/* Returns the name of a backend
+ */
+const char * gpio_backend_name(int id) {
+	switch(id)
+	{
+		case GPIO_BCM2835:
+			return("bcm2835");
+		case GPIO_CHARDEV:
+			return("chardev");
+		case GPIO_SIM:
+			return("sim");
+		default:
+			return("unknown");
+	}
+}
+
+/* Returns the backend for a name, or -1
+ */
+int gpio_backend_parse(const char * name) {
+	int i;
+
+	for (i = GPIO_BCM2835; i <= GPIO_SIM; i++)
+		if (strcmp(name, gpio_backend_name(i)) == 0)
+			return(i);
+	return(-1);
+}
+
+/* Sets a pin to be an input (pulled up) or an output
+ */
+void gpio_mode(int pin, int output) {
+	if (backend == NULL || !pin_ok(pin))
+		return;
+	if (output) {
+		out_mask |= 1u << pin;
+	} else {
+		out_mask &= ~(1u << pin);
+		known &= ~(1u << pin);
+	}
+	backend->mode(pin, output);
+}
+
+/* Reads a pin
+ */
+int gpio_read(int pin) {
+	if (backend == NULL || !pin_ok(pin))
+		return(LOW);
+	return(backend->read(pin));
+}
+
+/* Queues an output level, sent by gpio_flush()
+ */
+void gpio_write(int pin, int value) {
+	unsigned int bit;
+
+	if (!pin_ok(pin))
+		return;
+	bit = 1u << pin;
+	stats.writes++;
+	if (((pending & bit) != 0) == (value != 0) && (known & bit))
+		stats.redundant++;
+	if (value)
+		pending |= bit;
+	else
+		pending &= ~bit;
+}
+
+/* Writes a trace line for each named pin in 'dirty' that changed
+ */
+static void trace_pins(unsigned int dirty) {
+	int i;
+
+	for (i = 0; i < GPIO_MAX_PINS; i++) {
+		if (pin_names[i] == NULL || !(dirty & (1u << i)))
+			continue;
+		// first write of a pin is only traced if it is not low
+		if (!(known & (1u << i)) && !(pending & (1u << i)))
+			continue;
+		fprintf(trace_fp, "%lld %s %d\n",now_ms(),pin_names[i],
+			(pending >> i) & 1);
+	}
+	fflush(trace_fp);
+}
+
+/* Sends all queued output changes at once, returns the
+ * number of pins that changed
+ */
+int gpio_flush(void) {
+	unsigned int dirty, set, clr;
+
+	stats.flushes++;
+	if (backend == NULL)
+		return(0);
+
+	// pins whose hardware level differs, or was never set
+	dirty = ((pending ^ shadow) | ~known) & out_mask;
+	if (dirty == 0)
+		return(0);
+
+	set = pending & dirty;
+	clr = ~pending & dirty;
+	backend->write_mask(set, clr, pending & out_mask);
+	stats.hw_writes++;
+
+	if (trace_fp != NULL)
+		trace_pins(dirty);
+
+	shadow = (shadow & ~dirty) | set;
+	known |= dirty;
+	return(__builtin_popcount(dirty));
+}
+
+/* Sets the PWM clock divisor, range and data, skipped if
+ * nothing changed
+ */
+void gpio_pwm(int div, int range, int value) {
+	stats.pwm_writes++;
+	if (backend == NULL)
+		return;
+	if (div == pwm_div && range == pwm_range && value == pwm_value)
+		return;
+	backend->pwm(div, range, value);
+	stats.pwm_hw++;
+	pwm_div = div;
+	pwm_range = range;
+	pwm_value = value;
+}
+
+/* Lets go of a pin so another user (the COR line event) can
+ * claim it
+ */
+void gpio_release(int pin) {
+	if (backend != NULL && backend->release != NULL && pin_ok(pin))
+		backend->release(pin);
+}
+
+/* Sleeps for 'ms' mS
+ */
+void gpio_delay(unsigned int ms) {
+#ifdef SIMULATION
+	sim_sleep_ms(ms);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+#endif
+}
+
+/* Names an output pin for the trace
+ */
+void gpio_name_pin(int pin, const char * name) {
+	if (pin_ok(pin))
+		pin_names[pin] = name;
+}
+
+/* Starts tracing level changes of the named output pins
+ * to 'fp', NULL stops tracing
+ */
+void gpio_trace(FILE * fp) {
+	// stdio would malloc() a buffer on the first write, from loop()
+	if (fp != NULL && fp != stdout)
+		setvbuf(fp, trace_buf, _IOFBF, sizeof(trace_buf));
+	trace_fp = fp;
+}
+
+/* Sets the level the sim backend reads back for a pin
+ */
+void gpio_sim_set(int pin, int level) {
+	if (pin_ok(pin))
+		sim_levels[pin] = level ? HIGH : LOW;
+}
+
+/* Returns the level of a pin in the sim backend
+ */
+int gpio_sim_get(int pin) {
+	if (!pin_ok(pin))
+		return(LOW);
+	return(sim_levels[pin]);
+}
+
+/* Returns the write counters
+ */
+const GpioStats * gpio_stats(void) {
+	return(&stats);
+}
+
+/* Prints the write counters
+ */
+void gpio_show_stats(void) {
+	printf("GPIO (%s): %lld writes (%lld redundant) in %lld flushes, "
+		"%lld hardware writes, %lld avoided; PWM %lld/%lld\n",
+		gpio_backend_name(backend_id),stats.writes,stats.redundant,
+		stats.flushes,stats.hw_writes,stats.writes - stats.hw_writes,
+		stats.pwm_hw,stats.pwm_writes);
+}
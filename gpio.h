@@ -0,0 +1,135 @@
+/* gpio.h - GPIO backends for the 'minimalist' repeater controller.
+ *
+ * pinMode()/digitalWrite()/digitalRead()/analogWrite() go through
+ * one of these backends, picked at runtime:
+ *
+ *   bcm2835  - direct register access with the bcm2835 library
+ *              (only when built with HAVE_BCM2835)
+ *   chardev  - the Linux GPIO character device (/dev/gpiochipN)
+ *   sim      - in memory, for running without any hardware
+ *
+ * Output writes are not sent straight away. gpio_write() records
+ * the wanted level, and gpio_flush() (once per loop() pass) sends
+ * every pin that actually changed in a single set/clear mask
+ * operation. A shadow copy of what the hardware was last told
+ * drops writes that would not change anything.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: gpio.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// These used to come from bcm2835.h
+#ifndef HIGH
+#define HIGH 0x1
+#define LOW  0x0
+#endif
+#ifndef delay
+#define delay(x) gpio_delay(x)
+#endif
+
+#define GPIO_MAX_PINS 32    // pins that fit in a set/clear mask
+
+enum GpioBackends {
+  GPIO_BCM2835,
+  GPIO_CHARDEV,
+  GPIO_SIM
+};
+
+#ifdef HAVE_BCM2835
+#define DEFAULT_GPIO_BACKEND GPIO_BCM2835
+#else
+#define DEFAULT_GPIO_BACKEND GPIO_CHARDEV
+#endif
+
+typedef struct
+{
+    const char * name;
+    int (*open)(const char * dev);
+    void (*close)(void);
+    void (*mode)(int pin, int output);
+    int (*read)(int pin);
+    // 'set' and 'clr' are the pins that changed, 'level' is
+    // the new level of every output pin
+    void (*write_mask)(unsigned int set, unsigned int clr, unsigned int level);
+    void (*pwm)(int div, int range, int value);
+    void (*release)(int pin);
+} GpioBackend;
+
+typedef struct
+{
+    long long writes;       // gpio_write() calls
+    long long redundant;    // ... that asked for the level already there
+    long long flushes;      // gpio_flush() calls
+    long long hw_writes;    // output mask operations sent to the backend
+    long long pwm_writes;   // gpio_pwm() calls
+    long long pwm_hw;       // ... that reached the backend
+} GpioStats;
+
+/* Opens a backend, 'dev' is the gpiochip for GPIO_CHARDEV.
+ * Returns 1 on success, 0 on failure.
+ */
+int gpio_open(int backend, const char * dev);
+/* Flushes and closes the backend */
+void gpio_close(void);
+/* Returns the backend in use */
+int gpio_backend(void);
+/* Returns the name of a backend */
+const char * gpio_backend_name(int backend);
+/* Returns the backend for a name, or -1 */
+int gpio_backend_parse(const char * name);
+
+/* Sets a pin to be an input (pulled up) or an output */
+void gpio_mode(int pin, int output);
+/* Reads a pin */
+int gpio_read(int pin);
+/* Queues an output level, sent by gpio_flush() */
+void gpio_write(int pin, int value);
+/* Sends all queued output changes at once, returns the
+ * number of pins that changed */
+int gpio_flush(void);
+/* Sets the PWM clock divisor, range and data, skipped if
+ * nothing changed */
+void gpio_pwm(int div, int range, int value);
+/* Lets go of a pin so another user (the COR line event) can
+ * claim it */
+void gpio_release(int pin);
+/* Sleeps for 'ms' mS */
+void gpio_delay(unsigned int ms);
+
+/* Names an output pin for the trace */
+void gpio_name_pin(int pin, const char * name);
+/* Starts tracing level changes of the named output pins
+ * to 'fp', NULL stops tracing */
+void gpio_trace(FILE * fp);
+
+/* Sets the level the sim backend reads back for a pin */
+void gpio_sim_set(int pin, int level);
+/* Returns the level of a pin in the sim backend */
+int gpio_sim_get(int pin);
+
+/* Returns the write counters */
+const GpioStats * gpio_stats(void);
+/* Prints the write counters */
+void gpio_show_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __GPIO_H__
@@ -0,0 +1,206 @@
+/* mem.c - Memory for the 'minimalist' repeater controller.
+ *
+ * An arena is a list of blocks, newest first. Allocations are taken
+ * from the front of the newest block, 16 byte aligned; one that
+ * doesn't fit starts a new block (of its own size if it is bigger
+ * than a block). The Arena itself is the first thing in its first
+ * block.
+ *
+ * The guard replaces malloc(), calloc() and realloc() with versions
+ * that count the call if the thread is in a guarded section, then go
+ * on to glibc's own. free() is left alone.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: mem.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+
+#define ARENA_ALIGN 16
+#define ALIGN(n)    (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct ArenaBlock
+{
+    ArenaBlock * next;      // older block
+    size_t size;            // bytes after the header
+    size_t used;
+};
+
+#define BLOCK_HDR   ALIGN(sizeof(ArenaBlock))
+
+static size_t arena_bytes;      // in all the arenas, any thread
+static __thread int guarded;    // depth of this thread's guarded sections
+static unsigned long guard_allocs;
+
+/* Adds a block of at least 'n' bytes to the front of the arena's
+ * list. Returns NULL if there isn't the memory.
+ */
+static ArenaBlock * block_new(Arena * a, size_t n) {
+	ArenaBlock * b;
+
+	if (n < a->block)
+		n = a->block;
+	b = malloc(BLOCK_HDR + n);
+	if (b == NULL)
+		return(NULL);
+	b->next = a->head;
+	b->size = n;
+	b->used = 0;
+	a->head = b;
+	a->size += BLOCK_HDR + n;
+	a->blocks++;
+	__atomic_add_fetch(&arena_bytes, BLOCK_HDR + n, __ATOMIC_RELAXED);
+	return(b);
+}
+
+/* Makes an arena, which lives in its own first block. NULL if
+ * there isn't the memory.
+ */
+Arena * arena_new(const char * name, size_t block) {
+	Arena tmp;
+	Arena * a;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.name = name;
+	tmp.block = ALIGN(block);
+	if (block_new(&tmp, ALIGN(sizeof(Arena))) == NULL) {
+		printf("arena: no memory for '%s'\n",name);
+		return(NULL);
+	}
+
+	// move it into the block it describes
+	a = (Arena *)((char *)tmp.head + BLOCK_HDR);
+	*a = tmp;
+	a->head->used = ALIGN(sizeof(Arena));
+	a->used = a->head->used;
+	return(a);
+}
+
+/* Returns 'n' zeroed bytes, NULL if there isn't the memory
+ */
+void * arena_alloc(Arena * a, size_t n) {
+	ArenaBlock * b = a->head;
+	void * p;
+
+	n = ALIGN(n);
+	if (b->size - b->used < n) {
+		b = block_new(a, n);
+		if (b == NULL) {
+			printf("arena: no memory in '%s'\n",a->name);
+			return(NULL);
+		}
+	}
+	p = (char *)b + BLOCK_HDR + b->used;
+	b->used += n;
+	a->used += n;
+	memset(p, 0, n);
+	return(p);
+}
+
+/* Copies a string into the arena
+ */
+char * arena_strdup(Arena * a, const char * s) {
+	size_t n = strlen(s) + 1;
+	char * p = arena_alloc(a, n);
+
+	if (p != NULL)
+		memcpy(p, s, n);
+	return(p);
+}
+
+/* Frees the arena and everything in it
+ */
+void arena_free(Arena * a) {
+	ArenaBlock * b;
+	ArenaBlock * next;
+
+	if (a == NULL)
+		return;
+	__atomic_sub_fetch(&arena_bytes, a->size, __ATOMIC_RELAXED);
+	// the arena is in the last block, so nothing is read after it goes
+	for (b = a->head; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+}
+
+/* Returns the bytes held by all the arenas
+ */
+size_t arena_total(void) {
+	return(__atomic_load_n(&arena_bytes, __ATOMIC_RELAXED));
+}
+
+/* Starts / ends a section of the calling thread that mustn't
+ * allocate. They nest.
+ */
+void mem_guard_enter(void) {
+	guarded++;
+}
+
+void mem_guard_leave(void) {
+	guarded--;
+}
+
+/* Returns how many allocations were made in guarded sections
+ */
+unsigned long mem_guard_allocs(void) {
+	return(__atomic_load_n(&guard_allocs, __ATOMIC_RELAXED));
+}
+
+#ifndef __SANITIZE_ADDRESS__
+extern void * __libc_malloc(size_t n);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * p, size_t n);
+
+static void guard_check(void) {
+	if (guarded)
+		__atomic_add_fetch(&guard_allocs, 1, __ATOMIC_RELAXED);
+}
+
+void * malloc(size_t n) {
+	guard_check();
+	return(__libc_malloc(n));
+}
+
+void * calloc(size_t n, size_t size) {
+	guard_check();
+	return(__libc_calloc(n, size));
+}
+
+void * realloc(void * p, size_t n) {
+	guard_check();
+	return(__libc_realloc(p, n));
+}
+#endif
+
+/* Prints the process's memory use: from /proc, what is resident,
+ * its peak and how much is locked, and what the arenas hold
+ */
+void mem_report(FILE * fp) {
+	char line[128];
+	long rss = -1, hwm = -1, lck = -1;
+	FILE * f;
+
+	f = fopen("/proc/self/status", "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "VmRSS:", 6) == 0)
+				rss = atol(line + 6);
+			else if (strncmp(line, "VmHWM:", 6) == 0)
+				hwm = atol(line + 6);
+			else if (strncmp(line, "VmLck:", 6) == 0)
+				lck = atol(line + 6);
+		}
+		fclose(f);
+	}
+	fprintf(fp, "Memory: %ld kB resident (peak %ld kB), %ld kB locked, config %zu kB\n",
+		rss, hwm, lck, (arena_total() + 1023) / 1024);
+}
@@ -0,0 +1,78 @@
+/* mem.h - Memory for the 'minimalist' repeater controller.
+ *
+ * Arenas: the config's strings and everything built from them (a
+ * Snapshot, see rptrctrl.h) are bump allocated from one arena and
+ * freed with it in one go, so loading or reloading a config can't
+ * leak and nothing is freed piece by piece.
+ *
+ * The allocation guard: after setup() the control path allocates
+ * nothing, as malloc() can take a lock or fault in a page, which is
+ * jitter. loop() runs between mem_guard_enter() and mem_guard_leave(),
+ * and every malloc(), calloc() and realloc() the thread makes in
+ * between is counted. ctrl_bench fails if there were any, and the
+ * controller prints the count at exit. (Not in an AddressSanitizer
+ * build, which has its own malloc().)
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: mem.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARENA_BLOCK  4096       // bytes, anything bigger gets a block of its own
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct
+{
+    const char * name;
+    ArenaBlock * head;      // block being handed out from
+    size_t block;           // size of a new block
+    size_t used;            // bytes handed out
+    size_t size;            // bytes in all its blocks
+    int blocks;
+} Arena;
+
+/* Makes an arena, which lives in its own first block. NULL if
+ * there isn't the memory.
+ */
+Arena * arena_new(const char * name, size_t block);
+/* Returns 'n' zeroed bytes, NULL if there isn't the memory */
+void * arena_alloc(Arena * a, size_t n);
+/* Copies a string into the arena */
+char * arena_strdup(Arena * a, const char * s);
+/* Frees the arena and everything in it */
+void arena_free(Arena * a);
+/* Returns the bytes held by all the arenas */
+size_t arena_total(void);
+
+/* Starts / ends a section of the calling thread that mustn't
+ * allocate. They nest.
+ */
+void mem_guard_enter(void);
+void mem_guard_leave(void);
+/* Returns how many allocations were made in guarded sections */
+unsigned long mem_guard_allocs(void);
+/* Prints the process's memory use */
+void mem_report(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MEM_H__
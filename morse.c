@@ -0,0 +1,146 @@
+/* morse.c - Morse code compiler for the 'minimalist' repeater
+ * controller.
+ *
+ * The original ConvertCall() ran each character through a 36 case
+ * switch, strcat()ed the results into a fixed buffer (quadratic, and
+ * it could overflow) and stored element lengths that do_ID() had to
+ * scale on every element. Here characters are looked up directly in
+ * a 128 entry table and the whole message is compiled once into
+ * absolute key-on/key-off times.
+ *
+ * Timing follows the PARIS standard: a dit is 1200/WPM mS, a dah is
+ * three dits, elements are separated by one dit, characters by three
+ * and words by seven. With Farnsworth spacing the characters keep
+ * their full speed and only the character and word gaps are
+ * stretched to reach the slower overall speed (ARRL formula).
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: morse.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "morse.h"
+
+// ASCII to dit/dah pattern, indexed by character
+static const char * morse_table[128] = {
+	['A'] = ".-",     ['B'] = "-...",   ['C'] = "-.-.",   ['D'] = "-..",
+	['E'] = ".",      ['F'] = "..-.",   ['G'] = "--.",    ['H'] = "....",
+	['I'] = "..",     ['J'] = ".---",   ['K'] = "-.-",    ['L'] = ".-..",
+	['M'] = "--",     ['N'] = "-.",     ['O'] = "---",    ['P'] = ".--.",
+	['Q'] = "--.-",   ['R'] = ".-.",    ['S'] = "...",    ['T'] = "-",
+	['U'] = "..-",    ['V'] = "...-",   ['W'] = ".--",    ['X'] = "-..-",
+	['Y'] = "-.--",   ['Z'] = "--..",
+
+	['0'] = "-----",  ['1'] = ".----",  ['2'] = "..---",  ['3'] = "...--",
+	['4'] = "....-",  ['5'] = ".....",  ['6'] = "-....",  ['7'] = "--...",
+	['8'] = "---..",  ['9'] = "----.",
+
+	['.'] = ".-.-.-", [','] = "--..--", ['?'] = "..--..", ['\''] = ".----.",
+	['!'] = "-.-.--", ['/'] = "-..-.",  ['('] = "-.--.",  [')'] = "-.--.-",
+	['&'] = ".-...",  [':'] = "---...", [';'] = "-.-.-.", ['='] = "-...-",
+	['+'] = ".-.-.",  ['-'] = "-....-", ['_'] = "..--.-", ['"'] = ".-..-.",
+	['$'] = "...-..-", ['@'] = ".--.-."
+};
+
+/* Returns the dit/dah pattern for a character (e.g. ".-" for 'A'),
+ * or NULL if the character has no Morse representation.
+ */
+const char * morse_pattern(char c) {
+	unsigned char u = (unsigned char)c;
+
+	if (u >= 'a' && u <= 'z')
+		u -= 'a' - 'A';
+	if (u >= 128)
+		return(NULL);
+	return(morse_table[u]);
+}
+
+/* Works out the element and gap lengths for the given speeds
+ */
+static void morse_timing(MorseTimeline * tl, int wpm, int fwpm) {
+	double ta;
+
+	if (wpm <= 0)
+		wpm = DEFAULT_CW_WPM;
+
+	tl->wpm = wpm;
+	tl->dit = (1200 + wpm / 2) / wpm;
+	tl->char_gap = 3 * tl->dit;
+	tl->word_gap = 7 * tl->dit;
+	tl->fwpm = 0;
+
+	if (fwpm > 0 && fwpm < wpm) {
+		// total added delay per word in mS, of which 3/19 goes
+		// to each character gap and 7/19 to the word gap
+		// (ARRL Farnsworth timing formula)
+		ta = (60000.0 * wpm - 37200.0 * fwpm) / (double)(wpm * fwpm);
+		tl->char_gap = (int)(3.0 * ta / 19.0 + 0.5);
+		tl->word_gap = (int)(7.0 * ta / 19.0 + 0.5);
+		tl->fwpm = fwpm;
+	}
+}
+
+/* Compiles a message into a keying timeline at 'wpm' words per
+ * minute using PARIS timing. If 'fwpm' is non-zero and slower than
+ * 'wpm', characters are sent at 'wpm' with Farnsworth spacing for
+ * an overall speed of 'fwpm'. Returns the number of edges, or -1 if
+ * the message did not fit (the timeline holds what did fit).
+ */
+int morse_compile(MorseTimeline * tl, const char * msg, int wpm, int fwpm) {
+	unsigned int t = 0;         // current time in mS
+	unsigned int gap = 0;       // gap owed before the next element
+	int prosign = 0;            // inside <..>, no gaps between letters
+	const char * p;
+	const char * e;
+
+	morse_timing(tl, wpm, fwpm);
+	tl->count = 0;
+	tl->length = 0;
+
+	for (p = msg; *p != '\0'; p++) {
+		if (*p == '<') {
+			prosign = 1;
+			continue;
+		}
+		if (*p == '>') {
+			prosign = 0;
+			if (tl->count > 0)
+				gap = tl->char_gap;
+			continue;
+		}
+		if (*p == ' ') {
+			// collapse runs of spaces, no leading gap
+			if (tl->count > 0)
+				gap = tl->word_gap;
+			continue;
+		}
+
+		e = morse_pattern(*p);
+		if (e == NULL)
+			continue;
+
+		for (; *e != '\0'; e++) {
+			if (tl->count + 2 > MORSE_MAX_EDGES) {
+				tl->length = t;
+				return(-1);
+			}
+			t += gap;
+			tl->edge[tl->count++] = t;
+			t += (*e == '-') ? 3 * tl->dit : tl->dit;
+			tl->edge[tl->count++] = t;
+			gap = tl->dit;
+		}
+
+		if (!prosign)
+			gap = tl->char_gap;
+	}
+
+	tl->length = t;
+	return(tl->count);
+}
@@ -0,0 +1,62 @@
+/* morse.h - Morse code compiler for the 'minimalist' repeater
+ * controller.
+ *
+ * Turns a text message into a packed keying timeline: an array of
+ * absolute mS offsets where even entries are key-on edges and odd
+ * entries are key-off edges. The timeline is compiled once when the
+ * configuration is loaded and played back without any allocation.
+ *
+ * Supported: A-Z, 0-9, the ITU punctuation set, '/' and prosigns
+ * written in angle brackets (e.g. '<AR>', '<SK>'), whose letters are
+ * sent run together without inter-character spacing.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: morse.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __MORSE_H__
+#define __MORSE_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MORSE_MAX_EDGES 1024    // max key-on + key-off edges in a message
+#define DEFAULT_CW_WPM  20      // default character speed
+
+typedef struct
+{
+    unsigned int edge[MORSE_MAX_EDGES]; // mS from start, even = on, odd = off
+    int count;                  // number of edges (always even)
+    unsigned int length;        // mS from start to the last key-off
+    int wpm;                    // character speed used
+    int fwpm;                   // Farnsworth (overall) speed used, 0 if none
+    int dit;                    // dit length in mS
+    int char_gap;               // inter-character gap in mS
+    int word_gap;               // inter-word gap in mS
+} MorseTimeline;
+
+/* Returns the dit/dah pattern for a character (e.g. ".-" for 'A'),
+ * or NULL if the character has no Morse representation.
+ */
+const char * morse_pattern(char c);
+/* Compiles a message into a keying timeline at 'wpm' words per
+ * minute using PARIS timing. If 'fwpm' is non-zero and slower than
+ * 'wpm', characters are sent at 'wpm' with Farnsworth spacing for
+ * an overall speed of 'fwpm'. Returns the number of edges, or -1 if
+ * the message did not fit (the timeline holds what did fit).
+ */
+int morse_compile(MorseTimeline * tl, const char * msg, int wpm, int fwpm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __MORSE_H__
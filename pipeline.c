@@ -0,0 +1,214 @@
+/* pipeline.c - Threaded pipeline for the 'minimalist' repeater
+ * controller.
+ *
+ * The input thread owns the edge source from pipe_start_input() on;
+ * the control thread must not call cor_wait_until() after that. It
+ * wakes the control thread through an eventfd after each edge, and
+ * the control thread sleeps on that and a timerfd set to its next
+ * absolute deadline, the same way cor_wait_until() does.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: pipeline.c
+ * Author: KB4OID/Kodetroll
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "pipeline.h"
+#include "spsc.h"
+#include "audio.h"
+#include "evlog.h"
+#include "rt.h"
+
+static const char * thread_names[PIPE_COUNT] = {
+	"input", "control", "audio", "io", "aio"
+};
+static int thread_cpu[PIPE_COUNT] = { -1, -1, -1, -1, -1 };
+static int thread_prio[PIPE_COUNT];
+
+static cor_edge edge_buf[PIPE_EDGE_QUEUE];
+static Spsc edges;
+static pthread_t input;
+static int input_running;
+static int stopping;
+static int edge_fd = -1;        // input -> control wakeup
+static int timer_fd = -1;       // control's next deadline
+
+/* Sets the CPU (-1 = any) and SCHED_FIFO priority (0 = leave it
+ * alone) a thread is to run at
+ */
+void pipe_set_thread(int which, int cpu, int prio) {
+	thread_cpu[which] = cpu;
+	thread_prio[which] = prio;
+}
+
+/* Applies a thread's settings to the calling thread. All but the
+ * control thread also block the signals, so main() gets them.
+ */
+void pipe_thread_init(int which) {
+	char name[16];
+
+	if (which != PIPE_CONTROL) {
+		sigset_t all;
+
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, NULL);
+	}
+	snprintf(name, sizeof(name), "rptr-%s", thread_names[which]);
+	pthread_setname_np(pthread_self(), name);
+
+	if (thread_cpu[which] >= 0 && rt_pin_cpu(thread_cpu[which]))
+		printf("Pipeline: %s thread on CPU %d\n",thread_names[which],thread_cpu[which]);
+	if (thread_prio[which] > 0 && rt_set_priority(thread_prio[which]))
+		printf("Pipeline: %s thread at SCHED_FIFO %d\n",thread_names[which],thread_prio[which]);
+}
+
+/* Start hooks for the audio, io and aio threads
+ */
+void pipe_audio_start(void) {
+	pipe_thread_init(PIPE_AUDIO);
+}
+
+void pipe_io_start(void) {
+	pipe_thread_init(PIPE_IO);
+}
+
+void pipe_aio_start(void) {
+	pipe_thread_init(PIPE_AIO);
+}
+
+/* Input thread: queues every COR edge for the control thread
+ * and wakes it
+ */
+static void * input_main(void * arg) {
+	unsigned long long one = 1;
+	struct timespec ts;
+
+	pipe_thread_init(PIPE_INPUT);
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		cor_edge edge;
+		int n;
+
+		n = cor_wait_until(cor_clock_ns() + PIPE_INPUT_POLL * 1000000LL, &edge);
+		if (n < 0) {
+			// don't spin on a broken source
+			ts.tv_sec = 0;
+			ts.tv_nsec = 1000000L;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		if (n == 0)
+			continue;
+		// a refused edge is counted, control still wakes and
+		// reads the levels
+		spsc_push(&edges, &edge);
+		if (write(edge_fd, &one, sizeof(one)) < 0)
+			continue;
+	}
+	return(NULL);
+}
+
+/* Starts the input thread. Returns 1 on success.
+ */
+int pipe_start_input(void) {
+	spsc_init(&edges, "cor edges", edge_buf, PIPE_EDGE_QUEUE, sizeof(cor_edge));
+	edge_fd = eventfd(0, EFD_NONBLOCK);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (edge_fd < 0 || timer_fd < 0) {
+		printf("Pipeline: can't make the wakeup fds: %s\n",strerror(errno));
+		pipe_stop();
+		return(0);
+	}
+	stopping = 0;
+	if (pthread_create(&input, NULL, input_main, NULL) != 0) {
+		printf("Pipeline: can't start the input thread\n");
+		pipe_stop();
+		return(0);
+	}
+	input_running = 1;
+	return(1);
+}
+
+/* Stops the input thread
+ */
+void pipe_stop(void) {
+	if (input_running) {
+		__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+		pthread_join(input, NULL);
+		input_running = 0;
+	}
+	if (edge_fd >= 0)
+		close(edge_fd);
+	if (timer_fd >= 0)
+		close(timer_fd);
+	edge_fd = timer_fd = -1;
+}
+
+/* The control thread's side of the edge queue: takes the next
+ * queued edge, or sleeps until one is queued or the absolute time
+ * 'deadline' (CLOCK_MONOTONIC nS, negative waits forever). Returns
+ * as cor_wait_until() does.
+ */
+int pipe_wait_until(long long deadline, cor_edge * edge) {
+	struct pollfd pfd[2];
+	struct itimerspec its;
+	unsigned long long n;
+	int ret;
+
+	if (spsc_pop(&edges, edge))
+		return(1);
+
+	memset(&its, 0, sizeof(its));
+	if (deadline >= 0 && deadline <= cor_clock_ns()) {
+		// already due
+		return(0);
+	} else if (deadline >= 0) {
+		its.it_value.tv_sec = deadline / 1000000000LL;
+		its.it_value.tv_nsec = deadline % 1000000000LL;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	pfd[0].fd = edge_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = timer_fd;
+	pfd[1].events = POLLIN;
+	ret = poll(pfd, 2, -1);
+	if (ret < 0)
+		return((errno == EINTR) ? 0 : -1);
+	if ((pfd[0].revents & POLLIN) && read(edge_fd, &n, sizeof(n)) < 0)
+		n = 0;
+	if ((pfd[1].revents & POLLIN) && read(timer_fd, &n, sizeof(n)) < 0)
+		n = 0;
+	return(spsc_pop(&edges, edge));
+}
+
+/* Prints the threads and the queues' counters
+ */
+void pipe_dump(FILE * fp) {
+	int i;
+
+	fprintf(fp, "%-14s %6s %10s\n", "thread", "CPU", "priority");
+	for (i = 0; i < PIPE_COUNT; i++)
+		fprintf(fp, "%-14s %6d %10d\n", thread_names[i],
+			thread_cpu[i], thread_prio[i]);
+	fprintf(fp, "%-14s %6s %10s %9s %6s %6s\n", "queue", "size",
+		"pushed", "refused", "high", "now");
+	spsc_dump(&edges, fp);
+	audio_dump(fp);
+	evlog_dump(fp);
+	fflush(fp);
+}
@@ -0,0 +1,90 @@
+/* pipeline.h - Threaded pipeline for the 'minimalist' repeater
+ * controller.
+ *
+ * The controller runs as four threads, so a slow stage can't hold
+ * up COR handling:
+ *
+ *  input   - waits on the COR edge source and queues each edge, with
+ *            its timestamp, for the control thread. Highest priority.
+ *  control - main(): the cyclic executive and the state machines.
+ *  audio   - the tone audio engine (audio.c), fed by the control
+ *            thread's key and clip commands.
+ *  io      - the event log writer (evlog.c), which also runs the
+ *            telemetry: the stats dump on SIGUSR1 and overruns.
+ *
+ * and with an audio input configured, a fifth:
+ *
+ *  aio     - the audio I/O engine (audioio.c), moving RX and TX audio
+ *            a period at a time. Highest priority, as the sound
+ *            device won't wait.
+ *
+ * They only talk through Spsc queues, which never block and count
+ * the items they had to refuse. Each thread can be given a CPU and,
+ * with --realtime, a SCHED_FIFO priority, see [THREADS] in the
+ * config. The simulator runs everything on the one thread, so its
+ * runs stay deterministic.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: pipeline.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdio.h>
+#include "corevent.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPE_EDGE_QUEUE  64     // COR edges waiting for control, a power of 2
+#define PIPE_INPUT_POLL  100    // in mS, how often the input thread checks for a stop
+
+// The threads
+enum PipeThreads {
+  PIPE_INPUT,
+  PIPE_CONTROL,
+  PIPE_AUDIO,
+  PIPE_IO,
+  PIPE_AIO,
+  PIPE_COUNT
+};
+
+/* Sets the CPU (-1 = any) and SCHED_FIFO priority (0 = leave it
+ * alone) a thread is to run at
+ */
+void pipe_set_thread(int which, int cpu, int prio);
+/* Applies a thread's settings to the calling thread. All but the
+ * control thread also block the signals, so main() gets them.
+ */
+void pipe_thread_init(int which);
+/* Start hooks for the audio, io and aio threads */
+void pipe_audio_start(void);
+void pipe_io_start(void);
+void pipe_aio_start(void);
+/* Starts the input thread. Returns 1 on success. */
+int pipe_start_input(void);
+/* Stops the input thread */
+void pipe_stop(void);
+/* The control thread's side of the edge queue: takes the next
+ * queued edge, or sleeps until one is queued or the absolute time
+ * 'deadline' (CLOCK_MONOTONIC nS, negative waits forever). Returns
+ * as cor_wait_until() does.
+ */
+int pipe_wait_until(long long deadline, cor_edge * edge);
+/* Prints the threads and the queues' counters */
+void pipe_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __PIPELINE_H__
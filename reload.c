@@ -0,0 +1,273 @@
+/* reload.c - Config reloading for the 'minimalist' repeater
+ * controller.
+ *
+ * Only this thread ever builds or frees a snapshot. 'pending' is the
+ * one hand over point: the reload thread swaps a new snapshot in and
+ * frees any it displaced (the control thread never saw that one), the
+ * control thread swaps NULL in to take it. Replaced snapshots come
+ * back through the 'retired' queue, oldest first, and are freed once
+ * the audio engine has passed the mark they were retired with.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: reload.c
+ * Author: KB4OID/Kodetroll
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "reload.h"
+#include "spsc.h"
+#include "audio.h"
+#include "rt.h"
+
+// A snapshot the control thread has replaced
+typedef struct
+{
+    void * snap;
+    unsigned int mark;      // audio_mark() when it was replaced
+} Retired;
+
+static char path[256];          // the config file
+static char dir[256];           // and the directory watched for it
+static const char * name;       // its name in dir
+static int cpu = -1;
+static ReloadLoad load;
+static ReloadFree drop;
+
+static void * pending;          // built, waiting for the control thread
+static void * newest;           // the last one published, the next base
+static Retired retired_buf[RELOAD_RETIRED];
+static Spsc retired;
+
+static pthread_t thread;
+static int running;
+static int stopping;
+static int requested;           // SIGHUP
+static int watch_fd = -1;       // inotify
+static int wake_fd = -1;
+
+/* Returns 1 if the inotify events waiting say the config file
+ * was written or renamed into place
+ */
+static int file_changed(void) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event * ev;
+	int changed = 0;
+	ssize_t n;
+	char * p;
+
+	while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->len > 0 && strcmp(ev->name, name) == 0)
+				changed = 1;
+		}
+	}
+	return(changed);
+}
+
+/* Frees the retired snapshots the audio engine is done with
+ */
+static void free_retired(void) {
+	const Retired * r;
+
+	while ((r = spsc_peek(&retired)) != NULL && audio_passed(r->mark)) {
+		drop(r->snap);
+		spsc_drop(&retired);
+	}
+}
+
+/* Builds a snapshot from the file and publishes it
+ */
+static void reload(void) {
+	void * snap;
+	void * old;
+
+	printf("Reload: reading '%s'\n",path);
+	snap = load(path, newest);
+	if (snap == NULL) {
+		printf("Reload: '%s' rejected, nothing changed\n",path);
+		return;
+	}
+
+	// one that was never taken is replaced outright
+	newest = snap;
+	old = __atomic_exchange_n(&pending, snap, __ATOMIC_ACQ_REL);
+	if (old != NULL)
+		drop(old);
+	printf("Reload: new config ready\n");
+}
+
+/* Reload thread: waits for the file to change or SIGHUP, then for
+ * RELOAD_SETTLE mS of quiet (an editor saving can take several
+ * writes), and reloads
+ */
+static void * reload_main(void * arg) {
+	struct pollfd pfd[2];
+	unsigned long long n;
+	sigset_t all;
+	int changed = 0;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	pthread_setname_np(pthread_self(), "rptr-reload");
+	if (cpu >= 0)
+		rt_pin_cpu(cpu);
+
+	pfd[0].fd = watch_fd;           // poll() skips it if it is -1
+	pfd[0].events = POLLIN;
+	pfd[1].fd = wake_fd;
+	pfd[1].events = POLLIN;
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		int timeout = -1;
+		int ret;
+
+		if (changed)
+			timeout = RELOAD_SETTLE;
+		else if (spsc_count(&retired) > 0)
+			timeout = RELOAD_CHECK;
+
+		ret = poll(pfd, 2, timeout);
+		if (ret > 0 && (pfd[0].revents & POLLIN) && file_changed())
+			changed = 1;
+		if (ret > 0 && (pfd[1].revents & POLLIN) && read(wake_fd, &n, sizeof(n)) < 0)
+			n = 0;
+		if (__atomic_exchange_n(&requested, 0, __ATOMIC_ACQ_REL))
+			changed = 1;
+
+		free_retired();
+		if (ret == 0 && changed) {
+			changed = 0;
+			reload();
+		}
+	}
+	return(NULL);
+}
+
+/* Starts the reload thread watching 'file', on CPU 'cpu' (-1 =
+ * any). 'current' is the snapshot in use. Returns 1 on success.
+ */
+int reload_start(const char * file, int c, void * current,
+                 ReloadLoad l, ReloadFree d) {
+	char * slash;
+
+	snprintf(path, sizeof(path), "%s", file);
+	snprintf(dir, sizeof(dir), "%s", file);
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		strcpy(dir, ".");
+		name = path;
+	} else {
+		*slash = '\0';
+		name = path + (slash - dir) + 1;
+	}
+	cpu = c;
+	load = l;
+	drop = d;
+	newest = current;
+	spsc_init(&retired, "retired cfg", retired_buf, RELOAD_RETIRED, sizeof(Retired));
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		printf("Reload: can't make the wakeup fd: %s\n",strerror(errno));
+		return(0);
+	}
+
+	// without inotify it still reloads on SIGHUP
+	watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd < 0 || inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("Reload: can't watch '%s' (%s), SIGHUP only\n",path,strerror(errno));
+		if (watch_fd >= 0)
+			close(watch_fd);
+		watch_fd = -1;
+	}
+
+	stopping = 0;
+	if (pthread_create(&thread, NULL, reload_main, NULL) != 0) {
+		printf("Reload: can't start the reload thread\n");
+		reload_stop();
+		return(0);
+	}
+	running = 1;
+	return(1);
+}
+
+/* Asks for a reload, safe from a signal handler
+ */
+void reload_request(void) {
+	unsigned long long one = 1;
+
+	__atomic_store_n(&requested, 1, __ATOMIC_RELEASE);
+	if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+		one = 0;
+}
+
+/* Returns 1 if a new snapshot is waiting for the control thread
+ */
+int reload_pending(void) {
+	return(__atomic_load_n(&pending, __ATOMIC_ACQUIRE) != NULL);
+}
+
+/* Takes the waiting snapshot, NULL if there is none. Control
+ * thread only.
+ */
+void * reload_take(void) {
+	return(__atomic_exchange_n(&pending, NULL, __ATOMIC_ACQ_REL));
+}
+
+/* Hands back the snapshot the control thread replaced, to be freed
+ * once the audio engine has passed 'mark'. If the queue is full it
+ * is never freed, which is safer than freeing it too soon.
+ */
+void reload_retire(void * snap, unsigned int mark) {
+	Retired r;
+	unsigned long long one = 1;
+
+	r.snap = snap;
+	r.mark = mark;
+	if (!spsc_push(&retired, &r))
+		return;
+	// so the thread starts checking on it
+	if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+		one = 0;
+}
+
+/* Stops the reload thread, freeing what it still holds. The audio
+ * thread must have been stopped first.
+ */
+void reload_stop(void) {
+	const Retired * r;
+	void * snap;
+
+	if (running) {
+		__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+		reload_request();
+		pthread_join(thread, NULL);
+		running = 0;
+
+		snap = reload_take();
+		if (snap != NULL)
+			drop(snap);
+		while ((r = spsc_peek(&retired)) != NULL) {
+			drop(r->snap);
+			spsc_drop(&retired);
+		}
+	}
+	if (watch_fd >= 0)
+		close(watch_fd);
+	if (wake_fd >= 0)
+		close(wake_fd);
+	watch_fd = wake_fd = -1;
+}
@@ -0,0 +1,71 @@
+/* reload.h - Config reloading for the 'minimalist' repeater
+ * controller.
+ *
+ * Watches the config file (with inotify, on its directory so an
+ * editor that saves by renaming is seen too) and reloads it when it
+ * changes or on SIGHUP, without a restart, so PTT and the ID timer
+ * carry on as they were.
+ *
+ * The reload thread parses the file and builds everything derived
+ * from it (the Morse timelines, tone sequences and audio clips) into
+ * a new snapshot, through the 'load' hook. A file that doesn't parse
+ * or has a bad setting gives no snapshot, and nothing changes. A good
+ * one is published with a single atomic pointer swap; the control
+ * thread takes it with reload_take() once it is between an ID and a
+ * courtesy beep, and hands back the one it replaced, which is freed
+ * when the audio engine is done with its clips.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: reload.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __RELOAD_H__
+#define __RELOAD_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RELOAD_SETTLE   200     // in mS, quiet time after a change before reloading
+#define RELOAD_RETIRED  4       // replaced snapshots waiting to be freed
+#define RELOAD_CHECK    100     // in mS, how often those are checked
+
+/* Builds a snapshot from 'file' on top of 'base' (the newest one
+ * published), or returns NULL if the file is bad
+ */
+typedef void * (*ReloadLoad)(const char * file, const void * base);
+/* Frees a snapshot */
+typedef void (*ReloadFree)(void * snap);
+
+/* Starts the reload thread watching 'file', on CPU 'cpu' (-1 =
+ * any). 'current' is the snapshot in use. Returns 1 on success.
+ */
+int reload_start(const char * file, int cpu, void * current,
+                 ReloadLoad load, ReloadFree drop);
+/* Asks for a reload, safe from a signal handler */
+void reload_request(void);
+/* Returns 1 if a new snapshot is waiting for the control thread */
+int reload_pending(void);
+/* Takes the waiting snapshot, NULL if there is none. Control
+ * thread only.
+ */
+void * reload_take(void);
+/* Hands back the snapshot the control thread replaced, to be freed
+ * once the audio engine has passed 'mark' (see audio_mark())
+ */
+void reload_retire(void * snap, unsigned int mark);
+/* Stops the reload thread, freeing what it still holds */
+void reload_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __RELOAD_H__
@@ -0,0 +1,208 @@
+/* repeat.c - Repeat audio path for the 'minimalist' repeater
+ * controller.
+ *
+ * Both ends of the line are on the aio thread, which each pass
+ * writes a TX period and then reads an RX one, so the audio going
+ * out is read 'delay' samples (a period at the least) behind the
+ * audio coming in, and the line needs no locking. If the two sides
+ * drift apart by more than a period, e.g. two sound devices on
+ * clocks of their own, the read side is put back and the resync
+ * counted.
+ *
+ * The gate is [open_at, close_at), in samples of receive audio. The
+ * control thread stores open_at and then close_at (release), and
+ * the aio thread loads close_at (acquire) and then open_at, so the
+ * new close_at is only seen with the new open_at, and an old
+ * close_at with a new open_at is an empty gate, never one reaching
+ * back to the last over's squelch crash. Each sample's gain
+ * steps towards 1 inside the gate and 0 outside it, and a mute
+ * starts its fade early enough to be silent by close_at.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: repeat.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <limits.h>
+#include "repeat.h"
+#include "stats.h"
+
+static short line[REPEAT_LINE];
+static int rate;
+static int delay;               // in samples
+static int mute;
+static int fade;
+static float step;              // the gain's, each sample of a fade
+static int ready;
+
+// the aio thread's
+static long long w;             // samples put in the line
+static long long r;             // the next one out
+static long long w_last;        // w at the last TX period
+static int started;
+static float gain;
+static unsigned long resyncs;
+
+// shared with the control thread
+static long long written;       // w
+static long long sent;          // r
+static long long open_at = LLONG_MAX;
+static long long close_at = LLONG_MAX;
+
+// the control thread's
+static unsigned long opens;
+static unsigned long closes;
+static unsigned long late;      // closes that came after the audio went out
+
+/* Sets the path up for audio at 'rate' Hz, delayed 'delay_ms', the
+ * last 'mute_ms' before a COR drop held back and 'fade_ms' fades.
+ * Returns 0 (and prints why) if they don't fit.
+ */
+int repeat_init(int r_hz, int delay_ms, int mute_ms, int fade_ms) {
+	if (delay_ms < 1 || delay_ms > REPEAT_MAX || r_hz > 48000) {
+		printf("Repeat: Delay is 1 to %d mS, at up to 48 kHz\n",REPEAT_MAX);
+		return(0);
+	}
+	if (mute_ms < 0 || mute_ms > delay_ms) {
+		printf("Repeat: Mute can't be more than the %d mS Delay\n",delay_ms);
+		return(0);
+	}
+	if (fade_ms < 0 || fade_ms > REPEAT_MAX_FADE) {
+		printf("Repeat: Fade is 0 to %d mS\n",REPEAT_MAX_FADE);
+		return(0);
+	}
+	rate = r_hz;
+	delay = (int)((long long)rate * delay_ms / 1000);
+	mute = (int)((long long)rate * mute_ms / 1000);
+	fade = (int)((long long)rate * fade_ms / 1000);
+	step = (fade > 0) ? 1.0f / fade : 1.0f;
+
+	// closed, and the line empty
+	w = r = w_last = written = sent = 0;
+	open_at = close_at = LLONG_MAX;
+	started = 0;
+	gain = 0;
+	resyncs = opens = closes = late = 0;
+	ready = 1;
+	return(1);
+}
+
+/* Returns 1 once the path is set up
+ */
+int repeat_ready(void) {
+	return(ready);
+}
+
+/* Puts 'n' frames of receive audio into the line, the first of
+ * 'stride' channels
+ */
+void repeat_rx(const short * pcm, int n, int stride) {
+	int i;
+
+	if (!ready)
+		return;
+	for (i = 0; i < n; i++)
+		line[(w + i) & (REPEAT_LINE - 1)] = pcm[i * stride];
+	w += n;
+	__atomic_store_n(&written, w, __ATOMIC_RELAXED);
+}
+
+/* Mixes the line's audio, as far as the gate is open, into 'n'
+ * samples of transmit audio
+ */
+void repeat_tx(short * pcm, int n) {
+	long long ca = __atomic_load_n(&close_at, __ATOMIC_ACQUIRE);
+	long long oa = __atomic_load_n(&open_at, __ATOMIC_RELAXED);
+	long long k;
+	int d = (delay > n) ? delay : n;
+	int i;
+
+	if (!ready)
+		return;
+
+	// keep the read side 'd' behind, unless the input has stopped
+	if (!started || (w != w_last && (r > w - d + n || r < w - d - n))) {
+		if (started)
+			resyncs++;
+		r = w - d;
+		started = 1;
+	}
+	if (w != w_last)
+		stats_record(ST_REPEAT_DELAY, (w - r) * 1000000000LL / rate);
+	w_last = w;
+
+	for (i = 0, k = r; i < n; i++, k++) {
+		float x = (k >= 0 && k < w) ? line[k & (REPEAT_LINE - 1)] : 0;
+		float target = (k >= oa && k + fade < ca) ? 1.0f : 0.0f;
+		float v;
+
+		if (gain < target) {
+			gain += step;
+			if (gain > target)
+				gain = target;
+		} else if (gain > target) {
+			gain -= step;
+			if (gain < target)
+				gain = target;
+		}
+		v = pcm[i] + gain * x;
+		pcm[i] = (v > 32767) ? 32767 : (v < -32768) ? -32768 : (short)v;
+	}
+	r += n;
+	__atomic_store_n(&sent, r, __ATOMIC_RELAXED);
+}
+
+/* Opens the gate from the COR edge, which was 'lag_ns' ago, so the
+ * audio the debouncer held back goes out too. Never reaches back
+ * past the last close.
+ */
+void repeat_open(long long lag_ns) {
+	long long at;
+	long long last = __atomic_load_n(&close_at, __ATOMIC_RELAXED);
+
+	if (!ready)
+		return;
+	if (lag_ns < 0 || lag_ns > 1000000000LL)
+		lag_ns = 0;
+	at = __atomic_load_n(&written, __ATOMIC_RELAXED) - lag_ns * rate / 1000000000LL;
+	if (last != LLONG_MAX && at < last)
+		at = last;
+	__atomic_store_n(&open_at, at, __ATOMIC_RELAXED);
+	__atomic_store_n(&close_at, LLONG_MAX, __ATOMIC_RELEASE);
+	opens++;
+}
+
+/* Closes the gate Mute mS before the COR drop, which was 'lag_ns'
+ * ago
+ */
+void repeat_close(long long lag_ns) {
+	long long at;
+
+	if (!ready)
+		return;
+	if (lag_ns < 0 || lag_ns > 1000000000LL)
+		lag_ns = 0;
+	at = __atomic_load_n(&written, __ATOMIC_RELAXED) - mute - lag_ns * rate / 1000000000LL;
+	if (at < __atomic_load_n(&open_at, __ATOMIC_RELAXED))
+		at = __atomic_load_n(&open_at, __ATOMIC_RELAXED);
+	if (at < __atomic_load_n(&sent, __ATOMIC_RELAXED))
+		late++;
+	__atomic_store_n(&close_at, at, __ATOMIC_RELEASE);
+	closes++;
+}
+
+/* Prints the path's settings and counters
+ */
+void repeat_dump(FILE * fp) {
+	if (!ready)
+		return;
+	fprintf(fp, "Repeat audio: %.1f mS delay, the last %.1f mS before a COR drop held back, %.1f mS fades\n",
+		delay * 1000.0 / rate, mute * 1000.0 / rate, fade * 1000.0 / rate);
+	fprintf(fp, "  %lu opens, %lu closes, %lu too late to hold back, %lu resyncs\n",
+		opens, closes, late, resyncs);
+}
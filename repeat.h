@@ -0,0 +1,77 @@
+/* repeat.h - Repeat audio path for the 'minimalist' repeater
+ * controller.
+ *
+ * Carries the first port's receiver audio (the first input channel)
+ * to the transmitter, mixed in with the IDs and beeps, through a
+ * delay line of a fixed length. The delay is what lets the audio be
+ * muted after the fact: when COR drops, the last Mute mS before the
+ * drop are still in the line, and never go out, so the receiver's
+ * squelch crash isn't repeated. Muting and unmuting fade over Fade
+ * mS, so they don't click.
+ *
+ * The line is filled and emptied on the aio thread, a period at a
+ * time (see audioio.c), at the same cost for every sample whether
+ * the path is open or not, and nothing is allocated. The control
+ * thread opens and closes it when the debounced COR changes; the
+ * gate is kept as two positions in the receive audio, so a close can
+ * reach back in time.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: repeat.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __REPEAT_H__
+#define __REPEAT_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPEAT_LINE     32768   // samples, a power of 2: the longest delay and a period at 48 kHz
+#define REPEAT_MAX      500     // in mS, the longest delay
+#define REPEAT_MAX_FADE 50      // in mS
+
+#define DEFAULT_REPEAT_DELAY    200     // in mS, RX to TX
+#define DEFAULT_REPEAT_MUTE     100     // in mS, before the COR drop
+#define DEFAULT_REPEAT_FADE     5       // in mS, of a mute or unmute
+
+/* Sets the path up for audio at 'rate' Hz, delayed 'delay_ms', the
+ * last 'mute_ms' before a COR drop held back and 'fade_ms' fades.
+ * Returns 0 (and prints why) if they don't fit.
+ */
+int repeat_init(int rate, int delay_ms, int mute_ms, int fade_ms);
+/* Returns 1 once the path is set up */
+int repeat_ready(void);
+/* Puts 'n' frames of receive audio into the line, the first of
+ * 'stride' channels. The aio thread.
+ */
+void repeat_rx(const short * pcm, int n, int stride);
+/* Mixes the line's audio, as far as the gate is open, into 'n'
+ * samples of transmit audio. The aio thread.
+ */
+void repeat_tx(short * pcm, int n);
+/* Opens the gate from the COR edge, which was 'lag_ns' ago, but not
+ * before the last close. The control thread.
+ */
+void repeat_open(long long lag_ns);
+/* Closes the gate Mute mS before the COR drop, which was 'lag_ns'
+ * ago. The control thread.
+ */
+void repeat_close(long long lag_ns);
+/* Prints the path's settings and counters */
+void repeat_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __REPEAT_H__
@@ -28,11 +28,10 @@
  * and could be changed programatically, if desired (e.g. via the
  * serial port). Of course, you'd have to write that code.
  *
- * The ID Time out timer is implemented using the C time library and
- * is based on the elapsed time counter (unsigned long int seconds)
- * so timeout values are restricted to integer values greater than
- * one second. The squelch tail timer is implemented the same way,
- * so it has the same restrictions.
+ * The ID Time out timer and squelch tail timer are named timers in
+ * the timer service (timers.c), based on CLOCK_MONOTONIC with mS
+ * resolution, so they are not affected by wall clock steps. Both
+ * interval values are set in mS and can be changed in the config file.
  *
  * (C) 2013 KB4OID Labs - A division of Kodetroll Heavy Industries
  *
@@ -58,17 +57,45 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
 #include <time.h>
 #include <string.h>
 #include <getopt.h>
-#include <bcm2835.h>
+#include <signal.h>
 #include "ini.h"
 #include "rptrctrl.h"
+#include "corevent.h"
+#include "gpio.h"
+#include "stats.h"
+#include "debounce.h"
+#include "tasks.h"
+#include "rt.h"
+#include "evlog.h"
+#include "fsm.h"
+#ifdef SIMULATION
+#include "simclock.h"
+#endif
+#include "toneseq.h"
+#include "morse.h"
+#include "synth.h"
+#include "audiosink.h"
+#include "clipcache.h"
+#include "audio.h"
+#include "audioio.h"
+#include "ctcss.h"
+#include "squelch.h"
+#include "repeat.h"
+#include "dtmf.h"
+#include "pipeline.h"
+#include "reload.h"
 //#include "pitches.h"
 
 
 // 17.21.22
-// This is where we define what DIO PINs map to what functions
+// This is where we define what DIO PINs map to what functions. These
+// are the pins of the first port, unless its [PORT1] section says
+// otherwise.
 int PTT_PIN = 17;		// DIO Pin number for the PTT out - 17
 int COR_PIN = 27;		// DIO Pin number for the COR in - 18
 int COR_LED = 22;		// DIO Pin number for the undebounced COR indicator LED - 22
@@ -77,44 +104,32 @@ int PWM_PIN = 18;		// PWM Pin for the ID Audio output tone
 
 int pwm_div = PWM_DIV;
 
-// This is where the callsign is mapped in dah/dit/spaces
-// e.g. N0S would be 3,1,0,3,3,3,3,3,0,3,3,3,0
-// Put your call here, then count the number of elements and set
-// NumElements below
-int Elements[200];
-
-char Callsign[30];
+// The CW ID and courtesy beep characteristics, the callsign and the
+// timers: the settings a config reload can change. Each port's
+// callsign is compiled into a keying timeline (see morse.c) and its
+// tone sequences built into a Snapshot, once per config, and Snap is
+// the one the ports are running on.
+Settings Set;
+Snapshot * Snap;
+int CallGiven;          // set by --call, the config's Callsign is then ignored
+Arena * CfgArena;       // the loaded config's strings, PortConf points into it
 
 char cfgFile[50];
 
-// Here's where we define some of the CW ID characteristics
-int NumElements = 0;     // This is the number of elements in the ID
-int ID_tone = 1200;       // Audio frequency of CW ID
-int BEEP_type = CBEEP_SINGLE;    // Courtesy Beep Type
-int BEEP_tone1 = 1000;    // Audio frequency of Courtesy Beep 1
-int BEEP_tone2 = 800;     // Audio frequency of Courtesy Beep 2
-int BeepDuration = 2;     // Courtesy Tone length (in CWID increments)
-int CW_TIMEBASE = 50;     // CW ID Speed (This is a delay in mS)
-// (50 is about 20wpm)
-
-// Timer definitions
-time_t ticks;            // Current elapsed time in seconds
-time_t IDTimer;          // next expire time for ID timer
-time_t SQTimer;          // next expire time for Squelch Tail timer
-
-// timer reset value definitions
-int SQTimerValue;        // Squelch Tail interval time - in Seconds
-int IDTimerValue;        // ID Timer interval time - in Seconds
-
-// rptr run states
-int nextState = 0;  // next state
-int rptrState = 0;  // current state
-int prevState = 0;  // previous state
-
-// various DIO pin states
-int COR_Value;  // current COR value
-int pCOR_Value; // previous COR value
-int PTT_Value;  // current PTT state
+// Timer definitions (the deadlines themselves live in timers.c)
+msec_t ticks;            // Current elapsed time in mS
+
+// COR debounce windows - in mS
+int CORAssertTime = DEFAULT_COR_ASSERT;
+int CORReleaseTime = DEFAULT_COR_RELEASE;
+
+// The repeater ports, from the [PORTn] sections (or one port from
+// the globals if there are none). Each runs the state machine in
+// CtrlTable.
+extern const FsmDef CtrlFsmDef;
+Port Ports[PORT_MAX];
+int NumPorts = 1;
+port_config PortConf[PORT_MAX];
 
 // COR and PTT Logic sense
 int COR_SENSE = COR_NEG_LOGIC;
@@ -126,87 +141,160 @@ int COR_OFF;
 int PTT_ON;
 int PTT_OFF;
 
-int Need_ID;   // Whether on not we need to ID (was bool)
+long long BeepCutMax;   // worst COR edge to beep cut seen, in nS
+
+// Software tone generation, follows tone()/noTone() when a sink is set
+int SampleRate = DEFAULT_SAMPLE_RATE;  // in Hz
+int RampTime = DEFAULT_RAMP_TIME;      // key edge rise/fall time in mS
+int ToneLevel = DEFAULT_TONE_LEVEL;    // in percent of full scale
+char audioSpec[100];        // audio sink, e.g. 'alsa:default' ('' = none)
+char renderFile[100];       // render the ID to this WAV file and exit
+char cacheDir[100] = DEFAULT_CACHE_DIR;  // pre-rendered clip cache
+
+// The audio I/O engine, runs when there is an audio input
+char audioInSpec[100];      // receiver audio, e.g. 'alsa:default' ('' = none)
+int AudioIOPeriod = AIO_PERIOD;  // in mS
+int LatencyTest;            // round trip pings sent at startup
+int InputChannels = 1;      // one per receiver, port n's on channel n
+
+// Tone access, the receivers' CTCSS decoders run on their audio
+double CTCSSTone;           // in Hz, 0 = carrier access
+int CTCSSDetect = DEFAULT_CTCSS_DETECT;     // in mS
+int CTCSSRelease = DEFAULT_CTCSS_RELEASE;   // in mS
+Ctcss ToneDec[PORT_MAX];
+
+// Audio carrier detect, for receivers without a COR line
+int SquelchMode = SQ_PIN;           // every port's, -1 = not a mode
+double SquelchOpen = NAN;           // in dBFS, NAN = the mode's default
+double SquelchClose = NAN;
+int SquelchAttack = DEFAULT_SQ_ATTACK;      // in mS
+int SquelchRelease = DEFAULT_SQ_RELEASE;    // in mS
+Squelch SqDec[PORT_MAX];
+
+// The first port's receiver audio, repeated through a delay line
+int RepeatAudio;                            // 1 = on
+int RepeatDelay = DEFAULT_REPEAT_DELAY;     // in mS
+int RepeatMute = DEFAULT_REPEAT_MUTE;       // in mS, before a COR drop
+int RepeatFade = DEFAULT_REPEAT_FADE;       // in mS
+Debouncer RepeatDeb;                        // the first port's own receiver
+long long RepeatEdge;                       // its last COR edge, in nS
+
+// Remote control, the receivers' DTMF decoders run on their audio
+// and pass the digits to the control thread
+Dtmf DtmfDec[PORT_MAX];
+DtmfDigit DtmfBuf[DTMF_QUEUE];
+Spsc DtmfQ;
+int BeepChange = -1;        // a courtesy beep type to switch to, -1 = none
+
+// COR edge source
+int COR_Mode = COR_EVT_EVENT;   // how main() waits for COR edges
+int GPIO_Backend = DEFAULT_GPIO_BACKEND;  // how the pins are driven
+char gpioChip[50];              // GPIO character device for COR edges
+char corSimFile[100];           // edge script for the simulated source
+char traceFile[100];            // PTT/ID/LED trace output ('' = none)
+long long simTime = -1;         // mS of virtual time to simulate
+
+long long LoopStart;     // when the current loop() pass started
+
+// set by signal handlers, acted on by main()
+volatile sig_atomic_t DumpStats;
+volatile sig_atomic_t Quit;
+
+// the cyclic executive's tasks and their periods - in mS
+int CORPeriod = DEFAULT_COR_PERIOD;
+int ControlPeriod = DEFAULT_CONTROL_PERIOD;
+int TelemetryPeriod = DEFAULT_TELEMETRY_PERIOD;
+int CORTask = -1;
+int ControlTask = -1;
+int TelemetryTask = -1;
+unsigned long long Overruns;    // task overruns reported so far
 
 /* Flag set by ‘--verbose’. */
-static int verbose;
+int verbose;
 
 /* Flag set by ‘--debug’. */
-static int debug;
+int debug;
+
+/* Flag set by ‘--realtime’. */
+int Realtime;
+int RTPriority = RT_DEFAULT_PRIORITY;   // SCHED_FIFO priority
+int RTCpu = RT_DEFAULT_CPU;             // CPU to pin to, -1 = any
+int RTSelfTest = RT_DEFAULT_SELFTEST;   // jitter self-test wakeups
 
-/* This functions returns the current time in seconds from start
- * of UNIX epoch
+/* Flag set by ‘--pipeline’/‘--nopipeline’, the input, audio and
+ * io work on threads of their own. See [THREADS].
  */
-time_t now(void) {
+int Pipeline = 1;
+int InputCPU = -1;          // CPU for each thread, -1 = any
+int ControlCPU = -1;        // -1 = the [REALTIME] CPU
+int AudioCPU = -1;
+int IOCPU = -1;
+int AioCPU = -1;
 
-	time_t timer;
+/* Flag set by ‘--cwtiming’. */
+int CWTiming;
 
-	timer = time(NULL);
+/* Flag set by ‘--checkfsm’, 'make check' runs this. */
+int CheckFsm;
 
-	return(timer);
+/* Flag set by ‘--reload’/‘--noreload’, the config file is watched
+ * and reloaded when it changes. See [THREADS].
+ */
+int Reload = 1;
+
+/* This functions returns the current time in mS since the
+ * timer service was started (CLOCK_MONOTONIC based)
+ */
+msec_t now(void) {
+	return(now_ms());
 }
 
 /* This function emulates the arduino pinMode function,
  * setting the specified pin to the provided mode using
- * the bcm2835 library
+ * the selected GPIO backend
  */
 void pinMode(int pin,int value) {
-	// Set the pin to be an output
-	if (value == OUTPUT)
-	{
-		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
-		bcm2835_gpio_set_pud(pin, BCM2835_GPIO_PUD_OFF);
-	}
-	else
-	{
-		bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
-		bcm2835_gpio_set_pud(pin, BCM2835_GPIO_PUD_UP);
-	}
+	// Set the pin to be an output, or a pulled up input
+	gpio_mode(pin, value == OUTPUT);
 
 	if (debug)
-	{
-		if (value == OUTPUT)
-			printf("PM: 0x%02x: 0x%02x [OUTPUT]\n",pin,value);
-		else
-			printf("PM: 0x%02x: 0x%02x [INPUT]\n",pin,value);
-	}
+		log_event(EV_PIN_MODE, pin, value);
 }
 
 /* This function emulates the arduino digitalWrite
  * function, setting the specified pin to the
- * provided value using the bcm2835 library
+ * provided value. The write is queued, and goes out
+ * with the rest of the pass's changes at the end of
+ * loop() (only if the pin actually changes).
  */
 void digitalWrite(int pin,int value) {
 	if (debug)
-		printf("DW: 0x%02x: 0x%02x\n",pin,value);
+		log_event(EV_PIN_WRITE, pin, value);
 
-	bcm2835_gpio_write(pin, value);
+	gpio_write(pin, value);
 }
 
 /* This function emulates the arduino digitalRead
  * function, returning the value of the specified
- * pin using the bcm2835 library
+ * pin using the selected GPIO backend
  */
 int digitalRead(int pin) {
 	int value = 0;
-	value = bcm2835_gpio_lev(pin);
+	value = gpio_read(pin);
 	if (debug)
-		printf("DR: 0x%02x: 0x%02x\n",pin,value);
+		log_event(EV_PIN_READ, pin, value);
 	return(value);
 }
 
 /* This function emulates the arduino analogWrite
  * function, setting the specified PWM pin to the
- * provided value using the bcm2835 library
+ * provided value using the selected GPIO backend
  */
 void analogWrite(int pin,int value) {
 	// to be written
 	if (debug)
-		printf("AW: 0x%02x: 0x%02x\n",pin,value);
-	bcm2835_pwm_set_clock(pwm_div);
-	bcm2835_pwm_set_mode(PWM_CH, PWM_BALANCED, PWM_ON);
-	bcm2835_pwm_set_range(PWM_CH, PWM_RANGE);
-	bcm2835_pwm_set_data(PWM_CH, value);
+		log_event(EV_PWM, pin, value);
+	gpio_pwm(pwm_div, PWM_RANGE, value);
 }
 
 /* This function will turn on the CW ID key
@@ -217,10 +305,18 @@ void analogWrite(int pin,int value) {
 void tone(int pin, int freq, int duration)	 {
 	// Turn on ID Key
 	digitalWrite(pin, ON);
-	analogWrite(PWM_PIN,512);
-	pwm_div = PWM_CLK/freq;
+	// the divisor has to be set before the PWM is started,
+	// the PWM runs at PWM_CLK / (pwm_div * PWM_RANGE)
+	// There is one PWM and one audio sink, they follow the first
+	// port's ID, the other ports key external tone generators
+	if (pin == Ports[0].id_pin) {
+		pwm_div = PWM_CLK / (freq * PWM_RANGE);
+		analogWrite(PWM_PIN,PWM_RANGE / 2);
+		// and the software tone, unless a cached clip is playing it
+		audio_key(freq);
+	}
 	if (DEBUG_TONE)
-		printf("tone: %d, %d, %d\n",pin, freq, duration);
+		log_event(EV_TONE, pin, freq);
 }
 
 /* This function will turn off the CW ID key
@@ -230,53 +326,63 @@ void tone(int pin, int freq, int duration)	 {
  */
 void noTone(int pin) {
 	digitalWrite(pin, OFF);
-	analogWrite(PWM_PIN,OFF);
+	if (pin == Ports[0].id_pin) {
+		analogWrite(PWM_PIN,OFF);
+		audio_key(0);
+	}
 	if (DEBUG_TONE)
-		printf("noTone: %d\n",pin);
+		log_event(EV_NOTONE, pin, 0);
 }
 
 /* This function will reset the ID Timer by adding the
  * timer interval value to the current elapsed time
  */
-void reset_id_timer(void) {
-	IDTimer = ticks + IDTimerValue;
+void reset_id_timer(Port * p) {
+	timer_start(p->tmr + TMR_ID, p->id_timer);
 }
 
 
-/* This function will generate a beep of the
- * specified duration and frequency using PWM
- * (if enabled) and turn on the CW ID key
- * pin for the duration of the tone to enable
- * and external tone generator.
- * Note: This is a *Blocking call*
+/* This function starts the courtesy beep playing. loop()
+ * advances it with cbeep_poll().
+ * Note: This is NOT a *Blocking call*
  */
-void beep(int freq, int duration) {
-
+void cbeep_start(Port * p) {
 	if (DEBUG_BEEP)
-		printf("Beep: %d, %d\n",freq,duration);
-
-	// Start Playing the beep
-	tone(ID_PIN,freq,duration);
-
-	// Wait for the note to end
-	delay(duration);
+		log_port(p, EV_BEEP_START, Set.beep_type, seq_length(&p->beep_seq));
+	if (p == &Ports[0])
+		audio_play_clip(clip_get(&Snap->clips, CLIP_BEEP + Set.beep_type));
+	seq_start(&p->beep_seq);
+}
 
-	// stop playing the beep
-	noTone(ID_PIN);
+/* Advances the courtesy beep to the next edge if it is
+ * due. Returns 1 while the beep is still playing.
+ */
+int cbeep_poll(Port * p) {
+	if (seq_poll(&p->beep_seq))
+		return(1);
 	if (DEBUG_BEEP)
-		printf("Beep Done!\n");
+		log_port(p, EV_BEEP_DONE, 0, 0);
+	return(0);
 }
 
-/* This function will play the courtesy beep.
- * Note: This is a *Blocking call*
+/* Cuts the courtesy beep short, unkeying the tone.
  */
-void do_cbeep(int btype) {
+void cbeep_abort(Port * p) {
+	if (p == &Ports[0])
+		audio_stop_clip();
+	seq_abort(&p->beep_seq);
+}
 
-	// wait 200 mS
-	delay(ID_PTT_DELAY);
+/* Appends the courtesy beep to a tone sequence: a short
+ * delay, the beep tones for the given type and a little
+ * trailing delay.
+ */
+void cbeep_build(ToneSeq * seq, const Settings * set, int btype) {
 
 	// Calculate the Courtesy Tone duration
-	int BeepDelay = BeepDuration * CW_TIMEBASE;
+	int BeepDelay = set->beep_duration * set->cw_timebase;
+
+	seq_add(seq, 0, ID_PTT_DELAY);
 
 	switch(btype)
 	{
@@ -284,118 +390,211 @@ void do_cbeep(int btype) {
 			break;
 
 		case CBEEP_DEDOOP:
-			beep(BEEP_tone1,BeepDelay*2);
-			delay(BeepDelay);
-			beep(BEEP_tone2,BeepDelay);
+			seq_add(seq, set->beep_tone1, BeepDelay*2);
+			seq_add(seq, 0, BeepDelay);
+			seq_add(seq, set->beep_tone2, BeepDelay);
 			break;
 
 		case CBEEP_DODEEP:
-			beep(BEEP_tone2,BeepDelay*2);
-			delay(BeepDelay);
-			beep(BEEP_tone1,BeepDelay);
+			seq_add(seq, set->beep_tone2, BeepDelay*2);
+			seq_add(seq, 0, BeepDelay);
+			seq_add(seq, set->beep_tone1, BeepDelay);
 			break;
 
 		case CBEEP_DEDEEP:
-			beep(BEEP_tone1,BeepDelay);
-			delay(BeepDelay);
-			beep(BEEP_tone1,BeepDelay);
+			seq_add(seq, set->beep_tone1, BeepDelay);
+			seq_add(seq, 0, BeepDelay);
+			seq_add(seq, set->beep_tone1, BeepDelay);
 			break;
 
 		case CBEEP_SINGLE:
 		default:
-			beep(BEEP_tone1,BeepDelay);
+			seq_add(seq, set->beep_tone1, BeepDelay);
 			break;
 	}
 
-	// A little delay never hurts
-	delay(CW_MIN_DELAY);
-
+	seq_add(seq, 0, CW_MIN_DELAY);
 }
 
-/* this function will play the CW ID,
- * Note: This is a *BLOCKING CALL*
+/* Compiles a callsign into an ID keying timeline. Returns 0 if
+ * it didn't fit (the timeline holds what did).
  */
-void do_ID(void) {
-	int Element = 0;
+int id_compile(MorseTimeline * m, const char * call, const Settings * set) {
+	int wpm = set->cw_wpm;
 
-	// exit if we do not need to ID yet
-	if (!Need_ID)
-		return;
+	// no WPM given, so the old CWIDClockTime sets the dit length
+	if (wpm <= 0 && set->cw_timebase > 0)
+		wpm = 1200 / set->cw_timebase;
 
-	// We turn on the PTT output
-	PTT_Value = PTT_ON;
-	digitalWrite(PTT_PIN, PTT_Value);
+	return(morse_compile(m, call, wpm, set->cw_fwpm) >= 0);
+}
 
-	// wait 200 mS
-	delay(ID_PTT_DELAY);
+/* Builds the CW ID tone sequence from the ID keying timeline:
+ * PTT delay, the call, courtesy beep and PTT hang time.
+ */
+void id_build(ToneSeq * seq, const MorseTimeline * m, const Settings * set) {
+	int i;
+	unsigned int prev = 0;
 
-	// calculate the length of time to wait for the ID tone
-	// to quit playing.
-	int InterElementDelay = CW_TIMEBASE * 1.3;
+	seq_clear(seq);
 
-	if (debug)
-		printf("NumElements: %d\n",NumElements);
-
-	// We Play the ID elements
-	for (Element = 0; Element < NumElements; Element++) {
-		if (debug)
-			printf("Element: %d, Elements[%d]: %d\n",Element,Element,Elements[Element]);
-		if (Elements[Element] != 0) {
-			tone(ID_PIN,ID_tone,Elements[Element] * CW_TIMEBASE);
-			delay(Elements[Element] * InterElementDelay);
-			noTone(ID_PIN);
-		}
-		else
-			delay(InterElementDelay);
+	// wait 200 mS after PTT goes on
+	seq_add(seq, 0, ID_PTT_DELAY);
 
-		// add a little extra inter element delay
-		delay(CW_MIN_DELAY);
+	// We add the ID timeline, a gap then a tone for each
+	// key-on/key-off pair
+	for (i = 0; i + 1 < m->count; i += 2) {
+		seq_add(seq, 0, m->edge[i] - prev);
+		seq_add(seq, set->id_tone, m->edge[i + 1] - m->edge[i]);
+		prev = m->edge[i + 1];
 	}
 
 	// wait 200 mS
-	delay(ID_PTT_DELAY);
+	seq_add(seq, 0, ID_PTT_DELAY);
 
 	// do courtesy beep
-	do_cbeep(BEEP_type);
+	cbeep_build(seq, set, set->beep_type);
 
 	// we give a little PTT hang time
-	delay(ID_PTT_HANG);
+	seq_add(seq, 0, ID_PTT_HANG);
+
+	if (debug)
+		printf("ID segments: %d, length: %d mS\n",seq->count,seq_length(seq));
+}
+
+/* This function starts the CW ID: PTT goes on and the
+ * ID sequence starts playing. loop() advances it with
+ * id_poll().
+ * Note: This is NOT a *Blocking call*
+ */
+void id_start(Port * p) {
+
+	// We turn on the PTT output
+	p->ptt = PTT_ON;
+	digitalWrite(p->ptt_pin, p->ptt);
 
-	// Turn off the PTT
-	PTT_Value = PTT_OFF;
-	digitalWrite(PTT_PIN, PTT_Value);
+	if (p == &Ports[0])
+		audio_play_clip(clip_get(&Snap->clips, CLIP_ID));
+	seq_start(&p->id_seq);
+}
+
+/* Advances the CW ID to the next keying edge if it is due.
+ * Returns 1 while the ID is still playing.
+ */
+int id_poll(Port * p) {
+	return(seq_poll(&p->id_seq));
+}
 
-	// reset the ID timer
-	reset_id_timer();
+/* Stops the CW ID part way through. PTT is left as is.
+ */
+void id_abort(Port * p) {
+	if (p == &Ports[0])
+		audio_stop_clip();
+	seq_abort(&p->id_seq);
+}
 
-	// turn off need id
-	Need_ID = LOW;
+/* Renders the CW ID (with its courtesy beep) to a WAV file
+ */
+int render_id(char * file) {
+	char spec[110];
+	AudioSink * sink;
+	const Clip * clip;
+
+	clip = clip_get(&Snap->clips, CLIP_ID);
+	if (clip == NULL)
+		return(0);
+
+	snprintf(spec, sizeof(spec), "wav:%s", file);
+	sink = sink_open(spec, SampleRate);
+	if (sink == NULL)
+		return(0);
+	sink_write(sink, clip->pcm, clip->samples);
+	sink_close(sink);
+
+	printf("Rendered ID: %d samples @ %d Hz to '%s'\n",clip->samples,SampleRate,file);
+	return(1);
+}
+
+/* Renders the first port's ID and every courtesy beep type into
+ * a snapshot's clips, reusing clips that are already in the clip
+ * cache. Returns 1 on success.
+ */
+int build_clips(Snapshot * s) {
+	ToneSeq beeps[CLIP_COUNT - CLIP_BEEP];
+	ToneSeq * seqs[CLIP_COUNT];
+	msec_t t = now_ms();
+	int reused;
+	int i;
+
+	seqs[CLIP_ID] = &s->port[0].id_seq;
+	for (i = 0; i < CLIP_COUNT - CLIP_BEEP; i++) {
+		seq_init(&beeps[i], Ports[0].id_pin, TMR_BEEP);
+		cbeep_build(&beeps[i], &s->set, i);
+		seqs[CLIP_BEEP + i] = &beeps[i];
+	}
+
+	reused = clip_cache_build(&s->clips, cacheDir, seqs, SampleRate, RampTime, ToneLevel);
+	if (reused < 0) {
+		printf("Clip cache: render failed, using live tones\n");
+		return(0);
+	}
+	if (verbose)
+		printf("Clip cache: %d clips, %d reused, %lld mS\n",
+			CLIP_COUNT,reused,now_ms() - t);
+	return(1);
 }
 
 /* This function will print current repeater operating states
  * to the serial port. For debuggin purposes only.
  */
-void show_state_info(void) {
-	printf ("t: %d:state:%d,%d,%d:C:%d,%d:P:%d\n",now(),prevState, rptrState,nextState,COR_Value,pCOR_Value,PTT_Value);
+void show_state_info(Port * p) {
+	printf ("t: %lld:port %d:state:%s,%s:C:%d,%d:P:%d\n",now(),p->num,
+		fsm_state_name(&p->fsm, p->fsm.prev),
+		fsm_state_name(&p->fsm, p->fsm.state),p->cor,p->pcor,p->ptt);
 }
 
 /* Startup info */
 void Show_Start_Info(void)
 {
-	int i;
-	printf("Start Time: %d S\n",now());
-	printf("ID_Tone: %d Hz\n",ID_tone);
-	printf("Beep_Tone1: %d Hz\n",BEEP_tone1);
-	printf("Beep_Tone2: %d Hz\n",BEEP_tone2);
-	printf("CW ID Speed: %d mS\n",CW_TIMEBASE);
-	printf("BeepDuration: %d mS\n",BeepDuration);
-	printf("CallSign: '%s'\n",Callsign);
-	printf("NumElements: %d\n",NumElements);
-	printf("Elements: ");
-	for (i=0;i<NumElements;i++) {
-		printf("%d,",Elements[i]);
+	MorseTimeline * m = &Ports[0].morse;
+	int i, j;
+	printf("Start Time: %lld mS\n",now());
+	printf("ID Timer: %d mS\n",Ports[0].id_timer);
+	printf("SQ Timer: %d mS\n",Ports[0].sq_timer);
+	printf("COR Debounce: %d mS on, %d mS off\n",CORAssertTime,CORReleaseTime);
+	printf("ID_Tone: %d Hz\n",Set.id_tone);
+	printf("Beep_Tone1: %d Hz\n",Set.beep_tone1);
+	printf("Beep_Tone2: %d Hz\n",Set.beep_tone2);
+	printf("CW ID Speed: %d WPM",m->wpm);
+	if (m->fwpm)
+		printf(" (Farnsworth %d WPM)",m->fwpm);
+	printf(", dit %d mS\n",m->dit);
+	printf("BeepDuration: %d mS\n",Set.beep_duration * Set.cw_timebase);
+	printf("CallSign: '%s'\n",Ports[0].callsign);
+	printf("CW ID: %d edges, %u mS\n",m->count,m->length);
+	if (debug) {
+		printf("Edges: ");
+		for (i=0;i<m->count;i++) {
+			printf("%u,",m->edge[i]);
+		}
+		printf("\n");
+	}
+	if (NumPorts == 1)
+		return;
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+
+		printf("PORT%d: COR %d, PTT %d, LED %d, ID %d, CallSign '%s', "
+			"ID %d mS, SQ %d mS",p->num,p->cor_pin,p->ptt_pin,
+			p->cor_led,p->id_pin,p->callsign,p->id_timer,p->sq_timer);
+		if (p->links) {
+			printf(", keys up");
+			for (j = 0; j < NumPorts; j++)
+				if (p->links & (1U << j))
+					printf(" PORT%d",Ports[j].num);
+		}
+		printf("\n");
 	}
-	printf("\n");
 }
 
 /* Sets the COR Sense (COR ON as HIGH or LOW)
@@ -425,244 +624,548 @@ void setPTT_Sense(int Sense) {
 	}
 }
 
-/* Converts an ASCII character to a string of numbers
- * representing the Morse elements of the character.
+/* Reads a whole number setting into 'v', if it is given. Returns 0
+ * if it isn't a number from 'min' to 'max'.
  */
-char* cvt2morse(char c) {
-	switch(c)
-	{
-		case 'A':
-		case 'a':
-			return("130");
-			break;
-		case 'B':
-		case 'b':
-			return("31110");
-			break;
-		case 'C':
-		case 'c':
-			return("31310");
-			break;
-		case 'D':
-		case 'd':
-			return("3110");
-			break;
-		case 'E':
-		case 'e':
-			return("10");
-			break;
-		case 'F':
-		case 'f':
-			return("11310");
-			break;
-		case 'G':
-		case 'g':
-			return("3310");
-			break;
-		case 'H':
-		case 'h':
-			return("11110");
-			break;
-		case 'I':
-		case 'i':
-			return("110");
-			break;
-		case 'J':
-		case 'j':
-			return("13330");
-			break;
-		case 'K':
-		case 'k':
-			return("3130");
-			break;
-		case 'L':
-		case 'l':
-			return("13110");
-			break;
-		case 'M':
-		case 'm':
-			return("330");
-			break;
-		case 'N':
-		case 'n':
-			return("310");
-			break;
-		case 'O':
-		case 'o':
-			return("3330");
-			break;
-		case 'P':
-		case 'p':
-			return("13310");
-			break;
-		case 'Q':
-		case 'q':
-			return("33130");
-			break;
-		case 'R':
-		case 'r':
-			return("1310");
-			break;
-		case 'S':
-		case 's':
-			return("1110");
-			break;
-		case 'T':
-		case 't':
-			return("30");
-			break;
-		case 'U':
-		case 'u':
-			return("1130");
-			break;
-		case 'V':
-		case 'v':
-			return("11130");
-			break;
-		case 'W':
-		case 'w':
-			return("1330");
-			break;
-		case 'X':
-		case 'x':
-			return("31130");
-			break;
-		case 'Y':
-		case 'y':
-			return("31330");
-			break;
-		case 'Z':
-		case 'z':
-			return("33110");
-			break;
-		case '0':
-			return("333330");
-			break;
-		case '1':
-			return("133330");
-			break;
-		case '2':
-			return("113330");
-			break;
-		case '3':
-			return("111330");
-			break;
-		case '4':
-			return("111130");
-			break;
-		case '5':
-			return("111110");
-			break;
-		case '6':
-			return("311110");
-			break;
-		case '7':
-			return("331110");
-			break;
-		case '8':
-			return("333110");
-			break;
-		case '9':
-			return("333310");
-			break;
-		default:
-			return("0");
-			break;
+static int cfg_int(const char * name, const char * value, int min, int max, int * v) {
+	char * end;
+	long n;
+
+	if (value == NULL)
+		return(1);
+	n = strtol(value, &end, 10);
+	if (end == value || *end != '\0' || n < min || n > max) {
+		printf("Config: %s '%s' isn't a number from %d to %d\n",name,value,min,max);
+		return(0);
+	}
+	*v = (int)n;
+	return(1);
+}
+
+/* Reads a decimal setting into 'v', if it is given. Returns 0 if it
+ * isn't a number from 'min' to 'max'.
+ */
+static int cfg_double(const char * name, const char * value, double min, double max, double * v) {
+	char * end;
+	double n;
+
+	if (value == NULL)
+		return(1);
+	n = strtod(value, &end);
+	if (end == value || *end != '\0' || !(n >= min && n <= max)) {
+		printf("Config: %s '%s' isn't a number from %g to %g\n",name,value,min,max);
+		return(0);
+	}
+	*v = n;
+	return(1);
+}
+
+/* Reads a pin number from port 'num's 'name' setting into 'pin', if
+ * it is given. Returns 0 if it isn't one from 'min' (-1 for none) to
+ * GPIO_MAX_PINS - 1.
+ */
+static int port_pin(int num, const char * name, const char * value, int min, int * pin) {
+	char key[32];
+
+	snprintf(key, sizeof(key), "PORT%d %s", num, name);
+	return(cfg_int(key, value, min, GPIO_MAX_PINS - 1, pin));
+}
+
+/* Works out a squelch mode's Open and Close levels, the [SQUELCH]
+ * ones or the mode's defaults
+ */
+static void squelch_levels(int mode, double * open, double * close) {
+	squelch_defaults(mode, open, close);
+	if (!isnan(SquelchOpen))
+		*open = SquelchOpen;
+	if (!isnan(SquelchClose))
+		*close = SquelchClose;
+}
+
+/* Fills in the ports' pins from the [PORTn] sections, or makes one
+ * port on the global pins if there are none. Works out which
+ * receivers key up which ports. Returns 0 if a port is bad. Their
+ * callsigns and timers come with the snapshot, see snap_build().
+ */
+int port_init(void) {
+	int i, j, ok;
+
+	for (i = 0; i < NumPorts; i++) {
+		port_config * pc = &PortConf[i];
+		Port * p = &Ports[i];
+		const char * l;
+		double tone;
+
+		memset(p, 0, sizeof(*p));
+		p->num = i + 1;
+		p->tmr = i * TMR_COUNT;
+		p->log = (NumPorts > 1) ? p->num : 0;
+
+		// the first port keeps the old pins, the others have
+		// to be given
+		p->ptt_pin = (i == 0) ? PTT_PIN : -1;
+		p->cor_pin = (i == 0) ? COR_PIN : -1;
+		p->cor_led = (i == 0) ? COR_LED : -1;
+		p->id_pin = (i == 0) ? ID_PIN : -1;
+		ok = port_pin(p->num, "PTTPin", pc->pttpin, 0, &p->ptt_pin);
+		ok &= port_pin(p->num, "CORPin", pc->corpin, -1, &p->cor_pin);
+		ok &= port_pin(p->num, "CORLED", pc->corled, 0, &p->cor_led);
+		ok &= port_pin(p->num, "IDPin", pc->idpin, 0, &p->id_pin);
+		if (!ok)
+			return(0);
+		if (p->ptt_pin < 0 || p->cor_led < 0 || p->id_pin < 0) {
+			printf("PORT%d needs PTTPin, CORLED and IDPin\n",p->num);
+			return(0);
+		}
+
+		// CTCSS=100.0 - its receiver's tone, 0 for none
+		p->tone = -1;
+		tone = CTCSSTone;
+		if (!cfg_double("PORT CTCSS", pc->ctcss, 0, CTCSS_TONE_MAX, &tone))
+			return(0);
+		if (tone > 0) {
+			p->tone = ctcss_tone_index(tone);
+			if (p->tone < 0) {
+				printf("PORT%d: %.1f Hz isn't a CTCSS tone\n",p->num,tone);
+				return(0);
+			}
+		}
+
+		// Squelch=VOX - where its COR comes from: Pin, VOX or Noise
+		p->squelch = (pc->squelch != NULL) ? squelch_mode(pc->squelch) : SquelchMode;
+		if (p->squelch < 0) {
+			printf("PORT%d: Squelch is Pin, VOX or Noise\n",p->num);
+			return(0);
+		}
+		if (p->squelch != SQ_PIN) {
+			double open, close;
+
+			squelch_levels(p->squelch, &open, &close);
+			if (!squelch_check(p->squelch, open, close))
+				return(0);
+		} else if (p->cor_pin < 0) {
+			printf("PORT%d needs a CORPin, or Squelch VOX or Noise\n",p->num);
+			return(0);
+		}
+
+		// Link=2,3 - this port's receiver keys up ports 2 and 3 too
+		for (l = pc->link; l != NULL && *l != '\0'; l++) {
+			int n = atoi(l);
+
+			if (n < 1 || n > NumPorts || n == p->num) {
+				printf("PORT%d: can't link to port %d\n",p->num,n);
+				return(0);
+			}
+			p->links |= 1U << (n - 1);
+			l = strchr(l, ',');
+			if (l == NULL)
+				break;
+		}
+
+		// the pin names in the output trace
+		if (NumPorts > 1) {
+			snprintf(p->names[0], sizeof(p->names[0]), "PTT%d", p->num);
+			snprintf(p->names[1], sizeof(p->names[1]), "LED%d", p->num);
+			snprintf(p->names[2], sizeof(p->names[2]), "ID%d", p->num);
+		} else {
+			strcpy(p->names[0], "PTT");
+			strcpy(p->names[1], "LED");
+			strcpy(p->names[2], "ID");
+		}
+	}
+
+	// each port hears its own receiver and the ones linked to it
+	for (i = 0; i < NumPorts; i++) {
+		Ports[i].hears = 1U << i;
+		for (j = 0; j < NumPorts; j++)
+			if (Ports[j].links & (1U << i))
+				Ports[i].hears |= 1U << j;
+	}
+	return(1);
+}
+
+/* DTMF decoder callback, on the audio thread: passes the digit to
+ * the control thread. 'arg' is the port's index.
+ */
+static void dtmf_rx(char digit, long long at, void * arg) {
+	DtmfDigit d;
+
+	d.port = (int)(long)arg;
+	d.digit = digit;
+	spsc_push(&DtmfQ, &d);
+}
+
+/* aio listener, on the audio thread: feeds each receiver's audio
+ * to its CTCSS, DTMF and squelch decoders
+ */
+static void port_rx(const AioPeriod * a, void * arg) {
+	int heard = *(int *)arg;
+	int i;
+
+	for (i = 0; i < heard; i++) {
+		if (Ports[i].tone >= 0)
+			ctcss_feed(&ToneDec[i], a->pcm + i, a->n, a->channels);
+		if (DtmfDec[i].block > 0)
+			dtmf_feed(&DtmfDec[i], a->pcm + i, a->n, a->channels);
+		if (Ports[i].squelch != SQ_PIN)
+			squelch_feed(&SqDec[i], a->pcm + i, a->n, a->channels, a->t);
+	}
+}
+
+/* Starts the decoders on the 'channels' channels of receiver audio:
+ * DTMF on every port that has audio, CTCSS on the ones with a tone
+ * and squelch on the ones whose COR comes from the audio. A port
+ * with a tone and no audio goes on COR alone, and one with audio
+ * squelch and no audio on its COR pin.
+ */
+void rx_init(int channels) {
+	static int heard;       // ports with receiver audio
+	int i;
+
+	spsc_init(&DtmfQ, "dtmf", DtmfBuf, DTMF_QUEUE, sizeof(DtmfDigit));
+	heard = (channels < NumPorts) ? channels : NumPorts;
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+
+		if (i >= heard) {
+			if (p->tone >= 0)
+				printf("PORT%d: no receiver audio for CTCSS, on COR alone\n",p->num);
+			p->tone = -1;
+			if (p->squelch != SQ_PIN && p->cor_pin < 0) {
+				printf("PORT%d: no receiver audio for %s and no CORPin, it never keys up\n",p->num,squelch_mode_name(p->squelch));
+				continue;
+			}
+			if (p->squelch != SQ_PIN)
+				printf("PORT%d: no receiver audio for %s, on its COR pin\n",p->num,squelch_mode_name(p->squelch));
+			p->squelch = SQ_PIN;
+			continue;
+		}
+		// a rate too low for DTMF leaves that decoder off
+		dtmf_init(&DtmfDec[i], SampleRate, dtmf_rx, (void *)(long)i);
+		if (p->squelch != SQ_PIN) {
+			double open, close;
+
+			squelch_levels(p->squelch, &open, &close);
+			if (squelch_init(&SqDec[i], SampleRate, p->squelch, open, close, SquelchAttack, SquelchRelease))
+				printf("PORT%d: %s squelch on audio channel %d, open %.1f close %.1f dBFS\n",
+					p->num,squelch_mode_name(p->squelch),i + 1,open,close);
+			else if (p->cor_pin >= 0)
+				p->squelch = SQ_PIN;
+		}
+		if (p->tone < 0)
+			continue;
+		if (ctcss_init(&ToneDec[i], SampleRate, p->tone, CTCSSDetect, CTCSSRelease))
+			printf("PORT%d: CTCSS %.1f Hz on audio channel %d\n",p->num,ctcss_tones[p->tone],i + 1);
+		else
+			p->tone = -1;
 	}
+	if (heard > 0 && !aio_listen(port_rx, &heard))
+		printf("Receiver audio: too many audio listeners\n");
 }
 
-/* Converts call sign ASCII string to 'elements' and
- * stores this in the global Elements array for later
- * playback.
+/* Prints the decoders' counters
  */
-int ConvertCall(char * call) {
+void rx_dump(FILE * fp) {
 	int i;
-	char l[200];
-	memset(l,0x00,sizeof(l));
 
-//	printf("call: '%s'\n",call);
-	for (i=0;i<strlen(call);i++) {
-		strcat(l,cvt2morse(call[i]));
+	for (i = 0; i < NumPorts; i++) {
+		if (Ports[i].tone >= 0)
+			ctcss_dump(&ToneDec[i], Ports[i].num, fp);
+		if (Ports[i].squelch != SQ_PIN)
+			squelch_dump(&SqDec[i], Ports[i].num, fp);
 	}
-//	printf("l: '%s'\n",l);
-//	printf("sizeof(Elements): %d\n",sizeof(Elements));
-	for (i=0;i<sizeof(Elements)/SIZE_OF_INT;i++) {
-		Elements[i] = 0;
+	if (DtmfQ.buf == NULL)
+		return;
+	for (i = 0; i < NumPorts; i++)
+		if (DtmfDec[i].block > 0)
+			fprintf(fp, "DTMF port %d: %lu digits\n", Ports[i].num, DtmfDec[i].digits);
+}
+
+#ifndef SIMULATION
+/* Starts the repeat audio path, if it is on and there is an audio
+ * output ('out') to repeat to. The simulator has no receiver audio.
+ */
+static void repeat_setup(int out) {
+	if (!RepeatAudio)
+		return;
+	if (!out) {
+		printf("Repeat audio: needs an audio output\n");
+		return;
+	}
+	if (!repeat_init(SampleRate, RepeatDelay, RepeatMute, RepeatFade))
+		return;
+	printf("Repeat audio: %d mS delay, the last %d mS before a COR drop held back\n",RepeatDelay,RepeatMute);
+	// COR is only seen to drop once the debouncer lets it go
+	if (RepeatMute + CORReleaseTime > RepeatDelay)
+		printf("Repeat audio: Delay under Mute + the %d mS COR release, the end may get out\n",CORReleaseTime);
+}
+#endif
+
+/* Builds a snapshot from the settings: each port's callsign and
+ * timers, Morse timeline and tone sequences, and if 'clips' the
+ * first port's clips. Only reads the ports' pins and timers, which
+ * don't change after port_init(), so the reload thread can call it.
+ * The snapshot goes in arena 'a' (a new one if NULL), which is freed
+ * with it, or here if there isn't the memory and NULL is returned.
+ */
+Snapshot * snap_build(const Settings * set, int clips, Arena * a) {
+	Snapshot * s = NULL;
+	int i;
+
+	if (a == NULL)
+		a = arena_new("snapshot", ARENA_BLOCK);
+	if (a != NULL)
+		s = arena_alloc(a, sizeof(*s));
+	if (s == NULL) {
+		printf("No memory for the config\n");
+		arena_free(a);
+		return(NULL);
 	}
-	for (i=0;i<strlen(l);i++) {
-		Elements[i] = l[i]-0x30;
+	s->set = *set;
+	s->arena = a;
+
+	for (i = 0; i < NumPorts; i++) {
+		const Port * p = &Ports[i];
+		PortTones * pt = &s->port[i];
+
+		snprintf(pt->callsign, sizeof(pt->callsign), "%s",
+			(set->port[i].callsign[0] != '\0') ? set->port[i].callsign : set->callsign);
+		pt->id_timer = (set->port[i].id_timer >= 0) ? set->port[i].id_timer : set->id_timer;
+		pt->sq_timer = (set->port[i].sq_timer >= 0) ? set->port[i].sq_timer : set->sq_timer;
+
+		// compile the callsign into a keying timeline
+		if (!id_compile(&pt->morse, pt->callsign, set))
+			printf("CW ID '%s' too long, truncated\n",pt->callsign);
+
+		// build the CW ID once, it is played by loop()
+		seq_init(&pt->id_seq, p->id_pin, p->tmr + TMR_CWID);
+		id_build(&pt->id_seq, &pt->morse, set);
+		if (CWTiming)
+			pt->id_seq.stat = ST_CW_EDGE;
+
+		// and the courtesy beep
+		seq_init(&pt->beep_seq, p->id_pin, p->tmr + TMR_BEEP);
+		cbeep_build(&pt->beep_seq, set, set->beep_type);
 	}
 
-	return(i);
+	// the remote control codes, settings_parse() checked them
+	cmd_compile(&s->cmds, set->dtmf_pin, (const char (*)[CMD_CODE])set->dtmf_code);
+
+	// without the clips the live tones are used
+	if (clips)
+		build_clips(s);
+	return(s);
+}
+
+/* Frees a snapshot, with the arena it is in
+ */
+void snap_free(Snapshot * s) {
+	if (s == NULL)
+		return;
+	clip_cache_free(&s->clips);
+	arena_free(s->arena);
+}
+
+/* Switches the ports over to a snapshot. None of them may be
+ * sending an ID or courtesy beep. Running timers keep going, the
+ * new intervals are used the next time they are started. The
+ * intervals are the config's, so this undoes a remote IDTimer or
+ * SQTimer.
+ */
+void snap_apply(Snapshot * s) {
+	int i;
+
+	Snap = s;
+	Set = s->set;
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+		PortTones * pt = &s->port[i];
+
+		memcpy(p->callsign, pt->callsign, sizeof(p->callsign));
+		p->id_timer = pt->id_timer;
+		p->sq_timer = pt->sq_timer;
+		p->morse = pt->morse;
+		p->id_seq = pt->id_seq;
+		p->beep_seq = pt->beep_seq;
+	}
+}
+
+/* Builds the snapshot the controller starts on, and the tone
+ * synthesizer the clips are rendered with
+ */
+void build_tones(void) {
+
+	// software tone generation
+	synth_init(SampleRate, RampTime, ToneLevel);
+
+	snap_free(Snap);
+	Snap = snap_build(&Set, 0, NULL);
+	if (Snap == NULL)
+		exit(1);
+	snap_apply(Snap);
 }
 
 /* One time startup init loop */
 void setup(void) {
+	int i;
 
 	setCOR_Sense(COR_SENSE);
 	setPTT_Sense(PTT_SENSE);
 
-	// Determine the size of the Elements array
-//	NumElements = sizeof(Elements)/SIZE_OF_INT;
-//	printf("NumElements: %d\n",NumElements);
-
-//	printf("Callsign: '%s'\n",Callsign);
-
-	NumElements = ConvertCall(Callsign);
-//	printf("NumElements: %d\n",NumElements);
+	// ID, courtesy beep and tone generation
+	build_tones();
 
-	// Get a current tick timer value
+	// start the timer service and get a current tick timer value
+	timer_init();
 	ticks = now();
+	debounce_init(&RepeatDeb, CORAssertTime, CORReleaseTime,
+		DEBOUNCE_PERIOD, ticks);
+
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+
+		debounce_init(&p->deb, CORAssertTime, CORReleaseTime,
+			DEBOUNCE_PERIOD, ticks);
+
+		// incase any setup code needs to know what state we are in,
+		// loop() takes it from START to IDLE on its first pass
+		fsm_init(&p->fsm, &CtrlFsmDef, p);
+		p->wake = 1;
+		p->due = -1;
+
+		// setup the DIO pins for the right modes
+		pinMode(p->ptt_pin, OUTPUT);
+		if (p->cor_pin >= 0)
+			pinMode(p->cor_pin, INPUT);
+		pinMode(p->cor_led, OUTPUT);
+		pinMode(p->id_pin, OUTPUT);
+
+		// names for the output trace
+		gpio_name_pin(p->ptt_pin, p->names[0]);
+		gpio_name_pin(p->cor_led, p->names[1]);
+		gpio_name_pin(p->id_pin, p->names[2]);
+
+		// make sure we start with PTT and the ID key off
+		p->ptt = PTT_OFF;
+		digitalWrite(p->ptt_pin, PTT_OFF);
+		digitalWrite(p->id_pin, OFF);
+
+		// Get current values for COR, the squelch starts closed
+		p->cor_raw = (p->squelch != SQ_PIN) ? COR_OFF : digitalRead(p->cor_pin);
+		p->cor = p->pcor = COR_OFF;
+
+		// make sure we ID at startup.
+		p->need_id = HIGH;
+		timer_start(p->tmr + TMR_ID, 0);
+	}
 
-	// initialize the timers
-	SQTimerValue = DEFAULT_SQ_TIMER;
-	IDTimerValue = DEFAULT_ID_TIMER;
+	Show_Start_Info();
 
-	// incase any setup code needs to know what state we are in
-	rptrState = CS_START;
+	// and set the outputs
+	gpio_flush();
+}
 
-	// setup the DIO pins for the right modes
-	pinMode(PTT_PIN, OUTPUT);
-	pinMode(COR_PIN, INPUT);
-	pinMode(COR_LED, OUTPUT);
+/* Opens and closes the repeat audio on port 1's own receiver being
+ * heard, 'heard', debounced like a port's COR. The repeat audio is
+ * only that receiver's channel, so a linked receiver keying port 1
+ * up doesn't put its squelch noise on the air. Both ends are timed
+ * from the receiver's COR edge, or from now if the carrier didn't
+ * change (its tone came or went, or a remote disable).
+ */
+static void repeat_gate(int heard, msec_t t) {
+	int on = RepeatDeb.on;
+
+	if (heard != RepeatDeb.raw) {
+		if (Ports[0].cor_raw == (heard ? COR_ON : COR_OFF) && Ports[0].rx_edge > RepeatEdge)
+			RepeatEdge = Ports[0].rx_edge;
+		else
+			RepeatEdge = cor_clock_ns();
+	}
+	debounce_update(&RepeatDeb, heard, t);
+	if (RepeatDeb.on && !on)
+		repeat_open(cor_clock_ns() - RepeatEdge);
+	else if (!RepeatDeb.on && on)
+		repeat_close(cor_clock_ns() - RepeatEdge);
+}
 
-	// make sure we start with PTT off
-	digitalWrite(PTT_PIN, PTT_OFF);
+/* Retrieves the current COR sense from every port's COR input (or
+ * its audio squelch), works out what each port hears (its own receiver or a linked
+ * one), debounces that and lites the COR indicator LEDs. A receiver
+ * with a CTCSS tone is only heard while its tone is, and a port
+ * turned off by remote control hears nothing; the LED shows the
+ * carrier. Returns the ports whose COR or debounced COR changed.
+ */
+unsigned int get_cor(void) {
+	unsigned int active = 0;
+	unsigned int changed = 0;
+	msec_t t = now();
+	int i, j;
+
+	// Read the COR inputs
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+
+		if (p->squelch != SQ_PIN) {
+			int raw = squelch_on(&SqDec[i]) ? COR_ON : COR_OFF;
+
+			// the squelch changing is this receiver's COR edge,
+			// timed from the audio block that decided it
+			if (raw != p->cor_raw) {
+				p->rx_edge = squelch_changed(&SqDec[i]);
+				if (p->rx_edge <= 0 || p->rx_edge > cor_clock_ns())
+					p->rx_edge = cor_clock_ns();
+				for (j = 0; j < NumPorts; j++)
+					if (Ports[j].hears & (1U << i))
+						Ports[j].edge_time = p->rx_edge;
+			}
+			p->cor_raw = raw;
+		} else {
+			p->cor_raw = cor_read(i);
+		}
+		if (p->cor_raw == COR_ON && !p->disabled &&
+				(p->tone < 0 || ctcss_on(&ToneDec[i])))
+			active |= 1U << i;
 
-	// Get current values for COR
-	COR_Value = digitalRead(COR_PIN);
-	pCOR_Value = COR_Value;
+		// lite the external COR indicator LED
+		if (p->cor_raw == COR_ON)
+			digitalWrite(p->cor_led,HIGH);
+		else
+			digitalWrite(p->cor_led,LOW);
+	}
 
-	// Here is the first state we jump to
-	rptrState = CS_IDLE;
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+		int on = p->deb.on;
 
-	Show_Start_Info();
+		p->cor = (!p->disabled && (active & p->hears)) ? COR_ON : COR_OFF;
+		debounce_update(&p->deb, p->cor == COR_ON, t);
+		if (p->deb.on != on || p->cor != p->pcor)
+			changed |= 1U << i;
+	}
 
-	// make sure we ID at startup.
-	Need_ID = HIGH;
+	// the repeat audio is port 1's own receiver, whatever keys it up
+	if (repeat_ready())
+		repeat_gate((active & 1) != 0, t);
+	return(changed);
 }
 
-/* Retrieves the current COR sense from the COR PIN
- * saves the value to the global COR ver and lites
- * COR indicator LED
+/* Logs an event for a port, with its state, COR and PTT. The
+ * writer thread formats it and prints it later.
  */
-void get_cor(void) {
-
-	// Read the COR input and store it in a global
-	COR_Value = digitalRead(COR_PIN);
+void log_port(Port * p, int ev, long long a, long long b) {
+	evlog_push(ev, p->log, p->fsm.state, p->cor, p->ptt, a, b);
+}
 
-	// lite the external COR indicator LED
-	if (COR_Value == COR_ON)
-		digitalWrite(COR_LED,HIGH);
-	else
-		digitalWrite(COR_LED,LOW);
+/* Logs an event that isn't about any one port
+ */
+void log_event(int ev, long long a, long long b) {
+	log_port(&Ports[0], ev, a, b);
 }
 
 /* Prints a message to the screen or log
  */
-void show_msg(char * buf) {
-
-	printf ("[%d] %s\n",now(),buf);
+void show_msg(Port * p, int ev) {
+	log_port(p, ev, 0, 0);
 }
 
 /* Test loop
@@ -675,7 +1178,7 @@ void loop1(void) {
 	// grab the current COR value
 	get_cor();
 
-	printf("COR_Value[%d]: %d\n",ticks,COR_Value);
+	printf("COR_Value[%lld]: %d\n",ticks,Ports[0].cor);
 
 //  if (COR_Value == COR_ON) {
 //    printf("COR ON\n");
@@ -684,167 +1187,560 @@ void loop1(void) {
 
 }
 
-/* Master repeater state machine
+/* The state machine actions. Entry actions run on the way into a
+ * state, 'during' actions every pass spent in it, and the rest on
+ * the transition they are named in, in CtrlTable below. Each
+ * machine's context is its Port.
  */
-void loop(void) {
+static void ctrl_start(Fsm * fsm) {
+	show_msg(fsm->ctx, EV_START);
+}
 
-	// grab the current elapsed time
-	ticks = now();
+static void idle_entry(Fsm * fsm) {
+	show_msg(fsm->ctx, EV_IDLE);
+	if (verbose)
+		log_port(fsm->ctx, EV_GPIO_STATS, gpio_stats()->hw_writes,
+			gpio_stats()->writes - gpio_stats()->hw_writes);
+}
 
-	// grab the current COR value
-	get_cor();
+// COR went on, the debouncer gets timed from this edge
+static void cor_keyed(Fsm * fsm) {
+	Port * p = fsm->ctx;
 
-	// execute the state machine
-	switch(rptrState)
-	{
-		case CS_START:
-			// do nothing
-			show_msg("START");
-			rptrState = CS_IDLE;
+	p->on_edge = p->edge_time;
+}
 
-			break;
+// the debouncer has seen COR on for the whole assert window
+static void cor_good(Fsm * fsm) {
+	Port * p = fsm->ctx;
 
-		case CS_IDLE:
-			// wait for COR to activate, then jump to debounce
-			if (rptrState != prevState)
-				show_msg("IDLE");
-
-			prevState = rptrState;
-			if (COR_Value == COR_ON) {
-				pCOR_Value = COR_Value;
-				rptrState = CS_DEBOUNCE_COR_ON;
-			}
+	stats_since(ST_DEBOUNCE_ON, p->on_edge);
+	show_msg(p, EV_COR_ON);
+}
 
-			// look for ID timer expiry
-			if ((ticks > IDTimer) && Need_ID)
-				rptrState = CS_ID;
+static void ptt_on_entry(Fsm * fsm) {
+	Port * p = fsm->ctx;
 
-			break;
+	// turn on PTT, timed from the COR edge if it was off
+	if (p->ptt != PTT_ON)
+		p->ptt_on_from = p->on_edge;
+	p->ptt = PTT_ON;
+	digitalWrite(p->ptt_pin, p->ptt);
+	show_msg(p, EV_PTT_ON);
+	if (verbose)
+		log_port(p, EV_COR_PTT_ON, cor_clock_ns() - p->on_edge, 0);
+}
 
-		case CS_DEBOUNCE_COR_ON:
-			prevState = rptrState;
-			// ideally we will delay here a little while and test
-			// the current value (after the delay) with the pCOR_Value
-			// to prove its not a flake
-			delay(COR_DEBOUNCE_DELAY);
-			if ( pCOR_Value != digitalRead(COR_PIN)) {
-				rptrState = CS_IDLE;  // FLAKE - bail back to IDLE
-			} else {
-				nextState = CS_PTT;    // where we will go after PTT_ON
-				rptrState = CS_PTT_ON;  // good COR - PTT ON
-				show_msg("COR ON");
-			}
-			break;
+// COR dropped, dropouts shorter than the release window are
+// ridden through
+static void cor_dropped(Fsm * fsm) {
+	Port * p = fsm->ctx;
 
-		case CS_PTT_ON:
-			prevState = rptrState;
-			// turn on PTT
-			PTT_Value = PTT_ON;
-			digitalWrite(PTT_PIN, PTT_Value);
-			// jump to the desired next state (set by the previous state)
-			rptrState = nextState;
-			show_msg("PTT ON");
-			break;
+	p->off_edge = p->edge_time;
+}
+
+static void cor_gone(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	stats_since(ST_DEBOUNCE_OFF, p->off_edge);
+	show_msg(p, EV_COR_OFF);
+}
+
+static void sqt_on_entry(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	timer_start(p->tmr + TMR_SQT, p->sq_timer);
+	show_msg(p, EV_SQT_ON);
+}
+
+static void beep_entry(Fsm * fsm) {
+	show_msg(fsm->ctx, EV_BEEP);
+	cbeep_start(fsm->ctx);
+}
+
+static void beep_during(Fsm * fsm) {
+	Port * p = fsm->ctx;
 
+	p->beep_sending = cbeep_poll(p);
+}
+
+// a re-key cuts the beep short right away
+static void beep_cut(Fsm * fsm) {
+	Port * p = fsm->ctx;
+	long long cut;
+
+	cbeep_abort(p);
+	cut = cor_clock_ns() - p->edge_time;
+	if (cut > BeepCutMax)
+		BeepCutMax = cut;
+	if (verbose)
+		log_port(p, EV_BEEP_CUT, cut, BeepCutMax);
+	timer_stop(p->tmr + TMR_SQT);
+	p->on_edge = p->edge_time;
+}
+
+// a re-key during the squelch tail
+static void sqt_cut(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	timer_stop(p->tmr + TMR_SQT);
+	p->on_edge = p->edge_time;
+}
+
+// a re-key shorter than the assert window, the tail starts again
+// from where it dropped
+static void rekey_flake(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	p->off_edge = p->edge_time;
+}
+
+static void sqt_off_entry(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	// We just got done transmitting, so we need
+	// to ID next time the ID timer expires
+	p->need_id = HIGH;
+	show_msg(p, EV_SQT_OFF);
+}
+
+static void ptt_off_entry(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	// Turn the PTT off, timed from the COR drop if this
+	// is the end of a squelch tail
+	if (fsm->prev == CS_SQT_OFF)
+		p->ptt_off_from = p->off_edge;
+	p->ptt = PTT_OFF;
+	digitalWrite(p->ptt_pin, p->ptt);
+	show_msg(p, EV_PTT_OFF);
+}
+
+static void id_entry(Fsm * fsm) {
+	show_msg(fsm->ctx, EV_ID);
+	id_start(fsm->ctx);
+}
+
+// step through the ID while COR keeps being sampled
+static void id_during(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	// a user keyed up over the ID
+	if (p->cor == COR_ON && p->pcor != COR_ON)
+		p->on_edge = p->edge_time;
+	p->id_sending = id_poll(p);
+}
+
+// stop sending, need_id stays set so the ID is sent again the
+// next time we get back to IDLE
+static void id_keyup(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	id_abort(p);
+	show_msg(p, EV_ID_ABORT);
+	p->on_edge = p->edge_time;
+}
+
+// we have satisfied our need to ID, so NO
+static void id_done(Fsm * fsm) {
+	Port * p = fsm->ctx;
+
+	p->need_id = LOW;
+	reset_id_timer(p);
+	show_msg(p, EV_ID_DONE);
+}
+
+static const FsmState CtrlStateTable[CS_COUNT] = {
+	[CS_START]            = { "START",           NULL,          NULL,        NULL },
+	[CS_IDLE]             = { "IDLE",            idle_entry,    NULL,        NULL },
+	[CS_DEBOUNCE_COR_ON]  = { "DEBOUNCE_COR_ON", NULL,          NULL,        NULL },
+	[CS_PTT_ON]           = { "PTT_ON",          ptt_on_entry,  NULL,        NULL },
+	[CS_PTT]              = { "PTT",             NULL,          NULL,        NULL },
+	[CS_DEBOUNCE_COR_OFF] = { "DEBOUNCE_COR_OFF", NULL,         NULL,        NULL },
+	[CS_SQT_ON]           = { "SQT_ON",          sqt_on_entry,  NULL,        NULL },
+	[CS_SQT_BEEP]         = { "SQT_BEEP",        beep_entry,    beep_during, NULL },
+	[CS_SQT]              = { "SQT",             NULL,          NULL,        NULL },
+	[CS_DEBOUNCE_REKEY]   = { "DEBOUNCE_REKEY",  NULL,          NULL,        NULL },
+	[CS_SQT_OFF]          = { "SQT_OFF",         sqt_off_entry, NULL,        NULL },
+	[CS_PTT_OFF]          = { "PTT_OFF",         ptt_off_entry, NULL,        NULL },
+	[CS_ID]               = { "ID",              id_entry,      id_during,   NULL },
+};
+
+static const char * const CtrlEventNames[CE_COUNT] = {
+	"DONE", "ID_DUE", "ID_KEYUP", "COR_ON", "COR_OFF", "DEB_ON",
+	"DEB_OFF", "FLAKE", "SQT_DONE", "BEEP_DONE", "ID_DONE", "ID_DONE_KEYED",
+};
+
+/* The repeater state machine. Anything not listed is ignored in
+ * that state.
+ */
+static const FsmTrans CtrlTable[CS_COUNT][CE_COUNT] = {
+	[CS_START] = {
+		[CE_DONE]          = FSM_TO(CS_IDLE, ctrl_start),
+	},
+	// wait for COR to activate, or the ID timer
+	[CS_IDLE] = {
+		[CE_ID_DUE]        = FSM_TO(CS_ID, NULL),
+		[CE_COR_ON]        = FSM_TO(CS_DEBOUNCE_COR_ON, cor_keyed),
+	},
+	// wait (without blocking) for the debouncer to decide
+	[CS_DEBOUNCE_COR_ON] = {
+		[CE_DEB_ON]        = FSM_TO(CS_PTT_ON, cor_good),
+		[CE_FLAKE]         = FSM_TO(CS_IDLE, NULL),
+	},
+	[CS_PTT_ON] = {
+		[CE_DONE]          = FSM_TO(CS_PTT, NULL),
+	},
+	// repeating, wait for COR to drop
+	[CS_PTT] = {
+		[CE_COR_OFF]       = FSM_TO(CS_DEBOUNCE_COR_OFF, cor_dropped),
+	},
+	[CS_DEBOUNCE_COR_OFF] = {
+		[CE_DEB_OFF]       = FSM_TO(CS_SQT_ON, cor_gone),
+		[CE_FLAKE]         = FSM_TO(CS_PTT, NULL),
+	},
+	[CS_SQT_ON] = {
+		[CE_DONE]          = FSM_TO(CS_SQT_BEEP, NULL),
+	},
+	// the courtesy beep, then the rest of the squelch tail
+	[CS_SQT_BEEP] = {
+		[CE_COR_ON]        = FSM_TO(CS_DEBOUNCE_REKEY, beep_cut),
+		[CE_BEEP_DONE]     = FSM_TO(CS_SQT, NULL),
+	},
+	[CS_SQT] = {
+		[CE_COR_ON]        = FSM_TO(CS_DEBOUNCE_REKEY, sqt_cut),
+		[CE_SQT_DONE]      = FSM_TO(CS_SQT_OFF, NULL),
+	},
+	// COR came back with the PTT still up: repeat it, or if it was
+	// a flake start the squelch tail over so the PTT still drops
+	[CS_DEBOUNCE_REKEY] = {
+		[CE_DEB_ON]        = FSM_TO(CS_PTT_ON, cor_good),
+		[CE_FLAKE]         = FSM_TO(CS_SQT_ON, rekey_flake),
+	},
+	[CS_SQT_OFF] = {
+		[CE_DONE]          = FSM_TO(CS_PTT_OFF, NULL),
+	},
+	[CS_PTT_OFF] = {
+		[CE_DONE]          = FSM_TO(CS_IDLE, NULL),
+	},
+	// the user keyed up over the ID: abort, or finish the ID
+	// with the PTT kept up and then repeat them
+	[CS_ID] = {
+		[CE_ID_KEYUP]      = FSM_TO(CS_DEBOUNCE_REKEY, id_keyup),
+		[CE_ID_DONE]       = FSM_TO(CS_PTT_OFF, id_done),
+		[CE_ID_DONE_KEYED] = FSM_TO(CS_PTT_ON, id_done),
+	},
+};
+
+_Static_assert(CS_COUNT <= FSM_MAX_STATES, "too many CtrlStates");
+_Static_assert(CE_COUNT <= FSM_MAX_EVENTS, "too many CtrlEvents");
+
+const FsmDef CtrlFsmDef = {
+	"rptr", CS_COUNT, CE_COUNT, CS_START,
+	CtrlStateTable, CtrlEventNames, &CtrlTable[0][0]
+};
+
+/* Checks the state machine table, as the engine checks any table,
+ * and that the PTT can't be left up: it goes up in PTT_ON and ID,
+ * so every way from those back to IDLE has to be through PTT_OFF.
+ * Returns 1 if it's good.
+ */
+int ctrl_check(FILE * fp) {
+	int ok = fsm_validate(&CtrlFsmDef, fp);
+
+	if (!fsm_check_via(&CtrlFsmDef, FSM_EV(CS_PTT_ON) | FSM_EV(CS_ID),
+			CS_IDLE, CS_PTT_OFF, fp))
+		ok = 0;
+	return(ok);
+}
+
+/* Returns the state machine events that are true right now
+ * for the machine's port
+ */
+static unsigned long ctrl_events(Fsm * fsm) {
+	Port * p = fsm->ctx;
+	unsigned long ev = FSM_EV(CE_DONE);
+	int cor = (p->cor == COR_ON);
+
+	ev |= FSM_EV(cor ? CE_COR_ON : CE_COR_OFF);
+	ev |= FSM_EV(p->deb.on ? CE_DEB_ON : CE_DEB_OFF);
+	if (debounce_settled(&p->deb))
+		ev |= FSM_EV(CE_FLAKE);
+	if (p->need_id && timer_expired(p->tmr + TMR_ID))
+		ev |= FSM_EV(CE_ID_DUE);
+	if (cor && Set.keyup_action == ID_KEYUP_ABORT)
+		ev |= FSM_EV(CE_ID_KEYUP);
+	if (timer_expired(p->tmr + TMR_SQT))
+		ev |= FSM_EV(CE_SQT_DONE);
+	// these two are kept up to date by the 'during' actions
+	if (!p->beep_sending)
+		ev |= FSM_EV(CE_BEEP_DONE);
+	if (!p->id_sending)
+		ev |= FSM_EV(cor ? CE_ID_DONE_KEYED : CE_ID_DONE);
+	return(ev);
+}
+
+/* Returns how long a port's machine can be left alone, in mS.
+ * States that only wait on COR can wait for the next edge (-1),
+ * and states that wait on a timer until that timer expires. The
+ * transition states are always left in the same pass, but if the
+ * machine were ever stopped in one it runs right away (0).
+ */
+static long port_timeout(Port * p, msec_t t) {
+	switch(p->fsm.state)
+	{
+		case CS_IDLE:
 		case CS_PTT:
-			// we stay in this state and wait for COR to DROP (de-activate),
-			// then jump to debounce
-			prevState = rptrState;
-			if (COR_Value != COR_ON)
-				rptrState = CS_DEBOUNCE_COR_OFF;
-			break;
+		case CS_SQT:
+		case CS_SQT_BEEP:
+		case CS_ID:
+			return(timer_next_in(p->tmr, TMR_COUNT));
 
+		case CS_DEBOUNCE_COR_ON:
 		case CS_DEBOUNCE_COR_OFF:
-			// ideally we will delay here a little while and test
-			// the result with the pCOR_Value to prove its not a flake
-			prevState = rptrState;
-			delay(COR_DEBOUNCE_DELAY);
-			if ( COR_Value != digitalRead(COR_PIN))
-				rptrState = CS_PTT;  // FLAKE - ignore
+		case CS_DEBOUNCE_REKEY:
+			// until the debouncer can decide
+			return(debounce_next(&p->deb, t));
+
+		default:
+			return(0);
+	}
+}
+
+/* A port can take a new config between passes once it isn't
+ * sending its ID or courtesy beep
+ */
+static int port_quiet(Port * p) {
+	return(p->fsm.state != CS_ID && p->fsm.state != CS_SQT_BEEP &&
+		!p->id_seq.active && !p->beep_seq.active);
+}
+
+/* Switches to a reloaded config, if one is waiting and every port
+ * is quiet. The snapshot it replaces goes back to the reload
+ * thread, which frees it once the audio engine is done with its
+ * clips.
+ */
+static void config_swap(void) {
+	Snapshot * old = Snap;
+	Snapshot * s;
+	int i;
+
+	for (i = 0; i < NumPorts; i++)
+		if (!port_quiet(&Ports[i]))
+			return;
+	s = reload_take();
+	if (s == NULL)
+		return;
+	snap_apply(s);
+	reload_retire(old, audio_mark());
+	log_event(EV_RELOAD, 0, 0);
+}
+
+/* Switches the courtesy beep to the type a remote command asked
+ * for, once every port is quiet. The ID keeps the beep it was built
+ * with. A reload goes back to the config's.
+ */
+static void beep_swap(void) {
+	int i;
+
+	for (i = 0; i < NumPorts; i++)
+		if (!port_quiet(&Ports[i]))
+			return;
+	Set.beep_type = BeepChange;
+	BeepChange = -1;
+	for (i = 0; i < NumPorts; i++) {
+		seq_clear(&Ports[i].beep_seq);
+		cbeep_build(&Ports[i].beep_seq, &Set, Set.beep_type);
+	}
+}
+
+/* Runs a remote command a port's receiver sent. The timers it sets
+ * last until the next snap_apply(), i.e. a reload puts them back.
+ */
+static void remote_exec(Port * p, int cmd, long value) {
+	switch(cmd)
+	{
+		case CMD_ID_TIMER:
+			if (value < 1 || value > INT_MAX / 1000)
+				cmd = CMD_BAD;
 			else
-				rptrState = CS_SQT_ON;  // COR dropped, go to sqt
-				show_msg("COR OFF");
+				p->id_timer = (int)value * 1000;
 			break;
 
-		case CS_SQT_ON:
-			// set SQTimer active
-			SQTimer = ticks + SQTimerValue;
-			// jump to next state
-			prevState = rptrState;
-			rptrState = CS_SQT_BEEP;
-			show_msg("SQT ON");
+		case CMD_SQ_TIMER:
+			if (value > CMD_SQ_MAX)
+				cmd = CMD_BAD;
+			else
+				p->sq_timer = (int)value;
 			break;
 
-			case CS_SQT_BEEP:
-			// Do the courtesy beep
-			do_cbeep(BEEP_type);
-			// jump to CS_SQT to wait for SQT timer
-			prevState = rptrState;
-			rptrState = CS_SQT;
-			show_msg("BEEP");
+		case CMD_BEEP_TYPE:
+			if (value > CBEEP_DEDEEP)
+				cmd = CMD_BAD;
+			else
+				BeepChange = (int)value;
 			break;
 
-		case CS_SQT:
-			// We stay in this state until SQTimer expires, then
-			// we jump to to CS_SQT_OFF
-			prevState = rptrState;
-			if (ticks > SQTimer)
-			rptrState = CS_SQT_OFF;
-			if (COR_Value == COR_ON) {
-				pCOR_Value = COR_Value;
-				rptrState = CS_DEBOUNCE_COR_ON;
-			}
+		case CMD_ENABLE:
+			p->disabled = 0;
 			break;
 
-		case CS_SQT_OFF:
-			// set SQTail not active
-			prevState = rptrState;
-			nextState = CS_IDLE;
-			rptrState = CS_PTT_OFF;
-			// We just got done transmitting, so we need
-			// to ID next time the ID timer expires
-			Need_ID = HIGH;
-			show_msg("SQT OFF");
+		case CMD_DISABLE:
+			p->disabled = 1;
 			break;
+	}
+	log_port(p, EV_CMD, cmd, value);
+}
+
+/* Takes the DTMF digits the receivers heard and runs the commands
+ * they make up. A digit only counts while its receiver's carrier is
+ * up, and nothing is taken without a PIN.
+ */
+static void remote_poll(void) {
+	DtmfDigit d;
+	long value;
+	int cmd;
+
+	while (spsc_pop(&DtmfQ, &d)) {
+		Port * p = &Ports[d.port];
+
+		if (p->cor_raw != COR_ON)
+			continue;
+		cmd = cmd_digit(&Snap->cmds, &p->cmd, d.digit, ticks, Set.dtmf_timeout, &value);
+		if (cmd != CMD_NONE)
+			remote_exec(p, cmd, value);
+	}
+}
 
-		case CS_PTT_OFF:
-			// Turn the PTT off
-			PTT_Value = PTT_OFF;
-			digitalWrite(PTT_PIN, PTT_Value);
-			// jump to the desired next state (set by the previous state)
-			prevState = rptrState;
-			rptrState = nextState;
-			show_msg("PTT OFF");
+/* Master repeater state machine. Only the ports that had a COR
+ * change, or whose next deadline has come, are run, so an idle
+ * port costs next to nothing. It never allocates (see mem.h).
+ */
+void loop(void) {
+	unsigned int ran = 0;
+	long long t;
+	int i;
 
-			break;
+	mem_guard_enter();
 
-		case CS_ID:
-			show_msg("ID");
+	// time this pass and the gap since the last one
+	t = stats_clock();
+	if (LoopStart != 0)
+		stats_record(ST_LOOP_PERIOD, t - LoopStart);
+	LoopStart = t;
 
-			// Go do the ID (this is a *blocking* call)
-			do_ID();
-			// back to the IDLE state when
-			prevState = rptrState;
-			rptrState = CS_IDLE;
-			// we have satisfied our need to ID, so NO
-			Need_ID = LOW;
-			show_msg("ID DONE");
+	// grab the current elapsed time and fire any due timers
+	ticks = now();
+	timer_poll(ticks);
 
-			break;
+	// pick up a reloaded config, between IDs and beeps
+	if (reload_pending())
+		config_swap();
 
-		default:
-			// do nothing
-			break;
+	// grab the current COR values, and wake the ports they changed
+	port_wake(get_cor());
+
+	// the DTMF commands the receivers heard, and a new courtesy
+	// beep between beeps
+	remote_poll();
+	if (BeepChange >= 0)
+		beep_swap();
+
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+		long d;
+
+		if (!p->wake && (p->due < 0 || ticks < p->due))
+			continue;
+
+		// run the state machine until it settles
+		fsm_run(&p->fsm, ctrl_events);
+		ran |= 1U << i;
+
+		// and work out when it next needs to run
+		d = port_timeout(p, ticks);
+		p->wake = (d == 0);
+		p->due = (d > 0) ? ticks + d : -1;
 	}
 
-	// Comment this out to stop reporting this info
-	//show_state_info();
+	// send this pass's output changes in one go
+	t = stats_clock();
+	gpio_flush();
+	stats_since(ST_GPIO_FLUSH, t);
 
-	// capture the current machine state and COR value and
-	// save as 'previous' for the next loop.
-	pCOR_Value = COR_Value;
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
 
+		if (!(ran & (1U << i)))
+			continue;
+
+		// the PTT has now really changed
+		if (p->ptt_on_from != 0)
+			stats_since(ST_COR_PTT_ON, p->ptt_on_from);
+		if (p->ptt_off_from != 0)
+			stats_since(ST_COR_PTT_OFF, p->ptt_off_from);
+		p->ptt_on_from = p->ptt_off_from = 0;
+
+		// Comment this out to stop reporting this info
+		//show_state_info(p);
+
+		// capture the current COR value and save as 'previous'
+		// for the next loop.
+		p->pcor = p->cor;
+	}
+
+	// feed any tone keyed this pass to the audio sink; the audio
+	// thread, when it runs, times its own pumps
+	t = stats_clock();
+	if (audio_pump())
+		stats_since(ST_AUDIO_PUMP, t);
+
+	stats_since(ST_LOOP_RUN, LoopStart);
+
+	mem_guard_leave();
 }
+
+/* Marks the ports in the mask as needing a run of loop()
+ */
+void port_wake(unsigned int mask) {
+	int i;
+
+	for (i = 0; i < NumPorts; i++)
+		if (mask & (1U << i))
+			Ports[i].wake = 1;
+}
+
+/* Returns how long main() may sleep waiting for a COR edge
+ * before loop() has to run again, in mS: the soonest of the
+ * ports' deadlines, -1 if they are all waiting on COR, or 0 if
+ * one has to run right away.
+ */
+long loop_timeout(void) {
+	long t = -1;
+	long a;
+	msec_t n = now();
+	int i;
+
+	for (i = 0; i < NumPorts; i++) {
+		Port * p = &Ports[i];
+		long d;
+
+		if (p->wake)
+			return(0);
+		if (p->due < 0)
+			continue;
+		d = (p->due > n) ? (long)(p->due - n) : 0;
+		if (t < 0 || d < t)
+			t = d;
+	}
+
+	// streaming audio needs feeding every AUDIO_PERIOD mS
+	a = audio_timeout();
+	if (a >= 0 && (t < 0 || a < t))
+		t = a;
+	return(t);
+}
+
 /* Handler for parsing config file lines into config items
  */
 static int handler(void* user, const char* section, const char* name,
@@ -856,44 +1752,314 @@ static int handler(void* user, const char* section, const char* name,
     if (MATCH("protocol", "version")) {
         pconfig->version = atoi(value);
     } else if (MATCH("USER", "name")) {
-        pconfig->name = strdup(value);
+        pconfig->name = arena_strdup(pconfig->arena, value);
     } else if (MATCH("user", "email")) {
-        pconfig->email = strdup(value);
+        pconfig->email = arena_strdup(pconfig->arena, value);
     } else if (MATCH("CWID", "Callsign")) {
-        pconfig->callsign = strdup(value);
+        pconfig->callsign = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CWID", "WPM")) {
+        pconfig->cwidwpm = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CWID", "FarnsworthWPM")) {
+        pconfig->cwidfwpm = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CWID", "KeyupAction")) {
+        pconfig->keyupaction = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CWIDFreq")) {
-        pconfig->cwidfreq = strdup(value);
+        pconfig->cwidfreq = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CBEEPtype")) {
-        pconfig->beeptype = strdup(value);
+        pconfig->beeptype = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CBEEPFreq1")) {
-        pconfig->beepfreq1 = strdup(value);
+        pconfig->beepfreq1 = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CBEEPFreq2")) {
-        pconfig->beepfreq2 = strdup(value);
+        pconfig->beepfreq2 = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CBEEPTimeDuration")) {
-        pconfig->beeptime = strdup(value);
+        pconfig->beeptime = arena_strdup(pconfig->arena, value);
     } else if (MATCH("TONES", "CWIDClockTime")) {
-        pconfig->cwidspeed = strdup(value);
+        pconfig->cwidspeed = arena_strdup(pconfig->arena, value);
     } else if (MATCH("CONTROL", "CORSense")) {
-        pconfig->corsense = strdup(value);
+        pconfig->corsense = arena_strdup(pconfig->arena, value);
     } else if (MATCH("CONTROL", "PTTSense")) {
-        pconfig->pttsense = strdup(value);
+        pconfig->pttsense = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "Sink")) {
+        pconfig->audiosink = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "SampleRate")) {
+        pconfig->samplerate = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "RampTime")) {
+        pconfig->ramptime = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "Level")) {
+        pconfig->level = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "CacheDir")) {
+        pconfig->cachedir = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "Input")) {
+        pconfig->audioinput = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "Period")) {
+        pconfig->audioperiod = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "LatencyTest")) {
+        pconfig->latencytest = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("AUDIO", "InputChannels")) {
+        pconfig->inputchannels = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CTCSS", "Tone")) {
+        pconfig->ctcsstone = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CTCSS", "Detect")) {
+        pconfig->ctcssdetect = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CTCSS", "Release")) {
+        pconfig->ctcssrelease = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SQUELCH", "Mode")) {
+        pconfig->squelchmode = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SQUELCH", "Open")) {
+        pconfig->squelchopen = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SQUELCH", "Close")) {
+        pconfig->squelchclose = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SQUELCH", "Attack")) {
+        pconfig->squelchattack = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SQUELCH", "Release")) {
+        pconfig->squelchrelease = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REPEAT", "Audio")) {
+        pconfig->repeataudio = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REPEAT", "Delay")) {
+        pconfig->repeatdelay = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REPEAT", "Mute")) {
+        pconfig->repeatmute = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REPEAT", "Fade")) {
+        pconfig->repeatfade = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("DTMF", "PIN")) {
+        pconfig->dtmfpin = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("DTMF", "Timeout")) {
+        pconfig->dtmftimeout = arena_strdup(pconfig->arena, value);
+    } else if (strcmp(section, "DTMF") == 0) {
+        // a command's code, by its name
+        int i;
+
+        for (i = 0; i < CMD_COUNT; i++)
+            if (strcmp(name, cmd_name(i)) == 0)
+                break;
+        if (i == CMD_COUNT)
+            return 0;
+        pconfig->dtmfcode[i] = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CONTROL", "IDTimer")) {
+        pconfig->idtimer = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CONTROL", "SQTimer")) {
+        pconfig->sqtimer = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CONTROL", "CORAssertTime")) {
+        pconfig->corassert = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("CONTROL", "CORReleaseTime")) {
+        pconfig->correlease = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SCHED", "CORPeriod")) {
+        pconfig->corperiod = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SCHED", "ControlPeriod")) {
+        pconfig->controlperiod = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("SCHED", "TelemetryPeriod")) {
+        pconfig->telemetryperiod = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REALTIME", "Priority")) {
+        pconfig->rtpriority = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REALTIME", "CPU")) {
+        pconfig->rtcpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("REALTIME", "SelfTest")) {
+        pconfig->rtselftest = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "Pipeline")) {
+        pconfig->pipeline = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "InputCPU")) {
+        pconfig->inputcpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "ControlCPU")) {
+        pconfig->controlcpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "AudioCPU")) {
+        pconfig->audiocpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "IOCPU")) {
+        pconfig->iocpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "AioCPU")) {
+        pconfig->aiocpu = arena_strdup(pconfig->arena, value);
+    } else if (MATCH("THREADS", "Reload")) {
+        pconfig->reload = arena_strdup(pconfig->arena, value);
+    } else if (strncmp(section, "PORT", 4) == 0) {
+        // [PORT1] .. [PORTn], one per repeater or link radio
+        int n = atoi(section + 4);
+        port_config * pc;
+
+        if (n < 1 || n > PORT_MAX)
+            return 0;
+        pc = &pconfig->port[n - 1];
+        if (n > pconfig->ports)
+            pconfig->ports = n;
+        if (strcmp(name, "PTTPin") == 0)
+            pc->pttpin = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "CORPin") == 0)
+            pc->corpin = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "CORLED") == 0)
+            pc->corled = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "IDPin") == 0)
+            pc->idpin = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "Callsign") == 0)
+            pc->callsign = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "IDTimer") == 0)
+            pc->idtimer = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "SQTimer") == 0)
+            pc->sqtimer = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "Link") == 0)
+            pc->link = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "CTCSS") == 0)
+            pc->ctcss = arena_strdup(pconfig->arena, value);
+        else if (strcmp(name, "Squelch") == 0)
+            pc->squelch = arena_strdup(pconfig->arena, value);
+        else
+            return 0;
     } else {
         return 0;  /* unknown section/name, error */
     }
+    return 1;
+}
+
+/* Fills in the settings the controller has with no config
+ */
+void settings_default(Settings * set) {
+	int i;
+
+	memset(set, 0, sizeof(*set));
+	strcpy(set->callsign, DEFAULT_CALLSIGN);
+	set->id_tone = 1200;
+	set->beep_type = CBEEP_SINGLE;
+	set->beep_tone1 = 1000;
+	set->beep_tone2 = 800;
+	set->beep_duration = 2;
+	set->cw_timebase = 50;
+	set->cw_wpm = 0;
+	set->cw_fwpm = 0;
+	set->keyup_action = ID_KEYUP_FINISH;
+	set->id_timer = DEFAULT_ID_TIMER;
+	set->sq_timer = DEFAULT_SQ_TIMER;
+	for (i = 0; i < PORT_MAX; i++)
+		set->port[i].id_timer = set->port[i].sq_timer = -1;
+	set->dtmf_timeout = DEFAULT_CMD_TIMEOUT;
+	strcpy(set->dtmf_code[CMD_ID_TIMER], "1");
+	strcpy(set->dtmf_code[CMD_SQ_TIMER], "2");
+	strcpy(set->dtmf_code[CMD_BEEP_TYPE], "3");
+	strcpy(set->dtmf_code[CMD_ENABLE], "91");
+	strcpy(set->dtmf_code[CMD_DISABLE], "90");
+}
+
+/* Copies a callsign setting into 'buf' (30 chars), if it is given.
+ * Returns 0 if it is too long for that or for the ID timeline.
+ */
+static int cfg_call(const char * name, const char * value, char * buf, const Settings * set) {
+	MorseTimeline m;
+
+	if (value == NULL)
+		return(1);
+	if (strlen(value) >= sizeof(set->callsign) || !id_compile(&m, value, set)) {
+		printf("Config: %s '%s' is too long\n",name,value);
+		return(0);
+	}
+	strcpy(buf, value);
+	return(1);
+}
+
+/* Copies a DTMF PIN or code setting into 'buf', if it is given.
+ * Returns 0 if it is too long.
+ */
+static int cfg_code(const char * name, const char * value, char * buf) {
+	if (value == NULL)
+		return(1);
+	if (strlen(value) >= CMD_CODE) {
+		printf("Config: %s '%s' is longer than %d digits\n",name,value,CMD_CODE - 1);
+		return(0);
+	}
+	strcpy(buf, value);
+	return(1);
+}
+
+/* Reads the settings a reload can change from the config, into
+ * 'set' only if they are all good, so a bad file changes nothing.
+ * Settings the file doesn't give are left as they are. Returns 0
+ * if one is bad.
+ */
+int settings_parse(const configuration * c, Settings * set) {
+	static const char * beeps[] = {
+		"None", "Single", "DeDoop", "DoDeep", "DeDeep"  // BeepTypes order
+	};
+	int tone_max = SampleRate / 2 - 1;
+	Settings n = *set;
+	int ok = 1;
+	int i;
+
+	ok &= cfg_int("CWIDFreq", c->cwidfreq, 1, tone_max, &n.id_tone);
+	ok &= cfg_int("CBEEPFreq1", c->beepfreq1, 1, tone_max, &n.beep_tone1);
+	ok &= cfg_int("CBEEPFreq2", c->beepfreq2, 1, tone_max, &n.beep_tone2);
+	ok &= cfg_int("CBEEPTimeDuration", c->beeptime, 1, 100, &n.beep_duration);
+	ok &= cfg_int("CWIDClockTime", c->cwidspeed, 1, 1200, &n.cw_timebase);
+	ok &= cfg_int("WPM", c->cwidwpm, 0, 100, &n.cw_wpm);
+	ok &= cfg_int("FarnsworthWPM", c->cwidfwpm, 0, 100, &n.cw_fwpm);
+	ok &= cfg_int("IDTimer", c->idtimer, 1, INT_MAX, &n.id_timer);
+	ok &= cfg_int("SQTimer", c->sqtimer, 0, INT_MAX, &n.sq_timer);
+
+	if (c->beeptype != NULL) {
+		for (i = 0; i < (int)(sizeof(beeps) / sizeof(beeps[0])); i++)
+			if (strcmp(c->beeptype, beeps[i]) == 0)
+				break;
+		if (i < (int)(sizeof(beeps) / sizeof(beeps[0]))) {
+			n.beep_type = i;
+		} else {
+			printf("Config: CBEEPtype '%s' isn't a beep type\n",c->beeptype);
+			ok = 0;
+		}
+	}
+
+	if (c->keyupaction != NULL) {
+		if (strcmp(c->keyupaction,"Abort") == 0)
+			n.keyup_action = ID_KEYUP_ABORT;
+		else if (strcmp(c->keyupaction,"Finish") == 0)
+			n.keyup_action = ID_KEYUP_FINISH;
+		else {
+			printf("Config: KeyupAction '%s' isn't Abort or Finish\n",c->keyupaction);
+			ok = 0;
+		}
+	}
+
+	// after the speeds, the callsign has to fit at them. --call
+	// beats the config.
+	if (!CallGiven)
+		ok &= cfg_call("Callsign", c->callsign, n.callsign, &n);
+
+	for (i = 0; i < PORT_MAX; i++) {
+		const port_config * pc = &c->port[i];
+
+		ok &= cfg_call("Callsign", pc->callsign, n.port[i].callsign, &n);
+		ok &= cfg_int("IDTimer", pc->idtimer, 1, INT_MAX, &n.port[i].id_timer);
+		ok &= cfg_int("SQTimer", pc->sqtimer, 0, INT_MAX, &n.port[i].sq_timer);
+	}
+
+	// the remote control codes have to compile
+	ok &= cfg_code("PIN", c->dtmfpin, n.dtmf_pin);
+	for (i = 0; i < CMD_COUNT; i++)
+		ok &= cfg_code(cmd_name(i), c->dtmfcode[i], n.dtmf_code[i]);
+	ok &= cfg_int("Timeout", c->dtmftimeout, 1, INT_MAX, &n.dtmf_timeout);
+	if (ok) {
+		static CmdTrie trie;
+
+		ok &= cmd_compile(&trie, n.dtmf_pin, (const char (*)[CMD_CODE])n.dtmf_code);
+	}
+
+	if (ok)
+		*set = n;
+	return(ok);
 }
 
 int LoadConfig(char * cfile) {
 
 	configuration config;
+	int ok = 1;
+	int i;
 
+	memset(&config, 0, sizeof(config));
 	printf("cfgFile: '%s'\n",cfile);
 
-    if (ini_parse(cfile, handler, &config) < 0) {
-        printf("Can't load '%s'\n",cfile);
-        return (0);
-    }
-    if (verbose)
-        printf("Config loaded from '%s'\n",cfile);
+	config.arena = arena_new("config", ARENA_BLOCK);
+	if (config.arena == NULL)
+		return (0);
+	if (ini_parse(cfile, handler, &config) < 0) {
+		printf("Can't load '%s'\n",cfile);
+		arena_free(config.arena);
+		return (0);
+	}
+	if (verbose)
+		printf("Config loaded from '%s'\n",cfile);
 
 	if (debug)
     {
@@ -901,6 +2067,9 @@ int LoadConfig(char * cfile) {
         printf("name: '%s'\n", config.name);
         printf("email: '%s'\n", config.email);
         printf("callsign: '%s'\n", config.callsign);
+        printf("cwidwpm: '%s'\n", config.cwidwpm);
+        printf("cwidfwpm: '%s'\n", config.cwidfwpm);
+        printf("keyupaction: '%s'\n", config.keyupaction);
         printf("corsense: '%s'\n", config.corsense);
         printf("pttsense: '%s'\n", config.pttsense);
         printf("cwidfreq: '%s'\n", config.cwidfreq);
@@ -909,52 +2078,181 @@ int LoadConfig(char * cfile) {
         printf("beepfreq2: '%s'\n", config.beepfreq2);
         printf("beeptime: '%s'\n", config.beeptime);
         printf("cwidspeed: '%s'\n", config.cwidspeed);
+        printf("audiosink: '%s'\n", config.audiosink);
+        printf("samplerate: '%s'\n", config.samplerate);
+        printf("ramptime: '%s'\n", config.ramptime);
+        printf("level: '%s'\n", config.level);
+        printf("cachedir: '%s'\n", config.cachedir);
+        printf("audioinput: '%s'\n", config.audioinput);
+        printf("audioperiod: '%s'\n", config.audioperiod);
+        printf("latencytest: '%s'\n", config.latencytest);
+        printf("inputchannels: '%s'\n", config.inputchannels);
+        printf("ctcsstone: '%s'\n", config.ctcsstone);
+        printf("ctcssdetect: '%s'\n", config.ctcssdetect);
+        printf("ctcssrelease: '%s'\n", config.ctcssrelease);
+        printf("squelchmode: '%s'\n", config.squelchmode);
+        printf("squelchopen: '%s'\n", config.squelchopen);
+        printf("squelchclose: '%s'\n", config.squelchclose);
+        printf("squelchattack: '%s'\n", config.squelchattack);
+        printf("squelchrelease: '%s'\n", config.squelchrelease);
+        printf("repeataudio: '%s'\n", config.repeataudio);
+        printf("repeatdelay: '%s'\n", config.repeatdelay);
+        printf("repeatmute: '%s'\n", config.repeatmute);
+        printf("repeatfade: '%s'\n", config.repeatfade);
+        printf("dtmfpin: '%s'\n", config.dtmfpin);
+        printf("dtmftimeout: '%s'\n", config.dtmftimeout);
+        for (i = 0; i < CMD_COUNT; i++)
+            printf("dtmf %s: '%s'\n", cmd_name(i), config.dtmfcode[i]);
+        printf("idtimer: '%s'\n", config.idtimer);
+        printf("sqtimer: '%s'\n", config.sqtimer);
+        printf("corassert: '%s'\n", config.corassert);
+        printf("correlease: '%s'\n", config.correlease);
+        printf("corperiod: '%s'\n", config.corperiod);
+        printf("controlperiod: '%s'\n", config.controlperiod);
+        printf("telemetryperiod: '%s'\n", config.telemetryperiod);
+        printf("rtpriority: '%s'\n", config.rtpriority);
+        printf("rtcpu: '%s'\n", config.rtcpu);
+        printf("rtselftest: '%s'\n", config.rtselftest);
+        printf("pipeline: '%s'\n", config.pipeline);
+        printf("inputcpu: '%s'\n", config.inputcpu);
+        printf("controlcpu: '%s'\n", config.controlcpu);
+        printf("audiocpu: '%s'\n", config.audiocpu);
+        printf("iocpu: '%s'\n", config.iocpu);
+        printf("aiocpu: '%s'\n", config.aiocpu);
+        printf("reload: '%s'\n", config.reload);
+        for (i = 0; i < config.ports; i++) {
+            port_config * pc = &config.port[i];
+
+            printf("port%d: ptt '%s', cor '%s', led '%s', id '%s', "
+                "callsign '%s', idtimer '%s', sqtimer '%s', link '%s', ctcss '%s', squelch '%s'\n",
+                i + 1, pc->pttpin, pc->corpin, pc->corled, pc->idpin,
+                pc->callsign, pc->idtimer, pc->sqtimer, pc->link, pc->ctcss, pc->squelch);
+        }
     }
 
-    if (config.callsign != "")
-		strcpy(Callsign,config.callsign);
+    if (config.corsense != NULL)
+		COR_SENSE = (strcmp(config.corsense,"Positive") == 0) ? COR_POS_LOGIC : COR_NEG_LOGIC;
 
-    if (strcmp(config.corsense,"Positive") == 0)
-		COR_SENSE = COR_POS_LOGIC;
-	else
-		COR_SENSE = COR_NEG_LOGIC;
+    if (config.pttsense != NULL)
+		PTT_SENSE = (strcmp(config.pttsense,"Positive") == 0) ? PTT_POS_LOGIC : PTT_NEG_LOGIC;
 
-    if (strcmp(config.pttsense,"Positive") == 0)
-		PTT_SENSE = PTT_POS_LOGIC;
-	else
-		PTT_SENSE = PTT_NEG_LOGIC;
+    if (config.audiosink != NULL)
+		snprintf(audioSpec, sizeof(audioSpec), "%s", config.audiosink);
+
+	ok &= cfg_int("SampleRate", config.samplerate, 8000, 48000, &SampleRate);
+	ok &= cfg_int("RampTime", config.ramptime, 0, 40, &RampTime);
+	ok &= cfg_int("Level", config.level, 1, 100, &ToneLevel);
 
-    if (strcmp(config.beeptype,"None") == 0)
-		BEEP_type = CBEEP_NONE;
-	else if (strcmp(config.beeptype,"Single") == 0)
-		BEEP_type = CBEEP_SINGLE;
-	else if (strcmp(config.beeptype,"DeDeep") == 0)
-		BEEP_type = CBEEP_DEDEEP;
-	else if (strcmp(config.beeptype,"DeDoop") == 0)
-		BEEP_type = CBEEP_DEDOOP;
-	else if (strcmp(config.beeptype,"DoDeep") == 0)
-		BEEP_type = CBEEP_DODEEP;
+    if (config.cachedir != NULL)
+		snprintf(cacheDir, sizeof(cacheDir), "%s", config.cachedir);
 
-    if (config.beepfreq1 != "")
-		BEEP_tone1 = atoi(config.beepfreq1);
+    if (config.audioinput != NULL)
+		snprintf(audioInSpec, sizeof(audioInSpec), "%s", config.audioinput);
 
-    if (config.beepfreq2 != "")
-		BEEP_tone2 = atoi(config.beepfreq2);
+	ok &= cfg_int("Period", config.audioperiod, 1, 20, &AudioIOPeriod);
+	ok &= cfg_int("LatencyTest", config.latencytest, 0, 100, &LatencyTest);
 
-    if (config.cwidfreq != "")
-		ID_tone = atoi(config.cwidfreq);
+    ok &= cfg_int("InputChannels", config.inputchannels, 1, AIO_CHANNELS, &InputChannels);
+    ok &= cfg_double("CTCSS Tone", config.ctcsstone, 0, CTCSS_TONE_MAX, &CTCSSTone);
+    ok &= cfg_int("CTCSS Detect", config.ctcssdetect, 1, CTCSS_TIME_MAX, &CTCSSDetect);
+    ok &= cfg_int("CTCSS Release", config.ctcssrelease, 1, CTCSS_TIME_MAX, &CTCSSRelease);
 
-    if (config.beeptime != "")
-		BeepDuration = atoi(config.beeptime);
+    if (config.squelchmode != NULL)
+		SquelchMode = squelch_mode(config.squelchmode);
 
-    if (config.cwidspeed != "")
-		CW_TIMEBASE = atoi(config.cwidspeed);
+    ok &= cfg_double("Squelch Open", config.squelchopen, SQ_LEVEL_MIN, 0, &SquelchOpen);
+    ok &= cfg_double("Squelch Close", config.squelchclose, SQ_LEVEL_MIN, 0, &SquelchClose);
+    ok &= cfg_int("Squelch Attack", config.squelchattack, 0, SQ_TIME_MAX, &SquelchAttack);
+    ok &= cfg_int("Squelch Release", config.squelchrelease, 0, SQ_TIME_MAX, &SquelchRelease);
+
+    if (config.repeataudio != NULL)
+		RepeatAudio = (strcmp(config.repeataudio,"On") == 0);
+
+    ok &= cfg_int("Repeat Delay", config.repeatdelay, 1, REPEAT_MAX, &RepeatDelay);
+    ok &= cfg_int("Repeat Mute", config.repeatmute, 0, REPEAT_MAX, &RepeatMute);
+    ok &= cfg_int("Repeat Fade", config.repeatfade, 0, REPEAT_MAX_FADE, &RepeatFade);
+
+	ok &= cfg_int("CORAssertTime", config.corassert, 0, 10000, &CORAssertTime);
+	ok &= cfg_int("CORReleaseTime", config.correlease, 0, 10000, &CORReleaseTime);
+
+	ok &= cfg_int("CORPeriod", config.corperiod, 1, 1000, &CORPeriod);
+	ok &= cfg_int("ControlPeriod", config.controlperiod, 1, 1000, &ControlPeriod);
+	ok &= cfg_int("TelemetryPeriod", config.telemetryperiod, 1, 60000, &TelemetryPeriod);
+
+	ok &= cfg_int("Priority", config.rtpriority, 1, 99, &RTPriority);
+	ok &= cfg_int("CPU", config.rtcpu, -1, RT_CPU_MAX, &RTCpu);
+	ok &= cfg_int("SelfTest", config.rtselftest, 0, RT_SELFTEST_MAX, &RTSelfTest);
+
+    if (config.pipeline != NULL)
+		Pipeline = (strcmp(config.pipeline,"Off") != 0);
+
+	ok &= cfg_int("InputCPU", config.inputcpu, -1, RT_CPU_MAX, &InputCPU);
+	ok &= cfg_int("ControlCPU", config.controlcpu, -1, RT_CPU_MAX, &ControlCPU);
+	ok &= cfg_int("AudioCPU", config.audiocpu, -1, RT_CPU_MAX, &AudioCPU);
+	ok &= cfg_int("IOCPU", config.iocpu, -1, RT_CPU_MAX, &IOCPU);
+
+	ok &= cfg_int("AioCPU", config.aiocpu, -1, RT_CPU_MAX, &AioCPU);
+
+    if (config.reload != NULL)
+		Reload = (strcmp(config.reload,"Off") != 0);
+
+	// the [PORTn] sections, port_init() checks them. With none
+	// there is one port on the settings above.
+	memcpy(PortConf, config.port, sizeof(PortConf));
+	NumPorts = (config.ports > 0) ? config.ports : 1;
+
+	// PortConf points into the strings, they are kept until the
+	// config is loaded again
+	arena_free(CfgArena);
+	CfgArena = config.arena;
 
 	setCOR_Sense(COR_SENSE);
 	setPTT_Sense(PTT_SENSE);
-	return (1);
+
+	// last, as the tone limits depend on SampleRate. A bad one
+	// leaves all of these as they were.
+	ok &= settings_parse(&config, &Set);
+	return (ok);
 }
 
+/* Reload hook, runs on the reload thread: parses the config file on
+ * top of the settings of 'base' and builds a snapshot from them.
+ * Only the settings a reload can change are taken, the rest wait
+ * for a restart. Returns NULL, and nothing changes, if the file
+ * can't be read or has a bad line or setting.
+ */
+void * snap_load(const char * file, const void * base) {
+	configuration config;
+	Settings set = ((const Snapshot *)base)->set;
+	int err;
+
+	// the strings go in the new snapshot's arena
+	memset(&config, 0, sizeof(config));
+	config.arena = arena_new("snapshot", ARENA_BLOCK);
+	if (config.arena == NULL)
+		return(NULL);
+	err = ini_parse(file, handler, &config);
+	if (err < 0)
+		printf("Reload: can't read '%s'\n",file);
+	else if (err > 0)
+		printf("Reload: bad line %d in '%s'\n",err,file);
+	if (err != 0 || !settings_parse(&config, &set)) {
+		arena_free(config.arena);
+		return(NULL);
+	}
+	if (((config.ports > 0) ? config.ports : 1) != NumPorts)
+		printf("Reload: the number of ports only changes on a restart\n");
+	return(snap_build(&set, audio_sink() != NULL, config.arena));
+}
+
+#ifndef SIMULATION
+/* Reload hook, frees a snapshot
+ */
+static void snap_drop(void * s) {
+	snap_free(s);
+}
+#endif
+
 /* Print the program header info
  */
 void header(char * name)
@@ -988,6 +2286,22 @@ void usage(char * name)
 	printf("   --help, -h     Prints this info and exits.\n");
 	printf("   --call <CALL>  Sets callsign\n");
 	printf("   --file <FILE>  Sets alternate config file name\n");
+	printf("   --cormode <MODE>  COR edge source: event, poll or sim\n");
+	printf("   --gpiochip <DEV>  GPIO character device for COR events\n");
+	printf("   --gpio <BACKEND>  GPIO backend: bcm2835, chardev or sim\n");
+	printf("   --trace <FILE>    Trace PTT/ID/LED changes to a file ('-' for stdout)\n");
+#ifdef SIMULATION
+	printf("   --simtime <MS>    mS of virtual time to simulate\n");
+#endif
+	printf("   --corsim <FILE>   COR edge script for the sim source\n");
+	printf("   --audio <SINK>    Audio sink: wav:<file>, raw:<file>, pipe:<cmd>, alsa:<dev>\n");
+	printf("   --audioin <SRC>   Receiver audio, the same types as the sink\n");
+	printf("   --render <FILE>   Render the CW ID to a WAV file and exit\n");
+	printf("   --realtime     Run SCHED_FIFO with locked memory (see [REALTIME])\n");
+	printf("   --cwtiming     Measure how late the CW ID keying edges are\n");
+	printf("   --checkfsm     Check the state machine table and exit\n");
+	printf("   --nopipeline   Run everything on one thread (see [THREADS])\n");
+	printf("   --noreload     Don't reload the config when it changes (see [THREADS])\n");
     printf("\n");
 }
 
@@ -1006,18 +2320,36 @@ int ParseArgs(int argc, char **argv) {
 			{"brief",   no_argument,  &verbose, 0},
 			{"debug",   no_argument,    &debug, 1},
 			{"nodebug", no_argument,    &debug, 0},
+			{"realtime", no_argument,   &Realtime, 1},
+			{"cwtiming", no_argument,   &CWTiming, 1},
+			{"checkfsm", no_argument,   &CheckFsm, 1},
+			{"pipeline", no_argument,   &Pipeline, 1},
+			{"nopipeline", no_argument, &Pipeline, 0},
+			{"reload", no_argument,     &Reload, 1},
+			{"noreload", no_argument,   &Reload, 0},
 			/* These options don’t set a flag.
                We distinguish them by their indices. */
 			{"version", no_argument,       0, 'v'},
 			{"help",    no_argument,       0, 'h'},
 			{"call",    required_argument, 0, 'c'},
 			{"file",    required_argument, 0, 'f'},
+			{"cormode", required_argument, 0, 'm'},
+			{"gpiochip", required_argument, 0, 'g'},
+			{"gpio",    required_argument, 0, 'G'},
+			{"trace",   required_argument, 0, 't'},
+#ifdef SIMULATION
+			{"simtime", required_argument, 0, 'T'},
+#endif
+			{"corsim",  required_argument, 0, 's'},
+			{"audio",   required_argument, 0, 'a'},
+			{"audioin", required_argument, 0, 'i'},
+			{"render",  required_argument, 0, 'r'},
 			{0, 0, 0, 0}
 		};
 		/* getopt_long stores the option index here. */
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "vhc:f:",
+		c = getopt_long (argc, argv, "vhc:f:m:g:G:s:a:i:r:t:T:",
                        long_options, &option_index);
 
 		/* Detect the end of the options. */
@@ -1049,8 +2381,9 @@ int ParseArgs(int argc, char **argv) {
 			case 'c':
 				// load callsign
 				//printf ("option -c with value `%s'\n", optarg);
-				strcpy(Callsign,optarg);
-				printf("Setting Callsign: '%s'\n",Callsign);
+				snprintf(Set.callsign, sizeof(Set.callsign), "%s", optarg);
+				CallGiven = 1;
+				printf("Setting Callsign: '%s'\n",Set.callsign);
 				break;
 
 			case 'f':
@@ -1062,6 +2395,62 @@ int ParseArgs(int argc, char **argv) {
 					printf("Error loading cfgFile: '%s'\n",cfgFile);
 				break;
 
+			case 'm':
+				// select the COR edge source
+				if (strcmp(optarg,"event") == 0)
+					COR_Mode = COR_EVT_EVENT;
+				else if (strcmp(optarg,"poll") == 0)
+					COR_Mode = COR_EVT_POLL;
+				else if (strcmp(optarg,"sim") == 0)
+					COR_Mode = COR_EVT_SIM;
+				else
+					printf("Unknown COR mode: '%s'\n",optarg);
+				break;
+
+			case 'g':
+				// alternate GPIO character device
+				strcpy(gpioChip,optarg);
+				break;
+
+			case 'G':
+				// select the GPIO backend
+				if (gpio_backend_parse(optarg) >= 0)
+					GPIO_Backend = gpio_backend_parse(optarg);
+				else
+					printf("Unknown GPIO backend: '%s'\n",optarg);
+				break;
+
+			case 's':
+				// COR edge script, implies the sim source
+				strcpy(corSimFile,optarg);
+				COR_Mode = COR_EVT_SIM;
+				break;
+
+			case 't':
+				// trace file for the output pins
+				snprintf(traceFile, sizeof(traceFile), "%s", optarg);
+				break;
+
+			case 'T':
+				// how much virtual time to simulate
+				simTime = atoll(optarg);
+				break;
+
+			case 'a':
+				// audio sink for the software tones
+				snprintf(audioSpec, sizeof(audioSpec), "%s", optarg);
+				break;
+
+			case 'i':
+				// receiver audio, runs the audio I/O engine
+				snprintf(audioInSpec, sizeof(audioInSpec), "%s", optarg);
+				break;
+
+			case 'r':
+				// render the ID and exit
+				snprintf(renderFile, sizeof(renderFile), "%s", optarg);
+				break;
+
 			case '?':
 				/* getopt_long already printed an error message. */
 				break;
@@ -1088,21 +2477,112 @@ int ParseArgs(int argc, char **argv) {
 			printf ("%s ", argv[optind++]);
 		putchar ('\n');
     }
+	return(1);
+}
+
+
+/* COR sampling task. It only runs while the debouncer is
+ * deciding, the edge source wakes the control task the rest
+ * of the time. With the polled source this is what catches
+ * short dropouts between polls.
+ */
+void cor_task(void) {
+	unsigned int changed = get_cor();
+
+	if (changed) {
+		port_wake(changed);
+		task_release(ControlTask);
+	}
 }
 
+/* State machine task. Runs loop() on its period, on COR edges,
+ * and by whenever loop() says it next needs to run.
+ */
+void control_task(void) {
+	int unsettled = 0;
+	long t;
+	int i;
+
+	loop();
+	t = loop_timeout();
+	if (t == 0)
+		task_release(ControlTask);
+	else if (t > 0)
+		task_deadline(ControlTask, timer_to_ns(now() + t));
+	for (i = 0; i < NumPorts; i++)
+		if (!debounce_settled(&Ports[i].deb))
+			unsettled = 1;
+	task_enable(CORTask, unsettled);
+}
 
+/* Telemetry task. Prints the histograms if asked to, reports
+ * overruns and flushes the log. With the pipeline the io thread
+ * runs it after each pass of the event log writer, so the control
+ * thread never waits on stdout; what it prints is then a snapshot
+ * of counters the control thread is still updating.
+ */
+void telemetry_task(void) {
+	unsigned long long n = task_overruns();
+
+	if (DumpStats) {
+		DumpStats = 0;
+		stats_dump(stdout);
+		task_dump(stdout);
+		if (Pipeline)
+			pipe_dump(stdout);
+		aio_dump(stdout);
+		rx_dump(stdout);
+	}
+	if (n != Overruns) {
+		log_event(EV_OVERRUN, n - Overruns, n);
+		Overruns = n;
+	}
+	fflush(stdout);
+}
+
+/* SIGUSR1 asks for the latency histograms, SIGHUP for a config
+ * reload, SIGINT and SIGTERM stop the controller. The handlers
+ * only set flags (and wake the reload thread), main() and the
+ * reload thread do the work.
+ */
+void sig_handler(int sig) {
+	if (sig == SIGUSR1)
+		DumpStats = 1;
+	else if (sig == SIGHUP)
+		reload_request();
+	else
+		Quit = 1;
+}
+
+/* Installs sig_handler(). No SA_RESTART, so a signal wakes
+ * main() out of its wait for a COR edge.
+ */
+void setup_signals(void) {
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+// bench/ctrl_bench.c provides its own main()
+#ifndef NO_MAIN
 int main(int argc, char **argv)
 {
+	int corPins[PORT_MAX];
+	AudioSink * sink = NULL;
+	int i;
+
     debug = DEBUG;
 
-	strcpy(Callsign,DEFAULT_CALLSIGN);
+	settings_default(&Set);
 	strcpy(cfgFile,DEFAULT_CFGFILE);
+	strcpy(gpioChip,DEFAULT_GPIOCHIP);
 
-	// Set starting points for the GPIO pins.
-	COR_Value = COR_OFF;
-	pCOR_Value = COR_Value;
-	PTT_Value = PTT_OFF;
-	ID_PIN = OFF;
 	pwm_div = PWM_DIV;
 
 	if (LoadConfig(cfgFile) != 1)
@@ -1110,26 +2590,233 @@ int main(int argc, char **argv)
 
 	ParseArgs(argc,argv);
 
-	// If you call this, it will not actually access the GPIO
-	// Use for testing
-//	bcm2835_set_debug(1);
+	// Just check the state machine table and exit
+	if (CheckFsm)
+		return(ctrl_check(stdout) ? 0 : 1);
+
+	// Set up the repeater ports from the config
+	if (!port_init())
+		return 1;
 
+	// Just render the ID audio (no GPIO needed) and exit
+	if (renderFile[0] != '\0') {
+		build_tones();
+		if (!build_clips(Snap))
+			return(1);
+		return(render_id(renderFile) ? 0 : 1);
+	}
 
-	// Initialize the bcm2835 library, if this fails,
-	// then bail (exit).
-	if (!bcm2835_init())
+#ifdef SIMULATION
+	// the simulator always runs against the sim GPIO and a
+	// scripted COR input
+	if (COR_Mode != COR_EVT_SIM) {
+		printf("The simulator needs a COR script (--corsim <FILE>)\n");
 		return 1;
+	}
+	GPIO_Backend = GPIO_SIM;
+#endif
+
+	// Open the GPIO backend, if this fails, then bail (exit).
+	// Use '--gpio sim' for testing without any hardware.
+	if (!gpio_open(GPIO_Backend, gpioChip))
+		return 1;
+	printf("GPIO backend: %s\n",gpio_backend_name(gpio_backend()));
+
+	// Trace the output pins, if asked to
+	if (traceFile[0] != '\0') {
+		FILE * fp = (strcmp(traceFile, "-") == 0) ? stdout : fopen(traceFile, "w");
+		if (fp == NULL)
+			printf("Can't open trace file '%s'\n",traceFile);
+		gpio_trace(fp);
+	}
 
 	// This is normally called on startup by the Arduino bootloader,
 	// so we have to do it here.
 	setup();
 
+	// Open the audio sink, if one is configured
+	if (audioSpec[0] != '\0') {
+		sink = sink_open(audioSpec, SampleRate);
+		if (sink != NULL)
+			printf("Audio sink: %s @ %d Hz\n",audioSpec,SampleRate);
+	}
+
+	// With receiver audio as well, the audio I/O engine runs them
+	// both and the tones go out through it
+	if (audioInSpec[0] != '\0') {
+#ifdef SIMULATION
+		printf("The simulator has no audio input\n");
+#else
+		AudioSource * src = source_open(audioInSpec, SampleRate, InputChannels);
+
+		if (src != NULL && aio_init(src, sink, SampleRate, AudioIOPeriod)) {
+			printf("Audio input: %s @ %d Hz, %d channel(s)\n",audioInSpec,SampleRate,src->channels);
+			sink = aio_tx_sink();
+			rx_init(src->channels);
+			repeat_setup(sink != NULL);
+		}
+#endif
+	}
+	// with no receiver audio (or the simulator's) there is no tone
+	if (!aio_ready())
+		rx_init(0);
+	if (sink != NULL) {
+		build_clips(Snap);
+		audio_init(sink, SampleRate);
+	}
+
+	// Open the COR edge source. If the GPIO character device is
+	// not available this quietly falls back to polling.
+	// a port on audio squelch has its COR line, if any, left alone
+	for (i = 0; i < NumPorts; i++)
+		corPins[i] = (Ports[i].squelch == SQ_PIN) ? Ports[i].cor_pin : -1;
+	if (!cor_event_init(COR_Mode, corPins, NumPorts,
+			(COR_Mode == COR_EVT_SIM) ? corSimFile : gpioChip))
+		return 1;
+	printf("COR edge source: %s\n",cor_event_name(cor_event_mode()));
+
+#ifdef SIMULATION
+	// by default run until the ID after the last scripted edge
+	if (simTime < 0)
+		simTime = cor_sim_length() + Set.id_timer + SIM_END_EXTRA;
+	sim_set_end(simTime);
+	printf("Simulating %lld mS\n",simTime);
+#endif
+
+	setup_signals();
+
+#ifdef SIMULATION
+	// one thread, so the run is the same every time
+	Pipeline = 0;
+#else
+	// Each thread sets its own CPU, and with --realtime its
+	// priority: input above control, audio below it and the
+	// event log writer (io) left as an ordinary thread
+	if (Pipeline) {
+		if (ControlCPU < 0)
+			ControlCPU = RTCpu;
+		pipe_set_thread(PIPE_INPUT, InputCPU, Realtime ? rt_clamp(RTPriority + 1) : 0);
+		pipe_set_thread(PIPE_CONTROL, ControlCPU, Realtime ? RTPriority : 0);
+		pipe_set_thread(PIPE_AUDIO, AudioCPU, Realtime ? rt_clamp(RTPriority - 10) : 0);
+		pipe_set_thread(PIPE_IO, IOCPU, 0);
+		evlog_set_hooks(pipe_io_start, telemetry_task);
+	}
+#endif
+
+	// From here on messages go through the event log, so the
+	// control loop never waits on stdout
+	evlog_start(stdout);
+
+#ifndef SIMULATION
+	// The input thread takes over the COR edge source, and the
+	// audio thread the sink
+	if (Pipeline && !pipe_start_input())
+		Pipeline = 0;
+	if (Pipeline && (audio_sink() != NULL || aio_ready()))
+		audio_start_thread(pipe_audio_start);
+
+	// The aio thread, pipeline or not. With --realtime it is the
+	// highest priority, the sound device won't wait.
+	if (aio_ready()) {
+		pipe_set_thread(PIPE_AIO, AioCPU, Realtime ? rt_clamp(RTPriority + 2) : 0);
+		aio_start_thread(pipe_aio_start);
+	}
+
+	// Config file changes (and SIGHUP) are picked up without a
+	// restart, the reload thread shares the io thread's CPU
+	if (Reload)
+		reload_start(cfgFile, IOCPU, Snap, snap_load, snap_drop);
+
+	// Everything is allocated by now. The other threads were
+	// started first and set their own scheduling, and the tasks
+	// are added after the self-test so it isn't counted against
+	// their deadlines.
+	if (Realtime && Pipeline) {
+		if (rt_lock_memory())
+			printf("Realtime: memory locked\n");
+		pipe_thread_init(PIPE_CONTROL);
+		rt_self_test(RTSelfTest, 1000);
+	} else if (Realtime) {
+		rt_setup(RTPriority, RTCpu);
+		rt_self_test(RTSelfTest, 1000);
+	} else if (Pipeline) {
+		pipe_thread_init(PIPE_CONTROL);
+	}
+
+	// Time the audio round trip, out and back in
+	if (LatencyTest > 0)
+		aio_latency_test(LatencyTest);
+#endif
+
+#ifndef SIMULATION
+	// Setup is done, this is what it took
+	mem_report(stdout);
+#endif
+
+	// The tasks, highest rate first (they run in this order).
+	// How late the control task runs is the loop jitter.
+	CORTask = task_add("cor", CORPeriod, cor_task, -1);
+	ControlTask = task_add("control", ControlPeriod, control_task, ST_LOOP_JITTER);
+	if (!Pipeline)
+		TelemetryTask = task_add("telemetry", TelemetryPeriod, telemetry_task, -1);
+	task_enable(CORTask, 0);
+	task_release(ControlTask);
+
 	// This is the normal operating mode of an Arduino, again we
-	// have to provide this functionality. Note, this runs forever
-	// we might add a stop feature at some time to allow the controller
-	// to exit and restart.
-	while(1)
+	// have to provide this functionality. Note, this runs until
+	// SIGINT/SIGTERM. Rather than spinning, we sleep until
+	// COR changes or a task's deadline comes up.
+#ifdef SIMULATION
+	while(!Quit && !sim_finished())
+#else
+	while(!Quit)
+#endif
 	{
-		loop();
+		cor_edge edge;
+		int got;
+
+		if (Pipeline)
+			got = pipe_wait_until(task_next(), &edge);
+		else
+			got = cor_wait_until(task_next(), &edge);
+		if (got > 0) {
+			// every port that hears this receiver
+			for (i = 0; i < NumPorts; i++) {
+				if (Ports[i].hears & (1U << edge.line)) {
+					Ports[i].edge_time = edge.ts_ns;
+					Ports[i].wake = 1;
+				}
+			}
+			if (edge.line < NumPorts)
+				Ports[edge.line].rx_edge = edge.ts_ns;
+			task_release(ControlTask);
+		}
+		if (DumpStats && TelemetryTask >= 0)
+			task_release(TelemetryTask);
+		task_run();
+	}
+
+	if (Pipeline) {
+		pipe_stop();
+		audio_stop_thread();
 	}
+	aio_stop_thread();
+	reload_stop();
+	evlog_stop();
+	if (evlog_dropped())
+		printf("Event log: %lu events dropped\n",evlog_dropped());
+	stats_dump(stdout);
+	task_dump(stdout);
+	if (Pipeline)
+		pipe_dump(stdout);
+	aio_dump(stdout);
+	rx_dump(stdout);
+	gpio_show_stats();
+	gpio_close();
+	if (mem_guard_allocs())
+		printf("loop() allocated memory %lu times\n",mem_guard_allocs());
+	snap_free(Snap);
+	arena_free(CfgArena);
+	return 0;
 }
+#endif
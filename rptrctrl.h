@@ -12,7 +12,12 @@
  * This implementation does not afford a separate input for a
  * tone decoder output, hence the term, 'minimalist'. To provide
  * tone access control, the receiver must have tone decoding
- * built in and the COR output must AND with this.
+ * built in and the COR output must AND with this, or the receiver
+ * audio must come in through the audio input, where a software
+ * CTCSS decoder does the ANDing (see ctcss.h and [CTCSS]). A
+ * receiver without a usable COR line can have its COR worked out
+ * from that audio too, by VOX or noise squelch (see squelch.h and
+ * [SQUELCH]).
  *
  * The COR input and PTT output pins on the Rasberry PI GPIO port
  * are specified by defines. These should be changed to match your
@@ -25,14 +30,13 @@
  * Default values for the ID timer (600 Seconds - 10 minutes) and
  * the squelch tail timer (1 second) are specified by defines.
  * The runtime values of these parameters are stored in variables
- * and could be changed programatically, if desired (e.g. via the
- * serial port). Of course, you'd have to write that code.
+ * and can be changed over the air with DTMF commands, when there
+ * is receiver audio (see cmd.h and [DTMF]).
  *
- * The ID Time out timer is implemented using the C time library and
- * is based on the elapsed time counter (unsigned long int seconds)
- * so timeout values are restricted to integer values greater than
- * one second. The squelch tail timer is implemented the same way,
- * so it has the same restrictions.
+ * The ID Time out timer and squelch tail timer are named timers in
+ * the timer service (timers.c), based on CLOCK_MONOTONIC with mS
+ * resolution, so they are not affected by wall clock steps. Both
+ * interval values are set in mS and can be changed in the config file.
  *
  * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
  *
@@ -57,13 +61,40 @@
  * http://www.airspayce.com/mikem/bcm2835/
  */
 
-#ifndef __RPTRCTRL_H__
-#define __RPTRCTRL_H__
-
-/* Make this header file easier to include in C++ code */
-#ifdef __cplusplus
-extern "C" {
-#endif
+#ifndef __RPTRCTRL_H__
+#define __RPTRCTRL_H__
+
+#include "timers.h"
+#include "toneseq.h"
+#include "gpio.h"
+#include "fsm.h"
+#include "debounce.h"
+#include "morse.h"
+#include "clipcache.h"
+#include "mem.h"
+#include "cmd.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PORT_MAX  TIMER_PORTS     // [PORT1] to [PORT4]
+
+// The settings of a [PORTn] section, NULL if not given
+typedef struct
+{
+    const char* pttpin;
+    const char* corpin;
+    const char* corled;
+    const char* idpin;
+    const char* callsign;
+    const char* idtimer;
+    const char* sqtimer;
+    const char* link;
+    const char* ctcss;
+    const char* squelch;
+} port_config;
 
 typedef struct
 {
@@ -71,6 +102,9 @@ typedef struct
     const char* name;
     const char* email;
     const char* callsign;
+    const char* cwidwpm;
+    const char* cwidfwpm;
+    const char* keyupaction;
     const char* corsense;
     const char* pttsense;
     const char* cwidspeed;
@@ -79,8 +113,148 @@ typedef struct
     const char* beepfreq1;
     const char* beepfreq2;
     const char* beeptime;
+    const char* audiosink;
+    const char* samplerate;
+    const char* ramptime;
+    const char* level;
+    const char* cachedir;
+    const char* audioinput;
+    const char* audioperiod;
+    const char* latencytest;
+    const char* inputchannels;
+    const char* ctcsstone;
+    const char* ctcssdetect;
+    const char* ctcssrelease;
+    const char* squelchmode;
+    const char* squelchopen;
+    const char* squelchclose;
+    const char* squelchattack;
+    const char* squelchrelease;
+    const char* repeataudio;
+    const char* repeatdelay;
+    const char* repeatmute;
+    const char* repeatfade;
+    const char* dtmfpin;
+    const char* dtmfcode[CMD_COUNT];
+    const char* dtmftimeout;
+    const char* idtimer;
+    const char* sqtimer;
+    const char* corassert;
+    const char* correlease;
+    const char* corperiod;
+    const char* controlperiod;
+    const char* telemetryperiod;
+    const char* rtpriority;
+    const char* rtcpu;
+    const char* rtselftest;
+    const char* pipeline;
+    const char* inputcpu;
+    const char* controlcpu;
+    const char* audiocpu;
+    const char* iocpu;
+    const char* aiocpu;
+    const char* reload;
+    int ports;              // highest [PORTn] section seen
+    port_config port[PORT_MAX];
+    Arena * arena;          // the strings above are kept in
 } configuration;
 
+// The settings a config reload can change (see reload.c). The rest
+// of the config (pins, senses, audio, scheduling, threads and the
+// number of ports) only takes effect on a restart.
+typedef struct
+{
+    char callsign[30];      // for the ports without their own
+    int id_tone;            // Audio frequency of CW ID
+    int beep_type;          // Courtesy Beep Type
+    int beep_tone1;         // Audio frequency of Courtesy Beep 1
+    int beep_tone2;         // Audio frequency of Courtesy Beep 2
+    int beep_duration;      // Courtesy Tone length (in CWID increments)
+    int cw_timebase;        // Courtesy beep time base (This is a delay in mS)
+    int cw_wpm;             // CW ID Speed in WPM (0 = 1200/cw_timebase)
+    int cw_fwpm;            // CW ID Farnsworth speed in WPM (0 = off)
+    int keyup_action;       // what to do if a user keys up over the ID
+    int id_timer;           // ID interval - in mS
+    int sq_timer;           // Squelch Tail interval - in mS
+    struct {
+        char callsign[30];  // '' = the one above
+        int id_timer;       // -1 = the one above
+        int sq_timer;       // -1 = the one above
+    } port[PORT_MAX];
+    char dtmf_pin[CMD_CODE];    // for remote control, '' = none
+    char dtmf_code[CMD_COUNT][CMD_CODE];  // each command's, '' = not used
+    int dtmf_timeout;       // in mS, between digits
+} Settings;
+
+// A port's ID and courtesy beep, built from the settings
+typedef struct
+{
+    char callsign[30];
+    int id_timer;
+    int sq_timer;
+    MorseTimeline morse;    // the callsign compiled for keying
+    ToneSeq id_seq;         // the CW ID
+    ToneSeq beep_seq;       // the courtesy beep
+} PortTones;
+
+// The settings and everything built from them. Built off the control
+// thread and never changed once it is in use; a reload builds a new
+// one and the control thread swaps to it between IDs and beeps.
+typedef struct
+{
+    Settings set;
+    PortTones port[PORT_MAX];
+    CmdTrie cmds;           // the PIN and codes, compiled
+    ClipSet clips;          // the first port's ID and beeps, if there is a sink
+    Arena * arena;          // it lives in, freed with it
+} Snapshot;
+
+// One repeater or link radio: its pins and settings, and the state
+// machine and everything else it runs on. All ports are serviced
+// from the one control loop.
+typedef struct
+{
+    int num;                // n of its [PORTn] section
+    int ptt_pin;
+    int cor_pin;
+    int cor_led;
+    int id_pin;
+    char callsign[30];
+    int id_timer;           // ID interval - in mS
+    int sq_timer;           // Squelch Tail interval - in mS
+    unsigned int links;     // ports this port's receiver keys up
+    unsigned int hears;     // receivers that key this port up
+    int tone;               // CTCSS tone its receiver needs, -1 = none
+    int squelch;            // where its COR comes from, SQ_PIN = the pin
+    int tmr;                // first of this port's timers
+    int log;                // port number for the event log, 0 = only one
+
+    Fsm fsm;                // the state machine, see CtrlTable
+    Debouncer deb;          // COR debouncer
+    int cor_raw;            // this port's own COR input
+    int cor;                // COR_ON if it or a linked receiver is active
+    int pcor;               // cor the last time the state machine ran
+    int ptt;                // current PTT state
+    int need_id;            // Whether on not we need to ID
+    int beep_sending;       // courtesy beep still playing
+    int id_sending;         // CW ID still being sent
+    int wake;               // run the state machine on the next pass
+    int disabled;           // by remote control, it doesn't repeat
+    CmdState cmd;           // its receiver's DTMF command so far
+    msec_t due;             // or by this time, -1 = only when woken
+    long long edge_time;    // time of the most recent COR edge (nS)
+    long long rx_edge;      // time its own receiver's COR last changed (nS)
+    long long on_edge;      // edge that started the current keyup
+    long long off_edge;     // edge that ended the last keyup
+    long long ptt_on_from;  // COR edge the pending PTT on is timed from
+    long long ptt_off_from; // COR edge the pending PTT off is timed from
+
+    MorseTimeline morse;    // the callsign compiled for keying
+    ToneSeq id_seq;         // the CW ID, pre-built
+    ToneSeq beep_seq;       // the courtesy beep, pre-built
+    char names[3][8];       // trace names of the PTT, LED and ID pins
+} Port;
+
 #define VER_MAJOR 0
 #define VER_MINOR 85
 
@@ -104,14 +278,20 @@ typedef struct
 
 // Here we define the starting values of the ID and Squelch Tail
 // Timers
-#define DEFAULT_ID_TIMER 600       // In Seconds
-#define DEFAULT_SQ_TIMER 1         // In Seconds
+#define DEFAULT_ID_TIMER 600000    // In mS
+#define DEFAULT_SQ_TIMER 1000      // In mS
 
 // other misc timer values
 #define ID_PTT_DELAY  200       // in mS
 #define ID_PTT_HANG   500       // in mS
 #define CW_MIN_DELAY  30        // in mS
-#define COR_DEBOUNCE_DELAY  50  // in mS
+#define DEFAULT_COR_ASSERT  20  // in mS, COR debounce windows
+#define DEFAULT_COR_RELEASE 50  // in mS
+
+// cyclic executive task periods
+#define DEFAULT_COR_PERIOD        1     // in mS, while debouncing
+#define DEFAULT_CONTROL_PERIOD    10    // in mS
+#define DEFAULT_TELEMETRY_PERIOD  1000  // in mS
 
 #define OFF LOW
 #define ON HIGH
@@ -161,9 +341,35 @@ enum CtrlStates {
   CS_SQT_ON,
   CS_SQT_BEEP,
   CS_SQT,
+  CS_DEBOUNCE_REKEY,
   CS_SQT_OFF,
   CS_PTT_OFF,
-  CS_ID
+  CS_ID,
+  CS_COUNT
+};
+
+// The state machine events, in priority order: when several are
+// true at once, the lowest numbered one the state handles is taken
+enum CtrlEvents {
+  CE_DONE,              // always, for the transition states
+  CE_ID_DUE,            // ID timer expired and an ID is needed
+  CE_ID_KEYUP,          // COR on during the ID, KeyupAction=Abort
+  CE_COR_ON,            // COR input active
+  CE_COR_OFF,           // COR input not active
+  CE_DEB_ON,            // debounced COR on
+  CE_DEB_OFF,           // debounced COR off
+  CE_FLAKE,             // debouncer settled back where it was
+  CE_SQT_DONE,          // squelch tail timer expired
+  CE_BEEP_DONE,         // courtesy beep finished
+  CE_ID_DONE,           // ID finished, COR off
+  CE_ID_DONE_KEYED,     // ID finished, COR on
+  CE_COUNT
+};
+
+// What to do when a user keys up while the ID is being sent
+enum IDKeyupActions {
+  ID_KEYUP_FINISH,      // finish the ID over the user
+  ID_KEYUP_ABORT        // abort, and send the ID at the next IDLE
 };
 
 enum BeepTypes {
@@ -241,10 +447,10 @@ enum BeepTypes {
 //int Need_ID;   // Whether on not we need to ID (was bool)
 
 /* Flag set by ‘--verbose’. */
-static int verbose;
+extern int verbose;
 
 /* Flag set by ‘--debug’. */
-static int debug;
+extern int debug;
 
 //~~~~~~ abstraction of arduino dio commands
 #define OUTPUT 1
@@ -252,24 +458,24 @@ static int debug;
 //#define HIGH 1
 //#define LOW 0
 
-// This functions returns the current time in seconds from start
-// of UNIX epoch
-time_t now(void);
+// This functions returns the current time in mS since the
+// timer service was started (CLOCK_MONOTONIC based)
+msec_t now(void);
 // This function emulates the arduino pinMode function,
 // setting the specified pin to the provided mode using
-// the bcm2835 library
+// the selected GPIO backend
 void pinMode(int pin,int value);
 // This function emulates the arduino digitalWrite
-// function, setting the specified pin to the
-// provided value using the bcm2835 library
+// function, queueing the specified pin's new value
+// until the end of the loop() pass
 void digitalWrite(int pin,int value);
 // This function emulates the arduino digitalRead
 // function, returning the value of the specified
-// pin using the bcm2835 library
+// pin using the selected GPIO backend
 int digitalRead(int pin);
 // This function emulates the arduino analogWrite
 // function, setting the specified PWM pin to the
-// provided value using the bcm2835 library
+// provided value using the selected GPIO backend
 void analogWrite(int pin,int value);
 /* This function will turn on the CW ID key
  * pin and start the PWM timer to enable tone
@@ -286,44 +492,110 @@ void noTone(int pin);
 /* This function will reset the ID Timer by adding the
  * timer interval value to the current elapsed time
  */
-void reset_id_timer(void);
-
-/* This function will generate a beep of the
- * specified duration and frequency using PWM
- * (if enabled) and turn on the CW ID key
- * pin for the duration of the tone to enable
- * and external tone generator.
- * Note: This is a *Blocking call*
+void reset_id_timer(Port * p);
+
+/* This function starts the courtesy beep, loop() advances it
+ * Note: This is NOT a *Blocking call*
  */
-void beep(int freq, int duration);
-/* This function will play the courtesy beep.
- * Note: This is a *Blocking call*
+void cbeep_start(Port * p);
+/* Advances the courtesy beep, returns 1 while it is still playing */
+int cbeep_poll(Port * p);
+/* Cuts the courtesy beep short */
+void cbeep_abort(Port * p);
+
+/* Appends the courtesy beep to a tone sequence */
+void cbeep_build(ToneSeq * seq, const Settings * set, int btype);
+/* Compiles a callsign into an ID keying timeline. Returns 0 if
+ * it didn't fit.
  */
-void do_cbeep(int btype);
-
-/* this function will play the CW ID,
- * Note: This is a *BLOCKING CALL*
+int id_compile(MorseTimeline * m, const char * call, const Settings * set);
+/* Builds the CW ID tone sequence from the ID keying timeline */
+void id_build(ToneSeq * seq, const MorseTimeline * m, const Settings * set);
+/* This function starts the CW ID, loop() advances it
+ * Note: This is NOT a *Blocking call*
+ */
+void id_start(Port * p);
+/* Advances the CW ID, returns 1 while it is still playing */
+int id_poll(Port * p);
+/* Stops the CW ID part way through */
+void id_abort(Port * p);
+/* Renders the CW ID (with its courtesy beep) to a WAV file */
+int render_id(char * file);
+/* Renders the ID and courtesy beeps into a snapshot's clips */
+int build_clips(Snapshot * s);
+/* Sets the dump/quit flags from SIGUSR1/SIGINT/SIGTERM, and
+ * asks for a reload on SIGHUP
+ */
+void sig_handler(int sig);
+/* Installs sig_handler() */
+void setup_signals(void);
+/* Fills in the settings the controller has with no config */
+void settings_default(Settings * set);
+/* Reads the settings a reload can change from the config, into
+ * 'set' only if they are all good. Returns 0 if one is bad.
  */
-void do_ID(void);
+int settings_parse(const configuration * c, Settings * set);
+/* Builds a snapshot from the settings: each port's Morse timeline
+ * and tone sequences, and the clips if 'clips'. It goes in arena 'a'
+ * (a new one if NULL), which it then owns. NULL on failure.
+ */
+Snapshot * snap_build(const Settings * set, int clips, Arena * a);
+/* Frees a snapshot and its arena */
+void snap_free(Snapshot * s);
+/* Switches the ports over to a snapshot */
+void snap_apply(Snapshot * s);
+/* Builds the snapshot the controller starts on and the tone
+ * synthesizer
+ */
+void build_tones(void);
 /* This function will print current repeater operating states
  * to the serial port. For debuggin purposes only.
  */
-void show_state_info(void) ;
+void show_state_info(Port * p);
 /* Startup info */
 void Show_Start_Info(void);
 void setCOR_Sense(int Sense);
 void setPTT_Sense(int Sense);
-char* cvt2morse(char c);
-int ConvertCall(char * call);
+/* Fills in the ports from the config, returns 0 if one is bad */
+int port_init(void);
+// A DTMF digit, from the audio thread to the control thread
+typedef struct
+{
+    int port;               // index of the port whose receiver heard it
+    char digit;
+} DtmfDigit;
+
+#define DTMF_QUEUE  16      // digits, a power of 2
+
+/* Starts the ports' CTCSS, DTMF and squelch decoders on
+ * 'channels' channels of receiver audio, 0 if there is none
+ */
+void rx_init(int channels);
+/* Prints the decoders' counters */
+void rx_dump(FILE * fp);
 /* One time startup init loop */
 void setup(void);
-void get_cor(void);
-void show_msg(char * buf);
+unsigned int get_cor(void);
+void show_msg(Port * p, int ev);
+void log_port(Port * p, int ev, long long a, long long b);
+void log_event(int ev, long long a, long long b);
 void loop1(void);
 void loop(void);
-static int handler(void* user, const char* section, const char* name,
-                   const char* value);
+/* Returns how long main() may sleep waiting for a COR
+ * edge before loop() has to run again, in mS
+ */
+long loop_timeout(void);
+/* Marks the ports in the mask as needing a run of loop() */
+void port_wake(unsigned int mask);
+/* The cyclic executive's tasks */
+void cor_task(void);
+void control_task(void);
+void telemetry_task(void);
 int LoadConfig(char * cfile);
+/* Reload hook: builds a snapshot from the config file on top of
+ * 'base', NULL if the file is bad. Runs on the reload thread.
+ */
+void * snap_load(const char * file, const void * base);
 void header(char * name);
 void copyright(void);
 void version(void);
@@ -0,0 +1,162 @@
+/* rt.c - Real-time operating mode for the 'minimalist' repeater
+ * controller.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: rt.c
+ * Author: KB4OID/Kodetroll
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "rt.h"
+
+static long long late_ns[RT_SELFTEST_MAX];
+
+/* Touches the stack a page at a time so it is all resident
+ * and locked
+ */
+static int prefault_stack(void) {
+	volatile unsigned char buf[RT_STACK_PREFAULT];
+	int i;
+
+	for (i = 0; i < RT_STACK_PREFAULT; i += 4096)
+		buf[i] = 0;
+	return(buf[0]);
+}
+
+/* Locks current and future memory, prefaults the stack and keeps
+ * the heap from shrinking. Returns 1 on success.
+ */
+int rt_lock_memory(void) {
+	// freed memory stays with us instead of being trimmed, and
+	// big blocks come from the (locked) heap rather than mmap()
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		printf("Realtime: mlockall failed: %s\n",strerror(errno));
+		return(0);
+	}
+	prefault_stack();
+	return(1);
+}
+
+/* Pins the calling thread to a CPU. Returns 1 on success.
+ */
+int rt_pin_cpu(int cpu) {
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err != 0) {
+		printf("Realtime: can't pin to CPU %d: %s\n",cpu,strerror(err));
+		return(0);
+	}
+	return(1);
+}
+
+/* Sets the calling thread to SCHED_FIFO at 'prio'. Returns 1 on success.
+ */
+int rt_set_priority(int prio) {
+	struct sched_param sp;
+	int err;
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = prio;
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if (err != 0) {
+		printf("Realtime: can't set SCHED_FIFO %d: %s\n",prio,strerror(err));
+		return(0);
+	}
+	return(1);
+}
+
+/* Returns 'prio' brought into the SCHED_FIFO range
+ */
+int rt_clamp(int prio) {
+	int lo = sched_get_priority_min(SCHED_FIFO);
+	int hi = sched_get_priority_max(SCHED_FIFO);
+
+	if (prio < lo)
+		return(lo);
+	if (prio > hi)
+		return(hi);
+	return(prio);
+}
+
+/* All three of the above, printing what worked. Returns 1 if all did.
+ */
+int rt_setup(int prio, int cpu) {
+	int ok = 1;
+
+	if (rt_lock_memory())
+		printf("Realtime: memory locked\n");
+	else
+		ok = 0;
+	if (cpu >= 0) {
+		if (rt_pin_cpu(cpu))
+			printf("Realtime: pinned to CPU %d\n",cpu);
+		else
+			ok = 0;
+	}
+	if (rt_set_priority(prio))
+		printf("Realtime: SCHED_FIFO priority %d\n",prio);
+	else
+		ok = 0;
+	return(ok);
+}
+
+static int cmp_ll(const void * a, const void * b) {
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+
+	return((x > y) - (x < y));
+}
+
+/* Sleeps 'count' times to absolute deadlines 'period_us' uS apart
+ * and prints how late the wakeups were
+ */
+void rt_self_test(int count, int period_us) {
+	struct timespec ts, now;
+	long long due, sum = 0;
+	int i;
+
+	if (count > RT_SELFTEST_MAX)
+		count = RT_SELFTEST_MAX;
+	if (count <= 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	due = (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+	for (i = 0; i < count; i++) {
+		due += period_us * 1000LL;
+		ts.tv_sec = due / 1000000000LL;
+		ts.tv_nsec = due % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late_ns[i] = (long long)now.tv_sec * 1000000000LL + now.tv_nsec - due;
+		sum += late_ns[i];
+	}
+
+	qsort(late_ns, count, sizeof(long long), cmp_ll);
+	printf("Jitter self-test: %d wakeups, %d uS apart, late by "
+		"min %.1f, mean %.1f, p99 %.1f, max %.1f uS\n",
+		count, period_us, late_ns[0] / 1000.0, sum / 1000.0 / count,
+		late_ns[(int)(0.99 * (count - 1))] / 1000.0,
+		late_ns[count - 1] / 1000.0);
+}
@@ -0,0 +1,58 @@
+/* rt.h - Real-time operating mode for the 'minimalist' repeater
+ * controller.
+ *
+ * As a normal SCHED_OTHER process with pageable memory the
+ * controller's wakeups get late whenever something else on the Pi
+ * is busy, or a page it needs has to come back in. With --realtime
+ * it locks and prefaults its memory, stops malloc() giving memory
+ * back to the kernel, pins itself to one core and runs at a
+ * SCHED_FIFO priority. A short self-test then measures how late
+ * clock_nanosleep() wakeups actually are.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: rt.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __RT_H__
+#define __RT_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RT_DEFAULT_PRIORITY  80     // SCHED_FIFO, 1-99
+#define RT_DEFAULT_CPU       -1     // -1 = don't pin
+#define RT_CPU_MAX           1023   // highest CPU that can be pinned to, CPU_SETSIZE - 1
+#define RT_SELFTEST_MAX      10000  // max self-test wakeups
+#define RT_DEFAULT_SELFTEST  1000   // self-test wakeups, 1 mS apart
+#define RT_STACK_PREFAULT    (256 * 1024)
+
+/* Locks current and future memory, prefaults the stack and keeps
+ * the heap from shrinking. Returns 1 on success.
+ */
+int rt_lock_memory(void);
+/* Pins the calling thread to a CPU. Returns 1 on success. */
+int rt_pin_cpu(int cpu);
+/* Sets the calling thread to SCHED_FIFO at 'prio'. Returns 1 on success. */
+int rt_set_priority(int prio);
+/* Returns 'prio' brought into the SCHED_FIFO range */
+int rt_clamp(int prio);
+/* All three of the above, printing what worked. Returns 1 if all did. */
+int rt_setup(int prio, int cpu);
+/* Sleeps 'count' times to absolute deadlines 'period_us' uS apart
+ * and prints how late the wakeups were
+ */
+void rt_self_test(int count, int period_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __RT_H__
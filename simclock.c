@@ -0,0 +1,52 @@
+/* simclock.c - Virtual clock for the 'minimalist' repeater controller
+ * simulator.
+ *
+ * The clock starts at zero and only moves when someone sleeps on it,
+ * so the simulation is deterministic: the same script and config
+ * always give the same trace.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: simclock.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include "simclock.h"
+
+static long long sim_ns;            // virtual CLOCK_MONOTONIC
+static long long end_ms = -1;       // when to stop, -1 = never
+
+/* Returns the virtual time in nS
+ */
+long long sim_clock_ns(void) {
+	return(sim_ns);
+}
+
+/* Moves the virtual clock forward 'ms' mS
+ */
+void sim_sleep_ms(long ms) {
+	if (ms > 0)
+		sim_ns += (long long)ms * 1000000LL;
+}
+
+/* Sets the virtual time the simulation stops at, in mS
+ */
+void sim_set_end(long long ms) {
+	end_ms = ms;
+}
+
+/* Returns the virtual time the simulation stops at, in mS
+ */
+long long sim_end(void) {
+	return(end_ms);
+}
+
+/* Returns 1 once the virtual clock has reached the end time
+ */
+int sim_finished(void) {
+	return(end_ms >= 0 && sim_ns / 1000000LL >= end_ms);
+}
@@ -0,0 +1,46 @@
+/* simclock.h - Virtual clock for the 'minimalist' repeater controller
+ * simulator.
+ *
+ * 'make sim' builds rptrctrl-sim with SIMULATION defined. In that
+ * build the timer service, the COR edge source and delay() all run
+ * on this clock instead of CLOCK_MONOTONIC, and a sleep just moves
+ * the clock forward. The unmodified state machine then runs against
+ * a scripted COR input (--corsim) with the sim GPIO backend, so an
+ * hour of repeater operation takes a few mS.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: simclock.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __SIMCLOCK_H__
+#define __SIMCLOCK_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_END_EXTRA 10000     // in mS, run on after the last ID is due
+
+/* Returns the virtual time in nS */
+long long sim_clock_ns(void);
+/* Moves the virtual clock forward 'ms' mS */
+void sim_sleep_ms(long ms);
+/* Sets the virtual time the simulation stops at, in mS */
+void sim_set_end(long long ms);
+/* Returns the virtual time the simulation stops at, in mS */
+long long sim_end(void);
+/* Returns 1 once the virtual clock has reached the end time */
+int sim_finished(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SIMCLOCK_H__
@@ -0,0 +1,113 @@
+/* spsc.c - Single producer / single consumer queue for the
+ * 'minimalist' repeater controller.
+ *
+ * The indexes only ever count up, the slot is the index masked by
+ * size - 1. The producer owns 'head' and the consumer owns 'tail';
+ * each publishes its index with a release store and reads the
+ * other's with an acquire load, so the item is always written
+ * before it can be seen and read before its slot can be reused.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: spsc.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "spsc.h"
+
+/* Sets a queue up on 'buf', 'size' slots (a power of 2) of 'elem'
+ * bytes. Returns 1 on success.
+ */
+int spsc_init(Spsc * q, const char * name, void * buf, unsigned int size, unsigned int elem) {
+	memset(q, 0, sizeof(*q));
+	if (size == 0 || (size & (size - 1)) != 0) {
+		printf("spsc: queue '%s' size %u isn't a power of 2\n",name,size);
+		return(0);
+	}
+	q->name = name;
+	q->buf = buf;
+	q->size = size;
+	q->elem = elem;
+	return(1);
+}
+
+/* Returns the next item to fill in place, NULL (counted) if full.
+ * spsc_commit() publishes it. Producer only.
+ */
+void * spsc_reserve(Spsc * q) {
+	unsigned int n = q->head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+	if (n >= q->size) {
+		__atomic_store_n(&q->full, q->full + 1, __ATOMIC_RELAXED);
+		return(NULL);
+	}
+	if (n + 1 > q->high)
+		q->high = n + 1;
+	return(q->buf + (q->head & (q->size - 1)) * q->elem);
+}
+
+/* Publishes the item from spsc_reserve()
+ */
+void spsc_commit(Spsc * q) {
+	q->pushed++;
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Copies an item in. Producer only. Returns 0 (and counts it) if full.
+ */
+int spsc_push(Spsc * q, const void * item) {
+	void * slot = spsc_reserve(q);
+
+	if (slot == NULL)
+		return(0);
+	memcpy(slot, item, q->elem);
+	spsc_commit(q);
+	return(1);
+}
+
+/* Returns the oldest item without taking it, NULL if empty.
+ * Consumer only.
+ */
+const void * spsc_peek(Spsc * q) {
+	if (q->tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+		return(NULL);
+	return(q->buf + (q->tail & (q->size - 1)) * q->elem);
+}
+
+/* Drops the item from spsc_peek(). Consumer only.
+ */
+void spsc_drop(Spsc * q) {
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Copies the oldest item out. Consumer only. Returns 0 if empty.
+ */
+int spsc_pop(Spsc * q, void * item) {
+	const void * slot = spsc_peek(q);
+
+	if (slot == NULL)
+		return(0);
+	memcpy(item, slot, q->elem);
+	spsc_drop(q);
+	return(1);
+}
+
+/* Returns the number of items waiting, from either side
+ */
+unsigned int spsc_count(Spsc * q) {
+	return(__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) -
+		__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE));
+}
+
+/* Prints a line of the queue's counters
+ */
+void spsc_dump(Spsc * q, FILE * fp) {
+	fprintf(fp, "%-14s %6u %10lu %9lu %6u %6u\n", q->name, q->size,
+		q->pushed, __atomic_load_n(&q->full, __ATOMIC_RELAXED),
+		q->high, spsc_count(q));
+}
@@ -0,0 +1,75 @@
+/* spsc.h - Single producer / single consumer queue for the
+ * 'minimalist' repeater controller.
+ *
+ * The threads of the controller only talk to each other through
+ * these: a bounded ring of fixed size items with one thread pushing
+ * and one popping. Neither side ever takes a lock or waits, a push
+ * to a full queue fails and is counted instead (back-pressure), and
+ * the most items ever waiting is kept, so the queues can be sized
+ * from a real run.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: spsc.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPSC_LINE  64           // keep the two sides' indexes apart
+
+typedef struct
+{
+    const char * name;
+    unsigned char * buf;    // size * elem bytes, from the caller
+    unsigned int size;      // slots, a power of 2
+    unsigned int elem;      // bytes in an item
+    // producer side
+    unsigned int head __attribute__((aligned(SPSC_LINE)));
+    unsigned long pushed;
+    unsigned long full;     // pushes refused, the consumer was behind
+    unsigned int high;      // most items ever waiting
+    // consumer side
+    unsigned int tail __attribute__((aligned(SPSC_LINE)));
+} Spsc;
+
+/* Sets a queue up on 'buf', 'size' slots (a power of 2) of 'elem'
+ * bytes. Returns 1 on success.
+ */
+int spsc_init(Spsc * q, const char * name, void * buf, unsigned int size, unsigned int elem);
+/* Copies an item in. Producer only. Returns 0 (and counts it) if full. */
+int spsc_push(Spsc * q, const void * item);
+/* Returns the next item to fill in place, NULL (counted) if full.
+ * spsc_commit() publishes it. Producer only.
+ */
+void * spsc_reserve(Spsc * q);
+/* Publishes the item from spsc_reserve() */
+void spsc_commit(Spsc * q);
+/* Copies the oldest item out. Consumer only. Returns 0 if empty. */
+int spsc_pop(Spsc * q, void * item);
+/* Returns the oldest item without taking it, NULL if empty. Consumer only. */
+const void * spsc_peek(Spsc * q);
+/* Drops the item from spsc_peek(). Consumer only. */
+void spsc_drop(Spsc * q);
+/* Returns the number of items waiting, from either side */
+unsigned int spsc_count(Spsc * q);
+/* Prints a line of the queue's counters */
+void spsc_dump(Spsc * q, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SPSC_H__
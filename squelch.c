@@ -0,0 +1,265 @@
+/* squelch.c - Audio carrier detect (VOX and noise squelch) for the
+ * 'minimalist' repeater controller.
+ *
+ * The filter bank is four biquads in transposed direct form II, one
+ * to a lane of a vector, so a sample through all of them is a handful
+ * of vector operations (NEON on the Pi, SSE on a PC):
+ *
+ *   lane 0  voice high pass, 300 Hz       } fed the input
+ *   lane 1  noise high pass, 1st half     }
+ *   lane 2  voice low pass, 2500 Hz       } fed lanes 0 and 1's last
+ *   lane 3  noise high pass, 2nd half     } output
+ *
+ * The second stage runs a sample behind the first, which makes no
+ * difference to the levels. The noise band is a 4th order Butterworth
+ * high pass at SQ_NOISE_LO, or a bit under Nyquist at low rates.
+ * Lanes 2 and 3 are squared and added up over the block, and the sums
+ * held against the thresholds, kept as sums of squares so there is
+ * no log or square root on the audio thread but for the dump's levels.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: squelch.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "squelch.h"
+
+#define SQ_VOICE_LO     300.0   // in Hz, the voice band
+#define SQ_VOICE_HI     2500.0
+#define SQ_NOISE_LO     4000.0  // in Hz, where the noise band starts
+#define SQ_FULL_SCALE   32768.0
+#define SQ_TINY         1e-15f  // filter state flushed to 0, no denormals
+
+static const char * const names[SQ_MODES] = { "Pin", "VOX", "Noise" };
+
+/* Returns the mode called 'name' (Pin, VOX or Noise), -1 if there
+ * isn't one
+ */
+int squelch_mode(const char * name) {
+	int i;
+
+	for (i = 0; i < SQ_MODES; i++)
+		if (strcasecmp(name, names[i]) == 0)
+			return(i);
+	return(-1);
+}
+
+/* Returns a mode's name
+ */
+const char * squelch_mode_name(int mode) {
+	return((mode >= 0 && mode < SQ_MODES) ? names[mode] : "?");
+}
+
+/* Fills in a mode's default Open and Close levels
+ */
+void squelch_defaults(int mode, double * open, double * close) {
+	if (mode == SQ_NOISE) {
+		*open = DEFAULT_NOISE_OPEN;
+		*close = DEFAULT_NOISE_CLOSE;
+	} else {
+		*open = DEFAULT_VOX_OPEN;
+		*close = DEFAULT_VOX_CLOSE;
+	}
+}
+
+/* Returns 0 (and prints why) if Open and Close are the wrong way
+ * round for the mode, or above full scale
+ */
+int squelch_check(int mode, double open, double close) {
+	if (open > 0 || close > 0) {
+		printf("Squelch: Open and Close are in dBFS, 0 or under\n");
+		return(0);
+	}
+	if (mode == SQ_VOX && close > open) {
+		printf("Squelch: VOX needs Close at or under Open\n");
+		return(0);
+	}
+	if (mode == SQ_NOISE && close < open) {
+		printf("Squelch: Noise needs Close at or over Open\n");
+		return(0);
+	}
+	return(1);
+}
+
+/* Designs lane 'i' of the bank, a low or high pass at 'fc' with Q
+ * 'q', by the bilinear transform
+ */
+static void biquad(Squelch * d, int i, int high, double fc, double fs, double q) {
+	double k = tan(M_PI * fc / fs);
+	double norm = 1 / (1 + k / q + k * k);
+
+	if (high) {
+		d->b0[i] = (float)norm;
+		d->b1[i] = (float)(-2 * norm);
+	} else {
+		d->b0[i] = (float)(k * k * norm);
+		d->b1[i] = (float)(2 * k * k * norm);
+	}
+	d->b2[i] = d->b0[i];
+	d->a1[i] = (float)(2 * (k * k - 1) * norm);
+	d->a2[i] = (float)((1 - k / q + k * k) * norm);
+}
+
+/* Turns a level in dBFS into a block's sum of squares
+ */
+static float block_power(double db, int block) {
+	double rms = SQ_FULL_SCALE * pow(10, db / 20);
+
+	return((float)(rms * rms * block));
+}
+
+/* Turns a block's sum of squares into a level in dBFS
+ */
+static float block_db(float sum, int block) {
+	double ms = sum / block / (SQ_FULL_SCALE * SQ_FULL_SCALE);
+
+	return((float)(10 * log10(ms > 1e-12 ? ms : 1e-12)));
+}
+
+/* Sets up a detector in 'mode' on audio at 'rate' Hz, with Open and
+ * Close in dBFS, going on after 'attack_ms' past Open and off after
+ * 'release_ms' past Close. Returns 0 if the rate is too low.
+ */
+int squelch_init(Squelch * d, int rate, int mode, double open, double close,
+		int attack_ms, int release_ms) {
+	double noise = SQ_NOISE_LO;
+
+	memset(d, 0, sizeof(*d));
+	if (rate < 8000) {
+		printf("Squelch: needs audio at 8000 Hz or more\n");
+		return(0);
+	}
+	if (noise > 0.4 * rate)
+		noise = 0.4 * rate;
+
+	// the Q's of a 4th order Butterworth for the noise
+	biquad(d, 0, 1, SQ_VOICE_LO, rate, M_SQRT1_2);
+	biquad(d, 1, 1, noise, rate, 0.54119610);
+	biquad(d, 2, 0, SQ_VOICE_HI, rate, M_SQRT1_2);
+	biquad(d, 3, 1, noise, rate, 1.3065630);
+
+	d->block = rate * SQ_BLOCK / 1000;
+	d->sample_ns = 1000000000LL / rate;
+	d->mode = mode;
+	d->open = block_power(open, d->block);
+	d->close = block_power(close, d->block);
+	d->attack_n = (attack_ms + SQ_BLOCK - 1) / SQ_BLOCK;
+	if (d->attack_n < 1)
+		d->attack_n = 1;
+	d->release_n = (release_ms + SQ_BLOCK - 1) / SQ_BLOCK;
+	if (d->release_n < 1)
+		d->release_n = 1;
+	d->voice_db = d->noise_db = block_db(0, d->block);
+	return(1);
+}
+
+/* Decides a finished block, whose last sample was at 't': is the
+ * level past Open or Close? Then counts it towards going on or off.
+ * In between, the hysteresis, nothing changes.
+ */
+static void block_end(Squelch * d, long long t) {
+	float voice = d->acc[2];
+	float noise = d->acc[3];
+	int past_open, past_close;
+	int i;
+
+	if (d->mode == SQ_NOISE) {
+		past_open = (noise <= d->open);
+		past_close = (noise > d->close);
+	} else {
+		past_open = (voice >= d->open);
+		past_close = (voice < d->close);
+	}
+	d->blocks++;
+
+	if (past_open) {
+		d->misses = 0;
+		if (++d->hits >= d->attack_n && !d->on) {
+			__atomic_store_n(&d->changed, t, __ATOMIC_RELAXED);
+			__atomic_store_n(&d->on, 1, __ATOMIC_RELEASE);
+			d->opens++;
+		}
+	} else if (past_close) {
+		d->hits = 0;
+		if (++d->misses >= d->release_n && d->on) {
+			__atomic_store_n(&d->changed, t, __ATOMIC_RELAXED);
+			__atomic_store_n(&d->on, 0, __ATOMIC_RELEASE);
+		}
+	} else {
+		d->hits = 0;
+		d->misses = 0;
+	}
+
+	d->voice_db = block_db(voice, d->block);
+	d->noise_db = block_db(noise, d->block);
+	for (i = 0; i < 4; i++) {
+		if (fabsf(d->z1[i]) < SQ_TINY)
+			d->z1[i] = 0;
+		if (fabsf(d->z2[i]) < SQ_TINY)
+			d->z2[i] = 0;
+	}
+	memset(&d->acc, 0, sizeof(d->acc));
+	d->count = 0;
+}
+
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame), the
+ * last of them at 't' nS
+ */
+void squelch_feed(Squelch * d, const short * pcm, int n, int stride, long long t) {
+	SqVec z1 = d->z1, z2 = d->z2;
+	SqVec y = d->y, acc = d->acc;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float x = pcm[i * stride];
+		SqVec in = { x, x, y[0], y[1] };
+
+		y = d->b0 * in + z1;
+		z1 = d->b1 * in - d->a1 * y + z2;
+		z2 = d->b2 * in - d->a2 * y;
+		acc += y * y;
+
+		if (++d->count == d->block) {
+			d->z1 = z1;
+			d->z2 = z2;
+			d->acc = acc;
+			block_end(d, t - (n - 1 - i) * d->sample_ns);
+			z1 = d->z1;
+			z2 = d->z2;
+			acc = d->acc;
+		}
+	}
+	d->z1 = z1;
+	d->z2 = z2;
+	d->y = y;
+	d->acc = acc;
+}
+
+/* Returns 1 while there is a signal, from any thread
+ */
+int squelch_on(const Squelch * d) {
+	return(__atomic_load_n(&d->on, __ATOMIC_ACQUIRE));
+}
+
+/* Returns when the output last changed, at the end of the block that
+ * decided it, from any thread after squelch_on()
+ */
+long long squelch_changed(const Squelch * d) {
+	return(__atomic_load_n(&d->changed, __ATOMIC_RELAXED));
+}
+
+/* Prints the detector's levels and counters, for port 'num'
+ */
+void squelch_dump(const Squelch * d, int num, FILE * fp) {
+	fprintf(fp, "Squelch port %d: %s, %s, voice %.1f dBFS, noise %.1f dBFS, %lu blocks, %lu opens\n",
+		num, squelch_mode_name(d->mode), squelch_on(d) ? "on" : "off",
+		d->voice_db, d->noise_db, d->blocks, d->opens);
+}
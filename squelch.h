@@ -0,0 +1,122 @@
+/* squelch.h - Audio carrier detect (VOX and noise squelch) for the
+ * 'minimalist' repeater controller.
+ *
+ * For a receiver without a usable COR line: the COR comes from its
+ * audio instead of the pin (see get_cor()). Two bands are measured
+ * on each block of SQ_BLOCK mS:
+ *
+ *  - voice, 300 to 2500 Hz, which VOX opens on
+ *  - noise, above the voice band, which a receiver with its squelch
+ *    left open is full of until a carrier quiets it. Noise squelch
+ *    opens when it drops.
+ *
+ * Each band's RMS level (in dB below full scale) is held against two
+ * thresholds, Open and Close, the gap between them the hysteresis.
+ * The level has to be past Open for the attack time to go on, and
+ * past Close for the release time to go off.
+ *
+ * The detector is fed on the audio thread (an aio listener) and read
+ * on the control thread; only 'on' is shared.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: squelch.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __SQUELCH_H__
+#define __SQUELCH_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SQ_BLOCK        5       // in mS, between decisions
+
+#define DEFAULT_SQ_ATTACK       20      // in mS
+#define DEFAULT_SQ_RELEASE      250     // in mS
+#define SQ_LEVEL_MIN            -120.0  // in dBFS, lowest Open or Close
+#define SQ_TIME_MAX             10000   // in mS, longest Attack or Release
+#define DEFAULT_VOX_OPEN        -40.0   // in dBFS, voice over this opens
+#define DEFAULT_VOX_CLOSE       -46.0   // and under this closes
+#define DEFAULT_NOISE_OPEN      -40.0   // in dBFS, noise under this opens
+#define DEFAULT_NOISE_CLOSE     -34.0   // and over this closes
+
+// Where a port's COR comes from
+enum SqModes {
+  SQ_PIN,           // the COR pin
+  SQ_VOX,           // voice on the audio
+  SQ_NOISE,         // the audio's noise quieting
+  SQ_MODES
+};
+
+// four biquads at a time, NEON or SSE as the target has
+typedef float SqVec __attribute__((vector_size(16)));
+
+typedef struct
+{
+    SqVec b0, b1, b2, a1, a2;   // the biquads, one to a lane
+    SqVec z1, z2;               // and their state
+    SqVec y;                    // their last output
+    SqVec acc;                  // sum of the squares, this block
+    int count;                  // samples in the block so far
+    int block;                  // samples in a block
+    int mode;                   // SQ_VOX or SQ_NOISE
+    float open;                 // thresholds, as a block's sum of squares
+    float close;
+    int attack_n;               // blocks past Open to go on
+    int release_n;              // blocks past Close to go off
+    int hits;                   // blocks in a row past Open / Close
+    int misses;
+    float voice_db;             // the last block's levels
+    float noise_db;
+    long long sample_ns;        // a sample's time, in nS
+    long long changed;          // when 'on' last changed (nS), shared
+    int on;                     // the output, shared
+    unsigned long blocks;       // decided
+    unsigned long opens;        // times it went on
+} Squelch;
+
+/* Returns the mode called 'name' (Pin, VOX or Noise), -1 if there
+ * isn't one
+ */
+int squelch_mode(const char * name);
+/* Returns a mode's name */
+const char * squelch_mode_name(int mode);
+/* Fills in a mode's default Open and Close levels */
+void squelch_defaults(int mode, double * open, double * close);
+/* Returns 0 (and prints why) if Open and Close are the wrong way
+ * round for the mode, or above full scale
+ */
+int squelch_check(int mode, double open, double close);
+/* Sets up a detector in 'mode' on audio at 'rate' Hz, with Open and
+ * Close in dBFS, going on after 'attack_ms' past Open and off after
+ * 'release_ms' past Close. Returns 0 if the rate is too low.
+ */
+int squelch_init(Squelch * d, int rate, int mode, double open, double close,
+	int attack_ms, int release_ms);
+/* Feeds 'n' samples, 'stride' apart (the channels in a frame), the
+ * last of them at 't' nS (stats_clock(), as AioPeriod.t)
+ */
+void squelch_feed(Squelch * d, const short * pcm, int n, int stride, long long t);
+/* Returns 1 while there is a signal, from any thread */
+int squelch_on(const Squelch * d);
+/* Returns when the output last changed, at the end of the block that
+ * decided it, from any thread after squelch_on()
+ */
+long long squelch_changed(const Squelch * d);
+/* Prints the detector's levels and counters, for port 'num' */
+void squelch_dump(const Squelch * d, int num, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SQUELCH_H__
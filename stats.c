@@ -0,0 +1,154 @@
+/* stats.c - Latency histograms for the 'minimalist' repeater
+ * controller.
+ *
+ * A value v >= STATS_SUB_BUCKETS with its top bit at position m goes
+ * in bucket (m - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS plus the
+ * STATS_SUB_BITS bits below the top bit, so every bucket is at most
+ * 1/STATS_SUB_BUCKETS of its value wide (25%). Smaller values get a
+ * bucket each.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: stats.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "corevent.h"
+
+static Histogram hist[ST_COUNT];
+
+static const char * stats_names[ST_COUNT] = {
+	"COR->PTT on",
+	"COR->PTT off",
+	"loop period",
+	"loop run",
+	"loop jitter",
+	"debounce on",
+	"debounce off",
+	"gpio flush",
+	"audio pump",
+	"CW edge",
+	"audio round trip",
+	"repeat delay"
+};
+
+/* Returns the bucket for a value
+ */
+static int bucket_of(unsigned long long v) {
+	int msb;
+
+	if (v < STATS_SUB_BUCKETS)
+		return((int)v);
+	msb = 63 - __builtin_clzll(v);
+	return(((msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS) |
+		(int)((v >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1)));
+}
+
+/* Returns the largest value that lands in a bucket
+ */
+static long long bucket_top(int b) {
+	int msb;
+
+	if (b < STATS_SUB_BUCKETS)
+		return(b);
+	msb = (b >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+	return((long long)(((unsigned long long)((b & (STATS_SUB_BUCKETS - 1)) |
+		STATS_SUB_BUCKETS) + 1) << (msb - STATS_SUB_BITS)) - 1);
+}
+
+/* Records a latency in nS
+ */
+void stats_record(int id, long long ns) {
+	Histogram * h = &hist[id];
+
+	if (ns < 0)
+		ns = 0;
+	if (h->count == 0 || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->count++;
+	h->sum += ns;
+	h->bucket[bucket_of(ns)]++;
+}
+
+/* Returns the current time in nS for stats_since()
+ */
+long long stats_clock(void) {
+	return(cor_clock_ns());
+}
+
+/* Records the time since 'start' (a stats_clock() value)
+ */
+void stats_since(int id, long long start) {
+	stats_record(id, cor_clock_ns() - start);
+}
+
+/* Returns a histogram
+ */
+const Histogram * stats_get(int id) {
+	return(&hist[id]);
+}
+
+/* Returns the name of a histogram
+ */
+const char * stats_name(int id) {
+	return(stats_names[id]);
+}
+
+/* Returns the value at percentile 'p' (0-100), in nS. This is the
+ * top of the bucket the percentile falls in, capped at the max.
+ */
+long long stats_percentile(int id, double p) {
+	const Histogram * h = &hist[id];
+	unsigned long long want;
+	unsigned long long seen = 0;
+	int b;
+
+	if (h->count == 0)
+		return(0);
+	want = (unsigned long long)(p / 100.0 * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (b = 0; b < STATS_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			return((bucket_top(b) < h->max) ? bucket_top(b) : h->max);
+	}
+	return(h->max);
+}
+
+/* Clears all the histograms
+ */
+void stats_reset(void) {
+	memset(hist, 0, sizeof(hist));
+}
+
+/* Prints every histogram that has samples, in uS
+ */
+void stats_dump(FILE * fp) {
+	int i;
+
+	fprintf(fp, "%-14s %9s %10s %10s %10s %10s %10s %10s\n", "uS", "count",
+		"min", "mean", "p50", "p99", "p99.9", "max");
+	for (i = 0; i < ST_COUNT; i++) {
+		const Histogram * h = &hist[i];
+
+		if (h->count == 0)
+			continue;
+		fprintf(fp, "%-14s %9llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			stats_names[i], h->count, h->min / 1000.0,
+			(double)h->sum / h->count / 1000.0,
+			stats_percentile(i, 50) / 1000.0,
+			stats_percentile(i, 99) / 1000.0,
+			stats_percentile(i, 99.9) / 1000.0,
+			h->max / 1000.0);
+	}
+	fflush(fp);
+}
@@ -0,0 +1,84 @@
+/* stats.h - Latency histograms for the 'minimalist' repeater
+ * controller.
+ *
+ * Each histogram is a fixed table of log2 buckets, split into
+ * STATS_SUB_BUCKETS linear steps per power of two, so the bucket a
+ * value falls in is a count leading zeros and a shift. Recording
+ * just bumps a counter: no allocation, no locks and no syscalls
+ * (the nS timestamps come from the vDSO clock_gettime()).
+ *
+ * The histograms are printed when the controller gets SIGUSR1, and
+ * when it exits.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: stats.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STATS_SUB_BITS    2
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS     (64 * STATS_SUB_BUCKETS)
+
+// The recorded latencies
+enum StatsIds {
+  ST_COR_PTT_ON,    // COR edge to PTT on
+  ST_COR_PTT_OFF,   // COR drop to PTT off (includes the squelch tail)
+  ST_LOOP_PERIOD,   // start of one loop() pass to the next
+  ST_LOOP_RUN,      // time spent inside loop()
+  ST_LOOP_JITTER,   // wakeup after the loop_timeout() deadline
+  ST_DEBOUNCE_ON,   // COR edge to debounced on
+  ST_DEBOUNCE_OFF,  // COR drop to debounced off
+  ST_GPIO_FLUSH,    // gpio_flush()
+  ST_AUDIO_PUMP,    // audio_pump()
+  ST_CW_EDGE,       // CW ID keying edge after its due time (--cwtiming)
+  ST_AUDIO_RTT,     // audio round trip, a ping out to it coming back in
+  ST_REPEAT_DELAY,  // receive audio to transmit audio, through the repeat delay line
+  ST_COUNT
+};
+
+typedef struct
+{
+    unsigned long long count;
+    unsigned long long sum;     // nS
+    long long min;
+    long long max;
+    unsigned int bucket[STATS_BUCKETS];
+} Histogram;
+
+/* Records a latency in nS */
+void stats_record(int id, long long ns);
+/* Records the time since 'start' (a stats_clock() value) */
+void stats_since(int id, long long start);
+/* Returns the current time in nS for stats_since() */
+long long stats_clock(void);
+/* Returns a histogram */
+const Histogram * stats_get(int id);
+/* Returns the name of a histogram */
+const char * stats_name(int id);
+/* Returns the value at percentile 'p' (0-100), in nS */
+long long stats_percentile(int id, double p);
+/* Clears all the histograms */
+void stats_reset(void);
+/* Prints every histogram that has samples */
+void stats_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __STATS_H__
@@ -0,0 +1,200 @@
+/* synth.c - Software tone synthesis for the 'minimalist' repeater
+ * controller.
+ *
+ * tone() and noTone() only reprogram the BCM2835 PWM, which gives a
+ * raw square wave full of harmonics and hard key clicks. This module
+ * renders the same tones in software:
+ *
+ *  - a 32 bit phase accumulator indexes a 1024 entry sine table with
+ *    linear interpolation, so the output is a clean sine at any
+ *    frequency (a sine has no harmonics to alias)
+ *  - every key edge is shaped by a raised cosine ramp, by default
+ *    5 mS, which keeps the keying sidebands narrow
+ *  - samples are rendered in blocks of SYNTH_BLOCK, with the
+ *    oscillator, envelope and output stages in separate simple loops
+ *    so the compiler can vectorize the envelope and conversion
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: synth.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "synth.h"
+
+static float sine_table[SYNTH_TABLE_SIZE + 1];  // +1 so interpolation can read idx+1
+static float ramp_table[SYNTH_MAX_RAMP + 1];    // raised cosine, 0..1
+static int ramp_len = 1;
+static int sample_rate = DEFAULT_SAMPLE_RATE;
+static float tone_level = DEFAULT_TONE_LEVEL / 100.0f;
+
+/* Builds the sine and ramp tables for the given sample rate
+ * and key edge ramp time. Must be called before rendering.
+ */
+void synth_init(int rate, int ramp_ms, int level) {
+	int i;
+
+	if (rate <= 0)
+		rate = DEFAULT_SAMPLE_RATE;
+	if (level <= 0 || level > 100)
+		level = DEFAULT_TONE_LEVEL;
+	sample_rate = rate;
+	tone_level = level / 100.0f;
+
+	for (i = 0; i <= SYNTH_TABLE_SIZE; i++)
+		sine_table[i] = (float)sin(2.0 * M_PI * i / SYNTH_TABLE_SIZE);
+
+	ramp_len = rate * ramp_ms / 1000;
+	if (ramp_len < 1)
+		ramp_len = 1;
+	if (ramp_len > SYNTH_MAX_RAMP)
+		ramp_len = SYNTH_MAX_RAMP;
+	for (i = 0; i <= ramp_len; i++)
+		ramp_table[i] = (float)(0.5 - 0.5 * cos(M_PI * i / ramp_len));
+}
+
+/* Returns the sample rate set by synth_init()
+ */
+int synth_rate(void) {
+	return(sample_rate);
+}
+
+/* Resets a voice to silence
+ */
+void voice_init(SynthVoice * v) {
+	memset(v, 0, sizeof(*v));
+	v->amp = tone_level;
+}
+
+/* Keys a voice at 'freq' Hz, or unkeys it if 'freq' is 0. An
+ * unkeyed voice ramps down at the old frequency.
+ */
+void voice_key(SynthVoice * v, int freq) {
+	if (freq > 0) {
+		v->step = (unsigned int)((double)freq * 4294967296.0 / sample_rate);
+		v->gate = 1;
+	} else {
+		v->gate = 0;
+	}
+}
+
+/* Returns 1 while a voice is keyed or still ramping down
+ */
+int voice_active(SynthVoice * v) {
+	return(v->gate || v->ramp_pos > 0);
+}
+
+/* Renders one block of at most SYNTH_BLOCK samples
+ */
+static void voice_block(SynthVoice * v, short * out, int n) {
+	float osc[SYNTH_BLOCK];
+	float env[SYNTH_BLOCK];
+	unsigned int phase = v->phase;
+	unsigned int step = v->step;
+	int i;
+
+	// fully off: silence, and restart the next tone at phase 0
+	if (!v->gate && v->ramp_pos == 0) {
+		memset(out, 0, n * sizeof(short));
+		v->phase = 0;
+		return;
+	}
+
+	// oscillator
+	for (i = 0; i < n; i++) {
+		unsigned int idx = phase >> (32 - SYNTH_TABLE_BITS);
+		float frac = (float)(phase & ((1u << (32 - SYNTH_TABLE_BITS)) - 1))
+			* (1.0f / (1u << (32 - SYNTH_TABLE_BITS)));
+		osc[i] = sine_table[idx] + frac * (sine_table[idx + 1] - sine_table[idx]);
+		phase += step;
+	}
+	v->phase = phase;
+
+	// envelope, the steady state keyed case is the common one
+	if (v->gate && v->ramp_pos == ramp_len) {
+		for (i = 0; i < n; i++)
+			env[i] = v->amp;
+	} else {
+		int pos = v->ramp_pos;
+		for (i = 0; i < n; i++) {
+			if (v->gate) {
+				if (pos < ramp_len)
+					pos++;
+			} else if (pos > 0) {
+				pos--;
+			}
+			env[i] = ramp_table[pos] * v->amp;
+		}
+		v->ramp_pos = pos;
+	}
+
+	// output
+	for (i = 0; i < n; i++)
+		out[i] = (short)(osc[i] * env[i] * 32767.0f);
+}
+
+/* Renders 'n' samples from a voice
+ */
+void voice_render(SynthVoice * v, short * out, int n) {
+	while (n > 0) {
+		int len = (n > SYNTH_BLOCK) ? SYNTH_BLOCK : n;
+		voice_block(v, out, len);
+		out += len;
+		n -= len;
+	}
+}
+
+/* Returns the number of samples synth_render_seq() needs
+ */
+int synth_seq_samples(const ToneSeq * seq) {
+	long long ms = 0;
+	int i;
+
+	for (i = 0; i < seq->count; i++)
+		ms += seq->seg[i].ms;
+	// plus the ramp down after a final tone
+	return((int)(ms * sample_rate / 1000) + ramp_len);
+}
+
+/* Renders a tone sequence offline into 'out'. Returns the number
+ * of samples written (at most 'max').
+ */
+int synth_render_seq(const ToneSeq * seq, short * out, int max) {
+	SynthVoice v;
+	long long ms = 0;
+	int done = 0;
+	int i;
+
+	voice_init(&v);
+	for (i = 0; i < seq->count; i++) {
+		int end;
+
+		// segment boundaries are computed from the total elapsed
+		// time so rounding does not accumulate
+		ms += seq->seg[i].ms;
+		end = (int)(ms * sample_rate / 1000);
+		if (end > max)
+			end = max;
+
+		voice_key(&v, seq->seg[i].freq);
+		voice_render(&v, out + done, end - done);
+		done = end;
+	}
+
+	// let a final tone ramp down
+	if (voice_active(&v)) {
+		int end = done + ramp_len;
+		if (end > max)
+			end = max;
+		voice_key(&v, 0);
+		voice_render(&v, out + done, end - done);
+		done = end;
+	}
+	return(done);
+}
@@ -0,0 +1,75 @@
+/* synth.h - Software tone synthesis for the 'minimalist' repeater
+ * controller.
+ *
+ * Renders the CW ID and courtesy tones as sine wave PCM (signed
+ * 16 bit, mono) instead of a raw PWM square wave. A voice is a
+ * phase accumulator driving a sine wavetable, with a raised cosine
+ * envelope on every key edge to keep the keying click free.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: synth.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __SYNTH_H__
+#define __SYNTH_H__
+
+#include "toneseq.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNTH_TABLE_BITS  10        // 1024 entry sine table
+#define SYNTH_TABLE_SIZE  (1 << SYNTH_TABLE_BITS)
+#define SYNTH_BLOCK       64        // samples rendered per inner block
+#define SYNTH_MAX_RAMP    2048      // longest key edge ramp, in samples
+
+#define DEFAULT_SAMPLE_RATE 8000    // in Hz
+#define DEFAULT_RAMP_TIME   5       // key edge rise/fall time, in mS
+#define DEFAULT_TONE_LEVEL  50      // in percent of full scale
+
+// A single tone voice
+typedef struct
+{
+    unsigned int phase;     // phase accumulator, full turn = 2^32
+    unsigned int step;      // phase increment per sample
+    int gate;               // key state
+    int ramp_pos;           // position in the key edge ramp, 0..ramp_len
+    float amp;              // output level, 0..1
+} SynthVoice;
+
+/* Builds the sine and ramp tables for the given sample rate
+ * and key edge ramp time. Must be called before rendering.
+ */
+void synth_init(int rate, int ramp_ms, int level);
+/* Returns the sample rate set by synth_init() */
+int synth_rate(void);
+/* Resets a voice to silence */
+void voice_init(SynthVoice * v);
+/* Keys a voice at 'freq' Hz, or unkeys it if 'freq' is 0. An
+ * unkeyed voice ramps down at the old frequency.
+ */
+void voice_key(SynthVoice * v, int freq);
+/* Returns 1 while a voice is keyed or still ramping down */
+int voice_active(SynthVoice * v);
+/* Renders 'n' samples from a voice */
+void voice_render(SynthVoice * v, short * out, int n);
+/* Renders a tone sequence offline into 'out'. Returns the number
+ * of samples written (at most 'max').
+ */
+int synth_render_seq(const ToneSeq * seq, short * out, int max);
+/* Returns the number of samples synth_render_seq() needs */
+int synth_seq_samples(const ToneSeq * seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SYNTH_H__
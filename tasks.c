@@ -0,0 +1,170 @@
+/* tasks.c - Cyclic executive for the 'minimalist' repeater
+ * controller.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: tasks.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <string.h>
+#include "tasks.h"
+#include "stats.h"
+#include "corevent.h"
+
+static Task tasks[TASK_MAX];
+static int ntasks;
+
+/* Adds a task run every 'period_ms' mS (0 for only when released
+ * or given a deadline), recording how late it runs in the 'stat'
+ * histogram if it isn't -1. Returns the task id, -1 if full.
+ */
+int task_add(const char * name, long period_ms, void (*fn)(void), int stat) {
+	Task * t;
+
+	if (ntasks >= TASK_MAX)
+		return(-1);
+	t = &tasks[ntasks];
+	memset(t, 0, sizeof(*t));
+	t->name = name;
+	t->fn = fn;
+	t->period = (long long)period_ms * 1000000LL;
+	t->next = cor_clock_ns() + t->period;
+	t->early = -1;
+	t->enabled = 1;
+	t->stat = stat;
+	return(ntasks++);
+}
+
+/* Turns a task on or off. Turning it on restarts its period from now
+ */
+void task_enable(int id, int on) {
+	Task * t = &tasks[id];
+
+	if (on && !t->enabled)
+		t->next = cor_clock_ns() + t->period;
+	t->enabled = on;
+}
+
+/* Runs a task on the next pass
+ */
+void task_release(int id) {
+	tasks[id].released = 1;
+}
+
+/* Runs a task by absolute time 't' (nS), as well as on its period
+ */
+void task_deadline(int id, long long t) {
+	Task * tk = &tasks[id];
+
+	if (tk->early < 0 || t < tk->early)
+		tk->early = t;
+}
+
+/* Returns the earliest deadline of any task in nS, -1 if there is none
+ */
+long long task_next(void) {
+	long long best = -1;
+	int i;
+
+	for (i = 0; i < ntasks; i++) {
+		const Task * t = &tasks[i];
+
+		if (!t->enabled)
+			continue;
+		if (t->released)
+			return(0);
+		if (t->period > 0 && (best < 0 || t->next < best))
+			best = t->next;
+		if (t->early >= 0 && (best < 0 || t->early < best))
+			best = t->early;
+	}
+	return(best);
+}
+
+/* Runs every task that is due. Returns the number run.
+ */
+int task_run(void) {
+	int i, n = 0;
+
+	for (i = 0; i < ntasks; i++) {
+		Task * t = &tasks[i];
+		long long now = cor_clock_ns();
+		long long due = -1;
+		long long start, run;
+
+		if (!t->enabled)
+			continue;
+		if (t->period > 0 && now >= t->next)
+			due = t->next;
+		if (t->early >= 0 && now >= t->early && (due < 0 || t->early < due))
+			due = t->early;
+		if (due < 0 && !t->released)
+			continue;
+
+		// how late a deadline run is, released runs have none
+		if (due >= 0 && !t->released) {
+			if (now - due > t->max_late)
+				t->max_late = now - due;
+			if (t->stat >= 0)
+				stats_record(t->stat, now - due);
+		}
+
+		// whole periods gone by are runs that were missed
+		if (t->period > 0 && now >= t->next) {
+			long long missed = (now - t->next) / t->period;
+
+			t->overruns += missed;
+			t->next += (missed + 1) * t->period;
+		}
+		t->early = -1;
+		t->released = 0;
+
+		start = cor_clock_ns();
+		t->fn();
+		run = cor_clock_ns() - start;
+		if (run > t->max_run)
+			t->max_run = run;
+		t->runs++;
+		n++;
+	}
+	return(n);
+}
+
+/* Returns the total overruns of all tasks
+ */
+unsigned long long task_overruns(void) {
+	unsigned long long n = 0;
+	int i;
+
+	for (i = 0; i < ntasks; i++)
+		n += tasks[i].overruns;
+	return(n);
+}
+
+/* Returns a task
+ */
+const Task * task_get(int id) {
+	return(&tasks[id]);
+}
+
+/* Prints the task table
+ */
+void task_dump(FILE * fp) {
+	int i;
+
+	fprintf(fp, "%-14s %9s %10s %9s %12s %12s\n", "task", "period mS",
+		"runs", "overruns", "max late uS", "max run uS");
+	for (i = 0; i < ntasks; i++) {
+		const Task * t = &tasks[i];
+
+		fprintf(fp, "%-14s %9lld %10llu %9llu %12.1f %12.1f\n",
+			t->name, t->period / 1000000LL, t->runs, t->overruns,
+			t->max_late / 1000.0, t->max_run / 1000.0);
+	}
+	fflush(fp);
+}
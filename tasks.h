@@ -0,0 +1,79 @@
+/* tasks.h - Cyclic executive for the 'minimalist' repeater
+ * controller.
+ *
+ * The controller's work is split into a few tasks, each run at a
+ * fixed period on absolute CLOCK_MONOTONIC deadlines, so a late pass
+ * doesn't push every later one back. A task that finds a whole period
+ * has gone by since its deadline counts the missed runs as overruns
+ * and picks up again on its next deadline.
+ *
+ * A task can also be released to run on the next pass (a COR edge
+ * wakes the state machine this way), or given an earlier one-shot
+ * deadline (the next timer or CW ID edge) without moving its periodic
+ * deadlines. Tasks run in the order they were added.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: tasks.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __TASKS_H__
+#define __TASKS_H__
+
+#include <stdio.h>
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASK_MAX  8
+
+typedef struct
+{
+    const char * name;
+    void (*fn)(void);
+    long long period;       // nS, 0 = only when released or due
+    long long next;         // next periodic deadline, nS
+    long long early;        // one-shot deadline, nS, -1 = none
+    int released;           // run on the next pass
+    int enabled;
+    int stat;               // StatsIds histogram for lateness, -1 = none
+    unsigned long long runs;
+    unsigned long long overruns;
+    long long max_late;     // nS past the deadline
+    long long max_run;      // nS spent in fn
+} Task;
+
+/* Adds a task run every 'period_ms' mS (0 for only when released
+ * or given a deadline), recording how late it runs in the 'stat'
+ * histogram if it isn't -1. Returns the task id, -1 if full.
+ */
+int task_add(const char * name, long period_ms, void (*fn)(void), int stat);
+/* Turns a task on or off. Turning it on restarts its period from now */
+void task_enable(int id, int on);
+/* Runs a task on the next pass */
+void task_release(int id);
+/* Runs a task by absolute time 't' (nS), as well as on its period */
+void task_deadline(int id, long long t);
+/* Returns the earliest deadline of any task in nS, -1 if there is none */
+long long task_next(void);
+/* Runs every task that is due. Returns the number run. */
+int task_run(void);
+/* Returns the total overruns of all tasks */
+unsigned long long task_overruns(void);
+/* Returns a task */
+const Task * task_get(int id);
+/* Prints the task table */
+void task_dump(FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TASKS_H__
@@ -0,0 +1,210 @@
+/* timers.c - Millisecond monotonic timer service for the 'minimalist'
+ * repeater controller.
+ *
+ * The original controller tracked the ID and squelch tail timers
+ * as time_t values from time(NULL), which limited them to whole
+ * seconds and let them jump whenever the wall clock was stepped.
+ * Here every deadline is a named timer with an absolute expiry in
+ * mS on CLOCK_MONOTONIC. Armed timers live in a binary min-heap
+ * keyed on expiry, so the earliest deadline is always at the top
+ * and the main loop can sleep exactly until it.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: timers.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <time.h>
+#include "timers.h"
+#ifdef SIMULATION
+#include "simclock.h"
+#endif
+
+static msec_t deadline[TIMER_MAX];  // absolute expiry of each timer
+static int expired[TIMER_MAX];      // set once a timer fires
+static int heap[TIMER_MAX];         // timer ids, earliest expiry first
+static int heap_pos[TIMER_MAX];     // index of each timer in heap, -1 if idle
+static int heap_len;
+
+static msec_t time_base;            // CLOCK_MONOTONIC at timer_init()
+
+static const char * timer_names[TMR_COUNT] = {
+	"ID",
+	"SQT",
+	"CWID",
+	"BEEP"
+};
+
+/* Reads CLOCK_MONOTONIC in mS
+ */
+static msec_t mono_ms(void) {
+#ifdef SIMULATION
+	return(sim_clock_ns() / 1000000LL);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((msec_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+/* Returns mS elapsed on CLOCK_MONOTONIC since timer_init()
+ */
+msec_t now_ms(void) {
+	return(mono_ms() - time_base);
+}
+
+/* Converts a time from now_ms() to CLOCK_MONOTONIC nS, for
+ * sleeping until an absolute deadline
+ */
+long long timer_to_ns(msec_t t) {
+	return((time_base + t) * 1000000LL);
+}
+
+static void heap_swap(int a, int b) {
+	int t = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = t;
+	heap_pos[heap[a]] = a;
+	heap_pos[heap[b]] = b;
+}
+
+static void heap_up(int i) {
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (deadline[heap[parent]] <= deadline[heap[i]])
+			break;
+		heap_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(int i) {
+	while (1) {
+		int l = 2 * i + 1;
+		int r = l + 1;
+		int m = i;
+
+		if (l < heap_len && deadline[heap[l]] < deadline[heap[m]])
+			m = l;
+		if (r < heap_len && deadline[heap[r]] < deadline[heap[m]])
+			m = r;
+		if (m == i)
+			break;
+		heap_swap(i, m);
+		i = m;
+	}
+}
+
+/* Takes a timer out of the heap, if it is in it
+ */
+static void heap_remove(int id) {
+	int i = heap_pos[id];
+
+	if (i < 0)
+		return;
+
+	heap_len--;
+	if (i != heap_len) {
+		heap_swap(i, heap_len);
+		heap_up(i);
+		heap_down(i);
+	}
+	heap_pos[id] = -1;
+}
+
+/* Resets all timers and the time base
+ */
+void timer_init(void) {
+	int i;
+
+	time_base = mono_ms();
+	heap_len = 0;
+	for (i = 0; i < TIMER_MAX; i++) {
+		deadline[i] = 0;
+		expired[i] = 0;
+		heap_pos[i] = -1;
+	}
+}
+
+/* Starts (or restarts) a timer to expire 'ms' from now
+ */
+void timer_start(int id, msec_t ms) {
+	timer_start_at(id, now_ms() + ms);
+}
+
+/* Starts (or restarts) a timer to expire at absolute time 't'.
+ * Chained deadlines use this so loop latency does not accumulate.
+ */
+void timer_start_at(int id, msec_t t) {
+
+	heap_remove(id);
+	deadline[id] = t;
+	expired[id] = 0;
+
+	heap[heap_len] = id;
+	heap_pos[id] = heap_len;
+	heap_len++;
+	heap_up(heap_pos[id]);
+}
+
+/* Stops a timer and clears its expired flag
+ */
+void timer_stop(int id) {
+	heap_remove(id);
+	expired[id] = 0;
+}
+
+/* Moves all timers whose deadline is at or before 't' out of
+ * the heap and marks them expired. Returns the number fired.
+ */
+int timer_poll(msec_t t) {
+	int fired = 0;
+
+	while (heap_len > 0 && deadline[heap[0]] <= t) {
+		int id = heap[0];
+		heap_remove(id);
+		expired[id] = 1;
+		fired++;
+	}
+	return(fired);
+}
+
+/* Returns 1 if the timer has expired since it was last started
+ */
+int timer_expired(int id) {
+	return(expired[id]);
+}
+
+/* Returns mS until the earliest armed timer of 'count' timers from
+ * 'first' expires, or -1 if none of them is armed
+ */
+long timer_next_in(int first, int count) {
+	msec_t best = -1;
+	int id;
+
+	for (id = first; id < first + count; id++) {
+		if (heap_pos[id] < 0)
+			continue;
+		if (best < 0 || deadline[id] < best)
+			best = deadline[id];
+	}
+	if (best < 0)
+		return(-1);
+	best -= now_ms();
+	return((best < 0) ? 0 : (long)best);
+}
+
+/* Returns the name of a timer
+ */
+const char * timer_name(int id) {
+	if (id < 0 || id >= TIMER_MAX)
+		return("?");
+	return(timer_names[id % TMR_COUNT]);
+}
@@ -0,0 +1,73 @@
+/* timers.h - Millisecond monotonic timer service for the 'minimalist'
+ * repeater controller.
+ *
+ * All controller deadlines (ID, squelch tail and the ID and beep
+ * keying edges) are named timers kept in a small binary heap ordered
+ * by expiry time. Time comes from CLOCK_MONOTONIC, so timers have
+ * mS resolution and do not jump when NTP steps the wall clock.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: timers.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __TIMERS_H__
+#define __TIMERS_H__
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Time in mS
+typedef long long msec_t;
+
+// The named controller timers
+enum TimerIds {
+  TMR_ID,           // ID interval
+  TMR_SQT,          // squelch tail
+  TMR_CWID,         // next CW ID keying edge
+  TMR_BEEP,         // next courtesy beep edge
+  TMR_COUNT
+};
+
+// Each repeater port has its own set of the named timers, port n's
+// are n * TMR_COUNT + TMR_ID etc.
+#define TIMER_PORTS  4
+#define TIMER_MAX    (TMR_COUNT * TIMER_PORTS)
+
+/* Returns mS elapsed on CLOCK_MONOTONIC since timer_init() */
+msec_t now_ms(void);
+/* Converts a time from now_ms() to CLOCK_MONOTONIC nS */
+long long timer_to_ns(msec_t t);
+/* Resets all timers and the time base */
+void timer_init(void);
+/* Starts (or restarts) a timer to expire 'ms' from now */
+void timer_start(int id, msec_t ms);
+/* Starts (or restarts) a timer to expire at absolute time 't' */
+void timer_start_at(int id, msec_t t);
+/* Stops a timer and clears its expired flag */
+void timer_stop(int id);
+/* Moves all timers whose deadline is at or before 't' out of
+ * the heap and marks them expired. Returns the number fired.
+ */
+int timer_poll(msec_t t);
+/* Returns 1 if the timer has expired since it was last started */
+int timer_expired(int id);
+/* Returns mS until the earliest armed timer of 'count' timers from
+ * 'first' expires, or -1 if none of them is armed
+ */
+long timer_next_in(int first, int count);
+/* Returns the name of a timer */
+const char * timer_name(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TIMERS_H__
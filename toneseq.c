@@ -0,0 +1,143 @@
+/* toneseq.c - Non-blocking tone sequence player for the 'minimalist'
+ * repeater controller.
+ *
+ * do_ID() used to play the CW ID with a chain of delay() calls, so
+ * nothing else ran for the several seconds it took to send a call.
+ * Here the ID (and anything else built from tones and gaps) is a
+ * list of segments that loop() steps through one keying edge at a
+ * time. Each edge time is computed from the previous edge, not from
+ * when loop() got around to it, so element timing does not drift
+ * with loop latency.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: toneseq.c
+ * Author: KB4OID/Kodetroll
+ */
+#include <stdio.h>
+#include <time.h>
+#include "rptrctrl.h"
+#include "toneseq.h"
+#include "stats.h"
+
+/* Empties a sequence and sets the pin and timer it plays with
+ */
+void seq_init(ToneSeq * seq, int pin, int timer) {
+	seq->pin = pin;
+	seq->timer = timer;
+	seq->active = 0;
+	seq->keyed = 0;
+	seq->stat = -1;
+	seq_clear(seq);
+}
+
+/* Empties a sequence, keeping the pin and timer
+ */
+void seq_clear(ToneSeq * seq) {
+	seq->count = 0;
+	seq->idx = 0;
+}
+
+/* Appends a segment, merging it with the previous segment if it
+ * has the same frequency. Returns 0 if the sequence is full.
+ */
+int seq_add(ToneSeq * seq, int freq, int ms) {
+
+	if (ms <= 0)
+		return(1);
+
+	// back to back silences (or identical tones) are one segment
+	if (seq->count > 0 && seq->seg[seq->count - 1].freq == freq) {
+		seq->seg[seq->count - 1].ms += ms;
+		return(1);
+	}
+
+	if (seq->count >= TONESEQ_MAX)
+		return(0);
+
+	seq->seg[seq->count].freq = freq;
+	seq->seg[seq->count].ms = ms;
+	seq->count++;
+	return(1);
+}
+
+/* Returns the total length of a sequence in mS
+ */
+int seq_length(ToneSeq * seq) {
+	int i;
+	int total = 0;
+
+	for (i = 0; i < seq->count; i++)
+		total += seq->seg[i].ms;
+	return(total);
+}
+
+/* Keys (or unkeys) the tone for the current segment
+ */
+static void seq_key(ToneSeq * seq) {
+	ToneSeg * s = &seq->seg[seq->idx];
+
+	if (s->freq > 0) {
+		tone(seq->pin, s->freq, s->ms);
+		seq->keyed = 1;
+	} else if (seq->keyed) {
+		noTone(seq->pin);
+		seq->keyed = 0;
+	}
+}
+
+/* Starts playing a sequence from the first segment
+ */
+void seq_start(ToneSeq * seq) {
+
+	seq->idx = 0;
+	if (seq->count == 0) {
+		seq->active = 0;
+		return;
+	}
+
+	seq->active = 1;
+	seq->edge = now_ms() + seq->seg[0].ms;
+	seq_key(seq);
+	timer_start_at(seq->timer, seq->edge);
+}
+
+/* Advances the sequence past every edge that is due. Returns 1
+ * while the sequence is still playing, 0 once it has finished.
+ */
+int seq_poll(ToneSeq * seq) {
+	msec_t t;
+
+	if (!seq->active)
+		return(0);
+
+	t = now_ms();
+	while (t >= seq->edge) {
+		// how late this edge is being keyed
+		if (seq->stat >= 0)
+			stats_since(seq->stat, timer_to_ns(seq->edge));
+		seq->idx++;
+		if (seq->idx >= seq->count) {
+			seq_abort(seq);
+			return(0);
+		}
+		seq->edge += seq->seg[seq->idx].ms;
+		seq_key(seq);
+	}
+	timer_start_at(seq->timer, seq->edge);
+	return(1);
+}
+
+/* Stops a sequence immediately, unkeying the tone
+ */
+void seq_abort(ToneSeq * seq) {
+	if (seq->keyed)
+		noTone(seq->pin);
+	seq->keyed = 0;
+	seq->active = 0;
+	timer_stop(seq->timer);
+}
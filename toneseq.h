@@ -0,0 +1,74 @@
+/* toneseq.h - Non-blocking tone sequence player for the 'minimalist'
+ * repeater controller.
+ *
+ * A tone sequence is a list of segments, each a tone frequency (or
+ * silence) and a length in mS. The player keys the ID pin and PWM
+ * tone at each segment boundary and is advanced from loop(), one
+ * keying edge at a time, using a named timer for the next edge.
+ *
+ * (C) 2013-2015 KB4OID Labs - A division of Kodetroll Heavy Industries
+ *
+ * All rights reserved, but otherwise free to use for personal use.
+ * No warranty expressed or implied.
+ * This code is for educational or personal use only.
+ *
+ * File: toneseq.h
+ * Author: KB4OID/Kodetroll
+ */
+
+#ifndef __TONESEQ_H__
+#define __TONESEQ_H__
+
+#include "timers.h"
+
+/* Make this header file easier to include in C++ code */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TONESEQ_MAX 1100    // max segments, a full Morse timeline plus extras
+
+// A single segment of a tone sequence
+typedef struct
+{
+    int freq;               // tone frequency in Hz, 0 for silence
+    int ms;                 // segment length in mS
+} ToneSeg;
+
+typedef struct
+{
+    ToneSeg seg[TONESEQ_MAX];
+    int count;              // number of segments
+    int idx;                // segment currently playing
+    int active;             // sequence is playing
+    int keyed;              // tone currently on
+    int pin;                // keying pin
+    int timer;              // named timer used for the next edge
+    msec_t edge;            // absolute time of the next edge
+    int stat;               // StatsIds histogram for edge timing, -1 = none
+} ToneSeq;
+
+/* Empties a sequence and sets the pin and timer it plays with */
+void seq_init(ToneSeq * seq, int pin, int timer);
+/* Empties a sequence, keeping the pin and timer */
+void seq_clear(ToneSeq * seq);
+/* Appends a segment, merging it with the previous segment if it
+ * has the same frequency. Returns 0 if the sequence is full.
+ */
+int seq_add(ToneSeq * seq, int freq, int ms);
+/* Returns the total length of a sequence in mS */
+int seq_length(ToneSeq * seq);
+/* Starts playing a sequence from the first segment */
+void seq_start(ToneSeq * seq);
+/* Advances the sequence past every edge that is due. Returns 1
+ * while the sequence is still playing, 0 once it has finished.
+ */
+int seq_poll(ToneSeq * seq);
+/* Stops a sequence immediately, unkeying the tone */
+void seq_abort(ToneSeq * seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TONESEQ_H__